@@ -0,0 +1,59 @@
+#pragma once
+#include "cutils/vector.h"
+#include <stdint.h>
+
+// Arena allocator for data that is all released at the same time, such as
+// everything built up while handling a single request.
+//
+// Memory is handed out by bumping a pointer through large chunks. Passing
+// &arena->alloc to anything that takes an allocator_t (hash_t, vectors,
+// ...) puts its memory in the arena. Freeing is a no-op other than for the
+// most recent allocation, and reallocating the most recent allocation
+// grows it in place where there is room. As vectors and hash tables
+// reallocate the buffer they most recently grew, appending to a single
+// vector in an arena rarely copies.
+//
+// reset_arena releases everything at once but keeps the chunks for
+// reuse, so an arena that is reset between requests stops calling malloc
+// once it has warmed up. mark_arena and reset_arena_to release only the
+// allocations made after the mark.
+//
+// An arena must only be used by one thread at a time. thread_arena returns
+// an arena private to the calling thread that is freed when the thread
+// exits.
+
+typedef struct arena arena_t;
+struct arena_chunk;
+
+struct arena {
+	allocator_t alloc;
+	struct arena_chunk *chunks, *spare;
+	uint8_t *next, *end, *last;
+	size_t chunksz;
+	allocator_t *parent;
+};
+
+struct arena_mark {
+	struct arena_chunk *chunk;
+	uint8_t *next;
+};
+
+// chunks are allocated from parent, which can be NULL for malloc
+// chunksz of 0 picks a default
+void init_arena(arena_t *a, allocator_t *parent, size_t chunksz);
+void free_arena(arena_t *a);
+void reset_arena(arena_t *a);
+
+struct arena_mark mark_arena(arena_t *a);
+void reset_arena_to(arena_t *a, struct arena_mark m);
+
+// returns the memory used by chunks, including spare chunks
+size_t arena_memory(const arena_t *a);
+
+arena_t *thread_arena(void);
+
+static inline void *arena_alloc(arena_t *a, size_t size) {
+	return a->alloc.realloc(&a->alloc, NULL, size);
+}
+
+#define ARENA_NEW(A, TYPE) ((TYPE*)(A)->alloc.calloc(&(A)->alloc, 1, sizeof(TYPE)))
@@ -0,0 +1,53 @@
+#pragma once
+#include "cutils/vector.h"
+#include <stdint.h>
+
+// Bulk operations on a struct bitset (see vector.h). These work a word or
+// a SIMD register at a time rather than a bit at a time, so they are the
+// way to combine and scan large bitsets such as row filters.
+//
+// Ranges are given in bits as [begin, end) and must be within both
+// bitsets. To cover a whole bitset use 0 and bitset_bits(v).
+
+static inline size_t bitset_bits(const struct bitset *v) {
+	return v->bytes * 8;
+}
+
+// dst = dst op src over the range
+void and_bitset(struct bitset *dst, const struct bitset *src, size_t begin, size_t end);
+void or_bitset(struct bitset *dst, const struct bitset *src, size_t begin, size_t end);
+void xor_bitset(struct bitset *dst, const struct bitset *src, size_t begin, size_t end);
+void andnot_bitset(struct bitset *dst, const struct bitset *src, size_t begin, size_t end);
+
+// returns the number of bits set in the range
+size_t count_bitset(const struct bitset *v, size_t begin, size_t end);
+
+// returns the first set bit at or after idx or bitset_bits(v) if there is
+// none
+size_t next_bitset(const struct bitset *v, size_t idx);
+
+// writes the indices of up to max set bits at or after *pidx and before
+// end to out, returns the number written and updates *pidx to continue
+// from on the next call
+size_t list_bitset(const struct bitset *v, size_t *pidx, size_t end, size_t *out, size_t max);
+
+#define FOR_BITSET(IDX, V) for (size_t IDX = next_bitset((V), 0); IDX < bitset_bits(V); IDX = next_bitset((V), IDX + 1))
+
+// Rank index for answering rank queries in constant time. It stores the
+// number of set bits before each 512 bit block, an overhead of 1/8 of the
+// bitset. Select binary searches those counts, so takes O(log n). The
+// index must be rebuilt after the bitset is changed.
+struct bitset_rank {
+	uint64_t *blocks;
+	size_t num, total;
+};
+
+int build_bitset_rank(struct bitset_rank *r, const struct bitset *v);
+void free_bitset_rank(struct bitset_rank *r);
+
+// returns the number of bits set before idx
+size_t rank_bitset(const struct bitset_rank *r, const struct bitset *v, size_t idx);
+
+// returns the index of the nth set bit counting from 0 or bitset_bits(v)
+// if there are not that many
+size_t select_bitset(const struct bitset_rank *r, const struct bitset *v, size_t n);
@@ -0,0 +1,92 @@
+#pragma once
+#include "cutils/rbtree.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// In memory B+tree from uint64_t keys to pointers.
+//
+// This fills the same role as rbtree but each node holds many keys in a
+// contiguous array, so a lookup touches a handful of nodes rather than
+// one node per level of a binary tree. Nodes are BT_NODE_SIZE bytes, a
+// few cache lines each. Values are only stored in the leaves and the
+// leaves are linked in order, so scanning a range walks along the leaves
+// without going back up the tree.
+//
+// Keys are unique. Values and iterators are only valid until the next
+// insert or remove, as these move entries between nodes.
+//
+// Nodes are allocated from alloc, NULL uses malloc. A pool_t sized to
+// BT_NODE_SIZE works well. A zero initialized tree is empty.
+
+typedef struct btree btree;
+typedef struct btree_leaf btree_leaf;
+typedef struct btree_iter btree_iter;
+typedef struct allocator allocator_t;
+
+#define BT_NODE_SIZE 256
+#define BT_LEAF_MAX ((BT_NODE_SIZE - 3 * sizeof(void*)) / (sizeof(uint64_t) + sizeof(void*)))
+#define BT_INNER_MAX ((BT_NODE_SIZE - 2 * sizeof(void*)) / (sizeof(uint64_t) + sizeof(void*)))
+
+struct btree_leaf {
+	unsigned count;
+	btree_leaf *prev, *next;
+	uint64_t keys[BT_LEAF_MAX];
+	void *values[BT_LEAF_MAX];
+};
+
+struct btree {
+	void *root;
+	btree_leaf *first, *last;
+	size_t size;
+	unsigned depth;
+	allocator_t *alloc;
+};
+
+// position of an entry, leaf is NULL at the end
+struct btree_iter {
+	btree_leaf *leaf;
+	unsigned idx;
+};
+
+#define BT_INIT {NULL, NULL, NULL, 0, 0, NULL}
+
+void free_btree(btree *t);
+
+// returns 1 if the key was added, 0 if an existing value was replaced
+// and -1 on allocation failure
+int bt_insert(btree *t, uint64_t key, void *value);
+
+// returns the removed value or NULL if the key was not found
+void *bt_remove(btree *t, uint64_t key);
+
+// returns the value or NULL if the key was not found
+void *bt_find(const btree *t, uint64_t key);
+
+// first entry with a key >= key
+btree_iter bt_lower_bound(const btree *t, uint64_t key);
+
+static inline btree_iter bt_begin(const btree *t, rbdirection dir) {
+	btree_iter it;
+	it.leaf = dir == RB_LEFT ? t->first : t->last;
+	it.idx = (dir == RB_LEFT || !it.leaf) ? 0 : it.leaf->count - 1;
+	return it;
+}
+
+static inline btree_iter bt_next(btree_iter it, rbdirection dir) {
+	if (dir == RB_RIGHT) {
+		if (++it.idx == it.leaf->count) {
+			it.leaf = it.leaf->next;
+			it.idx = 0;
+		}
+	} else if (it.idx) {
+		it.idx--;
+	} else {
+		it.leaf = it.leaf->prev;
+		it.idx = it.leaf ? it.leaf->count - 1 : 0;
+	}
+	return it;
+}
+
+static inline uint64_t bt_key(btree_iter it) {return it.leaf->keys[it.idx];}
+static inline void *bt_value(btree_iter it) {return it.leaf->values[it.idx];}
@@ -25,21 +25,16 @@ static inline void *memrchr(const void *s, int c, size_t n) {
 	return NULL;
 }
 #endif
+
+// Returns the first occurrence of needle in hay or NULL. It compares the
+// first and last bytes of the needle at many positions at once with SIMD
+// and only checks the rest at those, falling back to the Two-Way algorithm
+// if that finds too many false candidates. Defined in search.c.
+const char *str_search(const char *hay, size_t haysz, const char *needle, size_t needlesz);
+
 #ifdef _MSC_VER
 static inline void *memmem(const void *hay, size_t haysz, const void *needle, size_t needlesz) {
-	while (needlesz <= haysz) {
-		char *test = (char*)memchr(hay, *(unsigned char*)needle, haysz - needlesz + 1);
-		if (!test) {
-			return NULL;
-		}
-		if (!memcmp(test, needle, needlesz)) {
-			return test;
-		}
-		test++;
-		haysz = (char*)hay + haysz - test;
-		hay = test;
-	}
-	return NULL;
+	return (void*) str_search((const char*) hay, haysz, (const char*) needle, needlesz);
 }
 #endif
 
@@ -86,6 +81,7 @@ struct slice {
 #define str_equals(A, B) ((A).len == (B).len && !memcmp((A).c_str, (B).c_str, (A).len))
 
 #define str_find_char(P, CH)    ((char*) memchr((P).c_str, (CH), (P).len))
+#define str_find(P, TEST)       ((char*) str_search((P).c_str, (P).len, (TEST), strlen(TEST)))
 #define str_rfind_char(P, CH) 	((char*) memrchr((P).c_str, (CH), (P).len))
 
 #define slice_all(P, STR) ((P)->len = (STR).len, (P)->c_str = (STR).c_str)
@@ -120,10 +116,13 @@ static inline int ca_add2_(char *buf, size_t bufsz, size_t *plen, const char *a,
 	}
 }
 
+// defined in format.c, see cutils/format.h
+int fmt_vsnprintf(char *buf, size_t sz, const char *fmt, va_list ap);
+
 static inline int ca_vaddf_(char *buf, size_t bufsz, size_t *plen, const char *fmt, va_list ap) {
 	assert(*plen >= 0 && *plen < bufsz);
 	size_t left = bufsz - *plen - 1;
-	int ret = vsnprintf(buf + *plen, left, fmt, ap);
+	int ret = fmt_vsnprintf(buf + *plen, left, fmt, ap);
 	if (ret < 0 || (size_t) ret >= left) {
 		buf[*plen] = '\0';
 		return -1;
@@ -0,0 +1,78 @@
+#pragma once
+#include "cutils/hash.h"
+
+// Concurrent hash map for read mostly data such as a cache shared across
+// worker threads.
+//
+// Keys follow the same conventions as hash_t (4B integers, 8B integers or
+// blobs). The key and value sizes are fixed at init time and values are
+// copied in and out of the map, so a value can never be observed half
+// written.
+//
+// The map is split into shards by hash, each of which is a HASH_GROUPED
+// hash_t. Writers take a per shard mutex. Readers never write to shared
+// memory: they copy what they need out of the shard and then check the
+// shard's sequence counter to see if a writer got in the way, retrying if
+// it did. Lookups therefore scale with the number of reader threads as
+// long as writes are rare.
+//
+// To make it safe for readers to race with a writer, arrays that the
+// shard tables drop when they rehash are never freed while the map is
+// alive. They are reused by later rehashes instead, so these stay within
+// a small multiple of the peak size of the map, no matter how many keys
+// are inserted and removed. Blob keys are copied into storage owned by
+// the map. Memory from removed blob keys is not reused, so that grows
+// with the total number of blob keys ever inserted.
+
+typedef struct concurrent_hash chash_t;
+struct chash_shard;
+
+struct concurrent_hash {
+	struct chash_shard *shards;
+	size_t mask;
+	size_t keysz, valsz;
+	uint64_t seed;
+};
+
+// iterators should be zero initialized and freed with free_chash_iter
+struct chash_iter {
+	size_t shard, next;
+	struct {
+		unsigned char *v;
+		size_t size, cap;
+	} buf;
+};
+
+// shards is rounded up to a power of 2, 0 picks a default
+int init_chash(chash_t *c, size_t keysz, size_t valsz, size_t shards, uint64_t seed);
+void free_chash(chash_t *c);
+
+// returns whether the key was found and copies the value into pval
+bool find_chash(chash_t *c, uint64_t key, const void *blob, void *pval);
+
+// adds or replaces the value for the key
+// returns 1 if the key was added, 0 if it was replaced and -1 on error
+int insert_chash(chash_t *c, uint64_t key, const void *blob, const void *pval);
+
+// returns whether the key was found
+bool remove_chash(chash_t *c, uint64_t key, const void *blob);
+
+// Iterates over the map, copying the key and value of each entry out.
+// Returns 0 at the end or if it runs out of memory. Each shard is copied
+// out under its lock when the iterator reaches it, so the iterator can be
+// used while other threads insert and remove. Each key is returned at
+// most once, but changes to a shard made after it was copied are not
+// seen. Blob keys remain valid until the map is freed.
+int next_chash(chash_t *c, struct chash_iter *it, void *pkey, void *pval);
+void free_chash_iter(struct chash_iter *it);
+
+// bytes used by the map, including arrays kept for reuse and blob keys
+size_t chash_memory(chash_t *c);
+
+#define INIT_CHASH(C, KEYTYPE, VALTYPE, SHARDS, SEED) init_chash((C), sizeof(KEYTYPE), sizeof(VALTYPE), (SHARDS), (SEED))
+#define FIND_CHASH(C, KEY, PVAL) find_chash((C), (KEY), NULL, (PVAL))
+#define FIND_BLOB_CHASH(C, KEY, SZ, PVAL) find_chash((C), (SZ), (KEY), (PVAL))
+#define INSERT_CHASH(C, KEY, PVAL) insert_chash((C), (KEY), NULL, (PVAL))
+#define INSERT_BLOB_CHASH(C, KEY, SZ, PVAL) insert_chash((C), (SZ), (KEY), (PVAL))
+#define REMOVE_CHASH(C, KEY) remove_chash((C), (KEY), NULL)
+#define REMOVE_BLOB_CHASH(C, KEY, SZ) remove_chash((C), (SZ), (KEY))
@@ -407,3 +407,30 @@ static inline uint8_t ctz(uint32_t v) {
 #endif
 
 
+
+// ctzl = count trailing zeros of a 64 bit value
+// This version does not protect against a zero value.
+#if defined __GNUC__
+static inline unsigned ctzl(uint64_t v) {
+	return (unsigned)__builtin_ctzll(v);
+}
+#else
+static inline unsigned ctzl(uint64_t v) {
+	uint32_t lo = (uint32_t)v;
+	return lo ? ctz(lo) : (32 + ctz((uint32_t)(v >> 32)));
+}
+#endif
+
+// popcountl = number of bits set in a 64 bit value
+#if defined __GNUC__
+static inline unsigned popcountl(uint64_t v) {
+	return (unsigned)__builtin_popcountll(v);
+}
+#else
+static inline unsigned popcountl(uint64_t v) {
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (unsigned)((v * 0x0101010101010101ULL) >> 56);
+}
+#endif
@@ -12,6 +12,7 @@ extern "C" {
 #define FLAG_EXIT_UNKNOWN_FLAG 2
 #define FLAG_EXIT_MISSING_VALUE 3
 #define FLAG_EXIT_INSUFFICIENT_ARGS 4
+#define FLAG_EXIT_INVALID_VALUE 5
 
 typedef void(*flag_exit_fn)(int code, const char *msg);
 extern flag_exit_fn flag_exit;
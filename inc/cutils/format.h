@@ -0,0 +1,109 @@
+#pragma once
+#include "cutils/str.h"
+#include <stdint.h>
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Native number formatting used by str_addf, str_vaddf, ca_addf and
+// ca_vaddf in place of the C library's vsnprintf.
+//
+// The printf conversions d i u o x X c s p n f F e E g G and % are handled
+// directly with the usual flags, width, precision and length modifiers.
+// Floating point output is exact and rounds half to even as glibc does.
+// Formatting ignores the locale, so the decimal point is always '.' and
+// the ' grouping flag is ignored. %a, %lc, %ls and long doubles go through
+// snprintf. Positional arguments (%1$d) aren't supported and return -1.
+//
+// For hot paths the typed functions below skip parsing a format string
+// altogether. str_add_double writes the shortest digits that read back as
+// the same double.
+
+// largest output of the fmt_* functions
+#define FMT_BUFSZ 32
+
+size_t fmt_u64(char *buf, uint64_t v);
+size_t fmt_i64(char *buf, int64_t v);
+size_t fmt_hex(char *buf, uint64_t v);
+size_t fmt_double(char *buf, double v);
+
+// same as vsnprintf
+int fmt_vsnprintf(char *buf, size_t sz, const char *fmt, va_list ap);
+
+#ifdef __GNUC__
+__attribute__((format (printf,3,4)))
+#endif
+int fmt_snprintf(char *buf, size_t sz, const char *fmt, ...);
+
+static inline void str_add_u64(str_t *s, uint64_t v) {
+	str_grow(s, s->len + FMT_BUFSZ);
+	s->len += fmt_u64(s->c_str + s->len, v);
+	s->c_str[s->len] = 0;
+}
+static inline void str_add_i64(str_t *s, int64_t v) {
+	str_grow(s, s->len + FMT_BUFSZ);
+	s->len += fmt_i64(s->c_str + s->len, v);
+	s->c_str[s->len] = 0;
+}
+static inline void str_add_hex(str_t *s, uint64_t v) {
+	str_grow(s, s->len + FMT_BUFSZ);
+	s->len += fmt_hex(s->c_str + s->len, v);
+	s->c_str[s->len] = 0;
+}
+static inline void str_add_double(str_t *s, double v) {
+	str_grow(s, s->len + FMT_BUFSZ);
+	s->len += fmt_double(s->c_str + s->len, v);
+	s->c_str[s->len] = 0;
+}
+static inline void str_add_slice(str_t *s, slice_t v) {
+	str_add2(s, v.c_str, v.len);
+}
+
+// same as %.*f
+void str_add_fixed(str_t *s, double v, int prec);
+
+#if defined __STDC_VERSION__ && __STDC_VERSION__ >= 201112L
+// Appends a value picking the function from its type at compile time.
+// STR_CAT appends up to 8 values in turn, eg
+// STR_CAT(&s, "id=", id, " took ", secs, "s").
+// Character literals have type int in C, so STR_CAT(&s, 'q') appends the
+// number "113". Cast to char or use a string to append the character, eg
+// STR_CAT(&s, (char) 'q') or STR_CAT(&s, "q").
+#define str_add_value(S, X) _Generic((X), \
+	char: str_addch, \
+	signed char: str_add_i64, \
+	short: str_add_i64, \
+	int: str_add_i64, \
+	long: str_add_i64, \
+	long long: str_add_i64, \
+	unsigned char: str_add_u64, \
+	unsigned short: str_add_u64, \
+	unsigned: str_add_u64, \
+	unsigned long: str_add_u64, \
+	unsigned long long: str_add_u64, \
+	float: str_add_double, \
+	double: str_add_double, \
+	char*: str_add, \
+	const char*: str_add, \
+	slice_t: str_add_slice)(S, X)
+
+#define STR_CAT(S, ...) FMT_GLUE(FMT_CAT_, FMT_NARGS(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0))(S, __VA_ARGS__)
+
+#define FMT_NARGS(_1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define FMT_GLUE_(A, B) A##B
+#define FMT_GLUE(A, B) FMT_GLUE_(A, B)
+#define FMT_CAT_1(S, A) str_add_value(S, A)
+#define FMT_CAT_2(S, A, ...) (str_add_value(S, A), FMT_CAT_1(S, __VA_ARGS__))
+#define FMT_CAT_3(S, A, ...) (str_add_value(S, A), FMT_CAT_2(S, __VA_ARGS__))
+#define FMT_CAT_4(S, A, ...) (str_add_value(S, A), FMT_CAT_3(S, __VA_ARGS__))
+#define FMT_CAT_5(S, A, ...) (str_add_value(S, A), FMT_CAT_4(S, __VA_ARGS__))
+#define FMT_CAT_6(S, A, ...) (str_add_value(S, A), FMT_CAT_5(S, __VA_ARGS__))
+#define FMT_CAT_7(S, A, ...) (str_add_value(S, A), FMT_CAT_6(S, __VA_ARGS__))
+#define FMT_CAT_8(S, A, ...) (str_add_value(S, A), FMT_CAT_7(S, __VA_ARGS__))
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -23,15 +23,84 @@
 //
 // If the key is a blob, use the BLOB versions. Otherwise use
 // the normal macros.
+//
+// The table layout is selected by setting h.mode before the first
+// insert or resize. A zero initialized table uses HASH_QUADRATIC.
+// 1. HASH_QUADRATIC
+//    2 bits of flags per slot and a quadratic probe one slot at a time.
+//    Smallest memory overhead.
+// 2. HASH_GROUPED
+//    One control byte per slot holding 7 bits of the hash. Slots are
+//    probed in groups of 16 with SIMD compares, so a lookup usually
+//    only touches a single cache line of control bytes before going to
+//    the key. Tables grow at 7/8 full instead of 3/4.
+// 3. HASH_LINEAR
+//    One byte per slot and a linear probe kept in Robin Hood order.
+//    Removing an entry shifts the following entries back instead of
+//    leaving a removed marker, so tables that see constant inserts and
+//    removes never fill up with removed slots and probes stay short.
+//    There is no per slot hash tag, so lookups go to the key more often
+//    than with HASH_GROUPED.
+//    Inserts and removes move other entries, so indices are only valid
+//    until the next insert or remove. To remove entries while iterating,
+//    step the index back by one after each remove so that the entry
+//    moved into its place is visited.
+//
+// The layout can be combined with HASH_STORE_HASHES to keep the full
+// hash of each entry in h.hashes. Growing the table then never rereads
+// the keys and mismatching entries are rejected without touching the
+// key. This is mostly of use for blob keys, at a cost of 8B per slot.
+//
+// HASH_INCREMENTAL spreads the cost of growing the table across the
+// following inserts and finds instead of moving every entry at once.
+// The old arrays are kept until all of their entries have been moved
+// over, so memory use temporarily peaks higher. Indices returned from
+// find and insert always refer to the current keys and values. Starting
+// an iteration with NEXT_HASH or calling RESIZE_HASH finishes any
+// outstanding move in one go. HASH_INCREMENTAL is ignored for
+// HASH_LINEAR tables, as moving an entry over during a find would shift
+// the entries after it and invalidate indices from earlier finds.
+//
+// Keys are hashed with hash_u64 or hash_bytes using h.seed. Tables
+// that hold untrusted keys should set a random seed before the first
+// insert to make it harder to force collisions.
 
 typedef struct allocator allocator_t;
 typedef struct hash_table hash_t;
 typedef struct hash_blob blob_t;
+struct hash_migration;
+
+enum hash_mode {
+	// layouts
+	HASH_QUADRATIC = 0,
+	HASH_GROUPED = 1,
+	HASH_LINEAR = 2,
+	HASH_LAYOUT_MASK = 0xFF,
+
+	// options that can be or'd with the layout
+	HASH_STORE_HASHES = 0x100,
+	HASH_INCREMENTAL = 0x200,
+};
 
 struct hash_table {
 	size_t size, end, num_used;
-	uint32_t *flags;
+	union {
+		uint32_t *flags;
+		uint8_t *ctrl;
+	};
 	allocator_t *alloc;
+	uint64_t *hashes;
+	unsigned mode;
+	unsigned keysz, valsz;
+	uint64_t seed;
+	struct hash_migration *migrating;
+};
+
+// state for probe_hash, zero initialize before the first call
+struct hash_probe {
+	size_t pos, step;
+	unsigned match;
+	bool started;
 };
 
 struct hash_blob {
@@ -42,6 +111,9 @@ struct hash_blob {
 #endif
 };
 
+uint64_t hash_u64(uint64_t key, uint64_t seed);
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed);
+
 void free_hash(hash_t *h, size_t valsz);
 void clear_hash(hash_t *h);
 size_t hash_memory(const hash_t *h, size_t keysz, size_t valsz);
@@ -51,6 +123,29 @@ size_t find_hash(hash_t *h, size_t keysz, uint64_t key, const void *blob);
 size_t insert_hash(hash_t *h, size_t keysz, size_t valsz, bool *padded, uint64_t key, const void *blob);
 int next_hash(hash_t *h, size_t *pidx);
 
+// Batch versions of find and insert for looking up many keys at once.
+// keys is an array of n keys of the table's key type (blob_t for blob
+// keys) and the index of each key is written to idx. The memory accesses
+// of the keys in a batch are overlapped, which is much faster than
+// separate calls when the table doesn't fit in cache. Any outstanding
+// incremental resize is finished first.
+//
+// insert_hash_batch grows the table for the whole batch up front, so the
+// indices stay valid until the next insert or remove after the batch.
+// padded may be NULL. Returns -1 if the table could not be grown.
+// Duplicate keys within a batch get the same index.
+void find_hash_batch(hash_t *h, size_t keysz, const void *keys, size_t n, size_t *idx);
+int insert_hash_batch(hash_t *h, size_t keysz, size_t valsz, const void *keys, size_t n, size_t *idx, bool *padded);
+
+// Low level lookup for readers that race with a writer (see
+// concurrent-hash.h). Each call returns the next slot in probe order
+// that is in use and may hold a key with the given full hash, or h->end
+// once the probe is exhausted. The caller compares the keys. Only the
+// arrays that h points to are read and nothing is written, so it can
+// run against a copy of the header. Entries still in the old arrays of
+// an incremental resize are not returned.
+size_t probe_hash(const hash_t *h, uint64_t hash, struct hash_probe *p);
+
 #define CLEAR_HASH(H) clear_hash(&(H)->h)
 #define REMOVE_HASH(H, IDX) remove_hash(&(H)->h, (IDX))
 
@@ -64,6 +159,8 @@ int next_hash(hash_t *h, size_t *pidx);
 #define FIND_BLOB_HASH(H, KEY, SZ) find_hash(&(H)->h, sizeof((H)->keys[0]), (SZ), (KEY))
 #define INSERT_HASH(H, KEY, PADDED) insert_hash(&(H)->h, sizeof((H)->keys[0]), sizeof((H)->values[0]), (PADDED), (KEY), NULL)
 #define INSERT_BLOB_HASH(H, KEY, SZ, PADDED) insert_hash(&(H)->h, sizeof((H)->keys[0]), sizeof((H)->values[0]), (PADDED), (SZ), (KEY))
+#define FIND_HASH_BATCH(H, KEYS, N, IDX) find_hash_batch(&(H)->h, sizeof((H)->keys[0]), (KEYS), (N), (IDX))
+#define INSERT_HASH_BATCH(H, KEYS, N, IDX, PADDED) insert_hash_batch(&(H)->h, sizeof((H)->keys[0]), sizeof((H)->values[0]), (KEYS), (N), (IDX), (PADDED))
 
 #define FREE_SET(H) free_hash(&(H)->h, 0)
 #define SET_MEMORY(H) hash_memory(&(H)->h, sizeof((H)->keys[0]), 0)
@@ -72,4 +169,6 @@ int next_hash(hash_t *h, size_t *pidx);
 #define FIND_BLOB_SET(H, KEY, SZ) find_hash(&(H)->h, sizeof((H)->keys[0]), (SZ), (KEY))
 #define INSERT_SET(H, KEY, PADDED) insert_hash(&(H)->h, sizeof((H)->keys[0]), 0, (PADDED), (KEY), NULL)
 #define INSERT_BLOB_SET(H, KEY, SZ, PADDED) insert_hash(&(H)->h, sizeof((H)->keys[0]), 0, (PADDED), (SZ), (KEY))
+#define FIND_SET_BATCH(H, KEYS, N, IDX) find_hash_batch(&(H)->h, sizeof((H)->keys[0]), (KEYS), (N), (IDX))
+#define INSERT_SET_BATCH(H, KEYS, N, IDX, PADDED) insert_hash_batch(&(H)->h, sizeof((H)->keys[0]), 0, (KEYS), (N), (IDX), (PADDED))
 
@@ -0,0 +1,89 @@
+#pragma once
+#include "cutils/hash.h"
+#include "cutils/arena.h"
+#include <stdint.h>
+#include <string.h>
+
+// String interning for data with many repeated strings such as paths and
+// header names.
+//
+// Each distinct string is stored once in an arena and the same pointer is
+// returned every time it is interned, so interned strings can be compared
+// with ==. Strings are null terminated and stay valid until the table is
+// freed. Each string is also given a small integer ID counting up from 0,
+// which can be used to index side arrays. Both the length and the ID are
+// stored just before the string so that intern_len and intern_id don't
+// need the table.
+//
+// Lookups go through a HASH_GROUPED hash_t with blob keys that point at
+// the stored copies. Strings are packed into pages taken from the arena
+// with 4B alignment rather than going through the arena allocator one at
+// a time, so the overhead per string is 8B plus the hash slot.
+//
+// intern_t must only be used by one thread at a time. cintern_t is the
+// thread safe equivalent. It splits the strings across shards by hash,
+// each with its own lock and intern_t. IDs from a cintern_t are unique
+// across the shards but are not dense.
+
+typedef struct intern intern_t;
+typedef struct concurrent_intern cintern_t;
+struct cintern_shard;
+
+struct intern {
+	arena_t arena;
+	char *next, *end;
+	struct {
+		hash_t h;
+		blob_t *keys;
+	} set;
+	struct {
+		const char **v;
+		size_t size, cap;
+	} strings;
+	unsigned id_shift;
+	uint32_t id_tag;
+};
+
+struct concurrent_intern {
+	struct cintern_shard *shards;
+	size_t mask;
+	uint64_t seed;
+};
+
+// arena chunks are allocated from parent, which can be NULL for malloc
+void init_intern(intern_t *t, allocator_t *parent);
+void free_intern(intern_t *t);
+size_t intern_memory(const intern_t *t);
+
+// returns the stored copy, adding it if it's not already in the table
+// returns NULL if memory can't be allocated or the string is 4GB or more
+const char *intern(intern_t *t, const void *data, size_t size);
+
+// returns the stored copy or NULL if it hasn't been interned
+const char *find_intern(intern_t *t, const void *data, size_t size);
+
+static inline size_t intern_len(const char *p) {
+	return ((const uint32_t*)p)[-1];
+}
+static inline uint32_t intern_id(const char *p) {
+	return ((const uint32_t*)p)[-2];
+}
+
+// returns the string for an ID
+static inline const char *intern_lookup(const intern_t *t, uint32_t id) {
+	return t->strings.v[id >> t->id_shift];
+}
+
+#define INTERN(T, STR) intern((T), (STR), strlen(STR))
+#define INTERN_SLICE(T, S) intern((T), (S).c_str, (S).len)
+
+// shards is rounded up to a power of 2, 0 picks a default
+int init_cintern(cintern_t *c, size_t shards, uint64_t seed);
+void free_cintern(cintern_t *c);
+size_t cintern_memory(cintern_t *c);
+
+const char *cintern(cintern_t *c, const void *data, size_t size);
+const char *find_cintern(cintern_t *c, const void *data, size_t size);
+const char *cintern_lookup(cintern_t *c, uint32_t id);
+
+#define CINTERN(C, STR) cintern((C), (STR), strlen(STR))
@@ -0,0 +1,53 @@
+#pragma once
+#include "cutils/hash.h"
+#include "cutils/file.h"
+#include <stdio.h>
+
+// Immutable minimal perfect hash tables that can be written out once and
+// then mapped straight into memory with no parsing or rebuilding.
+//
+// write_perfect_hash takes a populated hash_t (see hash.h) and writes out
+// its keys and values. Values are written as raw bytes, so they should not
+// contain pointers. Blob keys are copied into the file.
+//
+// The file holds one slot per entry. Keys are split into buckets by hash
+// and each bucket stores a small number (the pilot) chosen at build time
+// such that hashing the key together with its bucket's pilot gives a slot
+// that no other key uses. A lookup is then one hash, one pilot read and
+// one key compare. Building takes a while for large tables but only
+// happens once.
+//
+// All integers in the file are little endian. The file depends on
+// hash_u64 and hash_bytes, so those must not change without changing the
+// file version.
+
+typedef struct perfect_hash perfect_hash_t;
+
+struct perfect_hash {
+	mapped_file mf;
+	const uint8_t *pilots, *keys, *values, *strings;
+	size_t num, nbuckets, strings_size;
+	uint64_t seed;
+	unsigned keysz, valsz;
+};
+
+int write_perfect_hash(FILE *f, hash_t *h, size_t keysz, size_t valsz, uint64_t seed);
+
+// Opens a file written by write_perfect_hash. load_perfect_hash uses
+// data that the caller keeps around for the lifetime of the table
+// instead. Both return -1 if the file is invalid.
+int open_perfect_hash(perfect_hash_t *p, const char *fn);
+int load_perfect_hash(perfect_hash_t *p, const void *data, size_t size);
+void close_perfect_hash(perfect_hash_t *p);
+
+// returns the index of the key or p->num if not found
+size_t find_perfect_hash(const perfect_hash_t *p, uint64_t key, const void *blob);
+
+static inline const void *perfect_hash_value(const perfect_hash_t *p, size_t idx) {
+	return p->values + idx * p->valsz;
+}
+
+#define WRITE_PERFECT_HASH(F, H, SEED) write_perfect_hash((F), &(H)->h, sizeof((H)->keys[0]), sizeof((H)->values[0]), (SEED))
+#define WRITE_PERFECT_SET(F, H, SEED) write_perfect_hash((F), &(H)->h, sizeof((H)->keys[0]), 0, (SEED))
+#define FIND_PERFECT_HASH(P, KEY) find_perfect_hash((P), (KEY), NULL)
+#define FIND_BLOB_PERFECT_HASH(P, KEY, SZ) find_perfect_hash((P), (SZ), (KEY))
@@ -0,0 +1,112 @@
+#pragma once
+#include "cutils/vector.h"
+#include "cutils/thread.h"
+#include <stdint.h>
+
+// Pool allocator for fixed size objects such as the nodes of an rbtree,
+// heap or apc list.
+//
+// Objects are carved out of large slabs and freed objects go on a free
+// list to be handed out again, so allocating and freeing is a few
+// instructions and objects from the same pool sit next to each other in
+// memory. The memory is only returned to the parent allocator when the
+// pool is freed. clear_pool frees every object in the pool at once.
+//
+// The pool can be used directly with get_pool and put_pool or passed as
+// &pool->alloc to anything that takes an allocator_t, as long as it never
+// asks for more than the object size.
+//
+// A pool must only be used by one thread at a time. To share a pool
+// between threads, give each thread a pool_cache and use get_pool_cache
+// and put_pool_cache instead. Each cache keeps its own free list and only
+// takes the pool's lock to move objects to and from the pool in batches.
+// Caches must be flushed before the pool is cleared or freed.
+
+typedef struct pool pool_t;
+struct pool_slab;
+
+struct pool_free {
+	struct pool_free *next;
+};
+
+struct pool {
+	allocator_t alloc;
+	struct pool_free *free;
+	uint8_t *next, *end;
+	struct pool_slab *slabs, *cur;
+	size_t objsz, slabsz;
+	allocator_t *parent;
+	mtx_t lock;
+};
+
+struct pool_cache {
+	pool_t *pool;
+	struct pool_free *free;
+	size_t num;
+};
+
+// objsz is rounded up to a multiple of the pointer size
+// per_slab of 0 picks a default
+void init_pool(pool_t *p, allocator_t *parent, size_t objsz, size_t per_slab);
+void free_pool(pool_t *p);
+void clear_pool(pool_t *p);
+
+// returns the memory used by slabs
+size_t pool_memory(const pool_t *p);
+
+// objects from get_pool and get_pool_cache are not zeroed
+void *grow_pool(pool_t *p);
+
+static inline void *get_pool(pool_t *p) {
+	struct pool_free *f = p->free;
+	if (f) {
+		p->free = f->next;
+		return f;
+	}
+	return grow_pool(p);
+}
+
+static inline void put_pool(pool_t *p, void *obj) {
+	struct pool_free *f = (struct pool_free*) obj;
+	f->next = p->free;
+	p->free = f;
+}
+
+static inline void init_pool_cache(struct pool_cache *c, pool_t *p) {
+	c->pool = p;
+	c->free = NULL;
+	c->num = 0;
+}
+
+void *refill_pool_cache(struct pool_cache *c);
+void drain_pool_cache(struct pool_cache *c, size_t keep);
+
+static inline void *get_pool_cache(struct pool_cache *c) {
+	struct pool_free *f = c->free;
+	if (f) {
+		c->free = f->next;
+		c->num--;
+		return f;
+	}
+	return refill_pool_cache(c);
+}
+
+#define POOL_CACHE_BATCH 64
+
+static inline void put_pool_cache(struct pool_cache *c, void *obj) {
+	struct pool_free *f = (struct pool_free*) obj;
+	f->next = c->free;
+	c->free = f;
+	if (++c->num > 2 * POOL_CACHE_BATCH) {
+		drain_pool_cache(c, POOL_CACHE_BATCH);
+	}
+}
+
+// returns all of the cache's objects to the pool
+static inline void flush_pool_cache(struct pool_cache *c) {
+	drain_pool_cache(c, 0);
+}
+
+#define INIT_POOL(P, TYPE) init_pool((P), NULL, sizeof(TYPE), 0)
+#define POOL_NEW(P, TYPE) ((TYPE*)get_pool(P))
+#define POOL_CACHE_NEW(C, TYPE) ((TYPE*)get_pool_cache(C))
@@ -2,6 +2,32 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Intrusive red-black tree. Embed an rbnode in the element type and use
+// container_of to get back from the node to the element.
+//
+// DECLARE_RBTREE(NAME, TYPE, MEMBER, LESS) defines typed functions for a
+// tree of TYPE linked through TYPE.MEMBER:
+//	TYPE *NAME_entry(const rbnode *n);
+//	TYPE *NAME_find(const rbtree *t, const TYPE *key);
+//	TYPE *NAME_lower_bound(const rbtree *t, const TYPE *key);
+//	TYPE *NAME_upper_bound(const rbtree *t, const TYPE *key);
+//	void NAME_insert(rbtree *t, TYPE *e);
+//	TYPE *NAME_insert_unique(rbtree *t, TYPE *e);
+//	struct rbrange NAME_range(const rbtree *t, const TYPE *lo, const TYPE *hi);
+//	void NAME_build(rbtree *t, TYPE *v, size_t n);
+//
+// LESS(a, b) is given two const TYPE* and returns whether a sorts before b,
+// as with DECLARE_SORT. Only the fields used by LESS need to be set in key.
+// NAME_entry returns NULL for a NULL node.
+// NAME_lower_bound returns the first element not less than key and
+// NAME_upper_bound the first element greater than key, or NULL.
+// NAME_insert adds e after any equal elements. NAME_insert_unique only adds
+// e if there is no equal element, returning the existing element if there
+// is one or NULL if e was added.
+// NAME_range returns the elements from lo up to but not including hi.
+// NAME_build replaces the contents of the tree with the elements of v,
+// which must already be sorted, in O(n).
+
 typedef struct rbnode rbnode;
 typedef struct rbtree rbtree;
 
@@ -25,12 +51,121 @@ struct rbtree {
 static inline rbnode *rb_parent(const rbnode *n) {return (rbnode *) (n->parent_color &~ (uintptr_t)1);}
 static inline rbnode *rb_child(const rbnode *n, rbdirection dir) {return n->child[dir];}
 
+// adds node next to parent in direction dir, parent of NULL is only for an
+// empty tree
 void rb_insert(rbtree *tree, rbnode *parent, rbnode *node, rbdirection dir);
 void rb_remove(rbtree *tree, rbnode *n);
 
 rbnode *rb_begin(const rbtree *tree, rbdirection dir);
 rbnode *rb_next(const rbnode *node, rbdirection dir);
 
+// Replaces the contents of the tree with a balanced tree of the nodes,
+// which must be in order. Runs in O(n) without any rotations.
+void rb_build(rbtree *tree, rbnode *const *nodes, size_t n);
+// As rb_build for an array of n objects of objsz bytes with the node at
+// offset bytes into each object
+void rb_build_array(rbtree *tree, void *v, size_t n, size_t objsz, size_t offset);
+
+// half open range of nodes [begin, end), end is NULL for the end of the tree
+struct rbrange {
+	rbnode *begin, *end;
+};
+
+#define RB_FOR_RANGE(N, R) for (rbnode *N = (R).begin; N != (R).end; N = rb_next(N, RB_RIGHT))
+
 #ifndef container_of
 #define container_of(ptr, type, member) ((type*) ((char*) (ptr) - offsetof(type, member)))
 #endif
+
+#define DECLARE_RBTREE(NAME, TYPE, MEMBER, LESS) \
+	static inline TYPE *NAME##_entry(const rbnode *n) { \
+		return n ? container_of(n, TYPE, MEMBER) : NULL; \
+	} \
+	static inline TYPE *NAME##_find(const rbtree *t, const TYPE *key) { \
+		rbnode *p = t->root; \
+		while (p) { \
+			TYPE *e = container_of(p, TYPE, MEMBER); \
+			if (LESS(key, e)) { \
+				p = p->child[RB_LEFT]; \
+			} else if (LESS(e, key)) { \
+				p = p->child[RB_RIGHT]; \
+			} else { \
+				return e; \
+			} \
+		} \
+		return NULL; \
+	} \
+	static inline rbnode *NAME##_lower_bound_node(const rbtree *t, const TYPE *key) { \
+		rbnode *p = t->root, *ret = NULL; \
+		while (p) { \
+			if (LESS(container_of(p, TYPE, MEMBER), key)) { \
+				p = p->child[RB_RIGHT]; \
+			} else { \
+				ret = p; \
+				p = p->child[RB_LEFT]; \
+			} \
+		} \
+		return ret; \
+	} \
+	static inline rbnode *NAME##_upper_bound_node(const rbtree *t, const TYPE *key) { \
+		rbnode *p = t->root, *ret = NULL; \
+		while (p) { \
+			if (LESS(key, container_of(p, TYPE, MEMBER))) { \
+				ret = p; \
+				p = p->child[RB_LEFT]; \
+			} else { \
+				p = p->child[RB_RIGHT]; \
+			} \
+		} \
+		return ret; \
+	} \
+	static inline TYPE *NAME##_lower_bound(const rbtree *t, const TYPE *key) { \
+		return NAME##_entry(NAME##_lower_bound_node(t, key)); \
+	} \
+	static inline TYPE *NAME##_upper_bound(const rbtree *t, const TYPE *key) { \
+		return NAME##_entry(NAME##_upper_bound_node(t, key)); \
+	} \
+	static inline void NAME##_insert(rbtree *t, TYPE *e) { \
+		rbnode *p = t->root; \
+		rbdirection dir = RB_LEFT; \
+		while (p) { \
+			dir = LESS(e, container_of(p, TYPE, MEMBER)) ? RB_LEFT : RB_RIGHT; \
+			if (!p->child[dir]) { \
+				break; \
+			} \
+			p = p->child[dir]; \
+		} \
+		rb_insert(t, p, &e->MEMBER, dir); \
+	} \
+	static inline TYPE *NAME##_insert_unique(rbtree *t, TYPE *e) { \
+		rbnode *p = t->root; \
+		rbdirection dir = RB_LEFT; \
+		while (p) { \
+			TYPE *pe = container_of(p, TYPE, MEMBER); \
+			if (LESS(e, pe)) { \
+				dir = RB_LEFT; \
+			} else if (LESS(pe, e)) { \
+				dir = RB_RIGHT; \
+			} else { \
+				return pe; \
+			} \
+			if (!p->child[dir]) { \
+				break; \
+			} \
+			p = p->child[dir]; \
+		} \
+		rb_insert(t, p, &e->MEMBER, dir); \
+		return NULL; \
+	} \
+	static inline struct rbrange NAME##_range(const rbtree *t, const TYPE *lo, const TYPE *hi) { \
+		struct rbrange r; \
+		r.begin = NAME##_lower_bound_node(t, lo); \
+		r.end = NAME##_lower_bound_node(t, hi); \
+		if (!r.begin || (r.end && !LESS(container_of(r.begin, TYPE, MEMBER), container_of(r.end, TYPE, MEMBER)))) { \
+			r.begin = r.end; \
+		} \
+		return r; \
+	} \
+	static inline void NAME##_build(rbtree *t, TYPE *v, size_t n) { \
+		rb_build_array(t, v, n, sizeof(TYPE), offsetof(TYPE, MEMBER)); \
+	}
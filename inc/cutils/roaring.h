@@ -0,0 +1,96 @@
+#pragma once
+#include "cutils/bitset.h"
+#include "cutils/file.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Compressed bitmap of 32 bit values for sets that are too sparse or too
+// large for a flat struct bitset.
+//
+// The value space is split into chunks of 64K values keyed by the top 16
+// bits. Only chunks with values in them are stored, each in whichever
+// container suits it:
+//	array - sorted list of the low 16 bits, up to 4096 values
+//	bitmap - 64K bits, for more than 4096 values
+//	run - sorted list of start and length-1 pairs, from optimize_roaring
+//
+// A bitmap uses at most about 2 bytes per value and usually much less.
+// Union and intersection work a container at a time and use the bulk
+// bitset operations for bitmaps.
+//
+// write_roaring writes the bitmap out in a form that open_roaring and
+// load_roaring use in place without copying or parsing the containers.
+// Bitmaps loaded this way are read only. All integers in the file are
+// little endian, so they can only be loaded on little endian machines.
+
+typedef struct roaring roaring_t;
+
+enum roaring_type {
+	ROARING_ARRAY,
+	ROARING_BITMAP,
+	ROARING_RUN,
+};
+
+struct roaring_container {
+	uint16_t key;
+	uint8_t type;
+	// num is the number of u16 values for arrays, 1024 words for bitmaps
+	// and the number of pairs for runs
+	uint32_t num, card, cap;
+	uint16_t *data;
+};
+
+struct roaring {
+	struct roaring_container *v;
+	size_t size, cap;
+	mapped_file mf;
+	bool readonly;
+};
+
+#define ROARING_END ((uint64_t) 1 << 32)
+
+static inline void init_roaring(roaring_t *r) {
+	memset(r, 0, sizeof(*r));
+}
+void free_roaring(roaring_t *r);
+void clear_roaring(roaring_t *r);
+
+// These return -1 if memory can't be allocated or the bitmap is read only.
+int add_roaring(roaring_t *r, uint32_t val);
+int remove_roaring(roaring_t *r, uint32_t val);
+bool test_roaring(const roaring_t *r, uint32_t val);
+
+uint64_t count_roaring(const roaring_t *r);
+size_t roaring_memory(const roaring_t *r);
+
+// dst is overwritten and must not be a or b
+int or_roaring(roaring_t *dst, const roaring_t *a, const roaring_t *b);
+int and_roaring(roaring_t *dst, const roaring_t *a, const roaring_t *b);
+
+// converts containers to runs where that is smaller, best done once a
+// bitmap has been built and before it is written out
+int optimize_roaring(roaring_t *r);
+
+// returns the first value at or after idx or ROARING_END if there is none
+uint64_t next_roaring(const roaring_t *r, uint64_t idx);
+
+// writes up to max values at or after *pidx to out, returns the number
+// written and updates *pidx to continue from on the next call
+size_t list_roaring(const roaring_t *r, uint64_t *pidx, uint32_t *out, size_t max);
+
+#define FOR_ROARING(VAL, R) for (uint64_t VAL = next_roaring((R), 0); VAL < ROARING_END; VAL = next_roaring((R), VAL + 1))
+
+// Conversion to and from flat bitsets for dense ranges. roaring_to_bitset
+// sets b to the values in [begin, end) with bit 0 being begin.
+// bitset_to_roaring adds each set bit i in b as the value offset + i.
+int roaring_to_bitset(struct bitset *b, const roaring_t *r, uint64_t begin, uint64_t end);
+int bitset_to_roaring(roaring_t *r, const struct bitset *b, uint32_t offset);
+
+int write_roaring(FILE *f, const roaring_t *r);
+
+// open_roaring maps the file. load_roaring uses 8 byte aligned data that
+// the caller keeps around for the lifetime of the bitmap instead. Both
+// return -1 if the file is invalid. Use free_roaring to close either.
+int open_roaring(roaring_t *r, const char *fn);
+int load_roaring(roaring_t *r, const void *data, size_t size);
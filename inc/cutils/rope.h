@@ -0,0 +1,80 @@
+#pragma once
+#include "cutils/str.h"
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Chunked string builder for large outputs. Appends go into a list of
+// fixed size blocks so the data is never moved or copied as it grows, and
+// peak memory is the data plus at most one partly filled block. The output
+// can be written with write_rope or writev_rope, or read through
+// open_rope_stream (cutils/stream.h) without being flattened.
+//
+// Formatted appends are never split across blocks, so the usual str_addf
+// formats and the fmt_* functions can write straight into the tail.
+
+typedef struct rope rope_t;
+
+#define ROPE_BLOCK_SIZE (64 * 1024 - sizeof(struct rope_block))
+
+struct rope_block {
+	struct rope_block *next;
+	size_t len, cap;
+	char data[1];
+};
+
+struct rope {
+	struct rope_block *first, *last;
+	size_t len;
+};
+
+static inline void init_rope(rope_t *r) {
+	memset(r, 0, sizeof(*r));
+}
+void free_rope(rope_t *r);
+void clear_rope(rope_t *r);
+
+// These return -1 if memory can't be allocated.
+int rope_add2(rope_t *r, const char *a, size_t len);
+int rope_addch(rope_t *r, char ch);
+
+#ifdef __GNUC__
+__attribute__((format (printf,2,3)))
+#endif
+int rope_addf(rope_t *r, const char *fmt, ...);
+
+#ifdef __GNUC__
+__attribute__((format (printf,2,0)))
+#endif
+int rope_vaddf(rope_t *r, const char *fmt, va_list ap);
+
+static inline int rope_add(rope_t *r, const char *a) {
+	return rope_add2(r, a, strlen(a));
+}
+
+#define rope_addstr(P, STR) rope_add2(P, (STR).c_str, (STR).len)
+
+// rope_reserve returns space for at least len contiguous bytes at the end
+// and rope_commit then appends the first len bytes written there, eg
+// rope_commit(r, fmt_u64(rope_reserve(r, FMT_BUFSZ), v)).
+char *rope_reserve(rope_t *r, size_t len);
+static inline void rope_commit(rope_t *r, size_t len) {
+	r->last->len += len;
+	r->len += len;
+}
+
+void str_add_rope(str_t *s, const rope_t *r);
+
+// These return -1 on a write error.
+int write_rope(FILE *f, const rope_t *r);
+int writev_rope(int fd, const rope_t *r);
+
+#define FOR_ROPE(BLOCK, R) for (const struct rope_block *BLOCK = (R)->first; BLOCK != NULL; BLOCK = BLOCK->next)
+
+#ifdef __cplusplus
+}
+#endif
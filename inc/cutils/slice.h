@@ -0,0 +1,105 @@
+#pragma once
+#include "cutils/char-array.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Functions on slice_t, a non-owning view of a string that is not
+// necessarily null terminated. None of these allocate. Slices are passed
+// and returned by value and can be taken of a str_t or char array with
+// slice_all, slice_left and slice_right in char-array.h.
+//
+// Splitting takes a set of delimiter bytes. Sets of up to 8 bytes are
+// searched for 16 or 32 bytes at a time with SIMD, larger sets a byte at a
+// time with a bitmap. Case insensitive comparisons only fold ASCII.
+
+static inline slice_t make_slice(const char *p, size_t len) {
+	slice_t s;
+	s.c_str = p;
+	s.len = len;
+	return s;
+}
+
+static inline slice_t cstr_slice(const char *p) {
+	return make_slice(p, strlen(p));
+}
+
+// returns len bytes from off, clipped to the end of the slice
+static inline slice_t slice_sub(slice_t s, size_t off, size_t len) {
+	if (off > s.len) {
+		off = s.len;
+	}
+	if (len > s.len - off) {
+		len = s.len - off;
+	}
+	return make_slice(s.c_str + off, len);
+}
+
+// trims ASCII whitespace
+slice_t slice_trim(slice_t s);
+slice_t slice_ltrim(slice_t s);
+slice_t slice_rtrim(slice_t s);
+
+int slice_cmp(slice_t a, slice_t b);
+int slice_icmp(slice_t a, slice_t b);
+bool slice_iequals(slice_t a, slice_t b);
+
+// Splits the slice at the first ch. Returns false and leaves the slices
+// untouched if ch isn't found. Either output can be NULL.
+bool slice_cut(slice_t s, char ch, slice_t *pbefore, slice_t *pafter);
+
+struct slice_set {
+	uint64_t bits[4];
+	unsigned num;
+	char chars[8];
+};
+
+// chars is a null terminated list of the bytes in the set
+void init_slice_set(struct slice_set *set, const char *chars);
+
+// returns the index of the first byte in the set or s.len
+size_t slice_find_any(slice_t s, const struct slice_set *set);
+
+// returns the length of the prefix made up of bytes in the set
+size_t slice_span(slice_t s, const struct slice_set *set);
+
+// Iterates over the parts of a slice between delimiters, eg
+// struct slice_iter it;
+// init_slice_iter(&it, line, ", ");
+// slice_t tok;
+// while (next_token(&it, &tok)) {...}
+//
+// next_field returns every field including empty ones between adjacent
+// delimiters, so "a,,b" split on "," gives "a", "" and "b". next_token
+// skips over runs of delimiters and only returns non-empty tokens.
+struct slice_iter {
+	slice_t rest;
+	struct slice_set set;
+	bool done;
+};
+
+void init_slice_iter(struct slice_iter *it, slice_t s, const char *delims);
+bool next_field(struct slice_iter *it, slice_t *pfield);
+bool next_token(struct slice_iter *it, slice_t *ptoken);
+
+// These parse the whole slice as a number. Leading or trailing
+// whitespace, trailing junk and overflow are errors that return -1
+// without changing *pv.
+//
+// Base 0 picks the base from the prefix as strtoull does (0x for hex,
+// a leading 0 for octal). slice_to_i64 takes an optional sign.
+int slice_to_u64(slice_t s, int base, uint64_t *pv);
+int slice_to_i64(slice_t s, int base, int64_t *pv);
+
+// Decimal numbers of up to 19 significant digits with small exponents
+// are converted directly. Anything else, including inf, nan and hex
+// floats, goes through strtod and so is limited to 127 bytes and uses
+// the locale's decimal point.
+int slice_to_double(slice_t s, double *pv);
+
+#ifdef __cplusplus
+}
+#endif
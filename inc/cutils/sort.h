@@ -0,0 +1,386 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sorts and searches specialised for an element type. Unlike qsort and
+// bsearch, the comparison is inlined rather than called through a function
+// pointer.
+//
+// DECLARE_SORT(NAME, TYPE, LESS) defines:
+//	void NAME(TYPE *v, size_t n);
+//	void NAME_parallel(TYPE *v, size_t n, int threads);
+//	size_t NAME_lower_bound(const TYPE *v, size_t n, const TYPE *key);
+//	TYPE *NAME_search(TYPE *v, size_t n, const TYPE *key);
+//
+// LESS(a, b) is given two const TYPE* and returns whether a sorts before b.
+// It is usually a macro e.g. #define ID_LESS(a, b) ((a)->id < (b)->id).
+//
+// NAME is a pattern defeating quicksort. It is not stable. NAME_parallel
+// sorts chunks on separate threads and then merges them. It falls back to
+// NAME for small inputs, threads below 2 or if it can't allocate the merge
+// buffer.
+// NAME_lower_bound returns the index of the first element not less than
+// key using a branchless binary search. NAME_search returns the element
+// equal to key or NULL.
+//
+// DECLARE_RADIX_SORT(NAME, TYPE, KEY) defines:
+//	int NAME(TYPE *v, size_t n);
+//	void NAME_buffer(TYPE *v, TYPE *tmp, size_t n);
+//
+// KEY(p) is given a const TYPE* and returns an unsigned integer key. The
+// sort is stable and runs one pass per byte of the key, skipping bytes
+// that are the same in every key. NAME allocates a temporary buffer the
+// size of the input and returns -1 if that fails. NAME_buffer uses the
+// provided buffer instead.
+//
+// To sort a vector use NAME((V)->v, (V)->size).
+
+// size erased functions used by the parallel sort
+struct sort_ops {
+	size_t objsz;
+	void (*sort)(void *v, size_t n);
+	// returns how many elements from a are in the first k elements of
+	// the merged output
+	size_t (*split)(const void *a, size_t na, const void *b, size_t nb, size_t k);
+	void (*merge)(void *out, const void *a, size_t na, const void *b, size_t nb);
+};
+
+void parallel_sort(const struct sort_ops *ops, void *v, size_t n, int threads);
+
+#define SORT_INSERTION_MAX 24
+#define SORT_NINTHER_MIN 128
+#define SORT_PARTIAL_LIMIT 8
+
+#define DECLARE_SORT(NAME, TYPE, LESS) \
+	static inline void NAME##_swap(TYPE *a, TYPE *b) { \
+		TYPE t = *a; \
+		*a = *b; \
+		*b = t; \
+	} \
+	static inline void NAME##_sort2(TYPE *a, TYPE *b) { \
+		if (LESS(b, a)) { \
+			NAME##_swap(a, b); \
+		} \
+	} \
+	static inline void NAME##_sort3(TYPE *a, TYPE *b, TYPE *c) { \
+		NAME##_sort2(a, b); \
+		NAME##_sort2(b, c); \
+		NAME##_sort2(a, b); \
+	} \
+	static void NAME##_insertion(TYPE *begin, TYPE *end) { \
+		for (TYPE *i = begin + 1; i < end; i++) { \
+			if (LESS(i, i - 1)) { \
+				TYPE t = *i; \
+				TYPE *j = i; \
+				do { \
+					*j = *(j - 1); \
+					j--; \
+				} while (j > begin && LESS(&t, j - 1)); \
+				*j = t; \
+			} \
+		} \
+	} \
+	/* the element before begin must not be greater than any in the range */ \
+	static void NAME##_unguarded_insertion(TYPE *begin, TYPE *end) { \
+		for (TYPE *i = begin + 1; i < end; i++) { \
+			if (LESS(i, i - 1)) { \
+				TYPE t = *i; \
+				TYPE *j = i; \
+				do { \
+					*j = *(j - 1); \
+					j--; \
+				} while (LESS(&t, j - 1)); \
+				*j = t; \
+			} \
+		} \
+	} \
+	/* gives up after moving a few elements, returns whether it finished */ \
+	static bool NAME##_partial_insertion(TYPE *begin, TYPE *end) { \
+		size_t moved = 0; \
+		for (TYPE *i = begin + 1; i < end; i++) { \
+			if (LESS(i, i - 1)) { \
+				TYPE t = *i; \
+				TYPE *j = i; \
+				do { \
+					*j = *(j - 1); \
+					j--; \
+				} while (j > begin && LESS(&t, j - 1)); \
+				*j = t; \
+				moved += i - j; \
+				if (moved > SORT_PARTIAL_LIMIT) { \
+					return false; \
+				} \
+			} \
+		} \
+		return true; \
+	} \
+	static void NAME##_sift(TYPE *v, size_t i, size_t n) { \
+		TYPE t = v[i]; \
+		for (;;) { \
+			size_t c = 2 * i + 1; \
+			if (c >= n) { \
+				break; \
+			} \
+			if (c + 1 < n && LESS(&v[c], &v[c + 1])) { \
+				c++; \
+			} \
+			if (!LESS(&t, &v[c])) { \
+				break; \
+			} \
+			v[i] = v[c]; \
+			i = c; \
+		} \
+		v[i] = t; \
+	} \
+	static void NAME##_heapsort(TYPE *v, size_t n) { \
+		for (size_t i = n / 2; i-- > 0;) { \
+			NAME##_sift(v, i, n); \
+		} \
+		for (size_t i = n; i-- > 1;) { \
+			NAME##_swap(&v[0], &v[i]); \
+			NAME##_sift(v, 0, i); \
+		} \
+	} \
+	/* partitions around *begin with elements equal to the pivot on the \
+	 * right, returns the pivot's new position */ \
+	static TYPE *NAME##_partition_right(TYPE *begin, TYPE *end, bool *already_partitioned) { \
+		TYPE pivot = *begin; \
+		TYPE *first = begin; \
+		TYPE *last = end; \
+		while (LESS(++first, &pivot)) { \
+		} \
+		if (first - 1 == begin) { \
+			while (first < last && !LESS(--last, &pivot)) { \
+			} \
+		} else { \
+			while (!LESS(--last, &pivot)) { \
+			} \
+		} \
+		*already_partitioned = first >= last; \
+		while (first < last) { \
+			NAME##_swap(first, last); \
+			while (LESS(++first, &pivot)) { \
+			} \
+			while (!LESS(--last, &pivot)) { \
+			} \
+		} \
+		TYPE *pos = first - 1; \
+		*begin = *pos; \
+		*pos = pivot; \
+		return pos; \
+	} \
+	/* partitions around *begin with elements equal to the pivot on the \
+	 * left, used when there are many equal elements */ \
+	static TYPE *NAME##_partition_left(TYPE *begin, TYPE *end) { \
+		TYPE pivot = *begin; \
+		TYPE *first = begin; \
+		TYPE *last = end; \
+		while (LESS(&pivot, --last)) { \
+		} \
+		if (last + 1 == end) { \
+			while (first < last && !LESS(&pivot, ++first)) { \
+			} \
+		} else { \
+			while (!LESS(&pivot, ++first)) { \
+			} \
+		} \
+		while (first < last) { \
+			NAME##_swap(first, last); \
+			while (LESS(&pivot, --last)) { \
+			} \
+			while (!LESS(&pivot, ++first)) { \
+			} \
+		} \
+		*begin = *last; \
+		*last = pivot; \
+		return last; \
+	} \
+	static void NAME##_loop(TYPE *begin, TYPE *end, int bad_allowed, bool leftmost) { \
+		for (;;) { \
+			size_t size = end - begin; \
+			if (size < SORT_INSERTION_MAX) { \
+				if (leftmost) { \
+					NAME##_insertion(begin, end); \
+				} else { \
+					NAME##_unguarded_insertion(begin, end); \
+				} \
+				return; \
+			} \
+			/* move the median of 3 (or the ninther) to *begin */ \
+			size_t s2 = size / 2; \
+			if (size > SORT_NINTHER_MIN) { \
+				NAME##_sort3(begin, begin + s2, end - 1); \
+				NAME##_sort3(begin + 1, begin + s2 - 1, end - 2); \
+				NAME##_sort3(begin + 2, begin + s2 + 1, end - 3); \
+				NAME##_sort3(begin + s2 - 1, begin + s2, begin + s2 + 1); \
+				NAME##_swap(begin, begin + s2); \
+			} else { \
+				NAME##_sort3(begin + s2, begin, end - 1); \
+			} \
+			/* if the pivot equals the element before the range then the \
+			 * whole left partition is equal and doesn't need sorting */ \
+			if (!leftmost && !LESS(begin - 1, begin)) { \
+				begin = NAME##_partition_left(begin, end) + 1; \
+				continue; \
+			} \
+			bool already_partitioned; \
+			TYPE *pivot = NAME##_partition_right(begin, end, &already_partitioned); \
+			size_t lsize = pivot - begin; \
+			size_t rsize = end - (pivot + 1); \
+			if (lsize < size / 8 || rsize < size / 8) { \
+				/* too many bad pivots, switch to heapsort to bound the \
+				 * worst case, otherwise shuffle to break up patterns */ \
+				if (--bad_allowed == 0) { \
+					NAME##_heapsort(begin, end - begin); \
+					return; \
+				} \
+				if (lsize >= SORT_INSERTION_MAX) { \
+					NAME##_swap(begin, begin + lsize / 4); \
+					NAME##_swap(pivot - 1, pivot - lsize / 4); \
+				} \
+				if (rsize >= SORT_INSERTION_MAX) { \
+					NAME##_swap(pivot + 1, pivot + 1 + rsize / 4); \
+					NAME##_swap(end - 1, end - rsize / 4); \
+				} \
+			} else if (already_partitioned \
+				&& NAME##_partial_insertion(begin, pivot) \
+				&& NAME##_partial_insertion(pivot + 1, end)) { \
+				/* probably already sorted */ \
+				return; \
+			} \
+			NAME##_loop(begin, pivot, bad_allowed, leftmost); \
+			begin = pivot + 1; \
+			leftmost = false; \
+		} \
+	} \
+	static inline void NAME(TYPE *v, size_t n) { \
+		if (n > 1) { \
+			int log2 = 0; \
+			for (size_t i = n; i > 1; i >>= 1) { \
+				log2++; \
+			} \
+			NAME##_loop(v, v + n, log2, true); \
+		} \
+	} \
+	static inline size_t NAME##_lower_bound(const TYPE *v, size_t n, const TYPE *key) { \
+		if (!n) { \
+			return 0; \
+		} \
+		const TYPE *base = v; \
+		while (n > 1) { \
+			size_t half = n / 2; \
+			base = LESS(&base[half], key) ? base + half : base; \
+			n -= half; \
+		} \
+		return (base - v) + LESS(base, key); \
+	} \
+	static inline TYPE *NAME##_search(TYPE *v, size_t n, const TYPE *key) { \
+		size_t i = NAME##_lower_bound(v, n, key); \
+		return (i < n && !LESS(key, &v[i])) ? &v[i] : NULL; \
+	} \
+	static void NAME##_sort_erased(void *v, size_t n) { \
+		NAME((TYPE*) v, n); \
+	} \
+	static size_t NAME##_split(const void *pa, size_t na, const void *pb, size_t nb, size_t k) { \
+		const TYPE *a = (const TYPE*) pa; \
+		const TYPE *b = (const TYPE*) pb; \
+		size_t lo = k > nb ? k - nb : 0; \
+		size_t hi = k < na ? k : na; \
+		while (lo < hi) { \
+			size_t i = lo + (hi - lo) / 2; \
+			/* a[i] is in the first k if it merges before b[k-i-1] */ \
+			if (!LESS(&b[k - i - 1], &a[i])) { \
+				lo = i + 1; \
+			} else { \
+				hi = i; \
+			} \
+		} \
+		return lo; \
+	} \
+	static void NAME##_merge(void *pout, const void *pa, size_t na, const void *pb, size_t nb) { \
+		TYPE *out = (TYPE*) pout; \
+		const TYPE *a = (const TYPE*) pa, *aend = a + na; \
+		const TYPE *b = (const TYPE*) pb, *bend = b + nb; \
+		while (a < aend && b < bend) { \
+			bool bfirst = LESS(b, a); \
+			*out++ = bfirst ? *b : *a; \
+			b += bfirst; \
+			a += !bfirst; \
+		} \
+		memcpy(out, a, (aend - a) * sizeof(TYPE)); \
+		memcpy(out + (aend - a), b, (bend - b) * sizeof(TYPE)); \
+	} \
+	static const struct sort_ops NAME##_ops = { \
+		sizeof(TYPE), &NAME##_sort_erased, &NAME##_split, &NAME##_merge, \
+	}; \
+	static inline void NAME##_parallel(TYPE *v, size_t n, int threads) { \
+		parallel_sort(&NAME##_ops, v, n, threads); \
+	}
+
+#define RADIX_SORT_MIN 64
+
+#define DECLARE_RADIX_SORT(NAME, TYPE, KEY) \
+	static void NAME##_buffer(TYPE *v, TYPE *tmp, size_t n) { \
+		if (n < RADIX_SORT_MIN) { \
+			/* stable insertion sort on the key */ \
+			for (size_t i = 1; i < n; i++) { \
+				TYPE t = v[i]; \
+				size_t j = i; \
+				while (j > 0 && KEY(&t) < KEY(&v[j - 1])) { \
+					v[j] = v[j - 1]; \
+					j--; \
+				} \
+				v[j] = t; \
+			} \
+			return; \
+		} \
+		enum { BYTES = sizeof(KEY(v)) }; \
+		size_t count[BYTES][256]; \
+		memset(count, 0, sizeof(count)); \
+		for (size_t i = 0; i < n; i++) { \
+			uint64_t k = KEY(&v[i]); \
+			for (int b = 0; b < BYTES; b++) { \
+				count[b][(k >> (8 * b)) & 0xFF]++; \
+			} \
+		} \
+		uint64_t first = KEY(&v[0]); \
+		TYPE *src = v, *dst = tmp; \
+		for (int b = 0; b < BYTES; b++) { \
+			size_t *c = count[b]; \
+			if (c[(first >> (8 * b)) & 0xFF] == n) { \
+				continue; \
+			} \
+			size_t off = 0; \
+			for (int d = 0; d < 256; d++) { \
+				size_t num = c[d]; \
+				c[d] = off; \
+				off += num; \
+			} \
+			for (size_t i = 0; i < n; i++) { \
+				uint64_t k = KEY(&src[i]); \
+				dst[c[(k >> (8 * b)) & 0xFF]++] = src[i]; \
+			} \
+			TYPE *t = src; \
+			src = dst; \
+			dst = t; \
+		} \
+		if (src != v) { \
+			memcpy(v, src, n * sizeof(TYPE)); \
+		} \
+	} \
+	static inline int NAME(TYPE *v, size_t n) { \
+		if (n < RADIX_SORT_MIN) { \
+			NAME##_buffer(v, NULL, n); \
+			return 0; \
+		} \
+		TYPE *tmp = (TYPE*) malloc(n * sizeof(TYPE)); \
+		if (!tmp) { \
+			return -1; \
+		} \
+		NAME##_buffer(v, tmp, n); \
+		free(tmp); \
+		return 0; \
+	}
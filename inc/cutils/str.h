@@ -14,16 +14,40 @@ extern "C" {
 // see cutils/char-array.h for string comparison functions
 typedef struct str str_t;
 
+// Strings of up to STR_INLINE characters are stored in buf inside the
+// struct and only longer strings are moved to the heap. A string is inline
+// exactly when cap is STR_INLINE.
+//
+// c_str always points at the current data, so an inline string points into
+// its own struct. This means a str_t is not relocatable: after copying one
+// by value, returning one from a function or moving an array of them with
+// realloc or memcpy, call str_fixup on the new copy before using it. Only
+// one copy may be kept and destroyed, the old one must be dropped. The
+// str_* functions assert that this was done in debug builds.
+#define STR_INLINE 23
+
 struct str {
 	size_t cap;
 	size_t len;
 	char *c_str;
+	char buf[STR_INLINE + 1];
 };
 extern char str_initbuf[];
 
+// points c_str back at buf after an inline string has been moved
+static inline void str_fixup(str_t *s) {
+	if (s->cap == STR_INLINE) {
+		s->c_str = s->buf;
+	}
+}
+
+// catches inline strings that were moved without str_fixup
+#define STR_CHECK(S) assert((S)->cap != STR_INLINE || (S)->c_str == (S)->buf)
+
 
 static inline void str_setlen(str_t *s, size_t len) {
 	assert(0 <= len && len <= s->cap);
+	STR_CHECK(s);
 	s->len = len;
 	s->c_str[len] = '\0';
 }
@@ -32,11 +56,23 @@ static inline void str_setend(str_t *s, const char *end) {
 	str_setlen(s, (size_t)(end - s->c_str));
 }
 static inline void str_clear(str_t *s) {
+	STR_CHECK(s);
 	s->len = 0;
 	s->c_str[0] = 0;
 }
+// Returns the data as a heap allocation that the caller must free and
+// resets the string to empty. Inline and empty strings are copied to the
+// heap. Returns NULL and leaves the string alone if that fails.
 static inline char *str_release(str_t *s) {
+	STR_CHECK(s);
 	char *p = s->c_str;
+	if (!s->cap || s->cap == STR_INLINE) {
+		p = (char*) malloc(s->len + 1);
+		if (!p) {
+			return NULL;
+		}
+		memcpy(p, s->c_str, s->len + 1);
+	}
 	s->cap = 0;
 	s->len = 0;
 	s->c_str = str_initbuf;
@@ -46,9 +82,21 @@ static inline char *str_release(str_t *s) {
 void str_destroy(str_t *s);
 int str_read_file(str_t *s, const char *fn);
 void str_fread_all(str_t *s, FILE *f);
+// grows the capacity to at least cap, growing by at least half each time
+// data is moved so that appends are amortised constant time
 void str_grow(str_t *s, size_t cap);
 void str_add2(str_t *s, const char *a, size_t len);
+
+// Replacements find every match first and then move the data once, in
+// place where possible. Matches don't overlap. Where more than one find
+// string matches at the same position the first in the list is used.
+struct str_replacement {
+	const char *find;
+	const char *replace;
+};
+
 void str_replace_all(str_t *s, const char *find, const char *replacement);
+void str_replace_many(str_t *s, const struct str_replacement *r, size_t num);
 
 
 #ifdef __GNUC__
@@ -78,29 +126,39 @@ static inline void str_set(str_t *s, const char *a) {
 #define str_setstr(P, STR) str_set2(P, (STR).c_str, (STR).len)
 
 static inline void str_addch(str_t *s, char ch) {
+	STR_CHECK(s);
 	if (s->len == s->cap) {
-		str_grow(s, s->cap+1);
+		str_grow(s, s->len + 1);
 	}
 	s->c_str[s->len++] = ch;
 	s->c_str[s->len] = 0;
 }
 
+// swaps the contents, fixing up c_str for inline strings
 static inline void str_swap(str_t *a, str_t *b) {
 	str_t c = *a;
 	*a = *b;
 	*b = c;
+	str_fixup(a);
+	str_fixup(b);
 }
 
 
-#define STR_INIT {0,0,str_initbuf}
+#define STR_INIT {0, 0, str_initbuf, {0}}
 
+// the returned string is empty and doesn't use buf, so it is safe to
+// return by value
 static inline str_t str_init0(void) {
 	str_t ret = STR_INIT;
 	return ret;
 }
+// the returned string is always on the heap as it is returned by value,
+// so it doesn't need str_fixup
 static inline str_t str_init(const char *str) {
 	str_t ret = STR_INIT;
-	str_set(&ret, str);
+	size_t len = strlen(str);
+	str_grow(&ret, len > STR_INLINE ? len : STR_INLINE + 1);
+	str_set2(&ret, str, len);
 	return ret;
 }
 
@@ -24,10 +24,13 @@ struct container {
 };
 
 typedef struct br_hash_class_ br_hash_class;
+struct rope;
 
 stream *open_http_downloader(const char *url, uint64_t *ptotal);
 stream *open_file_stream(FILE *f);
 stream *open_buffer_stream(const void *data, size_t size);
+// the rope must not be changed while the stream is open
+stream *open_rope_stream(const struct rope *r);
 stream *open_limited(stream *source, uint64_t size);
 stream *open_xz_decoder(stream *source);
 stream *open_inflate(stream *source);
@@ -35,6 +38,13 @@ stream *open_deflate(stream *source);
 stream *open_gzip(stream *source);
 stream *open_hash(stream *source, const br_hash_class **vt);
 
+// Transcoding filters. Input is converted as it is read with invalid
+// sequences replaced as in utf.h. Flags:
+#define UTF_STRIP_BOM 1 // drop a byte order mark at the start of the input
+#define UTF_STRICT 2    // fail the read on invalid input rather than replace it
+stream *open_utf16le_to_utf8(stream *source, int flags);
+stream *open_utf8_to_utf16le(stream *source, int flags);
+
 container *open_zip(FILE *f);
 container *open_tar(stream *s);
 
@@ -42,3 +42,10 @@ void print_test_data(str_t *s, const uint8_t *a, size_t sz);
 #define EXPECT_FLOAT_EQ(A, B) (expect_float_eq(0, (A), (B), #A, #B, __FILE__, __LINE__) && BREAK())
 #define EXPECT_NEAR(A, B, DELTA) (expect_near(0, (A), (B), (DELTA), #A, #B, __FILE__, __LINE__) && BREAK())
 #define EXPECT_PTREQ(A, B) (expect_ptr_eq(0, (A), (B), #A, #B, __FILE__, __LINE__) && BREAK())
+
+// Quick generator for test data and benchmark inputs. Returns 48 bits
+// and repeats for the same seed, which is all the tests need.
+static inline uint64_t test_rand(uint64_t *seed) {
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return *seed >> 16;
+}
@@ -8,10 +8,10 @@ static inline void thrd_set_name(const char *name) {
 }
 
 #elif defined WIN32
-#include <os/thread-win32.h>
+#include "cutils/thread-win32.h"
 
 #else
-#include <os/thread-pthread.h>
+#include "cutils/thread-pthread.h"
 #define THREAD_API
 static inline void thrd_set_name(const char *name) {
 	(void) name;
@@ -1,8 +1,20 @@
 #pragma once
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
-// Requires a minimum of (3/2 x size) bytes in dest
+// Invalid input is replaced with U+FFFD. For UTF-8 each maximal part of an
+// invalid sequence is replaced with one U+FFFD as the WHATWG encoding
+// standard does. Overlong encodings, encoded surrogates and values above
+// U+10FFFF are invalid. For UTF-16 each unpaired surrogate is replaced. A
+// trailing odd byte of UTF-16 is ignored.
+//
+// Runs of ASCII are converted 16 or 32 bytes at a time with SSE2, AVX2 or
+// NEON. Validation uses the lookup table algorithm from simdjson (Keiser
+// & Lemire) where a byte shuffle is available (SSSE3, AVX2 or NEON).
+
+// Requires a minimum of (3/2 x size) bytes in dest, or the exact size
+// from UTF16LE_to_UTF8_length
 // size is number of bytes in source
 size_t UTF16LE_to_UTF8(void *dest, const void* src, size_t size);
 
@@ -10,7 +22,8 @@ static inline size_t UTF16LE_to_UTF8_size(size_t size) {
 	return size * 3 / 2;
 }
 
-// Requires a minimum of (2 x size) bytes in dest
+// Requires a minimum of (2 x size) bytes in dest, or the exact size from
+// UTF8_to_UTF16LE_length
 // size is number of bytes in source
 size_t UTF8_to_UTF16LE(void* dest, const void* src, size_t size);
 
@@ -18,3 +31,10 @@ static inline size_t UTF8_to_UTF16LE_size(size_t size) {
 	return size * 2;
 }
 
+// return the number of bytes the conversion functions above will output
+size_t UTF16LE_to_UTF8_length(const void *src, size_t size);
+size_t UTF8_to_UTF16LE_length(const void *src, size_t size);
+
+bool is_valid_UTF8(const void *src, size_t size);
+// false for an odd number of bytes or any unpaired surrogate
+bool is_valid_UTF16LE(const void *src, size_t size);
@@ -31,6 +31,51 @@ struct vector {
 void *grow_vector(allocator_t *a, struct vector *v, size_t objsz, size_t num);
 void *grow_append_vector(allocator_t *a, struct vector *v, size_t objsz, size_t num);
 
+// Small vectors store their first few elements inside the struct and only
+// allocate once they grow past that. They have the same layout as other
+// vectors followed by the inline buffer, so FIRST, LAST, SORT_VECTOR,
+// BSEARCH_VECTOR, APPEND and so on all work on them.
+//
+// The vector macros pass the size of the whole struct so that growing can
+// tell when the data is still in the inline buffer. As the data points into
+// the struct, small vectors must not be copied or moved.
+//
+// A zero initialized small vector works but doesn't use the inline buffer
+// until it is freed with FREE_SMALL_VECTOR.
+//
+// FREE_SMALL_VECTOR gives the memory back to libc. A small vector grown
+// with APPEND_ALLOC(V, A) must be freed with FREE_SMALL_VECTOR_ALLOC(V, A)
+// using the same allocator.
+#define SMALL_VECTOR(TYPE, N) struct { TYPE *v; size_t size, cap; TYPE buf[N]; }
+#define INIT_SMALL_VECTOR(V) ((V)->v = (V)->buf, (V)->size = 0, (V)->cap = sizeof((V)->buf) / sizeof((V)->buf[0]))
+#define FREE_SMALL_VECTOR(V) FREE_SMALL_VECTOR_ALLOC((V), NULL)
+#define FREE_SMALL_VECTOR_ALLOC(V, A) ((V)->v != (V)->buf ? xfree((A), (V)->v) : (void)0, INIT_SMALL_VECTOR(V))
+
+// vecsz is the size of the vector struct including any inline buffer
+void *grow_small_vector(allocator_t *a, struct vector *v, size_t vecsz, size_t objsz, size_t num);
+
+static inline void *append_small_vector(allocator_t *a, struct vector *v, size_t vecsz, size_t objsz, size_t num) {
+	size_t newsz = v->size + num;
+	if (newsz <= v->cap) {
+		char *ret = (char*)v->data + objsz * v->size;
+		v->size = newsz;
+		return ret;
+	}
+	char *ret = (char*)grow_small_vector(a, v, vecsz, objsz, num);
+	if (ret) {
+		v->size += num;
+	}
+	return ret;
+}
+
+static inline void *append_small_vector_zeroed(allocator_t *a, struct vector *v, size_t vecsz, size_t objsz, size_t num) {
+	void *ret = append_small_vector(a, v, vecsz, objsz, num);
+	if (ret) {
+		memset(ret, 0, objsz * num);
+	}
+	return ret;
+}
+
 static inline void *append_vector(allocator_t *a, struct vector *v, size_t objsz, size_t num) {
 	size_t newsz = v->size + num;
 	if (newsz <= v->cap) {
@@ -52,12 +97,12 @@ static inline void *append_vector_zeroed(allocator_t *a, struct vector *v, size_
 
 #define FIRST(V) ((V)->v[0])
 #define LAST(V) ((V)->v[(V)->size - 1])
-#define APPEND2(V,N) append_vector(NULL, (struct vector*) (V), sizeof((V)->v[0]), (N))
+#define APPEND2(V,N) append_small_vector(NULL, (struct vector*) (V), sizeof(*(V)), sizeof((V)->v[0]), (N))
 #define APPEND(V) APPEND2((V), 1)
-#define APPEND2_ZERO(V,N) append_vector_zeroed(NULL, (struct vector*) (V), sizeof((V)->v[0]), (N))
+#define APPEND2_ZERO(V,N) append_small_vector_zeroed(NULL, (struct vector*) (V), sizeof(*(V)), sizeof((V)->v[0]), (N))
 #define APPEND_ZERO(V) APPEND2_ZERO((V), 1)
-#define APPEND_ALLOC(V,A) append_vector((A), (struct vector*)(V), sizeof((V)->v[0]), 1)
-#define GROW_VECTOR(V, N) grow_vector(NULL, (struct vector*) (V), sizeof((V)->v[0]), (N))
+#define APPEND_ALLOC(V,A) append_small_vector((A), (struct vector*)(V), sizeof(*(V)), sizeof((V)->v[0]), 1)
+#define GROW_VECTOR(V, N) grow_small_vector(NULL, (struct vector*) (V), sizeof(*(V)), sizeof((V)->v[0]), (N))
 #define VECTOR_MEMORY(V) ((V)->cap * sizeof((V)->v[0]))
 #define SORT_VECTOR(V,FN) qsort((V)->v, (V)->size, sizeof((V)->v[0]), (FN))
 #define BSEARCH_VECTOR(V,KEY,FN) bsearch(&(KEY),(V)->v,(V)->size, sizeof((V)->v[0]), (FN))
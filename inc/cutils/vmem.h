@@ -0,0 +1,37 @@
+#pragma once
+#include "cutils/vector.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Allocator for a single very large buffer, typically the data of a
+// vector that grows to gigabytes.
+//
+// init_vmem reserves address space for the largest size the buffer will
+// ever reach without using any memory. Growing the buffer commits more of
+// the reservation, so the data never moves and is never copied. Freeing
+// the buffer returns the memory to the OS but keeps the reservation, so
+// the allocator can be reused.
+//
+// Pass &vmem->alloc to APPEND_ALLOC or grow_vector. Only one buffer can be
+// allocated at a time and allocations fail once the reservation is full.
+//
+// VMEM_HUGE_PAGES asks the OS to back the buffer with huge pages where
+// it's supported (transparent huge pages on Linux). This cuts the number
+// of page faults and TLB misses when walking a large buffer.
+
+typedef struct vmem vmem_t;
+
+enum vmem_flags {
+	VMEM_HUGE_PAGES = 1,
+};
+
+struct vmem {
+	allocator_t alloc;
+	uint8_t *base;
+	size_t reserved, committed;
+	bool used;
+	unsigned flags;
+};
+
+int init_vmem(vmem_t *v, size_t reserve, unsigned flags);
+void free_vmem(vmem_t *v);
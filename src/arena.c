@@ -0,0 +1,250 @@
+#include "cutils/arena.h"
+#include "cutils/endian.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include "cutils/thread.h"
+#endif
+
+#define DEFAULT_CHUNK 0x10000 // 64 KB
+#define ALIGN 16
+
+// Each allocation is preceded by its size so that realloc knows how much
+// to copy. The bump pointer is kept at the size header of the next
+// allocation so that the data after it is aligned.
+#define HDR sizeof(size_t)
+
+struct arena_chunk {
+	struct arena_chunk *prev;
+	size_t size;
+};
+
+static uint8_t *chunk_begin(struct arena_chunk *c) {
+	return (uint8_t*) ALIGN_UP((uintptr_t) (c + 1) + HDR, ALIGN) - HDR;
+}
+
+static uint8_t *chunk_end(struct arena_chunk *c) {
+	return (uint8_t*) (c + 1) + c->size;
+}
+
+static int new_chunk(arena_t *a, size_t size) {
+	size_t need = size + HDR + ALIGN;
+	if (need < size) {
+		return -1;
+	}
+
+	struct arena_chunk **pc = &a->spare;
+	while (*pc && (*pc)->size < need) {
+		pc = &(*pc)->prev;
+	}
+	struct arena_chunk *c = *pc;
+	if (c) {
+		*pc = c->prev;
+	} else {
+		size_t csz = need > a->chunksz ? need : a->chunksz;
+		if (csz + sizeof(*c) < csz) {
+			return -1;
+		}
+		c = xmalloc(a->parent, sizeof(*c) + csz);
+		if (!c) {
+			return -1;
+		}
+		c->size = csz;
+	}
+
+	c->prev = a->chunks;
+	a->chunks = c;
+	a->next = chunk_begin(c);
+	a->end = chunk_end(c);
+	a->last = NULL;
+	return 0;
+}
+
+static size_t available(arena_t *a) {
+	size_t avail = a->next ? (size_t) (a->end - a->next) : 0;
+	return avail < HDR ? 0 : avail - HDR;
+}
+
+static void set_next(arena_t *a, uint8_t *p, size_t size) {
+	size_t used = ALIGN_UP(size + HDR, ALIGN) - HDR;
+	a->next = used < (size_t) (a->end - p) ? p + used : a->end;
+	memcpy(p - HDR, &size, HDR);
+}
+
+static void *bump(arena_t *a, size_t size) {
+	// a zero sized request still needs room for the header
+	if ((!a->next || (size_t) (a->end - a->next) < HDR || size > available(a)) && new_chunk(a, size)) {
+		return NULL;
+	}
+	uint8_t *p = a->next + HDR;
+	set_next(a, p, size);
+	a->last = p;
+	return p;
+}
+
+static void *arena_realloc(allocator_t *alloc, void *ptr, size_t size) {
+	arena_t *a = (arena_t*) alloc;
+	uint8_t *p = ptr;
+	if (!p) {
+		return bump(a, size);
+	}
+
+	if (p == a->last && size <= (size_t) (a->end - p)) {
+		set_next(a, p, size);
+		return p;
+	}
+
+	size_t old;
+	memcpy(&old, p - HDR, HDR);
+	if (size <= old) {
+		return p;
+	}
+
+	uint8_t *q = bump(a, size);
+	if (q) {
+		memcpy(q, p, old);
+	}
+	return q;
+}
+
+static void *arena_calloc(allocator_t *alloc, size_t num, size_t size) {
+	if (size && num > SIZE_MAX / size) {
+		return NULL;
+	}
+	void *p = bump((arena_t*) alloc, num * size);
+	if (p) {
+		memset(p, 0, num * size);
+	}
+	return p;
+}
+
+static void arena_free(allocator_t *alloc, void *p) {
+	arena_t *a = (arena_t*) alloc;
+	if (p && p == a->last) {
+		a->next = a->last - HDR;
+		a->last = NULL;
+	}
+}
+
+void init_arena(arena_t *a, allocator_t *parent, size_t chunksz) {
+	memset(a, 0, sizeof(*a));
+	a->alloc.calloc = &arena_calloc;
+	a->alloc.realloc = &arena_realloc;
+	a->alloc.free = &arena_free;
+	a->parent = parent;
+	a->chunksz = chunksz ? chunksz : DEFAULT_CHUNK;
+}
+
+static void free_chunks(allocator_t *parent, struct arena_chunk *c) {
+	while (c) {
+		struct arena_chunk *prev = c->prev;
+		xfree(parent, c);
+		c = prev;
+	}
+}
+
+void free_arena(arena_t *a) {
+	free_chunks(a->parent, a->chunks);
+	free_chunks(a->parent, a->spare);
+	a->chunks = a->spare = NULL;
+	a->next = a->end = a->last = NULL;
+}
+
+struct arena_mark mark_arena(arena_t *a) {
+	struct arena_mark m;
+	m.chunk = a->chunks;
+	m.next = a->next;
+	return m;
+}
+
+void reset_arena_to(arena_t *a, struct arena_mark m) {
+	while (a->chunks != m.chunk) {
+		struct arena_chunk *c = a->chunks;
+		a->chunks = c->prev;
+		c->prev = a->spare;
+		a->spare = c;
+	}
+	a->next = m.next;
+	a->end = m.chunk ? chunk_end(m.chunk) : NULL;
+	a->last = NULL;
+}
+
+void reset_arena(arena_t *a) {
+	struct arena_mark m = {0};
+	reset_arena_to(a, m);
+}
+
+size_t arena_memory(const arena_t *a) {
+	size_t ret = 0;
+	for (struct arena_chunk *c = a->chunks; c != NULL; c = c->prev) {
+		ret += sizeof(*c) + c->size;
+	}
+	for (struct arena_chunk *c = a->spare; c != NULL; c = c->prev) {
+		ret += sizeof(*c) + c->size;
+	}
+	return ret;
+}
+
+static void free_thread_arena(void *p) {
+	if (p) {
+		free_arena(p);
+		free(p);
+	}
+}
+
+static arena_t *new_thread_arena(void) {
+	arena_t *a = malloc(sizeof(arena_t));
+	if (a) {
+		init_arena(a, NULL, 0);
+	}
+	return a;
+}
+
+#ifdef WIN32
+static INIT_ONCE thread_once = INIT_ONCE_STATIC_INIT;
+static DWORD thread_key = FLS_OUT_OF_INDEXES;
+
+static void WINAPI fls_free_arena(void *p) {
+	free_thread_arena(p);
+}
+
+static BOOL CALLBACK create_thread_key(INIT_ONCE *once, void *param, void **ctx) {
+	thread_key = FlsAlloc(&fls_free_arena);
+	return TRUE;
+}
+
+arena_t *thread_arena(void) {
+	InitOnceExecuteOnce(&thread_once, &create_thread_key, NULL, NULL);
+	if (thread_key == FLS_OUT_OF_INDEXES) {
+		return NULL;
+	}
+	arena_t *a = FlsGetValue(thread_key);
+	if (!a && (a = new_thread_arena()) != NULL && !FlsSetValue(thread_key, a)) {
+		free(a);
+		return NULL;
+	}
+	return a;
+}
+#else
+static once_flag thread_once = ONCE_FLAG_INIT;
+static tss_t thread_key;
+static int thread_key_error;
+
+static void create_thread_key(void) {
+	thread_key_error = tss_create(&thread_key, &free_thread_arena) != thrd_success;
+}
+
+arena_t *thread_arena(void) {
+	call_once(&thread_once, &create_thread_key);
+	if (thread_key_error) {
+		return NULL;
+	}
+	arena_t *a = tss_get(thread_key);
+	if (!a && (a = new_thread_arena()) != NULL && tss_set(thread_key, a) != thrd_success) {
+		free(a);
+		return NULL;
+	}
+	return a;
+}
+#endif
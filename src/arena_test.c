@@ -0,0 +1,238 @@
+#include "cutils/arena.h"
+#include "cutils/hash.h"
+#include "cutils/thread.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdint.h>
+
+static int bench_requests = 1000;
+
+struct int_map {
+	hash_t h;
+	uint64_t *keys;
+	int *values;
+};
+
+struct int_vector {
+	int *v;
+	size_t size, cap;
+};
+
+static void test_basic(void) {
+	arena_t a;
+	init_arena(&a, NULL, 1024);
+
+	char *p1 = arena_alloc(&a, 3);
+	char *p2 = arena_alloc(&a, 24);
+	EXPECT_TRUE(p1 != NULL && p2 != NULL);
+	EXPECT_EQ(0, (uintptr_t)p1 & 15);
+	EXPECT_EQ(0, (uintptr_t)p2 & 15);
+	EXPECT_TRUE(p2 >= p1 + 16);
+	memset(p2, 'a', 24);
+
+	// freeing the last allocation gives the space back
+	xfree(&a.alloc, p2);
+	EXPECT_PTREQ(p2, arena_alloc(&a, 8));
+
+	int *z = ARENA_NEW(&a, int);
+	EXPECT_EQ(0, *z);
+
+	// large allocations get their own chunk
+	char *big = arena_alloc(&a, 5000);
+	EXPECT_TRUE(big != NULL);
+	memset(big, 1, 5000);
+	EXPECT_GT(arena_memory(&a), 5000);
+
+	free_arena(&a);
+	EXPECT_EQ(0, arena_memory(&a));
+}
+
+static void test_zero(void) {
+	// zero sized requests are valid on a fresh arena
+	arena_t a;
+	init_arena(&a, NULL, 64);
+	void *p1 = xmalloc(&a.alloc, 0);
+	void *p2 = xmalloc(&a.alloc, 0);
+	EXPECT_TRUE(p1 != NULL && p2 != NULL);
+	EXPECT_TRUE(p1 != p2);
+	char *p3 = arena_alloc(&a, 8);
+	EXPECT_TRUE(p3 != NULL);
+	memset(p3, 1, 8);
+	free_arena(&a);
+}
+
+static void test_realloc(void) {
+	arena_t a;
+	init_arena(&a, NULL, 4096);
+
+	// the last allocation grows in place
+	struct int_vector v = {0};
+	for (int i = 0; i < 256; i++) {
+		*(int*)APPEND_ALLOC(&v, &a.alloc) = i;
+	}
+	int *first = v.v;
+	for (int i = 256; i < 512; i++) {
+		*(int*)APPEND_ALLOC(&v, &a.alloc) = i;
+	}
+	EXPECT_PTREQ(first, v.v);
+
+	// anything else is copied
+	int *other = arena_alloc(&a, 16);
+	for (int i = 512; i < 1024; i++) {
+		*(int*)APPEND_ALLOC(&v, &a.alloc) = i;
+	}
+	EXPECT_TRUE(v.v != first);
+	EXPECT_TRUE(other != NULL);
+	for (int i = 0; i < 1024; i++) {
+		EXPECT_EQ(i, v.v[i]);
+	}
+
+	// shrinking never moves
+	int *p = v.v;
+	EXPECT_PTREQ(p, xrealloc(&a.alloc, p, 8));
+	EXPECT_PTREQ(other, xrealloc(&a.alloc, other, 8));
+
+	free_arena(&a);
+}
+
+static void test_hash(void) {
+	arena_t a;
+	init_arena(&a, NULL, 0);
+
+	for (int round = 0; round < 3; round++) {
+		struct int_map m = {0};
+		m.h.alloc = &a.alloc;
+		bool added;
+		for (int i = 0; i < 5000; i++) {
+			size_t idx = INSERT_HASH(&m, i, &added);
+			m.values[idx] = i * 2;
+		}
+		for (int i = 0; i < 5000; i++) {
+			size_t idx = FIND_HASH(&m, i);
+			EXPECT_GT(m.h.end, idx);
+			EXPECT_EQ(i * 2, m.values[idx]);
+		}
+		size_t mem = arena_memory(&a);
+		reset_arena(&a);
+
+		// once warmed up the chunks are reused
+		EXPECT_EQ(mem, arena_memory(&a));
+	}
+
+	free_arena(&a);
+}
+
+static void test_mark(void) {
+	arena_t a;
+	init_arena(&a, NULL, 256);
+
+	struct arena_mark m0 = mark_arena(&a);
+	char *p = arena_alloc(&a, 10);
+	struct arena_mark m1 = mark_arena(&a);
+	char *q = arena_alloc(&a, 10);
+	for (int i = 0; i < 100; i++) {
+		arena_alloc(&a, 100);
+	}
+	reset_arena_to(&a, m1);
+	EXPECT_PTREQ(q, arena_alloc(&a, 10));
+	size_t mem = arena_memory(&a);
+	reset_arena_to(&a, m0);
+	EXPECT_PTREQ(p, arena_alloc(&a, 10));
+	EXPECT_EQ(mem, arena_memory(&a));
+
+	free_arena(&a);
+}
+
+static int other_thread(void *udata) {
+	arena_t **pa = udata;
+	*pa = thread_arena();
+	return arena_alloc(*pa, 100) == NULL;
+}
+
+static void test_thread(void) {
+	arena_t *a = thread_arena();
+	EXPECT_TRUE(a != NULL);
+	EXPECT_PTREQ(a, thread_arena());
+
+	arena_t *b = NULL;
+	thrd_t thrd;
+	int res = -1;
+	EXPECT_EQ(thrd_success, thrd_create(&thrd, &other_thread, &b));
+	thrd_join(thrd, &res);
+	EXPECT_EQ(0, res);
+	EXPECT_TRUE(b != NULL && b != a);
+}
+
+struct node {
+	struct node *next;
+	char name[24];
+};
+
+// simulates the allocations made while handling a request
+static int handle_request(allocator_t *alloc, bool free_all, int n) {
+	struct node *list = NULL;
+	struct int_vector v = {0};
+	int sum = 0;
+	for (int i = 0; i < n; i++) {
+		struct node *nd = xmalloc(alloc, sizeof(*nd));
+		nd->name[0] = (char)i;
+		nd->next = list;
+		list = nd;
+		*(int*)APPEND_ALLOC(&v, alloc) = i;
+	}
+	while (list) {
+		struct node *next = list->next;
+		sum += list->name[0];
+		if (free_all) {
+			xfree(alloc, list);
+		}
+		list = next;
+	}
+	sum += v.v[n - 1];
+	if (free_all) {
+		xfree(alloc, v.v);
+	}
+	return sum;
+}
+
+static void bench_arena(log_t *log) {
+	arena_t a;
+	init_arena(&a, NULL, 0);
+	int n = 200;
+	int sum = 0;
+
+	struct timer t;
+	start_timer(&t);
+	for (int i = 0; i < bench_requests; i++) {
+		sum += handle_request(NULL, true, n);
+	}
+	double libc = stop_timer(&t);
+
+	start_timer(&t);
+	for (int i = 0; i < bench_requests; i++) {
+		sum -= handle_request(&a.alloc, false, n);
+		reset_arena(&a);
+	}
+	double arena = stop_timer(&t);
+	EXPECT_EQ(0, sum);
+
+	LOG(log, "arena requests|requests:%d|libcNsPerRequest:%.0f|arenaNsPerRequest:%.0f|arenaBytes:%u",
+		bench_requests, libc * 1e9 / bench_requests, arena * 1e9 / bench_requests, (unsigned)arena_memory(&a));
+	free_arena(&a);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_requests, 0, "bench-requests", "N", "number of requests in the benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_basic();
+	test_zero();
+	test_realloc();
+	test_hash();
+	test_mark();
+	test_thread();
+	bench_arena(log);
+
+	return finish_test();
+}
@@ -0,0 +1,305 @@
+#include "cutils/bitset.h"
+#include "cutils/endian.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined __AVX2__
+#include <immintrin.h>
+#define BITSET_AVX2
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BITSET_SSE2
+#elif defined __ARM_NEON && defined __aarch64__
+#include <arm_neon.h>
+#define BITSET_NEON
+#endif
+
+#define BLOCK_BITS 512
+#define BLOCK_WORDS (BLOCK_BITS / 64)
+
+#if defined BITSET_AVX2
+#define VEC_SIZE 32
+typedef __m256i vec_t;
+static inline vec_t vec_load(const uint8_t *p) {return _mm256_loadu_si256((const __m256i*)p);}
+static inline void vec_store(uint8_t *p, vec_t v) {_mm256_storeu_si256((__m256i*)p, v);}
+static inline vec_t vec_and(vec_t a, vec_t b) {return _mm256_and_si256(a, b);}
+static inline vec_t vec_or(vec_t a, vec_t b) {return _mm256_or_si256(a, b);}
+static inline vec_t vec_xor(vec_t a, vec_t b) {return _mm256_xor_si256(a, b);}
+static inline vec_t vec_andnot(vec_t a, vec_t b) {return _mm256_andnot_si256(b, a);}
+static inline int vec_zero(vec_t a) {return _mm256_testz_si256(a, a);}
+#elif defined BITSET_SSE2
+#define VEC_SIZE 16
+typedef __m128i vec_t;
+static inline vec_t vec_load(const uint8_t *p) {return _mm_loadu_si128((const __m128i*)p);}
+static inline void vec_store(uint8_t *p, vec_t v) {_mm_storeu_si128((__m128i*)p, v);}
+static inline vec_t vec_and(vec_t a, vec_t b) {return _mm_and_si128(a, b);}
+static inline vec_t vec_or(vec_t a, vec_t b) {return _mm_or_si128(a, b);}
+static inline vec_t vec_xor(vec_t a, vec_t b) {return _mm_xor_si128(a, b);}
+static inline vec_t vec_andnot(vec_t a, vec_t b) {return _mm_andnot_si128(b, a);}
+static inline int vec_zero(vec_t a) {return _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128())) == 0xFFFF;}
+#elif defined BITSET_NEON
+#define VEC_SIZE 16
+typedef uint8x16_t vec_t;
+static inline vec_t vec_load(const uint8_t *p) {return vld1q_u8(p);}
+static inline void vec_store(uint8_t *p, vec_t v) {vst1q_u8(p, v);}
+static inline vec_t vec_and(vec_t a, vec_t b) {return vandq_u8(a, b);}
+static inline vec_t vec_or(vec_t a, vec_t b) {return vorrq_u8(a, b);}
+static inline vec_t vec_xor(vec_t a, vec_t b) {return veorq_u8(a, b);}
+static inline vec_t vec_andnot(vec_t a, vec_t b) {return vbicq_u8(a, b);}
+static inline int vec_zero(vec_t a) {return vmaxvq_u8(a) == 0;}
+#endif
+
+#define SCALAR_AND(a, b) ((a) & (b))
+#define SCALAR_OR(a, b) ((a) | (b))
+#define SCALAR_XOR(a, b) ((a) ^ (b))
+#define SCALAR_ANDNOT(a, b) ((a) & ~(b))
+
+#ifdef VEC_SIZE
+#define VECTOR_LOOP(FN) \
+	for (; i + VEC_SIZE <= n; i += VEC_SIZE) { \
+		vec_store(d + i, FN(vec_load(d + i), vec_load(s + i))); \
+	}
+#else
+#define VECTOR_LOOP(FN)
+#endif
+
+#define DEFINE_OP(NAME, SCALAR, VECTOR) \
+	static void NAME##_bytes(uint8_t *d, const uint8_t *s, size_t n) { \
+		size_t i = 0; \
+		VECTOR_LOOP(VECTOR) \
+		for (; i + 8 <= n; i += 8) { \
+			uint64_t a, b; \
+			memcpy(&a, d + i, 8); \
+			memcpy(&b, s + i, 8); \
+			a = SCALAR(a, b); \
+			memcpy(d + i, &a, 8); \
+		} \
+		for (; i < n; i++) { \
+			d[i] = (uint8_t) SCALAR(d[i], s[i]); \
+		} \
+	} \
+	void NAME##_bitset(struct bitset *dst, const struct bitset *src, size_t begin, size_t end) { \
+		apply_bitset(dst, src, begin, end, &NAME##_bytes); \
+	}
+
+typedef void (*op_fn)(uint8_t *d, const uint8_t *s, size_t n);
+
+static void apply_edge(struct bitset *dst, const struct bitset *src, size_t i, uint8_t mask, op_fn fn) {
+	uint8_t d = dst->v[i];
+	fn(&d, &src->v[i], 1);
+	dst->v[i] ^= (dst->v[i] ^ d) & mask;
+}
+
+static void apply_bitset(struct bitset *dst, const struct bitset *src, size_t begin, size_t end, op_fn fn) {
+	if (begin >= end) {
+		return;
+	}
+	size_t first = begin >> 3, last = (end - 1) >> 3;
+	uint8_t fmask = (uint8_t) (0xFF << (begin & 7));
+	uint8_t lmask = (uint8_t) (0xFF >> (7 - ((end - 1) & 7)));
+	if (first == last) {
+		apply_edge(dst, src, first, fmask & lmask, fn);
+		return;
+	}
+	// partial bytes at either end, whole bytes in the middle
+	size_t mid = first + (fmask != 0xFF);
+	size_t midend = last + (lmask == 0xFF);
+	if (fmask != 0xFF) {
+		apply_edge(dst, src, first, fmask, fn);
+	}
+	fn(dst->v + mid, src->v + mid, midend - mid);
+	if (lmask != 0xFF) {
+		apply_edge(dst, src, last, lmask, fn);
+	}
+}
+
+DEFINE_OP(and, SCALAR_AND, vec_and)
+DEFINE_OP(or, SCALAR_OR, vec_or)
+DEFINE_OP(xor, SCALAR_XOR, vec_xor)
+DEFINE_OP(andnot, SCALAR_ANDNOT, vec_andnot)
+
+static size_t count_bytes(const uint8_t *p, size_t n) {
+	size_t ret = 0, i = 0;
+#if defined BITSET_AVX2
+	// look up the count of each nibble and sum the bytes into 64 bit lanes
+	const __m256i lut = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0F);
+	__m256i acc = _mm256_setzero_si256();
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = vec_load(p + i);
+		__m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low));
+		__m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+	}
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i*) lanes, acc);
+	ret += (size_t) (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+#elif defined BITSET_NEON
+	for (; i + 16 <= n; i += 16) {
+		ret += vaddvq_u8(vcntq_u8(vld1q_u8(p + i)));
+	}
+#endif
+	for (; i + 8 <= n; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, 8);
+		ret += popcountl(w);
+	}
+	for (; i < n; i++) {
+		ret += popcountl(p[i]);
+	}
+	return ret;
+}
+
+size_t count_bitset(const struct bitset *v, size_t begin, size_t end) {
+	if (begin >= end) {
+		return 0;
+	}
+	size_t first = begin >> 3, last = (end - 1) >> 3;
+	uint8_t fmask = (uint8_t) (0xFF << (begin & 7));
+	uint8_t lmask = (uint8_t) (0xFF >> (7 - ((end - 1) & 7)));
+	if (first == last) {
+		return popcountl(v->v[first] & fmask & lmask);
+	}
+	return popcountl(v->v[first] & fmask)
+		+ count_bytes(v->v + first + 1, last - first - 1)
+		+ popcountl(v->v[last] & lmask);
+}
+
+// loads 64 bits starting at bit w*64, the bytes past the end are zero
+static uint64_t load_word(const struct bitset *v, size_t w) {
+	size_t off = w * 8;
+	if (off + 8 <= v->bytes) {
+		return little_64(v->v + off);
+	}
+	uint64_t ret = 0;
+	for (size_t i = off; i < v->bytes; i++) {
+		ret |= (uint64_t) v->v[i] << (8 * (i - off));
+	}
+	return ret;
+}
+
+// returns the offset of the first group of 8 bytes at or after off that
+// isn't zero, off must be a multiple of 8
+static size_t skip_zeros(const uint8_t *p, size_t off, size_t n) {
+#ifdef VEC_SIZE
+	while (off + VEC_SIZE <= n && vec_zero(vec_load(p + off))) {
+		off += VEC_SIZE;
+	}
+#endif
+	while (off + 8 <= n && little_64(p + off) == 0) {
+		off += 8;
+	}
+	return off;
+}
+
+size_t next_bitset(const struct bitset *v, size_t idx) {
+	size_t bits = bitset_bits(v);
+	if (idx >= bits) {
+		return bits;
+	}
+	size_t w = idx >> 6;
+	uint64_t word = load_word(v, w) & (UINT64_MAX << (idx & 63));
+	while (!word) {
+		w = skip_zeros(v->v, (w + 1) * 8, v->bytes) / 8;
+		if (w * 64 >= bits) {
+			return bits;
+		}
+		word = load_word(v, w);
+	}
+	return w * 64 + ctzl(word);
+}
+
+size_t list_bitset(const struct bitset *v, size_t *pidx, size_t end, size_t *out, size_t max) {
+	size_t num = 0;
+	size_t idx = next_bitset(v, *pidx);
+	while (num < max && idx < end) {
+		// pull all the bits out of the word before looking for the next
+		size_t w = idx >> 6;
+		uint64_t word = load_word(v, w) & (UINT64_MAX << (idx & 63));
+		while (word && num < max) {
+			size_t i = w * 64 + ctzl(word);
+			if (i >= end) {
+				*pidx = end;
+				return num;
+			}
+			out[num++] = i;
+			word &= word - 1;
+		}
+		idx = word ? w * 64 + ctzl(word) : next_bitset(v, (w + 1) * 64);
+	}
+	*pidx = idx < end ? idx : end;
+	return num;
+}
+
+int build_bitset_rank(struct bitset_rank *r, const struct bitset *v) {
+	size_t words = (v->bytes + 7) / 8;
+	size_t num = words / BLOCK_WORDS + 1;
+	uint64_t *blocks = realloc(r->blocks, num * sizeof(uint64_t));
+	if (!blocks) {
+		return -1;
+	}
+	uint64_t total = 0;
+	for (size_t b = 0; b < num; b++) {
+		blocks[b] = total;
+		for (size_t w = b * BLOCK_WORDS; w < (b + 1) * BLOCK_WORDS && w < words; w++) {
+			total += popcountl(load_word(v, w));
+		}
+	}
+	r->blocks = blocks;
+	r->num = num;
+	r->total = (size_t) total;
+	return 0;
+}
+
+void free_bitset_rank(struct bitset_rank *r) {
+	free(r->blocks);
+	r->blocks = NULL;
+	r->num = r->total = 0;
+}
+
+size_t rank_bitset(const struct bitset_rank *r, const struct bitset *v, size_t idx) {
+	size_t bits = bitset_bits(v);
+	if (idx >= bits) {
+		return r->total;
+	}
+	size_t b = idx / BLOCK_BITS;
+	size_t ret = (size_t) r->blocks[b];
+	size_t w = b * BLOCK_WORDS;
+	for (; w < (idx >> 6); w++) {
+		ret += popcountl(load_word(v, w));
+	}
+	if (idx & 63) {
+		ret += popcountl(load_word(v, w) & (UINT64_MAX >> (64 - (idx & 63))));
+	}
+	return ret;
+}
+
+size_t select_bitset(const struct bitset_rank *r, const struct bitset *v, size_t n) {
+	if (n >= r->total) {
+		return bitset_bits(v);
+	}
+	// find the last block starting with no more than n bits before it
+	const uint64_t *base = r->blocks;
+	size_t len = r->num;
+	while (len > 1) {
+		size_t half = len / 2;
+		base = base[half] <= n ? base + half : base;
+		len -= half;
+	}
+	size_t w = (base - r->blocks) * BLOCK_WORDS;
+	n -= (size_t) *base;
+	for (;;) {
+		uint64_t word = load_word(v, w);
+		unsigned cnt = popcountl(word);
+		if (n < cnt) {
+			while (n--) {
+				word &= word - 1;
+			}
+			return w * 64 + ctzl(word);
+		}
+		n -= cnt;
+		w++;
+	}
+}
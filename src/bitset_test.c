@@ -0,0 +1,163 @@
+#include "cutils/bitset.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+static int bench_bits = 1 << 24;
+
+// one bit in every 1 << shift is set on average
+static void fill(struct bitset *b, size_t bits, int shift, uint64_t *seed) {
+	b->bytes = 0;
+	EXPECT_EQ(0, set_bitset_size(NULL, b, bits));
+	for (size_t i = 0; i < bits; i++) {
+		if ((test_rand(seed) & ((1U << shift) - 1)) == 0) {
+			set_bitset(b, i);
+		}
+	}
+}
+
+static void test_ops(void) {
+	uint64_t seed = 1;
+	struct bitset a = {0}, b = {0}, c = {0};
+	for (int round = 0; round < 200; round++) {
+		size_t bits = (test_rand(&seed) % 100) * 8 + 8;
+		fill(&a, bits, 1, &seed);
+		fill(&b, bits, 1, &seed);
+		size_t begin = test_rand(&seed) % bits;
+		size_t end = begin + test_rand(&seed) % (bits - begin + 1);
+
+		for (int op = 0; op < 4; op++) {
+			c.bytes = 0;
+			EXPECT_EQ(0, set_bitset_size(NULL, &c, bits));
+			memcpy(c.v, a.v, a.bytes);
+			switch (op) {
+			case 0:
+				and_bitset(&c, &b, begin, end);
+				break;
+			case 1:
+				or_bitset(&c, &b, begin, end);
+				break;
+			case 2:
+				xor_bitset(&c, &b, begin, end);
+				break;
+			default:
+				andnot_bitset(&c, &b, begin, end);
+				break;
+			}
+			for (size_t i = 0; i < bits; i++) {
+				int x = test_bitset(&a, i), y = test_bitset(&b, i), want = x;
+				if (begin <= i && i < end) {
+					want = op == 0 ? (x & y) : op == 1 ? (x | y) : op == 2 ? (x ^ y) : (x & !y);
+				}
+				EXPECT_EQ(want, test_bitset(&c, i));
+			}
+		}
+
+		size_t count = 0;
+		for (size_t i = begin; i < end; i++) {
+			count += test_bitset(&a, i);
+		}
+		EXPECT_EQ(count, count_bitset(&a, begin, end));
+	}
+	free(a.v);
+	free(b.v);
+	free(c.v);
+}
+
+static void test_scan(void) {
+	uint64_t seed = 2;
+	struct bitset b = {0};
+	struct bitset_rank r = {0};
+	static const int shifts[] = {0, 1, 4, 9};
+	for (int s = 0; s < sizeof(shifts) / sizeof(shifts[0]); s++) {
+		size_t bits = 5000 + s;
+		bits -= bits & 7;
+		fill(&b, bits, shifts[s], &seed);
+		EXPECT_EQ(0, build_bitset_rank(&r, &b));
+
+		size_t out[7], idx = 0, listed = 0, want = 0, n = 0;
+		size_t got = next_bitset(&b, 0);
+		for (size_t i = 0; i < bits; i++) {
+			EXPECT_EQ(n, rank_bitset(&r, &b, i));
+			if (!test_bitset(&b, i)) {
+				continue;
+			}
+			EXPECT_EQ(i, got);
+			EXPECT_EQ(i, select_bitset(&r, &b, n));
+			got = next_bitset(&b, i + 1);
+			if (listed == want) {
+				listed = 0;
+				want = list_bitset(&b, &idx, bits, out, 7);
+			}
+			EXPECT_EQ(i, out[listed++]);
+			n++;
+		}
+		EXPECT_EQ(bits, got);
+		EXPECT_EQ(n, r.total);
+		EXPECT_EQ(n, rank_bitset(&r, &b, bits));
+		EXPECT_EQ(bits, select_bitset(&r, &b, n));
+		EXPECT_EQ(want, listed);
+		EXPECT_EQ(0, list_bitset(&b, &idx, bits, out, 7));
+
+		size_t iter = 0;
+		FOR_BITSET(i, &b) {
+			iter++;
+		}
+		EXPECT_EQ(n, iter);
+	}
+	free_bitset_rank(&r);
+	free(b.v);
+}
+
+// a sparse row filter, combined with a second filter and then scanned
+static void bench_filter(log_t *log) {
+	size_t bits = (size_t) bench_bits;
+	uint64_t seed = 3;
+	struct bitset a = {0}, b = {0};
+	fill(&a, bits, 2, &seed);
+	fill(&b, bits, 3, &seed);
+	struct timer t;
+
+	start_timer(&t);
+	size_t bytewise = 0;
+	for (size_t i = 0; i < bits; i++) {
+		if (test_bitset(&a, i) && test_bitset(&b, i)) {
+			bytewise += i;
+		}
+	}
+	double slow = stop_timer(&t);
+
+	start_timer(&t);
+	and_bitset(&a, &b, 0, bits);
+	size_t bulk = 0, out[256], idx = 0, num;
+	while ((num = list_bitset(&a, &idx, bits, out, 256)) > 0) {
+		for (size_t i = 0; i < num; i++) {
+			bulk += out[i];
+		}
+	}
+	double fast = stop_timer(&t);
+	EXPECT_EQ(bytewise, bulk);
+
+	start_timer(&t);
+	size_t count = count_bitset(&a, 0, bits);
+	double popcount = stop_timer(&t);
+	EXPECT_GT(count, 0);
+
+	LOG(log, "bitset filter|bits:%.0f|bitwiseNsPerBit:%.3f|bulkNsPerBit:%.3f|countNsPerBit:%.4f",
+		(double) bits, slow * 1e9 / bits, fast * 1e9 / bits, popcount * 1e9 / bits);
+	free(a.v);
+	free(b.v);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_bits, 0, "bench-bits", "N", "number of bits in the benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_ops();
+	test_scan();
+	bench_filter(log);
+
+	return finish_test();
+}
@@ -0,0 +1,362 @@
+#include "cutils/btree.h"
+#include "cutils/vector.h"
+#include <string.h>
+
+typedef struct btree_inner btree_inner;
+
+// keys[i] is the smallest key under child[i+1]
+struct btree_inner {
+	unsigned count;
+	uint64_t keys[BT_INNER_MAX];
+	void *child[BT_INNER_MAX + 1];
+};
+
+#define LEAF_MIN (BT_LEAF_MAX / 2)
+#define INNER_MIN (BT_INNER_MAX / 2)
+#define MAX_DEPTH 32
+
+// The key searches are written without branches so that they vectorise.
+// For nodes of this size that beats a binary search.
+static inline unsigned count_less(const uint64_t *keys, unsigned n, uint64_t key) {
+	unsigned r = 0;
+	for (unsigned i = 0; i < n; i++) {
+		r += keys[i] < key;
+	}
+	return r;
+}
+
+static inline unsigned count_less_equal(const uint64_t *keys, unsigned n, uint64_t key) {
+	unsigned r = 0;
+	for (unsigned i = 0; i < n; i++) {
+		r += keys[i] <= key;
+	}
+	return r;
+}
+
+static btree_leaf *find_leaf(const btree *t, uint64_t key) {
+	void *n = t->root;
+	for (unsigned d = 0; d < t->depth; d++) {
+		btree_inner *in = n;
+		n = in->child[count_less_equal(in->keys, in->count, key)];
+	}
+	return n;
+}
+
+void *bt_find(const btree *t, uint64_t key) {
+	btree_leaf *l = find_leaf(t, key);
+	if (l) {
+		unsigned i = count_less(l->keys, l->count, key);
+		if (i < l->count && l->keys[i] == key) {
+			return l->values[i];
+		}
+	}
+	return NULL;
+}
+
+btree_iter bt_lower_bound(const btree *t, uint64_t key) {
+	btree_iter it;
+	it.leaf = find_leaf(t, key);
+	it.idx = it.leaf ? count_less(it.leaf->keys, it.leaf->count, key) : 0;
+	if (it.leaf && it.idx == it.leaf->count) {
+		it.leaf = it.leaf->next;
+		it.idx = 0;
+	}
+	return it;
+}
+
+static void free_node(btree *t, void *n, unsigned depth) {
+	if (depth) {
+		btree_inner *in = n;
+		for (unsigned i = 0; i <= in->count; i++) {
+			free_node(t, in->child[i], depth - 1);
+		}
+	}
+	xfree(t->alloc, n);
+}
+
+void free_btree(btree *t) {
+	if (t->root) {
+		free_node(t, t->root, t->depth);
+	}
+	t->root = NULL;
+	t->first = t->last = NULL;
+	t->size = 0;
+	t->depth = 0;
+}
+
+static void insert_leaf(btree_leaf *l, unsigned i, uint64_t key, void *value) {
+	memmove(l->keys + i + 1, l->keys + i, (l->count - i) * sizeof(l->keys[0]));
+	memmove(l->values + i + 1, l->values + i, (l->count - i) * sizeof(l->values[0]));
+	l->keys[i] = key;
+	l->values[i] = value;
+	l->count++;
+}
+
+static void insert_inner(btree_inner *in, unsigned at, uint64_t key, void *child) {
+	memmove(in->keys + at + 1, in->keys + at, (in->count - at) * sizeof(in->keys[0]));
+	memmove(in->child + at + 2, in->child + at + 1, (in->count - at) * sizeof(in->child[0]));
+	in->keys[at] = key;
+	in->child[at + 1] = child;
+	in->count++;
+}
+
+// Splits a full inner node while adding key and child after child[at].
+// The right half goes in q and the key to add to the parent is returned.
+static uint64_t split_inner(btree_inner *p, btree_inner *q, unsigned at, uint64_t key, void *child, bool append) {
+	uint64_t keys[BT_INNER_MAX + 1];
+	void *children[BT_INNER_MAX + 2];
+	memcpy(keys, p->keys, at * sizeof(keys[0]));
+	keys[at] = key;
+	memcpy(keys + at + 1, p->keys + at, (BT_INNER_MAX - at) * sizeof(keys[0]));
+	memcpy(children, p->child, (at + 1) * sizeof(children[0]));
+	children[at + 1] = child;
+	memcpy(children + at + 2, p->child + at + 1, (BT_INNER_MAX - at) * sizeof(children[0]));
+
+	// appends leave the left node as full as possible
+	unsigned total = BT_INNER_MAX + 1;
+	unsigned mid = append ? total - 2 : total / 2;
+	p->count = mid;
+	memcpy(p->keys, keys, mid * sizeof(keys[0]));
+	memcpy(p->child, children, (mid + 1) * sizeof(children[0]));
+	q->count = total - mid - 1;
+	memcpy(q->keys, keys + mid + 1, q->count * sizeof(keys[0]));
+	memcpy(q->child, children + mid + 1, (q->count + 1) * sizeof(children[0]));
+	return keys[mid];
+}
+
+int bt_insert(btree *t, uint64_t key, void *value) {
+	if (!t->root) {
+		btree_leaf *l = xmalloc(t->alloc, BT_NODE_SIZE);
+		if (!l) {
+			return -1;
+		}
+		l->count = 0;
+		l->prev = l->next = NULL;
+		t->root = t->first = t->last = l;
+	}
+
+	btree_inner *path[MAX_DEPTH];
+	unsigned pidx[MAX_DEPTH];
+	void *n = t->root;
+	for (unsigned d = 0; d < t->depth; d++) {
+		btree_inner *in = n;
+		path[d] = in;
+		pidx[d] = count_less_equal(in->keys, in->count, key);
+		n = in->child[pidx[d]];
+	}
+
+	btree_leaf *l = n;
+	unsigned i = count_less(l->keys, l->count, key);
+	if (i < l->count && l->keys[i] == key) {
+		l->values[i] = value;
+		return 0;
+	} else if (l->count < BT_LEAF_MAX) {
+		insert_leaf(l, i, key, value);
+		t->size++;
+		return 1;
+	}
+
+	// Allocate all of the nodes for the split up front so that we can
+	// fail without leaving the tree half split.
+	void *nodes[MAX_DEPTH + 2];
+	unsigned need = 1, used = 0;
+	unsigned d = t->depth;
+	while (d > 0 && path[d - 1]->count == BT_INNER_MAX) {
+		need++;
+		d--;
+	}
+	if (d == 0) {
+		need++;
+	}
+	if (t->depth + 1 >= MAX_DEPTH) {
+		return -1;
+	}
+	for (unsigned j = 0; j < need; j++) {
+		nodes[j] = xmalloc(t->alloc, BT_NODE_SIZE);
+		if (!nodes[j]) {
+			while (j > 0) {
+				xfree(t->alloc, nodes[--j]);
+			}
+			return -1;
+		}
+	}
+
+	// Split the leaf. Appending to the end of the tree leaves the
+	// current leaf full so that sorted inserts pack the leaves.
+	btree_leaf *r = nodes[used++];
+	bool append = i == l->count && !l->next;
+	unsigned s = append ? l->count : (l->count + 1) / 2;
+	r->count = l->count - s;
+	memcpy(r->keys, l->keys + s, r->count * sizeof(r->keys[0]));
+	memcpy(r->values, l->values + s, r->count * sizeof(r->values[0]));
+	l->count = s;
+	r->prev = l;
+	r->next = l->next;
+	if (l->next) {
+		l->next->prev = r;
+	} else {
+		t->last = r;
+	}
+	l->next = r;
+	if (i >= s && (i > s || append)) {
+		insert_leaf(r, i - s, key, value);
+	} else {
+		insert_leaf(l, i, key, value);
+	}
+	t->size++;
+
+	uint64_t sep = r->keys[0];
+	void *child = r;
+	for (d = t->depth; d > 0; d--) {
+		btree_inner *p = path[d - 1];
+		if (p->count < BT_INNER_MAX) {
+			insert_inner(p, pidx[d - 1], sep, child);
+			return 1;
+		}
+		btree_inner *q = nodes[used++];
+		sep = split_inner(p, q, pidx[d - 1], sep, child, append);
+		child = q;
+	}
+
+	btree_inner *root = nodes[used++];
+	root->count = 1;
+	root->keys[0] = sep;
+	root->child[0] = t->root;
+	root->child[1] = child;
+	t->root = root;
+	t->depth++;
+	return 1;
+}
+
+static void remove_inner(btree_inner *in, unsigned k) {
+	// removes keys[k] and child[k+1]
+	memmove(in->keys + k, in->keys + k + 1, (in->count - k - 1) * sizeof(in->keys[0]));
+	memmove(in->child + k + 1, in->child + k + 2, (in->count - k - 1) * sizeof(in->child[0]));
+	in->count--;
+}
+
+static void merge_leaf(btree *t, btree_leaf *l, btree_leaf *r) {
+	memcpy(l->keys + l->count, r->keys, r->count * sizeof(l->keys[0]));
+	memcpy(l->values + l->count, r->values, r->count * sizeof(l->values[0]));
+	l->count += r->count;
+	l->next = r->next;
+	if (r->next) {
+		r->next->prev = l;
+	} else {
+		t->last = l;
+	}
+	xfree(t->alloc, r);
+}
+
+// Fixes up the underfull leaf p->child[at] by taking an entry from a
+// sibling or merging with it.
+static void rebalance_leaf(btree *t, btree_inner *p, unsigned at) {
+	btree_leaf *l = p->child[at];
+	btree_leaf *left = at > 0 ? p->child[at - 1] : NULL;
+	btree_leaf *right = at < p->count ? p->child[at + 1] : NULL;
+	if (left && left->count > LEAF_MIN) {
+		left->count--;
+		insert_leaf(l, 0, left->keys[left->count], left->values[left->count]);
+		p->keys[at - 1] = l->keys[0];
+	} else if (right && right->count > LEAF_MIN) {
+		l->keys[l->count] = right->keys[0];
+		l->values[l->count] = right->values[0];
+		l->count++;
+		right->count--;
+		memmove(right->keys, right->keys + 1, right->count * sizeof(right->keys[0]));
+		memmove(right->values, right->values + 1, right->count * sizeof(right->values[0]));
+		p->keys[at] = right->keys[0];
+	} else if (left) {
+		merge_leaf(t, left, l);
+		remove_inner(p, at - 1);
+	} else {
+		merge_leaf(t, l, right);
+		remove_inner(p, at);
+	}
+}
+
+static void merge_inner(btree *t, btree_inner *p, unsigned k, btree_inner *l, btree_inner *r) {
+	// merges r = p->child[k+1] into l = p->child[k]
+	l->keys[l->count] = p->keys[k];
+	memcpy(l->keys + l->count + 1, r->keys, r->count * sizeof(l->keys[0]));
+	memcpy(l->child + l->count + 1, r->child, (r->count + 1) * sizeof(l->child[0]));
+	l->count += r->count + 1;
+	remove_inner(p, k);
+	xfree(t->alloc, r);
+}
+
+static void rebalance_inner(btree *t, btree_inner *p, unsigned at) {
+	btree_inner *n = p->child[at];
+	btree_inner *left = at > 0 ? p->child[at - 1] : NULL;
+	btree_inner *right = at < p->count ? p->child[at + 1] : NULL;
+	if (left && left->count > INNER_MIN) {
+		memmove(n->keys + 1, n->keys, n->count * sizeof(n->keys[0]));
+		memmove(n->child + 1, n->child, (n->count + 1) * sizeof(n->child[0]));
+		n->keys[0] = p->keys[at - 1];
+		n->child[0] = left->child[left->count];
+		n->count++;
+		p->keys[at - 1] = left->keys[left->count - 1];
+		left->count--;
+	} else if (right && right->count > INNER_MIN) {
+		n->keys[n->count] = p->keys[at];
+		n->child[n->count + 1] = right->child[0];
+		n->count++;
+		p->keys[at] = right->keys[0];
+		memmove(right->keys, right->keys + 1, (right->count - 1) * sizeof(right->keys[0]));
+		memmove(right->child, right->child + 1, right->count * sizeof(right->child[0]));
+		right->count--;
+	} else if (left) {
+		merge_inner(t, p, at - 1, left, n);
+	} else {
+		merge_inner(t, p, at, n, right);
+	}
+}
+
+void *bt_remove(btree *t, uint64_t key) {
+	if (!t->root) {
+		return NULL;
+	}
+
+	btree_inner *path[MAX_DEPTH];
+	unsigned pidx[MAX_DEPTH];
+	void *n = t->root;
+	for (unsigned d = 0; d < t->depth; d++) {
+		btree_inner *in = n;
+		path[d] = in;
+		pidx[d] = count_less_equal(in->keys, in->count, key);
+		n = in->child[pidx[d]];
+	}
+
+	btree_leaf *l = n;
+	unsigned i = count_less(l->keys, l->count, key);
+	if (i == l->count || l->keys[i] != key) {
+		return NULL;
+	}
+	void *value = l->values[i];
+	l->count--;
+	memmove(l->keys + i, l->keys + i + 1, (l->count - i) * sizeof(l->keys[0]));
+	memmove(l->values + i, l->values + i + 1, (l->count - i) * sizeof(l->values[0]));
+	t->size--;
+
+	// Separator keys in the inner nodes may still hold the removed key.
+	// That's fine as they only need to route lookups.
+	if (t->depth && l->count < LEAF_MIN) {
+		unsigned d = t->depth - 1;
+		rebalance_leaf(t, path[d], pidx[d]);
+		while (d > 0 && path[d]->count < INNER_MIN) {
+			d--;
+			rebalance_inner(t, path[d], pidx[d]);
+		}
+	}
+
+	if (t->depth && !((btree_inner*) t->root)->count) {
+		btree_inner *root = t->root;
+		t->root = root->child[0];
+		t->depth--;
+		xfree(t->alloc, root);
+	} else if (!t->depth && !l->count) {
+		xfree(t->alloc, l);
+		t->root = t->first = t->last = NULL;
+	}
+	return value;
+}
@@ -0,0 +1,427 @@
+#include "cutils/concurrent-hash.h"
+#include "cutils/vector.h"
+#include "cutils/thread.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifndef container_of
+#define container_of(ptr, type, member) ((type*) ((char*) (ptr) - offsetof(type, member)))
+#endif
+
+#define DEFAULT_SHARDS 64
+#define KEY_CHUNK 4096
+#define OPTIMISTIC_READS 4
+
+// same layout as the table types in hash.h
+struct table {
+	hash_t h;
+	uint8_t *keys, *values;
+};
+
+struct chash_shard {
+	// written under the lock, read by anyone
+	volatile unsigned seq;
+	struct table t;
+
+	// only touched under the lock
+	mtx_t lock;
+	allocator_t retire;
+	struct {
+		struct spare **v;
+		size_t size, cap;
+	} spare;
+	struct {
+		void **v;
+		size_t size, cap;
+	} key_chunks;
+	uint8_t *key_next;
+	size_t key_left, key_memory;
+
+	// keep the next shard's sequence counter off our cache line
+	char pad[64];
+};
+
+// Sequence lock. Writers make seq odd for the duration of a write.
+// Readers note seq before reading and check it is unchanged after.
+
+#if defined _MSC_VER
+#if defined _M_ARM64
+#define read_fence() __dmb(_ARM64_BARRIER_ISHLD)
+#define write_fence() __dmb(_ARM64_BARRIER_ISHST)
+#else
+#define read_fence() _ReadWriteBarrier()
+#define write_fence() _ReadWriteBarrier()
+#endif
+
+static unsigned read_seq(struct chash_shard *s) {
+	unsigned seq = s->seq;
+	read_fence();
+	return seq;
+}
+#else
+#define read_fence() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define write_fence() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+static unsigned read_seq(struct chash_shard *s) {
+	return __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+}
+#endif
+
+static bool read_changed(struct chash_shard *s, unsigned seq) {
+	read_fence();
+	return s->seq != seq;
+}
+
+static void write_begin(struct chash_shard *s) {
+	mtx_lock(&s->lock);
+	s->seq++;
+	write_fence();
+}
+
+static void write_end(struct chash_shard *s) {
+	write_fence();
+	s->seq++;
+	mtx_unlock(&s->lock);
+}
+
+// The shard tables use an allocator that never gives memory back while
+// the map is alive, as readers may still be looking at dropped arrays.
+// Instead dropped arrays are kept as spares and handed out again for
+// later arrays of the same or smaller size. A reader looking at a reused
+// array may see garbage, but the array is still at least as long as the
+// header the reader copied and the writer bumps seq while filling it in,
+// so the reader throws away what it read. Rehashes at the same size,
+// which happen to purge tombstones, therefore reuse the arrays from the
+// previous rehash rather than allocating more.
+
+struct spare {
+	size_t size;
+	size_t pad;
+};
+
+static void *retire_realloc(allocator_t *a, void *p, size_t size) {
+	struct chash_shard *s = container_of(a, struct chash_shard, retire);
+	if (p) {
+		// hash.c only ever allocates new arrays
+		return NULL;
+	}
+
+	// best fit from the spares
+	size_t best = SIZE_MAX;
+	for (size_t i = 0; i < s->spare.size; i++) {
+		size_t sz = s->spare.v[i]->size;
+		if (sz >= size && (best == SIZE_MAX || sz < s->spare.v[best]->size)) {
+			best = i;
+		}
+	}
+	if (best != SIZE_MAX) {
+		struct spare *b = s->spare.v[best];
+		s->spare.v[best] = s->spare.v[--s->spare.size];
+		return b + 1;
+	}
+
+	if (size > SIZE_MAX - sizeof(struct spare)) {
+		return NULL;
+	}
+	struct spare *b = malloc(sizeof(struct spare) + size);
+	if (!b) {
+		return NULL;
+	}
+	b->size = size;
+	return b + 1;
+}
+
+static void *retire_calloc(allocator_t *a, size_t num, size_t size) {
+	if (size && num > SIZE_MAX / size) {
+		return NULL;
+	}
+	void *p = retire_realloc(a, NULL, num * size);
+	if (p) {
+		memset(p, 0, num * size);
+	}
+	return p;
+}
+
+static void retire_free(allocator_t *a, void *p) {
+	struct chash_shard *s = container_of(a, struct chash_shard, retire);
+	if (!p) {
+		return;
+	}
+	struct spare **pb = APPEND(&s->spare);
+	if (pb) {
+		*pb = (struct spare*)p - 1;
+	}
+	// else leak it, readers may still be using it
+}
+
+static struct chash_shard *get_shard(chash_t *c, uint64_t hash) {
+	// the shard tables use the low bits for the slot and the top bits
+	// for the control byte tag
+	return &c->shards[(size_t)(hash >> 32) & c->mask];
+}
+
+static uint64_t hash_entry(chash_t *c, uint64_t key, const void *blob) {
+	return blob ? hash_bytes(blob, (size_t)key, c->seed) : hash_u64(key, c->seed);
+}
+
+int init_chash(chash_t *c, size_t keysz, size_t valsz, size_t shards, uint64_t seed) {
+	if (keysz != 4 && keysz != 8 && keysz != sizeof(blob_t)) {
+		return -1;
+	}
+	size_t n = 1;
+	while (n < (shards ? shards : DEFAULT_SHARDS)) {
+		n *= 2;
+	}
+	c->shards = calloc(n, sizeof(struct chash_shard));
+	if (!c->shards) {
+		return -1;
+	}
+	c->mask = n - 1;
+	c->keysz = keysz;
+	c->valsz = valsz;
+	c->seed = seed;
+	for (size_t i = 0; i < n; i++) {
+		struct chash_shard *s = &c->shards[i];
+		if (mtx_init(&s->lock, mtx_plain) != thrd_success) {
+			while (i--) {
+				mtx_destroy(&c->shards[i].lock);
+			}
+			free(c->shards);
+			c->shards = NULL;
+			return -1;
+		}
+		s->retire.calloc = &retire_calloc;
+		s->retire.realloc = &retire_realloc;
+		s->retire.free = &retire_free;
+		s->t.h.alloc = &s->retire;
+		s->t.h.seed = seed;
+		s->t.h.mode = HASH_GROUPED;
+		if (keysz == sizeof(blob_t)) {
+			// rejects most mismatching entries without going to the key
+			s->t.h.mode |= HASH_STORE_HASHES;
+		}
+	}
+	return 0;
+}
+
+void free_chash(chash_t *c) {
+	if (!c->shards) {
+		return;
+	}
+	for (size_t i = 0; i <= c->mask; i++) {
+		struct chash_shard *s = &c->shards[i];
+		free_hash(&s->t.h, c->valsz);
+		for (size_t j = 0; j < s->spare.size; j++) {
+			free(s->spare.v[j]);
+		}
+		for (size_t j = 0; j < s->key_chunks.size; j++) {
+			free(s->key_chunks.v[j]);
+		}
+		free(s->spare.v);
+		free(s->key_chunks.v);
+		mtx_destroy(&s->lock);
+	}
+	free(c->shards);
+	c->shards = NULL;
+}
+
+static bool key_matches(chash_t *c, struct chash_shard *s, unsigned seq, const uint8_t *keys, size_t idx, uint64_t key, const void *blob) {
+	switch (c->keysz) {
+	case 4: {
+		uint32_t k;
+		memcpy(&k, keys + idx * 4, 4);
+		return k == (uint32_t)key;
+	}
+	case 8: {
+		uint64_t k;
+		memcpy(&k, keys + idx * 8, 8);
+		return k == key;
+	}
+	default:
+		break;
+	}
+	blob_t b;
+	memcpy(&b, keys + idx * sizeof(blob_t), sizeof(b));
+	// b may be torn, so check before following the pointer
+	// the data itself is owned by the map and never freed
+	return !read_changed(s, seq) && b.size == key && !memcmp(b.data, blob, b.size);
+}
+
+// returns 1 if found, 0 if not found and -1 if a writer got in the way
+static int read_shard(chash_t *c, struct chash_shard *s, uint64_t hash, uint64_t key, const void *blob, void *pval) {
+	unsigned seq = read_seq(s);
+	if (seq & 1) {
+		return -1;
+	}
+	struct table t;
+	memcpy(&t, &s->t, sizeof(t));
+	if (read_changed(s, seq)) {
+		return -1;
+	}
+	// the header is consistent so all the arrays are at least as long as
+	// t.h.end, even if they have since been retired
+	struct hash_probe p = {0};
+	size_t idx;
+	while ((idx = probe_hash(&t.h, hash, &p)) < t.h.end) {
+		if (key_matches(c, s, seq, t.keys, idx, key, blob)) {
+			if (pval && c->valsz) {
+				memcpy(pval, t.values + idx * c->valsz, c->valsz);
+			}
+			return read_changed(s, seq) ? -1 : 1;
+		}
+	}
+	return read_changed(s, seq) ? -1 : 0;
+}
+
+bool find_chash(chash_t *c, uint64_t key, const void *blob, void *pval) {
+	if (c->keysz == 4) {
+		key = (uint32_t)key;
+	}
+	uint64_t hash = hash_entry(c, key, blob);
+	struct chash_shard *s = get_shard(c, hash);
+	for (int i = 0; i < OPTIMISTIC_READS; i++) {
+		int ret = read_shard(c, s, hash, key, blob, pval);
+		if (ret >= 0) {
+			return ret != 0;
+		}
+	}
+
+	// a writer keeps getting in the way, wait for it
+	mtx_lock(&s->lock);
+	size_t idx = find_hash(&s->t.h, c->keysz, key, blob);
+	bool found = idx < s->t.h.end;
+	if (found && pval && c->valsz) {
+		memcpy(pval, s->t.values + idx * c->valsz, c->valsz);
+	}
+	mtx_unlock(&s->lock);
+	return found;
+}
+
+static const void *copy_key(struct chash_shard *s, const void *blob, size_t size) {
+	if (size > s->key_left) {
+		size_t chunk = size > KEY_CHUNK ? size : KEY_CHUNK;
+		uint8_t *p = malloc(chunk);
+		void **pp = p ? APPEND(&s->key_chunks) : NULL;
+		if (!pp) {
+			free(p);
+			return NULL;
+		}
+		*pp = p;
+		s->key_memory += chunk;
+		s->key_next = p;
+		s->key_left = chunk;
+	}
+	uint8_t *ret = s->key_next;
+	memcpy(ret, blob, size);
+	s->key_next += size;
+	s->key_left -= size;
+	return ret;
+}
+
+int insert_chash(chash_t *c, uint64_t key, const void *blob, const void *pval) {
+	if (c->keysz == 4) {
+		key = (uint32_t)key;
+	}
+	struct chash_shard *s = get_shard(c, hash_entry(c, key, blob));
+	write_begin(s);
+	bool added;
+	size_t idx = insert_hash(&s->t.h, c->keysz, c->valsz, &added, key, blob);
+	int ret = -1;
+	if (idx < s->t.h.end) {
+		ret = added;
+		if (added && blob) {
+			const void *data = copy_key(s, blob, (size_t)key);
+			if (data) {
+				((blob_t*)s->t.keys)[idx].data = data;
+			} else {
+				remove_hash(&s->t.h, idx);
+				ret = -1;
+			}
+		}
+		if (ret >= 0 && c->valsz) {
+			memcpy(s->t.values + idx * c->valsz, pval, c->valsz);
+		}
+	}
+	write_end(s);
+	return ret;
+}
+
+bool remove_chash(chash_t *c, uint64_t key, const void *blob) {
+	if (c->keysz == 4) {
+		key = (uint32_t)key;
+	}
+	struct chash_shard *s = get_shard(c, hash_entry(c, key, blob));
+	write_begin(s);
+	size_t idx = find_hash(&s->t.h, c->keysz, key, blob);
+	bool found = idx < s->t.h.end;
+	if (found) {
+		remove_hash(&s->t.h, idx);
+	}
+	write_end(s);
+	return found;
+}
+
+int next_chash(chash_t *c, struct chash_iter *it, void *pkey, void *pval) {
+	size_t entsz = c->keysz + c->valsz;
+	while (it->next == it->buf.size) {
+		if (it->shard > c->mask) {
+			return 0;
+		}
+		struct chash_shard *s = &c->shards[it->shard++];
+		it->buf.size = 0;
+		it->next = 0;
+
+		// readers don't take the lock, so iterating only needs the lock
+		mtx_lock(&s->lock);
+		uint8_t *p = grow_vector(NULL, (struct vector*)&it->buf, 1, s->t.h.size * entsz);
+		if (!p && s->t.h.size) {
+			mtx_unlock(&s->lock);
+			return 0;
+		}
+		size_t idx = SIZE_MAX;
+		while (next_hash(&s->t.h, &idx)) {
+			memcpy(p, s->t.keys + idx * c->keysz, c->keysz);
+			if (c->valsz) {
+				memcpy(p + c->keysz, s->t.values + idx * c->valsz, c->valsz);
+			}
+			p += entsz;
+		}
+		it->buf.size = s->t.h.size * entsz;
+		mtx_unlock(&s->lock);
+	}
+	const uint8_t *e = it->buf.v + it->next;
+	if (pkey) {
+		memcpy(pkey, e, c->keysz);
+	}
+	if (pval && c->valsz) {
+		memcpy(pval, e + c->keysz, c->valsz);
+	}
+	it->next += entsz;
+	return 1;
+}
+
+void free_chash_iter(struct chash_iter *it) {
+	free(it->buf.v);
+	it->buf.v = NULL;
+	it->buf.size = it->buf.cap = 0;
+}
+
+size_t chash_memory(chash_t *c) {
+	size_t ret = (c->mask + 1) * sizeof(struct chash_shard);
+	for (size_t i = 0; i <= c->mask; i++) {
+		struct chash_shard *s = &c->shards[i];
+		mtx_lock(&s->lock);
+		ret += hash_memory(&s->t.h, c->keysz, c->valsz);
+		for (size_t j = 0; j < s->spare.size; j++) {
+			ret += sizeof(struct spare) + s->spare.v[j]->size;
+		}
+		ret += s->key_chunks.cap * sizeof(void*) + s->spare.cap * sizeof(struct spare*);
+		ret += s->key_memory;
+		mtx_unlock(&s->lock);
+	}
+	return ret;
+}
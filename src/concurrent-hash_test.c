@@ -0,0 +1,276 @@
+#include "cutils/concurrent-hash.h"
+#include "cutils/thread.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int bench_lookups = 100000;
+
+static void test_basic(void) {
+	chash_t c;
+	EXPECT_EQ(0, INIT_CHASH(&c, uint32_t, uint64_t, 4, 0));
+
+	uint64_t v = 0;
+	EXPECT_TRUE(!FIND_CHASH(&c, 3, &v));
+	for (uint32_t i = 0; i < 1000; i++) {
+		v = i * 3;
+		EXPECT_EQ(1, INSERT_CHASH(&c, i, &v));
+	}
+	v = 42;
+	EXPECT_EQ(0, INSERT_CHASH(&c, 7, &v));
+	for (uint32_t i = 0; i < 1000; i++) {
+		EXPECT_TRUE(FIND_CHASH(&c, i, &v));
+		EXPECT_EQ(i == 7 ? 42 : i * 3, v);
+	}
+	EXPECT_TRUE(!FIND_CHASH(&c, 1000, &v));
+
+	for (uint32_t i = 0; i < 1000; i += 2) {
+		EXPECT_TRUE(REMOVE_CHASH(&c, i));
+	}
+	EXPECT_TRUE(!REMOVE_CHASH(&c, 0));
+	EXPECT_TRUE(!FIND_CHASH(&c, 0, &v));
+	EXPECT_TRUE(FIND_CHASH(&c, 1, &v));
+
+	struct chash_iter it = {0};
+	uint32_t key;
+	size_t num = 0;
+	uint64_t sum = 0;
+	while (next_chash(&c, &it, &key, &v)) {
+		EXPECT_EQ(1, key & 1);
+		sum += key;
+		num++;
+	}
+	free_chash_iter(&it);
+	EXPECT_EQ(500, num);
+	EXPECT_EQ(250000, sum);
+
+	free_chash(&c);
+}
+
+static void test_blob(void) {
+	chash_t c;
+	EXPECT_EQ(0, INIT_CHASH(&c, blob_t, int, 0, 1234));
+
+	char buf[32];
+	for (int i = 0; i < 500; i++) {
+		int n = sprintf(buf, "dir/file-%d.txt", i);
+		EXPECT_EQ(1, INSERT_BLOB_CHASH(&c, buf, n, &i));
+	}
+	// the map holds its own copy of the keys
+	memset(buf, 'x', sizeof(buf));
+
+	for (int i = 0; i < 500; i++) {
+		int n = sprintf(buf, "dir/file-%d.txt", i);
+		int v = -1;
+		EXPECT_TRUE(FIND_BLOB_CHASH(&c, buf, n, &v));
+		EXPECT_EQ(i, v);
+	}
+	EXPECT_TRUE(!FIND_BLOB_CHASH(&c, "dir/file-500.txt", 16, NULL));
+	EXPECT_TRUE(REMOVE_BLOB_CHASH(&c, "dir/file-10.txt", 15));
+	EXPECT_TRUE(!FIND_BLOB_CHASH(&c, "dir/file-10.txt", 15, NULL));
+
+	struct chash_iter it = {0};
+	blob_t key;
+	int v;
+	size_t num = 0;
+	while (next_chash(&c, &it, &key, &v)) {
+		int n = sprintf(buf, "dir/file-%d.txt", v);
+		EXPECT_BYTES_EQ(buf, n, key.data, key.size);
+		num++;
+	}
+	free_chash_iter(&it);
+	EXPECT_EQ(499, num);
+
+	free_chash(&c);
+}
+
+#define RACE_KEYS 20000
+
+struct race {
+	chash_t c;
+	volatile int done;
+	int errors;
+};
+
+static uint64_t race_value(uint64_t key, int gen) {
+	return key * 0x9E3779B97F4A7C15 + gen;
+}
+
+static int race_writer(void *udata) {
+	struct race *r = udata;
+	for (uint64_t i = 0; i < RACE_KEYS; i++) {
+		uint64_t v = race_value(i, 0);
+		insert_chash(&r->c, i, NULL, &v);
+		if (i % 3 == 0) {
+			v = race_value(i / 2, 1);
+			insert_chash(&r->c, i / 2, NULL, &v);
+		}
+		if (i % 5 == 0) {
+			remove_chash(&r->c, i / 4, NULL);
+		}
+	}
+	r->done = 1;
+	return 0;
+}
+
+static int race_reader(void *udata) {
+	struct race *r = udata;
+	uint64_t key = 0;
+	while (!r->done) {
+		uint64_t v;
+		uint64_t k = test_rand(&key) % RACE_KEYS;
+		if (find_chash(&r->c, k, NULL, &v)) {
+			if (v != race_value(k, 0) && v != race_value(k, 1)) {
+				r->errors++;
+			}
+		}
+	}
+	return 0;
+}
+
+static void test_racing(void) {
+	static struct race r;
+	EXPECT_EQ(0, init_chash(&r.c, 8, 8, 4, 99));
+
+	thrd_t writer, readers[3];
+	EXPECT_EQ(thrd_success, thrd_create(&writer, &race_writer, &r));
+	for (int i = 0; i < 3; i++) {
+		EXPECT_EQ(thrd_success, thrd_create(&readers[i], &race_reader, &r));
+	}
+
+	// iterate while the writer is still going
+	static uint8_t seen[RACE_KEYS];
+	struct chash_iter it = {0};
+	uint64_t key, v;
+	int dups = 0, bad = 0;
+	while (next_chash(&r.c, &it, &key, &v)) {
+		dups += seen[key]++ != 0;
+		bad += v != race_value(key, 0) && v != race_value(key, 1);
+	}
+	free_chash_iter(&it);
+	EXPECT_EQ(0, dups);
+	EXPECT_EQ(0, bad);
+
+	thrd_join(writer, NULL);
+	for (int i = 0; i < 3; i++) {
+		thrd_join(readers[i], NULL);
+	}
+	EXPECT_EQ(0, r.errors);
+
+	// check the final state against a single threaded replay
+	static int8_t gen[RACE_KEYS];
+	memset(gen, -1, sizeof(gen));
+	for (uint64_t i = 0; i < RACE_KEYS; i++) {
+		gen[i] = 0;
+		if (i % 3 == 0) {
+			gen[i / 2] = 1;
+		}
+		if (i % 5 == 0) {
+			gen[i / 4] = -1;
+		}
+	}
+	for (uint64_t i = 0; i < RACE_KEYS; i++) {
+		bool found = find_chash(&r.c, i, NULL, &v);
+		EXPECT_EQ(gen[i] >= 0, found);
+		if (found && gen[i] >= 0) {
+			EXPECT_EQ(race_value(i, gen[i]), v);
+		}
+	}
+
+	free_chash(&r.c);
+}
+
+static void test_churn(void) {
+	// a constant number of keys with lots of churn rehashes at the same
+	// size to purge tombstones, which shouldn't keep using more memory
+	chash_t c;
+	EXPECT_EQ(0, INIT_CHASH(&c, uint64_t, uint64_t, 4, 0));
+	uint64_t n = 10000, v = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		EXPECT_EQ(1, INSERT_CHASH(&c, i, &v));
+	}
+	// each shard keeps one set of spare arrays to swap with once the
+	// tombstones start to force rehashes
+	size_t start = chash_memory(&c), mem = 0;
+	for (uint64_t r = 0; r < 60; r++) {
+		for (uint64_t i = r * n; i < (r + 1) * n; i++) {
+			EXPECT_TRUE(REMOVE_CHASH(&c, i));
+			EXPECT_EQ(1, INSERT_CHASH(&c, i + n, &v));
+		}
+		size_t m = chash_memory(&c);
+		if (r == 29) {
+			mem = m;
+			EXPECT_GT(2 * start, mem);
+		} else if (r > 29) {
+			EXPECT_EQ(mem, m);
+		}
+	}
+	EXPECT_TRUE(FIND_CHASH(&c, 60 * n, &v));
+	EXPECT_TRUE(!FIND_CHASH(&c, 60 * n - 1, &v));
+	free_chash(&c);
+}
+
+struct bench {
+	chash_t *c;
+	int keys, lookups;
+	uint64_t found;
+};
+
+static int bench_reader(void *udata) {
+	struct bench *b = udata;
+	uint64_t found = 0, v;
+	uint32_t k = 0;
+	for (int i = 0; i < b->lookups; i++) {
+		k = (k + 7919) % b->keys;
+		found += FIND_CHASH(b->c, k, &v);
+	}
+	b->found = found;
+	return 0;
+}
+
+static void bench_readers(log_t *log) {
+	chash_t c;
+	EXPECT_EQ(0, INIT_CHASH(&c, uint32_t, uint64_t, 0, 0));
+	int keys = 1 << 16;
+	for (int i = 0; i < keys; i++) {
+		uint64_t v = i;
+		INSERT_CHASH(&c, i, &v);
+	}
+
+	for (int n = 1; n <= 8; n *= 2) {
+		thrd_t thrd[8];
+		struct bench b[8];
+		struct timer t;
+		start_timer(&t);
+		for (int i = 0; i < n; i++) {
+			b[i].c = &c;
+			b[i].keys = keys;
+			b[i].lookups = bench_lookups;
+			thrd_create(&thrd[i], &bench_reader, &b[i]);
+		}
+		for (int i = 0; i < n; i++) {
+			thrd_join(thrd[i], NULL);
+			EXPECT_EQ(bench_lookups, b[i].found);
+		}
+		double secs = stop_timer(&t);
+		LOG(log, "concurrent lookups|threads:%d|lookupsPerSec:%.0f", n, (double)n * bench_lookups / secs);
+	}
+
+	free_chash(&c);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_lookups, 0, "bench-lookups", "N", "lookups per thread in the benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_basic();
+	test_blob();
+	test_racing();
+	test_churn();
+	bench_readers(log);
+
+	return finish_test();
+}
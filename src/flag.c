@@ -2,7 +2,9 @@
 #include "cutils/str.h"
 #include "cutils/utf.h"
 #include "cutils/path.h"
+#include "cutils/slice.h"
 #include <stdlib.h>
+#include <limits.h>
 #include <stdio.h>
 
 #ifdef WIN32
@@ -192,11 +194,20 @@ static int process_flag(struct flag *f, const char *arg, const char *str_value,
 	case FLAG_BOOL:
 		f->pval->b = bool_value;
 		break;
-	case FLAG_INT:
-		f->pval->i = strtol(str_value, NULL, 0);
+	case FLAG_INT: {
+		int64_t v;
+		if (slice_to_i64(cstr_slice(str_value), 0, &v) || v < INT_MIN || v > INT_MAX) {
+			flag_error(FLAG_EXIT_INVALID_VALUE, "invalid value %s for %s", str_value, arg);
+			return -1;
+		}
+		f->pval->i = (int) v;
 		break;
+	}
 	case FLAG_DOUBLE:
-		f->pval->d = strtod(str_value, NULL);
+		if (slice_to_double(cstr_slice(str_value), &f->pval->d)) {
+			flag_error(FLAG_EXIT_INVALID_VALUE, "invalid value %s for %s", str_value, arg);
+			return -1;
+		}
 		break;
 	case FLAG_STRING:
 		f->pval->s = str_value;
@@ -232,7 +243,7 @@ static char **reparse_command_line(int *pargc, const char **argv) {
 		wchar_t **wargs = CommandLineToArgvW(cmdline, pargc);
 		size_t memsz = (*pargc + 1) * sizeof(char*);
 		for (int i = 0; i < *pargc; i++) {
-			memsz += UTF16LE_to_UTF8_size(2*wcslen(wargs[i])) + 1;
+			memsz += UTF16LE_to_UTF8_length(wargs[i], 2*wcslen(wargs[i])) + 1;
 		}
 		char **cargs = malloc(memsz);
 		char *mem = (char*)&cargs[*pargc + 1];
@@ -55,6 +55,24 @@ int main(int argc, const char *argv[]) {
 	EXPECT_STREQ(str, "foobar");
 	free(argv2);
 
+	// test invalid values
+	flag_int(&i, 0, "int", "N", "int usage");
+	const char *args3[] = { "foo", "--int=3x", NULL };
+	int argc3 = 2;
+	char **argv3 = flag_parse(&argc3, args3, "", 0);
+	EXPECT_EQ(FLAG_EXIT_INVALID_VALUE, g_code);
+	EXPECT_EQ(i, 3);
+	free(argv3);
+	g_code = 0;
+
+	flag_int(&i, 0, "int", "N", "int usage");
+	const char *args4[] = { "foo", "--int=0x10", NULL };
+	int argc4 = 2;
+	char **argv4 = flag_parse(&argc4, args4, "", 0);
+	EXPECT_EQ(0, g_code);
+	EXPECT_EQ(i, 16);
+	free(argv4);
+
 	str_destroy(&g_lastmsg);
 	return finish_test();
 }
@@ -0,0 +1,951 @@
+#include "cutils/format.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+#include <wchar.h>
+
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// writes the digits backwards ending at end and returns the start
+static char *put_u64(char *end, uint64_t v) {
+	while (v >= 100) {
+		end -= 2;
+		memcpy(end, digit_pairs + (v % 100) * 2, 2);
+		v /= 100;
+	}
+	if (v >= 10) {
+		end -= 2;
+		memcpy(end, digit_pairs + v * 2, 2);
+	} else {
+		*(--end) = (char) ('0' + v);
+	}
+	return end;
+}
+
+static char *put_hex(char *end, uint64_t v, const char *hex) {
+	do {
+		*(--end) = hex[v & 15];
+		v >>= 4;
+	} while (v);
+	return end;
+}
+
+size_t fmt_u64(char *buf, uint64_t v) {
+	char tmp[24];
+	char *p = put_u64(tmp + sizeof(tmp), v);
+	size_t n = tmp + sizeof(tmp) - p;
+	memcpy(buf, p, n);
+	return n;
+}
+
+size_t fmt_i64(char *buf, int64_t v) {
+	if (v < 0) {
+		*buf = '-';
+		return 1 + fmt_u64(buf + 1, 0 - (uint64_t) v);
+	}
+	return fmt_u64(buf, (uint64_t) v);
+}
+
+size_t fmt_hex(char *buf, uint64_t v) {
+	char tmp[16];
+	char *p = put_hex(tmp + sizeof(tmp), v, "0123456789abcdef");
+	size_t n = tmp + sizeof(tmp) - p;
+	memcpy(buf, p, n);
+	return n;
+}
+
+// Exact decimal conversion of doubles uses small bignums. The largest
+// value needed is about 2^1130 when scaling up the smallest subnormal.
+
+#define BIG_WORDS 40
+
+struct big {
+	int n;
+	uint32_t w[BIG_WORDS];
+};
+
+static void big_set(struct big *b, uint64_t v) {
+	b->w[0] = (uint32_t) v;
+	b->w[1] = (uint32_t) (v >> 32);
+	b->n = b->w[1] ? 2 : b->w[0] ? 1 : 0;
+}
+
+static void big_mul(struct big *b, uint32_t m) {
+	uint64_t c = 0;
+	for (int i = 0; i < b->n; i++) {
+		c += (uint64_t) b->w[i] * m;
+		b->w[i] = (uint32_t) c;
+		c >>= 32;
+	}
+	if (c) {
+		b->w[b->n++] = (uint32_t) c;
+	}
+}
+
+static void big_pow10(struct big *b, int k) {
+	static const uint32_t pow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+	for (; k >= 9; k -= 9) {
+		big_mul(b, 1000000000);
+	}
+	if (k) {
+		big_mul(b, pow10[k]);
+	}
+}
+
+static void big_shl(struct big *b, int bits) {
+	if (!b->n) {
+		return;
+	}
+	int words = bits / 32;
+	bits %= 32;
+	if (bits) {
+		uint32_t c = 0;
+		for (int i = 0; i < b->n; i++) {
+			uint64_t x = ((uint64_t) b->w[i] << bits) | c;
+			b->w[i] = (uint32_t) x;
+			c = (uint32_t) (x >> 32);
+		}
+		if (c) {
+			b->w[b->n++] = c;
+		}
+	}
+	if (words) {
+		memmove(b->w + words, b->w, b->n * sizeof(uint32_t));
+		memset(b->w, 0, words * sizeof(uint32_t));
+		b->n += words;
+	}
+}
+
+static int big_cmp(const struct big *a, const struct big *b) {
+	if (a->n != b->n) {
+		return a->n < b->n ? -1 : 1;
+	}
+	for (int i = a->n - 1; i >= 0; i--) {
+		if (a->w[i] != b->w[i]) {
+			return a->w[i] < b->w[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+static void big_add(struct big *dst, const struct big *a, const struct big *b) {
+	if (a->n < b->n) {
+		const struct big *t = a;
+		a = b;
+		b = t;
+	}
+	uint64_t c = 0;
+	for (int i = 0; i < a->n; i++) {
+		c += (uint64_t) a->w[i] + (i < b->n ? b->w[i] : 0);
+		dst->w[i] = (uint32_t) c;
+		c >>= 32;
+	}
+	dst->n = a->n;
+	if (c) {
+		dst->w[dst->n++] = (uint32_t) c;
+	}
+}
+
+// a must be at least b
+static void big_sub(struct big *a, const struct big *b) {
+	uint64_t borrow = 0;
+	for (int i = 0; i < a->n; i++) {
+		uint64_t x = (uint64_t) a->w[i] - (i < b->n ? b->w[i] : 0) - borrow;
+		a->w[i] = (uint32_t) x;
+		borrow = (x >> 32) & 1;
+	}
+	while (a->n && !a->w[a->n - 1]) {
+		a->n--;
+	}
+}
+
+// 2a compared to b
+static int big_cmp_half(const struct big *a, const struct big *b) {
+	struct big t;
+	big_add(&t, a, a);
+	return big_cmp(&t, b);
+}
+
+enum dtoa_mode {
+	DTOA_SHORTEST,
+	DTOA_DIGITS,
+	DTOA_DECIMALS,
+};
+
+// a double has at most 767 significant digits
+#define DTOA_MAX 800
+
+static int round_up(char *d, int n, int *pk) {
+	while (n > 0 && d[n - 1] == '9') {
+		n--;
+	}
+	if (!n) {
+		d[0] = '1';
+		(*pk)++;
+		return 1;
+	}
+	d[n - 1]++;
+	return n;
+}
+
+// The digit loop of dtoa for when r, s, mm and mp fit in a native integer.
+// Nothing can overflow as long as 10s does as they are all less than s at
+// the start of each step.
+#define DTOA_LOOP(NAME, T) \
+static int NAME(enum dtoa_mode mode, bool even, int ndigits, T r, T s, T mm, T mp, char *d, int *pk) { \
+	int n = 0; \
+	for (;;) { \
+		r *= 10; \
+		int dig = (int) (r / s); \
+		r -= dig * s; \
+		d[n++] = (char) ('0' + dig); \
+		if (mode == DTOA_SHORTEST) { \
+			mm *= 10; \
+			mp *= 10; \
+			bool low = even ? r <= mm : r < mm; \
+			bool high = even ? r + mp >= s : r + mp > s; \
+			if (high && (!low || 2 * r >= s)) { \
+				return round_up(d, n, pk); \
+			} else if (low || high) { \
+				return n; \
+			} \
+		} else if (!r) { \
+			return n; \
+		} else if (n == ndigits) { \
+			if (2 * r > s || (2 * r == s && (dig & 1))) { \
+				return round_up(d, n, pk); \
+			} \
+			return n; \
+		} \
+	} \
+}
+
+DTOA_LOOP(dtoa_64, uint64_t)
+
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 u128;
+DTOA_LOOP(dtoa_128, u128)
+
+static u128 big_u128(const struct big *b) {
+	u128 v = 0;
+	for (int i = b->n - 1; i >= 0; i--) {
+		v = (v << 32) | b->w[i];
+	}
+	return v;
+}
+#endif
+
+static uint64_t big_u64(const struct big *b) {
+	uint64_t v = 0;
+	for (int i = b->n - 1; i >= 0; i--) {
+		v = (v << 32) | b->w[i];
+	}
+	return v;
+}
+
+// Generates the decimal digits of v > 0 such that v ~= 0.d[0]d[1]... * 10^k
+// and returns the number of digits. Trailing zeros may be left off.
+// DTOA_SHORTEST stops at the shortest digits that read back as v. The other
+// modes generate prec significant digits or prec digits after the decimal
+// point and round half to even.
+static int dtoa(double v, enum dtoa_mode mode, int prec, char *d, int *pk) {
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	int be = (int) ((bits >> 52) & 0x7FF);
+	uint64_t f = bits & ((UINT64_C(1) << 52) - 1);
+	int e = -1074;
+	if (be) {
+		f |= UINT64_C(1) << 52;
+		e = be - 1075;
+	}
+	bool even = (f & 1) == 0;
+	// at powers of two the gap to the next value down is half that up
+	bool unequal = be > 1 && f == (UINT64_C(1) << 52);
+
+	// v = r/s and the values mm below and mp above v still read back as v
+	struct big r, s, mp, mm, t;
+	big_set(&r, f);
+	big_set(&mm, 1);
+	if (e >= 0) {
+		big_shl(&r, e + 1 + unequal);
+		big_set(&s, 2 << unequal);
+		big_shl(&mm, e);
+	} else {
+		big_shl(&r, 1 + unequal);
+		big_set(&s, 1);
+		big_shl(&s, 1 + unequal - e);
+	}
+	mp = mm;
+	if (unequal) {
+		big_shl(&mp, 1);
+	}
+
+	// estimate k from the binary exponent, which may be one too small
+	int log2 = e;
+	for (uint64_t u = f >> 1; u; u >>= 1) {
+		log2++;
+	}
+	double est = log2 * 0.30102999566398114;
+	int k = (int) est;
+	if (k > est) {
+		k--;
+	}
+	k++;
+	if (k >= 0) {
+		big_pow10(&s, k);
+	} else {
+		big_pow10(&r, -k);
+		big_pow10(&mm, -k);
+		big_pow10(&mp, -k);
+	}
+	int c;
+	if (mode == DTOA_SHORTEST) {
+		big_add(&t, &r, &mp);
+		c = big_cmp(&t, &s);
+		c = even ? c >= 0 : c > 0;
+	} else {
+		c = big_cmp(&r, &s) >= 0;
+	}
+	if (c) {
+		big_mul(&s, 10);
+		k++;
+	}
+
+	int ndigits = DTOA_MAX;
+	if (mode == DTOA_DIGITS) {
+		ndigits = prec;
+	} else if (mode == DTOA_DECIMALS) {
+		ndigits = k + prec;
+	}
+	if (ndigits > DTOA_MAX) {
+		ndigits = DTOA_MAX;
+	}
+	*pk = k;
+
+	if (ndigits < 0) {
+		return 0;
+	} else if (ndigits == 0) {
+		// v/10^k is between 0.1 and 1 and rounds to 0 or 10^k
+		if (big_cmp_half(&r, &s) > 0) {
+			d[0] = '1';
+			(*pk)++;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (s.n < 2 || (s.n == 2 && s.w[1] < (1U << 28))) {
+		return dtoa_64(mode, even, ndigits, big_u64(&r), big_u64(&s), big_u64(&mm), big_u64(&mp), d, pk);
+	}
+#ifdef __SIZEOF_INT128__
+	if (s.n <= 3) {
+		return dtoa_128(mode, even, ndigits, big_u128(&r), big_u128(&s), big_u128(&mm), big_u128(&mp), d, pk);
+	}
+#endif
+
+	int n = 0;
+	for (;;) {
+		big_mul(&r, 10);
+		int dig = 0;
+		while (big_cmp(&r, &s) >= 0) {
+			big_sub(&r, &s);
+			dig++;
+		}
+		d[n++] = (char) ('0' + dig);
+
+		if (mode == DTOA_SHORTEST) {
+			big_mul(&mm, 10);
+			big_mul(&mp, 10);
+			c = big_cmp(&r, &mm);
+			bool low = even ? c <= 0 : c < 0;
+			big_add(&t, &r, &mp);
+			c = big_cmp(&t, &s);
+			bool high = even ? c >= 0 : c > 0;
+			if (high && (!low || big_cmp_half(&r, &s) >= 0)) {
+				return round_up(d, n, pk);
+			} else if (low || high) {
+				return n;
+			}
+		} else if (!r.n) {
+			return n;
+		} else if (n == ndigits) {
+			c = big_cmp_half(&r, &s);
+			if (c > 0 || (c == 0 && (dig & 1))) {
+				return round_up(d, n, pk);
+			}
+			return n;
+		}
+	}
+}
+
+// Output goes either to a str_t which grows as needed or to a fixed buffer
+// where len counts everything even past the end of the buffer.
+struct out {
+	str_t *s;
+	char *buf;
+	size_t len, cap;
+};
+
+static void out_add(struct out *o, const char *p, size_t n) {
+	if (o->s) {
+		if (o->len + n > o->s->cap) {
+			str_grow(o->s, o->len + n);
+		}
+		memcpy(o->s->c_str + o->len, p, n);
+		// keep len up to date so that str_grow copies everything so far
+		o->s->len = o->len + n;
+	} else if (o->len < o->cap) {
+		memcpy(o->buf + o->len, p, n < o->cap - o->len ? n : o->cap - o->len);
+	}
+	o->len += n;
+}
+
+static void out_fill(struct out *o, char ch, size_t n) {
+	char tmp[32];
+	memset(tmp, ch, sizeof(tmp));
+	while (n) {
+		size_t k = n < sizeof(tmp) ? n : sizeof(tmp);
+		out_add(o, tmp, k);
+		n -= k;
+	}
+}
+
+// writes digits [from,to) of d padding with zeros before and after the n
+// digits that were generated
+static void out_digits(struct out *o, const char *d, int n, int from, int to) {
+	if (from < 0) {
+		int z = (to < 0 ? to : 0) - from;
+		out_fill(o, '0', z);
+		from += z;
+	}
+	if (from < n && from < to) {
+		int end = n < to ? n : to;
+		out_add(o, d + from, end - from);
+		from = end;
+	}
+	if (from < to) {
+		out_fill(o, '0', to - from);
+	}
+}
+
+#define FLAG_LEFT 1
+#define FLAG_PLUS 2
+#define FLAG_SPACE 4
+#define FLAG_ALT 8
+#define FLAG_ZERO 16
+
+struct spec {
+	int flags;
+	size_t width;
+	int prec;
+	char conv;
+};
+
+static void pad_before(struct out *o, const struct spec *sp, size_t len) {
+	if (!(sp->flags & FLAG_LEFT) && sp->width > len) {
+		out_fill(o, ' ', sp->width - len);
+	}
+}
+
+static void pad_after(struct out *o, const struct spec *sp, size_t len) {
+	if ((sp->flags & FLAG_LEFT) && sp->width > len) {
+		out_fill(o, ' ', sp->width - len);
+	}
+}
+
+static void format_str(struct out *o, const struct spec *sp, const char *p, size_t n) {
+	pad_before(o, sp, n);
+	out_add(o, p, n);
+	pad_after(o, sp, n);
+}
+
+static void format_int(struct out *o, const struct spec *sp, uint64_t u, char sign) {
+	char buf[24];
+	char *end = buf + sizeof(buf);
+	char *p = end;
+	char prefix[2];
+	size_t plen = 0;
+	if (sign) {
+		prefix[plen++] = sign;
+	}
+	if (sp->conv == 'x' || sp->conv == 'X') {
+		if (u) {
+			p = put_hex(end, u, sp->conv == 'x' ? "0123456789abcdef" : "0123456789ABCDEF");
+			if (sp->flags & FLAG_ALT) {
+				prefix[plen++] = '0';
+				prefix[plen++] = sp->conv;
+			}
+		}
+	} else if (sp->conv == 'o') {
+		for (; u; u >>= 3) {
+			*(--p) = (char) ('0' + (u & 7));
+		}
+	} else if (u) {
+		p = put_u64(end, u);
+	}
+
+	size_t ndig = end - p;
+	size_t prec = sp->prec < 0 ? 1 : (size_t) sp->prec;
+	if (sp->conv == 'o' && (sp->flags & FLAG_ALT) && prec <= ndig) {
+		// the alternate form of octal always starts with a 0
+		prec = ndig + 1;
+	}
+	size_t zeros = prec > ndig ? prec - ndig : 0;
+	size_t len = plen + zeros + ndig;
+	if ((sp->flags & (FLAG_ZERO | FLAG_LEFT)) == FLAG_ZERO && sp->prec < 0 && sp->width > len) {
+		zeros += sp->width - len;
+		len = sp->width;
+	}
+
+	pad_before(o, sp, len);
+	out_add(o, prefix, plen);
+	out_fill(o, '0', zeros);
+	out_add(o, p, ndig);
+	pad_after(o, sp, len);
+}
+
+static void format_double(struct out *o, const struct spec *sp, double v) {
+	char sign = signbit(v) ? '-' : (sp->flags & FLAG_PLUS) ? '+' : (sp->flags & FLAG_SPACE) ? ' ' : 0;
+	bool upper = sp->conv == 'F' || sp->conv == 'E' || sp->conv == 'G';
+
+	if (isnan(v) || isinf(v)) {
+		const char *text = isnan(v) ? (upper ? "NAN" : "nan") : (upper ? "INF" : "inf");
+		size_t len = 3 + (sign != 0);
+		pad_before(o, sp, len);
+		out_add(o, &sign, sign != 0);
+		out_add(o, text, 3);
+		pad_after(o, sp, len);
+		return;
+	}
+
+	char d[DTOA_MAX];
+	int n = 0, k = 1;
+	int prec = sp->prec < 0 ? 6 : sp->prec;
+	char conv = sp->conv | 0x20;
+	bool strip = false;
+
+	if (conv == 'g') {
+		if (!prec) {
+			prec = 1;
+		}
+		if (v != 0) {
+			n = dtoa(v, DTOA_DIGITS, prec, d, &k);
+		}
+		// use fixed notation if the exponent is in [-4,prec)
+		int x = k - 1;
+		if (-4 <= x && x < prec) {
+			conv = 'f';
+			prec -= 1 + x;
+		} else {
+			conv = 'e';
+			prec--;
+		}
+		strip = !(sp->flags & FLAG_ALT);
+	} else if (v != 0) {
+		n = dtoa(v, conv == 'e' ? DTOA_DIGITS : DTOA_DECIMALS, conv == 'e' ? prec + 1 : prec, d, &k);
+	}
+
+	// digits before the fraction
+	int first = conv == 'e' ? 1 : (k > 0 ? k : 1);
+	int start = conv == 'e' ? 0 : k - first;
+	if (strip) {
+		for (int i = start + first + prec - 1; prec > 0 && (i < 0 || i >= n || d[i] == '0'); i--) {
+			prec--;
+		}
+	}
+
+	char exp[8];
+	size_t explen = 0;
+	if (conv == 'e') {
+		int x = v != 0 ? k - 1 : 0;
+		char *end = exp + sizeof(exp);
+		char *p = put_u64(end, (uint64_t) (x < 0 ? -x : x));
+		if (end - p < 2) {
+			*(--p) = '0';
+		}
+		*(--p) = x < 0 ? '-' : '+';
+		*(--p) = upper ? 'E' : 'e';
+		explen = end - p;
+		memmove(exp, p, explen);
+	}
+
+	bool point = prec > 0 || (sp->flags & FLAG_ALT);
+	size_t len = (sign != 0) + first + point + prec + explen;
+	size_t zeros = 0;
+	if ((sp->flags & (FLAG_ZERO | FLAG_LEFT)) == FLAG_ZERO && sp->width > len) {
+		zeros = sp->width - len;
+		len = sp->width;
+	}
+
+	pad_before(o, sp, len);
+	out_add(o, &sign, sign != 0);
+	out_fill(o, '0', zeros);
+	out_digits(o, d, n, start, start + first);
+	out_add(o, ".", point);
+	out_digits(o, d, n, start + first, start + first + prec);
+	out_add(o, exp, explen);
+	pad_after(o, sp, len);
+}
+
+// The C library handles anything we don't. lenmod and conv are added to
+// the spec and the remaining arguments are passed through.
+static void format_fallback(struct out *o, const struct spec *sp, const char *lenmod, ...) {
+	char spec[64];
+	char *p = spec;
+	*(p++) = '%';
+	if (sp->flags & FLAG_LEFT) *(p++) = '-';
+	if (sp->flags & FLAG_PLUS) *(p++) = '+';
+	if (sp->flags & FLAG_SPACE) *(p++) = ' ';
+	if (sp->flags & FLAG_ALT) *(p++) = '#';
+	if (sp->flags & FLAG_ZERO) *(p++) = '0';
+	if (sp->width) {
+		p += sprintf(p, "%zu", sp->width);
+	}
+	if (sp->prec >= 0) {
+		p += sprintf(p, ".%d", sp->prec);
+	}
+	p += sprintf(p, "%s%c", lenmod, sp->conv);
+
+	va_list ap, aq;
+	va_start(ap, lenmod);
+	va_copy(aq, ap);
+	char tmp[256];
+	int n = vsnprintf(tmp, sizeof(tmp), spec, ap);
+	if (n < 0) {
+		n = 0;
+	} else if (n < (int) sizeof(tmp)) {
+		out_add(o, tmp, n);
+	} else {
+		char *big = (char*) malloc(n + 1);
+		vsnprintf(big, n + 1, spec, aq);
+		out_add(o, big, n);
+		free(big);
+	}
+	va_end(aq);
+	va_end(ap);
+}
+
+static int do_format(struct out *o, const char *fmt, va_list ap) {
+	size_t start = o->len;
+	for (;;) {
+		const char *pct = strchr(fmt, '%');
+		if (!pct) {
+			out_add(o, fmt, strlen(fmt));
+			break;
+		}
+		out_add(o, fmt, pct - fmt);
+		const char *p = pct + 1;
+
+		struct spec sp = {0, 0, -1, 0};
+		for (;; p++) {
+			if (*p == '-') {
+				sp.flags |= FLAG_LEFT;
+			} else if (*p == '+') {
+				sp.flags |= FLAG_PLUS;
+			} else if (*p == ' ') {
+				sp.flags |= FLAG_SPACE;
+			} else if (*p == '#') {
+				sp.flags |= FLAG_ALT;
+			} else if (*p == '0') {
+				sp.flags |= FLAG_ZERO;
+			} else if (*p != '\'') {
+				break;
+			}
+		}
+
+		if (*p == '*') {
+			int w = va_arg(ap, int);
+			if (w < 0) {
+				sp.flags |= FLAG_LEFT;
+				w = -w;
+			}
+			sp.width = (size_t) w;
+			p++;
+		} else {
+			for (; '0' <= *p && *p <= '9'; p++) {
+				sp.width = sp.width * 10 + (*p - '0');
+			}
+		}
+
+		if (*p == '.') {
+			p++;
+			if (*p == '*') {
+				sp.prec = va_arg(ap, int);
+				if (sp.prec < 0) {
+					sp.prec = -1;
+				}
+				p++;
+			} else {
+				sp.prec = 0;
+				for (; '0' <= *p && *p <= '9'; p++) {
+					sp.prec = sp.prec * 10 + (*p - '0');
+				}
+			}
+		}
+
+		// length modifiers, including the MSVC I, I32 and I64 forms
+		const char *lenmod = p;
+		char len = 0;
+		switch (*p) {
+		case 'h':
+			len = (p[1] == 'h') ? 'H' : 'h';
+			p += (p[1] == 'h') ? 2 : 1;
+			break;
+		case 'l':
+			len = (p[1] == 'l') ? 'q' : 'l';
+			p += (p[1] == 'l') ? 2 : 1;
+			break;
+		case 'q':
+		case 'L':
+		case 'j':
+		case 'z':
+		case 't':
+			len = *(p++);
+			break;
+		case 'I':
+			if (p[1] == '6' && p[2] == '4') {
+				len = 'q';
+				p += 3;
+			} else if (p[1] == '3' && p[2] == '2') {
+				p += 3;
+			} else {
+				len = 'z';
+				p++;
+			}
+			break;
+		}
+		char lenbuf[4] = {0};
+		memcpy(lenbuf, lenmod, p - lenmod);
+
+		sp.conv = *(p++);
+		switch (sp.conv) {
+		case 'd':
+		case 'i': {
+			int64_t v;
+			switch (len) {
+			case 'H': v = (signed char) va_arg(ap, int); break;
+			case 'h': v = (short) va_arg(ap, int); break;
+			case 'l': v = va_arg(ap, long); break;
+			case 'q':
+			case 'L': v = va_arg(ap, long long); break;
+			case 'j': v = va_arg(ap, intmax_t); break;
+			case 'z':
+			case 't': v = va_arg(ap, ptrdiff_t); break;
+			default: v = va_arg(ap, int); break;
+			}
+			char sign = v < 0 ? '-' : (sp.flags & FLAG_PLUS) ? '+' : (sp.flags & FLAG_SPACE) ? ' ' : 0;
+			format_int(o, &sp, v < 0 ? 0 - (uint64_t) v : (uint64_t) v, sign);
+			break;
+		}
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X': {
+			uint64_t v;
+			switch (len) {
+			case 'H': v = (unsigned char) va_arg(ap, unsigned); break;
+			case 'h': v = (unsigned short) va_arg(ap, unsigned); break;
+			case 'l': v = va_arg(ap, unsigned long); break;
+			case 'q':
+			case 'L': v = va_arg(ap, unsigned long long); break;
+			case 'j': v = va_arg(ap, uintmax_t); break;
+			case 'z': v = va_arg(ap, size_t); break;
+			case 't': v = (size_t) va_arg(ap, ptrdiff_t); break;
+			default: v = va_arg(ap, unsigned); break;
+			}
+			format_int(o, &sp, v, 0);
+			break;
+		}
+		case 'p': {
+			void *v = va_arg(ap, void*);
+			if (v) {
+				sp.conv = 'x';
+				sp.flags |= FLAG_ALT;
+				format_int(o, &sp, (uintptr_t) v, (sp.flags & FLAG_PLUS) ? '+' : (sp.flags & FLAG_SPACE) ? ' ' : 0);
+			} else {
+				format_str(o, &sp, "(nil)", 5);
+			}
+			break;
+		}
+		case 'c':
+			if (len == 'l') {
+				format_fallback(o, &sp, lenbuf, va_arg(ap, wint_t));
+			} else {
+				char ch = (char) va_arg(ap, int);
+				format_str(o, &sp, &ch, 1);
+			}
+			break;
+		case 's':
+			if (len == 'l') {
+				format_fallback(o, &sp, lenbuf, va_arg(ap, const wchar_t*));
+			} else {
+				const char *s = va_arg(ap, const char*);
+				if (!s) {
+					s = sp.prec < 0 || sp.prec >= 6 ? "(null)" : "";
+				}
+				size_t n;
+				if (sp.prec < 0) {
+					n = strlen(s);
+				} else {
+					const char *e = (const char*) memchr(s, 0, (size_t) sp.prec);
+					n = e ? (size_t) (e - s) : (size_t) sp.prec;
+				}
+				format_str(o, &sp, s, n);
+			}
+			break;
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+			if (len == 'L') {
+				format_fallback(o, &sp, lenbuf, va_arg(ap, long double));
+			} else {
+				format_double(o, &sp, va_arg(ap, double));
+			}
+			break;
+		case 'a':
+		case 'A':
+			if (len == 'L') {
+				format_fallback(o, &sp, lenbuf, va_arg(ap, long double));
+			} else {
+				format_fallback(o, &sp, lenbuf, va_arg(ap, double));
+			}
+			break;
+		case 'n': {
+			void *v = va_arg(ap, void*);
+			size_t n = o->len - start;
+			switch (len) {
+			case 'H': *(signed char*) v = (signed char) n; break;
+			case 'h': *(short*) v = (short) n; break;
+			case 'l': *(long*) v = (long) n; break;
+			case 'q':
+			case 'L': *(long long*) v = (long long) n; break;
+			case 'j': *(intmax_t*) v = (intmax_t) n; break;
+			case 'z':
+			case 't': *(ptrdiff_t*) v = (ptrdiff_t) n; break;
+			default: *(int*) v = (int) n; break;
+			}
+			break;
+		}
+		case '%':
+			out_add(o, "%", 1);
+			break;
+		default:
+			return -1;
+		}
+		fmt = p;
+	}
+	return (int) (o->len - start);
+}
+
+int fmt_vsnprintf(char *buf, size_t sz, const char *fmt, va_list ap) {
+	struct out o = {NULL, buf, 0, sz ? sz - 1 : 0};
+	int ret = do_format(&o, fmt, ap);
+	if (sz) {
+		buf[o.len < o.cap ? o.len : o.cap] = 0;
+	}
+	return ret;
+}
+
+int fmt_snprintf(char *buf, size_t sz, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	int ret = fmt_vsnprintf(buf, sz, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+int str_vaddf(str_t *s, const char *fmt, va_list ap) {
+	size_t len = s->len;
+	struct out o = {s, NULL, len, 0};
+	int ret = do_format(&o, fmt, ap);
+	str_setlen(s, ret < 0 ? len : o.len);
+	return ret;
+}
+
+void str_add_fixed(str_t *s, double v, int prec) {
+	struct spec sp = {0, 0, prec, 'f'};
+	struct out o = {s, NULL, s->len, 0};
+	format_double(&o, &sp, v);
+	str_setlen(s, o.len);
+}
+
+size_t fmt_double(char *buf, double v) {
+	char *p = buf;
+	if (signbit(v)) {
+		*(p++) = '-';
+		v = -v;
+	}
+	if (isnan(v) || isinf(v)) {
+		memcpy(p, isnan(v) ? "nan" : "inf", 3);
+		return p + 3 - buf;
+	} else if (v == 0) {
+		*(p++) = '0';
+		return p - buf;
+	}
+
+	char d[DTOA_MAX];
+	int k, n;
+	if (v < 9007199254740992.0 && v == (double) (uint64_t) v) {
+		// every integer below 2^53 is exact, so only trailing zeros can go
+		n = k = (int) fmt_u64(d, (uint64_t) v);
+		while (d[n - 1] == '0') {
+			n--;
+		}
+	} else {
+		n = dtoa(v, DTOA_SHORTEST, 0, d, &k);
+	}
+
+	if (k < -3 || k > 17) {
+		// d.ddde+xx
+		*(p++) = d[0];
+		if (n > 1) {
+			*(p++) = '.';
+			memcpy(p, d + 1, n - 1);
+			p += n - 1;
+		}
+		int x = k - 1;
+		*(p++) = 'e';
+		*(p++) = x < 0 ? '-' : '+';
+		if (x < 0) {
+			x = -x;
+		}
+		if (x < 10) {
+			*(p++) = '0';
+		}
+		p += fmt_u64(p, (uint64_t) x);
+	} else if (k <= 0) {
+		// 0.000ddd
+		*(p++) = '0';
+		*(p++) = '.';
+		memset(p, '0', -k);
+		p += -k;
+		memcpy(p, d, n);
+		p += n;
+	} else if (k >= n) {
+		// ddd000
+		memcpy(p, d, n);
+		memset(p + n, '0', k - n);
+		p += k;
+	} else {
+		// ddd.ddd
+		memcpy(p, d, k);
+		p += k;
+		*(p++) = '.';
+		memcpy(p, d + k, n - k);
+		p += n - k;
+	}
+	return p - buf;
+}
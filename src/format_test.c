@@ -0,0 +1,298 @@
+#include "cutils/format.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <wchar.h>
+
+static int bench_lines = 20000;
+
+// doubles spread over every exponent
+static double rand_double(uint64_t *seed) {
+	for (;;) {
+		uint64_t u = (test_rand(seed) << 32) ^ test_rand(seed);
+		double v;
+		memcpy(&v, &u, sizeof(v));
+		if (!isnan(v) && !isinf(v)) {
+			return v;
+		}
+	}
+}
+
+// checks that the C library and both of our entry points agree
+static void check(const char *fmt, ...) {
+	char want[2048], got[2048], small[8];
+	va_list ap;
+	va_start(ap, fmt);
+	va_list aq, ar;
+	va_copy(aq, ap);
+	va_copy(ar, ap);
+	int wantn = vsnprintf(want, sizeof(want), fmt, ap);
+	int gotn = fmt_vsnprintf(got, sizeof(got), fmt, aq);
+	int smalln = fmt_vsnprintf(small, sizeof(small), fmt, ar);
+	va_end(ar);
+	va_end(aq);
+	va_end(ap);
+	EXPECT_STREQ(want, got);
+	EXPECT_EQ(wantn, gotn);
+	EXPECT_EQ(wantn, smalln);
+	EXPECT_EQ(0, strncmp(want, small, sizeof(small) - 1));
+	EXPECT_EQ(strlen(small), wantn < (int) sizeof(small) ? wantn : (int) sizeof(small) - 1);
+
+	str_t s = STR_INIT;
+	str_add(&s, "x");
+	va_start(ap, fmt);
+	EXPECT_EQ(wantn, str_vaddf(&s, fmt, ap));
+	va_end(ap);
+	EXPECT_STREQ(want, s.c_str + 1);
+	str_destroy(&s);
+}
+
+static void test_int(void) {
+	static const char *fmts[] = {
+		"%d", "%5d", "%-5d|", "%05d", "%+d", "% d", "%.3d", "%8.3d", "%-+8.3d|", "%.0d", "%08.3d",
+		"%u", "%x", "%#x", "%#08X", "%o", "%#o", "%#.0o", "%.0x", "%#5.3x", "%+5u", "%i",
+	};
+	static const int vals[] = {0, 1, -1, 7, 255, 4096, -12345, INT_MAX, INT_MIN};
+	for (int i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++) {
+		for (int j = 0; j < sizeof(vals) / sizeof(vals[0]); j++) {
+			check(fmts[i], vals[j]);
+		}
+	}
+	check("%hhd %hhu %hd %hu", 300, 300, 70000, 70000);
+	check("%ld %lu %lx", LONG_MIN, ULONG_MAX, ULONG_MAX);
+	check("%lld %llu %llo", LLONG_MIN, ULLONG_MAX, ULLONG_MAX);
+	check("%" PRId64 " %" PRIu64 " %" PRIx64, INT64_MIN, UINT64_MAX, UINT64_MAX);
+	check("%zu %zx %jd %td", (size_t) 12345, SIZE_MAX, INTMAX_MIN, (ptrdiff_t) -5);
+	check("%*d|%-*d|%*d|%.*d", 6, 42, 6, 42, -6, 42, 4, 42);
+	check("%c|%5c|%-5c|%%|%5%", 'a', 'b', 'c');
+	check("%s|%.2s|%8s|%-8s|%.*s|%.0s", "hello", "hello", "hi", "hi", 3, "hello", "hi");
+	check("%s|%.3s|%10s", NULL, NULL, NULL);
+	check("%p|%20p|%-20p|%p", (void*) 0x1234, (void*) &fmts, (void*) &fmts, NULL);
+	check("no conversions");
+	check("");
+	check("%a %.3A %ls %lc", 1.5, 1.0 / 3, L"wide", (wint_t) 'w');
+	check("%Lf %.3Le", (long double) 1.25, (long double) 3.5);
+
+	int n = 0;
+	long long ln = 0;
+	char buf[32];
+	EXPECT_EQ(6, fmt_snprintf(buf, sizeof(buf), "abc%ndef%lln", &n, &ln));
+	EXPECT_EQ(3, n);
+	EXPECT_EQ(6, ln);
+	const char *bad = "%y";
+	EXPECT_EQ(-1, fmt_snprintf(buf, sizeof(buf), bad, 0));
+	EXPECT_EQ(3, fmt_snprintf(NULL, 0, "%d", 123));
+}
+
+static void test_float(void) {
+	static const char *fmts[] = {
+		"%f", "%.0f", "%.1f", "%.3f", "%.17f", "%.40f", "%#.0f", "%+012.3f", "%-12.3f|", "%F",
+		"%e", "%.0e", "%.3E", "%.20e", "%#.0e", "%-14.2e|", "% e",
+		"%g", "%.0g", "%.1g", "%.3g", "%.17g", "%#.3g", "%#.10g", "%G", "%010g", "% .12g",
+	};
+	static const double vals[] = {
+		0, 1, 0.5, 1.5, 2.5, 0.125, 0.375, 9.5, 99.5, 999999.5, 0.1, 0.2, 0.3, 1.0 / 3,
+		123456.789, 1e-5, 9.9999e-5, 1e15, 1e16, 1e21, 1e22, 1e23, 5e-324, DBL_MIN,
+		DBL_MAX, 4.35, 0.045, 2.675, 1e100, 123e-300,
+	};
+	for (int i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++) {
+		for (int j = 0; j < sizeof(vals) / sizeof(vals[0]); j++) {
+			check(fmts[i], vals[j]);
+			check(fmts[i], -vals[j]);
+		}
+		check(fmts[i], INFINITY);
+		check(fmts[i], -INFINITY);
+		check(fmts[i], NAN);
+	}
+
+	uint64_t seed = 1;
+	for (int i = 0; i < 1000; i++) {
+		double v = rand_double(&seed);
+		int prec = (int) (test_rand(&seed) % 20);
+		check("%.*f|%.*e|%.*g|%a", prec, v, prec, v, prec, v, v);
+		// the same values in the range where people usually print them
+		double w = ldexp(v, -ilogb(v) + (int) (test_rand(&seed) % 60) - 30);
+		check("%f|%.2f|%.*f|%e|%g|%.15g", w, w, prec, w, w, w, w);
+	}
+}
+
+static void test_shortest(void) {
+	char buf[FMT_BUFSZ + 1];
+	static const struct {
+		double v;
+		const char *want;
+	} tests[] = {
+		{0, "0"},
+		{-0.0, "-0"},
+		{1, "1"},
+		{-1.5, "-1.5"},
+		{0.1, "0.1"},
+		{0.3, "0.3"},
+		{0.1 + 0.2, "0.30000000000000004"},
+		{100, "100"},
+		{123456.789, "123456.789"},
+		{1e16, "10000000000000000"},
+		{1e17, "1e+17"},
+		{1.5e17, "1.5e+17"},
+		{0.0001, "0.0001"},
+		{0.00001, "1e-05"},
+		{5e-324, "5e-324"},
+		{DBL_MAX, "1.7976931348623157e+308"},
+		{DBL_MIN, "2.2250738585072014e-308"},
+		{9007199254740993.0, "9007199254740992"},
+		{INFINITY, "inf"},
+		{-INFINITY, "-inf"},
+		{NAN, "nan"},
+	};
+	for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		buf[fmt_double(buf, tests[i].v)] = 0;
+		EXPECT_STREQ(tests[i].want, buf);
+	}
+
+	// the output must read back as the same double and be no longer than
+	// the shortest %.*e output that does
+	uint64_t seed = 2;
+	for (int i = 0; i < 5000; i++) {
+		double v = rand_double(&seed);
+		size_t n = fmt_double(buf, v);
+		EXPECT_GT(FMT_BUFSZ + 1, n);
+		buf[n] = 0;
+		EXPECT_TRUE(strtod(buf, NULL) == v);
+
+		int want = 1;
+		char ref[64];
+		for (; want < 17; want++) {
+			snprintf(ref, sizeof(ref), "%.*e", want - 1, v);
+			if (strtod(ref, NULL) == v) {
+				break;
+			}
+		}
+		int digits = 0, lead = 1, zeros = 0;
+		for (char *p = buf; *p && *p != 'e'; p++) {
+			if (*p == '0') {
+				zeros++;
+			} else if ('1' <= *p && *p <= '9') {
+				digits += lead ? 1 : zeros + 1;
+				lead = 0;
+				zeros = 0;
+			}
+		}
+		EXPECT_EQ(want, digits);
+	}
+}
+
+static void test_typed(void) {
+	str_t s = STR_INIT;
+	str_add_u64(&s, UINT64_MAX);
+	str_addch(&s, ' ');
+	str_add_i64(&s, INT64_MIN);
+	str_addch(&s, ' ');
+	str_add_i64(&s, 0);
+	str_addch(&s, ' ');
+	str_add_hex(&s, 0xDEADBEEF);
+	str_addch(&s, ' ');
+	str_add_fixed(&s, 2.675, 2);
+	str_addch(&s, ' ');
+	str_add_double(&s, 0.1);
+	EXPECT_STREQ("18446744073709551615 -9223372036854775808 0 deadbeef 2.67 0.1", s.c_str);
+
+#ifdef STR_CAT
+	str_clear(&s);
+	slice_t sl = {"slice", 5};
+	unsigned char uc = 200;
+	STR_CAT(&s, "id=", 42, " n=", (size_t) 7, " x=", 1.25, (char) ' ', sl);
+	STR_CAT(&s, uc);
+	EXPECT_STREQ("id=42 n=7 x=1.25 slice200", s.c_str);
+
+	// character literals are ints
+	str_clear(&s);
+	STR_CAT(&s, 'q', (char) 'q');
+	EXPECT_STREQ("113q", s.c_str);
+#endif
+
+	// char arrays use the same engine
+	struct {
+		size_t len;
+		char c_str[16];
+	} ca;
+	ca_clear(&ca);
+	EXPECT_EQ(0, ca_addf(&ca, "%d-%.1f", 12, 3.25));
+	EXPECT_STREQ("12-3.2", ca.c_str);
+	EXPECT_EQ(-1, ca_addf(&ca, "%s", "too long to fit"));
+	EXPECT_STREQ("12-3.2", ca.c_str);
+	str_destroy(&s);
+}
+
+// a log line with a mix of strings, integers and floats
+static void bench_format(log_t *log) {
+	str_t s = STR_INIT;
+	char buf[256];
+	struct timer t;
+
+	start_timer(&t);
+	for (int i = 0; i < bench_lines; i++) {
+		snprintf(buf, sizeof(buf), "%s|id:%d|size:%zu|hash:%x|took:%.3f|ratio:%g", "request", i, (size_t) i * 4096, (unsigned) i * 2654435761U, i * 0.001, i / 7.0);
+	}
+	double libc = stop_timer(&t);
+
+	start_timer(&t);
+	for (int i = 0; i < bench_lines; i++) {
+		str_clear(&s);
+		str_addf(&s, "%s|id:%d|size:%zu|hash:%x|took:%.3f|ratio:%g", "request", i, (size_t) i * 4096, (unsigned) i * 2654435761U, i * 0.001, i / 7.0);
+	}
+	double addf = stop_timer(&t);
+
+	start_timer(&t);
+	for (int i = 0; i < bench_lines; i++) {
+		str_clear(&s);
+		str_add(&s, "request|id:");
+		str_add_i64(&s, i);
+		str_add(&s, "|size:");
+		str_add_u64(&s, (size_t) i * 4096);
+		str_add(&s, "|hash:");
+		str_add_hex(&s, (unsigned) i * 2654435761U);
+		str_add(&s, "|took:");
+		str_add_fixed(&s, i * 0.001, 3);
+		str_add(&s, "|ratio:");
+		str_add_double(&s, i / 7.0);
+	}
+	double typed = stop_timer(&t);
+
+	start_timer(&t);
+	for (int i = 0; i < bench_lines; i++) {
+		snprintf(buf, sizeof(buf), "%.17g", i / 7.0);
+	}
+	double libcdbl = stop_timer(&t);
+
+	start_timer(&t);
+	for (int i = 0; i < bench_lines; i++) {
+		fmt_double(buf, i / 7.0);
+	}
+	double shortest = stop_timer(&t);
+
+	LOG(log, "format line|lines:%d|snprintfNs:%.0f|addfNs:%.0f|typedNs:%.0f",
+		bench_lines, libc * 1e9 / bench_lines, addf * 1e9 / bench_lines, typed * 1e9 / bench_lines);
+	LOG(log, "format double|values:%d|snprintfNs:%.0f|shortestNs:%.0f",
+		bench_lines, libcdbl * 1e9 / bench_lines, shortest * 1e9 / bench_lines);
+	str_destroy(&s);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_lines, 0, "bench-lines", "N", "number of lines in the benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_int();
+	test_float();
+	test_shortest();
+	test_typed();
+	bench_format(log);
+
+	return finish_test();
+}
@@ -4,6 +4,14 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASH_SSE2
+#elif defined __ARM_NEON && defined __aarch64__
+#include <arm_neon.h>
+#define HASH_NEON
+#endif
+
 // use quadratic probing
 // stepping function i*(i+1)/2
 // table size a power of 2
@@ -16,18 +24,91 @@
 // 6 - 6*7/2 = 21
 // i*(i+1)/2 - i*(i-1)/2 = i*(i+1-i+1)/2 = i
 
+// The linear layout uses a control byte for each entry holding
+// the distance of the entry from its home slot plus one, with 0 for
+// empty. Entries are kept in Robin Hood order, so within a run of
+// used slots the home slots never decrease. Inserting shifts the rest
+// of the run up a slot and removing shifts it back down, so there are
+// never any removed markers and a lookup can stop as soon as it sees
+// an entry closer to its home than the key would be. The probe does
+// not wrap around. Instead there are extra slots past the last home
+// slot, and an entry that would end up too far from home grows the
+// table. Lookups compare 16 control bytes at a time against the
+// distances the key would have in each slot. A group of zero bytes past
+// the end stops any probe.
+
+// The grouped layout uses a control byte for each entry
+// 0x80 - has not been used
+// 0xFE - removed (used previously)
+// 0x00 to 0x7F - used now, holds the top 7 bits of the hash
+// Slots are split into aligned groups of 16. The probe sequence
+// is the same quadratic sequence as above but steps a group at a
+// time. Each group is checked for the tag and for empty slots
+// with a single SIMD compare. Lookups stop at the first group
+// that has an empty slot.
+
+#define GROUP_SIZE 16
+#define CTRL_EMPTY 0x80
+#define CTRL_REMOVED 0xFE
+#define LINEAR_TAIL 256
+#define LINEAR_MAX 254
+
 struct table {
 	hash_t h;
 	uint8_t *keys;
 	uint8_t *values;
 };
 
+// Resizing moves the entries from the old arrays, held in struct
+// hash_migration, into newly allocated arrays. A normal resize moves
+// everything in one go. Tables with HASH_INCREMENTAL keep the old
+// arrays around and move a few slots on each insert and find. While
+// this is going on, lookups check the new table and then the old one.
+// Entries found in the old table are moved across straight away so
+// that the returned index always refers to the current keys and values.
+
+struct hash_migration {
+	size_t end, next;
+	size_t keysz, valsz;
+	union {
+		uint32_t *flags;
+		uint8_t *ctrl;
+	};
+	uint64_t *hashes;
+	uint8_t *keys;
+	uint8_t *values;
+};
+
+static bool is_grouped(const hash_t *h) {
+	return (h->mode & HASH_LAYOUT_MASK) == HASH_GROUPED;
+}
+
+static bool is_linear(const hash_t *h) {
+	return (h->mode & HASH_LAYOUT_MASK) == HASH_LINEAR;
+}
+
+// number of home slots in a linear table
+static size_t linear_cap(size_t end) {
+	return end < 2 * LINEAR_TAIL ? end / 2 : end - LINEAR_TAIL;
+}
+
+static size_t linear_end(size_t cap) {
+	return cap < LINEAR_TAIL ? cap * 2 : cap + LINEAR_TAIL;
+}
+
+static void free_old(hash_t *h, struct hash_migration *m);
+
 void free_hash(hash_t *h, size_t valsz) {
-	if (h->size) {
+	if (h->migrating) {
+		free_old(h, h->migrating);
+	}
+	if (h->end) {
 		struct table *t = (struct table*)h;
 		xfree(h->alloc, h->flags);
+		xfree(h->alloc, h->hashes);
 		xfree(h->alloc, t->keys);
 		h->flags = NULL;
+		h->hashes = NULL;
 		h->size = 0;
 		t->keys = NULL;
 		h->end = 0;
@@ -40,46 +121,154 @@ void free_hash(hash_t *h, size_t valsz) {
 }
 
 void clear_hash(hash_t *h) {
+	if (h->migrating) {
+		free_old(h, h->migrating);
+	}
 	h->size = 0;
 	h->num_used = 0;
-	memset(h->flags, 0, h->end >> 2);
+	if (is_grouped(h)) {
+		memset(h->ctrl, CTRL_EMPTY, h->end);
+	} else if (is_linear(h)) {
+		memset(h->ctrl, 0, h->end);
+	} else {
+		memset(h->flags, 0, h->end >> 2);
+	}
 }
 
 size_t hash_memory(const hash_t *h, size_t keysz, size_t valsz) {
-	return (h->end >> 2) // flags
+	bool bytes = is_grouped(h) || is_linear(h);
+	size_t flags = bytes ? h->end : (h->end >> 2);
+	size_t hashes = h->hashes ? (sizeof(uint64_t) * h->end) : 0;
+	size_t old = 0;
+	if (h->migrating) {
+		const struct hash_migration *m = h->migrating;
+		old = (bytes ? m->end : (m->end >> 2))
+			+ (m->hashes ? (sizeof(uint64_t) * m->end) : 0)
+			+ ((keysz + valsz) * m->end);
+	}
+	return flags
+		+ hashes
+		+ old
 		+ (keysz * h->end)
 		+ (valsz * h->end);
 }
 
-size_t hash_blob(const void *data, size_t size) {
+// The hash functions are based on wyhash (public domain). Keys are
+// mixed by folding the 128 bit product of the key against the
+// secret. This spreads the entropy across all 64 bits so that both
+// the low bits used for the slot and the top bits used for the grouped
+// tags are usable, even for sequential or aligned pointer keys. Blobs
+// are consumed 8 or 16 bytes at a time.
+
+#define SECRET0 UINT64_C(0xA0761D6478BD642F)
+#define SECRET1 UINT64_C(0xE7037ED1A0B428DB)
+#define SECRET2 UINT64_C(0x8EBC6AF09C88C6E3)
+#define SECRET3 UINT64_C(0x589965CC75374CC3)
+
+static void mum(uint64_t *a, uint64_t *b) {
+#if defined __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#elif defined _MSC_VER && defined _M_X64
+	*a = _umul128(*a, *b, b);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t mix(uint64_t a, uint64_t b) {
+	mum(&a, &b);
+	return a ^ b;
+}
+
+static uint64_t read64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static uint64_t read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+uint64_t hash_u64(uint64_t key, uint64_t seed) {
+	uint64_t a = key ^ SECRET0;
+	uint64_t b = seed ^ SECRET1;
+	mum(&a, &b);
+	return mix(a ^ SECRET0, b ^ SECRET1);
+}
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
 	const uint8_t *p = data;
-	const uint8_t *e = p + size;
-	size_t h = 0;
-	while (p < e) {
-		h = (h << 5) - h + (size_t)(*(p++));
+	uint64_t a, b;
+	seed ^= mix(seed ^ SECRET0, SECRET1);
+	if (size <= 16) {
+		if (size >= 4) {
+			size_t off = (size >> 3) << 2;
+			a = (read32(p) << 32) | read32(p + off);
+			b = (read32(p + size - 4) << 32) | read32(p + size - 4 - off);
+		} else if (size) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[size >> 1] << 8) | p[size - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = size;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = mix(read64(p) ^ SECRET1, read64(p + 8) ^ seed);
+				see1 = mix(read64(p + 16) ^ SECRET2, read64(p + 24) ^ see1);
+				see2 = mix(read64(p + 32) ^ SECRET3, read64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = mix(read64(p) ^ SECRET1, read64(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = read64(p + i - 16);
+		b = read64(p + i - 8);
 	}
-	return h;
+	a ^= SECRET1;
+	b ^= seed;
+	mum(&a, &b);
+	return mix(a ^ SECRET0 ^ (uint64_t)size, b ^ SECRET1);
 }
 
-static size_t hash_key(uint64_t key, const void *blob) {
+static uint64_t hash_key(const hash_t *h, uint64_t key, const void *blob) {
 	if (blob) {
-		return hash_blob(blob, (size_t)key);
+		return hash_bytes(blob, (size_t)key, h->seed);
 	} else {
-		return (size_t)key;
+		return hash_u64(key, h->seed);
 	}
 }
 
-static size_t rehash_key(size_t keysz, const void *keys, size_t idx) {
+static uint64_t rehash_key(const hash_t *h, size_t keysz, const void *keys, size_t idx) {
 	switch (keysz) {
 	case 4:
-		return (size_t) (((uint32_t*)keys)[idx]);
+		return hash_u64(((uint32_t*)keys)[idx], h->seed);
 	case 8:
-		return (size_t) (((uint64_t*)keys)[idx]);
+		return hash_u64(((uint64_t*)keys)[idx], h->seed);
 	default:
 		break;
 	}
 	blob_t b = ((blob_t*)keys)[idx];
-	return hash_blob(b.data, b.size);
+	return hash_bytes(b.data, b.size, h->seed);
 }
 
 static int key_equals(size_t keysz, const void *keys, size_t idx, uint64_t key, const void *blob) {
@@ -132,37 +321,132 @@ static void set_used(uint32_t *flags, size_t idx) {
 }
 
 static void set_removed(uint32_t *flags, size_t idx) {
-	flags[idx >> 4] &= 1 << (2 * (idx & 15));
-	flags[idx >> 4] |= 2 << (2 * (idx & 15));
+	flags[idx >> 4] &= ~(3U << (2 * (idx & 15)));
+	flags[idx >> 4] |= 2U << (2 * (idx & 15));
 }
 
-int next_hash(hash_t *h, size_t *pidx) {
+static uint8_t ctrl_tag(uint64_t hash) {
+	return (uint8_t)(hash >> 57);
+}
+
+#if defined HASH_SSE2
+static unsigned group_match(const uint8_t *ctrl, uint8_t tag) {
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+	return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+}
+static unsigned group_free(const uint8_t *ctrl) {
+	// empty and removed both have the top bit set
+	return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+#elif defined HASH_NEON
+static unsigned neon_mask(uint8x16_t m) {
+	static const uint8_t bits[GROUP_SIZE] = {1,2,4,8,16,32,64,128,1,2,4,8,16,32,64,128};
+	m = vandq_u8(m, vld1q_u8(bits));
+	return (unsigned)vaddv_u8(vget_low_u8(m)) | ((unsigned)vaddv_u8(vget_high_u8(m)) << 8);
+}
+static unsigned group_match(const uint8_t *ctrl, uint8_t tag) {
+	return neon_mask(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(tag)));
+}
+static unsigned group_free(const uint8_t *ctrl) {
+	return neon_mask(vcltq_s8(vreinterpretq_s8_u8(vld1q_u8(ctrl)), vdupq_n_s8(0)));
+}
+#else
+static unsigned group_match(const uint8_t *ctrl, uint8_t tag) {
+	unsigned ret = 0;
+	for (unsigned i = 0; i < GROUP_SIZE; i++) {
+		ret |= (unsigned)(ctrl[i] == tag) << i;
+	}
+	return ret;
+}
+static unsigned group_free(const uint8_t *ctrl) {
+	unsigned ret = 0;
+	for (unsigned i = 0; i < GROUP_SIZE; i++) {
+		ret |= (unsigned)(ctrl[i] >> 7) << i;
+	}
+	return ret;
+}
+#endif
+
+static unsigned group_empty(const uint8_t *ctrl) {
+	return group_match(ctrl, CTRL_EMPTY);
+}
+
+static unsigned lowest_bit(unsigned mask) {
+#if defined _MSC_VER
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+	return (unsigned)idx;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// always inlined with a constant keysz so that key_equals
+// compiles down to a single compare per candidate
+static inline size_t find_grouped_(hash_t *h, size_t keysz, uint64_t hash, uint64_t key, const void *blob) {
+	struct table *t = (struct table*)h;
+	uint8_t tag = ctrl_tag(hash);
+	size_t gmask = (h->end / GROUP_SIZE) - 1;
+	size_t group = (size_t)hash & gmask;
+	size_t step = 0;
 	for (;;) {
-		(*pidx)++;
-		if (*pidx == h->end) {
-			return 0;
+		const uint8_t *ctrl = h->ctrl + group * GROUP_SIZE;
+		unsigned match = group_match(ctrl, tag);
+		while (match) {
+			size_t idx = group * GROUP_SIZE + lowest_bit(match);
+			if ((!h->hashes || h->hashes[idx] == hash) && key_equals(keysz, t->keys, idx, key, blob)) {
+				return idx;
+			}
+			match &= match - 1;
 		}
-		size_t flag = get_flags(h->flags, *pidx);
-		if (flag & USED) {
-			return 1;
+		if (group_empty(ctrl) || step == gmask) {
+			return h->end;
 		}
+		group = (group + (++step)) & gmask;
 	}
 }
 
-size_t find_hash(hash_t *h, size_t keysz, uint64_t key, const void *blob) {
-	struct table *t = (struct table*)h;
-	if (!h->end) {
-		return 0;
+static size_t find_grouped(hash_t *h, size_t keysz, uint64_t hash, uint64_t key, const void *blob) {
+	switch (keysz) {
+	case 4:
+		return find_grouped_(h, 4, hash, key, blob);
+	case 8:
+		return find_grouped_(h, 8, hash, key, blob);
+	default:
+		return find_grouped_(h, sizeof(blob_t), hash, key, blob);
 	}
+}
+
+// finds a free slot for an entry that is known to not be in the table
+static size_t free_grouped(uint8_t *ctrl, size_t end, uint64_t hash) {
+	size_t gmask = (end / GROUP_SIZE) - 1;
+	size_t group = (size_t)hash & gmask;
+	size_t step = 0;
+	for (;;) {
+		unsigned avail = group_free(ctrl + group * GROUP_SIZE);
+		if (avail) {
+			return group * GROUP_SIZE + lowest_bit(avail);
+		}
+		if (step == gmask) {
+			return end;
+		}
+		group = (group + (++step)) & gmask;
+	}
+}
+
+static size_t find_quadratic(hash_t *h, size_t keysz, uint64_t full, uint64_t key, const void *blob) {
+	struct table *t = (struct table*)h;
 	size_t mask = h->end - 1;
-	size_t hash = hash_key(key, blob) & mask;
+	size_t hash = (size_t)full & mask;
 	size_t first = hash;
 	size_t step = 0;
 	do {
 		size_t flags = get_flags(h->flags, hash);
 		if (!flags) {
 			break;
-		} else if ((flags & USED) && key_equals(keysz, t->keys, hash, key, blob)) {
+		} else if ((flags & USED)
+			&& (!h->hashes || h->hashes[hash] == full)
+			&& key_equals(keysz, t->keys, hash, key, blob)) {
 			return hash;
 		}
 		hash = (hash + (++step)) & mask;
@@ -171,6 +455,391 @@ size_t find_hash(hash_t *h, size_t keysz, uint64_t key, const void *blob) {
 	return h->end;
 }
 
+// Compares 16 control bytes of a linear table against the distances
+// dist to dist+15. Returns a mask of the slots holding an entry at the
+// distance the key would have there and sets *stop to a mask of the
+// slots past which the key can't be.
+static unsigned linear_match(const uint8_t *ctrl, unsigned dist, unsigned *stop) {
+#if defined HASH_SSE2
+	__m128i c = _mm_loadu_si128((const __m128i*)ctrl);
+	__m128i d = _mm_adds_epu8(_mm_set1_epi8((char)dist),
+		_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+	unsigned ge = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(c, d), c));
+	unsigned eq = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(c, d));
+#elif defined HASH_NEON
+	static const uint8_t lanes[GROUP_SIZE] = {0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15};
+	uint8x16_t c = vld1q_u8(ctrl);
+	uint8x16_t d = vqaddq_u8(vdupq_n_u8((uint8_t)dist), vld1q_u8(lanes));
+	unsigned ge = neon_mask(vcgeq_u8(c, d));
+	unsigned eq = neon_mask(vceqq_u8(c, d));
+#else
+	unsigned ge = 0, eq = 0;
+	for (unsigned i = 0; i < GROUP_SIZE; i++) {
+		ge |= (unsigned)(ctrl[i] >= dist + i) << i;
+		eq |= (unsigned)(ctrl[i] == dist + i) << i;
+	}
+#endif
+	unsigned end = ~ge & 0xFFFF;
+	if (dist + GROUP_SIZE - 1 > LINEAR_MAX) {
+		end |= 0xFFFF << (LINEAR_MAX + 1 - dist);
+	}
+	*stop = end;
+	return end ? (eq & ((end & (0U - end)) - 1)) : eq;
+}
+
+static inline size_t find_linear_(hash_t *h, size_t keysz, uint64_t full, uint64_t key, const void *blob) {
+	struct table *t = (struct table*)h;
+	size_t pos = (size_t)full & (linear_cap(h->end) - 1);
+	for (unsigned dist = 1; dist <= LINEAR_MAX; dist += GROUP_SIZE, pos += GROUP_SIZE) {
+		unsigned stop;
+		unsigned match = linear_match(h->ctrl + pos, dist, &stop);
+		while (match) {
+			size_t idx = pos + lowest_bit(match);
+			if ((!h->hashes || h->hashes[idx] == full) && key_equals(keysz, t->keys, idx, key, blob)) {
+				return idx;
+			}
+			match &= match - 1;
+		}
+		if (stop) {
+			break;
+		}
+	}
+	return h->end;
+}
+
+static size_t find_linear(hash_t *h, size_t keysz, uint64_t full, uint64_t key, const void *blob) {
+	switch (keysz) {
+	case 4:
+		return find_linear_(h, 4, full, key, blob);
+	case 8:
+		return find_linear_(h, 8, full, key, blob);
+	default:
+		return find_linear_(h, sizeof(blob_t), full, key, blob);
+	}
+}
+
+// moves count entries starting at from to slot to
+static void shift_linear(hash_t *h, size_t to, size_t from, size_t count) {
+	struct table *t = (struct table*)h;
+	if (!count) {
+		return;
+	}
+	memmove(h->ctrl + to, h->ctrl + from, count);
+	memmove(t->keys + to * h->keysz, t->keys + from * h->keysz, count * h->keysz);
+	if (h->valsz) {
+		memmove(t->values + to * h->valsz, t->values + from * h->valsz, count * h->valsz);
+	}
+	if (h->hashes) {
+		memmove(h->hashes + to, h->hashes + from, count * sizeof(uint64_t));
+	}
+}
+
+// finds and claims a slot for an entry that is known to not be in the
+// table, returns h->end if an entry would end up too far from home
+static size_t place_linear(hash_t *h, uint64_t full) {
+	size_t pos = (size_t)full & (linear_cap(h->end) - 1);
+	unsigned dist = 1;
+	for (;;) {
+		unsigned stop;
+		linear_match(h->ctrl + pos, dist, &stop);
+		if (stop) {
+			unsigned n = lowest_bit(stop);
+			pos += n;
+			dist += n;
+			break;
+		}
+		pos += GROUP_SIZE;
+		dist += GROUP_SIZE;
+	}
+	if (dist > LINEAR_MAX) {
+		return h->end;
+	}
+	// the rest of the run moves up one
+	size_t last = pos;
+	while (h->ctrl[last]) {
+		if (h->ctrl[last] == LINEAR_MAX) {
+			return h->end;
+		}
+		last++;
+	}
+	if (last == h->end) {
+		return h->end;
+	}
+	shift_linear(h, pos + 1, pos, last - pos);
+	for (size_t i = pos + 1; i <= last; i++) {
+		h->ctrl[i]++;
+	}
+	h->ctrl[pos] = (uint8_t)dist;
+	h->num_used++;
+	return pos;
+}
+
+static void remove_linear(hash_t *h, size_t idx) {
+	// pull back the following entries that aren't in their home slot
+	size_t end = idx + 1;
+	while (h->ctrl[end] > 1) {
+		end++;
+	}
+	shift_linear(h, idx, idx + 1, end - idx - 1);
+	for (size_t i = idx; i < end - 1; i++) {
+		h->ctrl[i]--;
+	}
+	h->ctrl[end - 1] = 0;
+	h->num_used--;
+	h->size--;
+}
+
+static size_t lookup(hash_t *h, size_t keysz, uint64_t full, uint64_t key, const void *blob) {
+	if (is_grouped(h)) {
+		return find_grouped(h, keysz, full, key, blob);
+	} else if (is_linear(h)) {
+		return find_linear(h, keysz, full, key, blob);
+	} else {
+		return find_quadratic(h, keysz, full, key, blob);
+	}
+}
+
+// finds and claims a slot for an entry that is known to not be in the table
+static size_t place_entry(hash_t *h, uint64_t full) {
+	size_t site;
+	if (is_grouped(h)) {
+		site = free_grouped(h->ctrl, h->end, full);
+		if (site == h->end) {
+			return site;
+		}
+		if (h->ctrl[site] == CTRL_EMPTY) {
+			h->num_used++;
+		}
+		h->ctrl[site] = ctrl_tag(full);
+	} else if (is_linear(h)) {
+		site = place_linear(h, full);
+		if (site == h->end) {
+			return site;
+		}
+	} else {
+		size_t mask = h->end - 1;
+		size_t first = (size_t)full & mask;
+		size_t step = 0;
+		size_t flags;
+		site = first;
+		while ((flags = get_flags(h->flags, site)) & USED) {
+			site = (site + (++step)) & mask;
+			if (site == first) {
+				return h->end;
+			}
+		}
+		if (!flags) {
+			h->num_used++;
+		}
+		set_used(h->flags, site);
+	}
+	if (h->hashes) {
+		h->hashes[site] = full;
+	}
+	return site;
+}
+
+// Number of old slots moved per insert or find. Growth doubles
+// the table, so at least 3/4 of the old size worth of inserts happen
+// before the next growth. Anything over 4/3 is enough to guarantee
+// that a migration is finished by then.
+#define MIGRATE_STEP 32
+
+static bool old_used(const hash_t *h, const struct hash_migration *m, size_t idx) {
+	if (is_grouped(h)) {
+		return m->ctrl[idx] < CTRL_EMPTY;
+	} else if (is_linear(h)) {
+		return m->ctrl[idx] != 0;
+	} else {
+		return (get_flags(m->flags, idx) & USED) != 0;
+	}
+}
+
+// moves entry idx of the old table to slot site of the current table
+static void move_entry(hash_t *h, struct hash_migration *m, size_t idx, size_t site) {
+	struct table *t = (struct table*)h;
+	memcpy(t->keys + (site * m->keysz), m->keys + (idx * m->keysz), m->keysz);
+	if (m->valsz) {
+		memcpy(t->values + (site * m->valsz), m->values + (idx * m->valsz), m->valsz);
+	}
+	if (is_grouped(h)) {
+		m->ctrl[idx] = CTRL_REMOVED;
+	} else if (!is_linear(h)) {
+		set_removed(m->flags, idx);
+	}
+	// linear tables are only ever moved in one go and the old table is
+	// left untouched so that a failed move can go back to it
+}
+
+// returns -1 if a linear run in the new table gets too long, the other
+// layouts always have room
+static int move_entries(hash_t *h, struct hash_migration *m, size_t limit) {
+	size_t end = (m->end - m->next > limit) ? (m->next + limit) : m->end;
+	for (size_t i = m->next; i < end; i++) {
+		if (old_used(h, m, i)) {
+			uint64_t full = m->hashes ? m->hashes[i] : rehash_key(h, m->keysz, m->keys, i);
+			size_t site = place_entry(h, full);
+			if (site == h->end) {
+				m->next = i;
+				return -1;
+			}
+			move_entry(h, m, i, site);
+		}
+	}
+	m->next = end;
+	return 0;
+}
+
+static void free_old(hash_t *h, struct hash_migration *m) {
+	allocator_t *a = h->alloc;
+	xfree(a, m->flags);
+	xfree(a, m->hashes);
+	xfree(a, m->keys);
+	xfree(a, m->values);
+	if (h->migrating == m) {
+		xfree(a, m);
+		h->migrating = NULL;
+	}
+}
+
+// Only grouped and quadratic tables migrate incrementally and those
+// always have room for the old entries, so moves can't fail here.
+static void finish_migration(hash_t *h) {
+	struct hash_migration *m = h->migrating;
+	if (m) {
+		move_entries(h, m, m->end - m->next);
+		free_old(h, m);
+	}
+}
+
+static void step_migration(hash_t *h) {
+	struct hash_migration *m = h->migrating;
+	move_entries(h, m, MIGRATE_STEP);
+	if (m->next == m->end) {
+		free_old(h, m);
+	}
+}
+
+// looks for a key in the old table, returns m->end if not found
+static size_t find_old(hash_t *h, size_t keysz, uint64_t full, uint64_t key, const void *blob) {
+	struct hash_migration *m = h->migrating;
+	struct table old;
+	old.h = *h;
+	old.h.end = m->end;
+	old.h.flags = m->flags;
+	old.h.hashes = m->hashes;
+	old.keys = m->keys;
+	old.values = m->values;
+	return lookup(&old.h, keysz, full, key, blob);
+}
+
+int next_hash(hash_t *h, size_t *pidx) {
+	finish_migration(h);
+	for (;;) {
+		(*pidx)++;
+		if (*pidx == h->end) {
+			return 0;
+		}
+		if (is_grouped(h)) {
+			if (h->ctrl[*pidx] < CTRL_EMPTY) {
+				return 1;
+			}
+		} else if (is_linear(h)) {
+			if (h->ctrl[*pidx]) {
+				return 1;
+			}
+		} else if (get_flags(h->flags, *pidx) & USED) {
+			return 1;
+		}
+	}
+}
+
+size_t probe_hash(const hash_t *h, uint64_t hash, struct hash_probe *p) {
+	if (!h->end) {
+		return 0;
+	}
+	if (is_grouped(h)) {
+		size_t gmask = (h->end / GROUP_SIZE) - 1;
+		if (!p->started) {
+			p->started = true;
+			p->pos = (size_t)hash & gmask;
+			p->match = group_match(h->ctrl + p->pos * GROUP_SIZE, ctrl_tag(hash));
+		}
+		for (;;) {
+			while (p->match) {
+				size_t idx = p->pos * GROUP_SIZE + lowest_bit(p->match);
+				p->match &= p->match - 1;
+				if (!h->hashes || h->hashes[idx] == hash) {
+					return idx;
+				}
+			}
+			if (group_empty(h->ctrl + p->pos * GROUP_SIZE) || p->step == gmask) {
+				return h->end;
+			}
+			p->pos = (p->pos + (++p->step)) & gmask;
+			p->match = group_match(h->ctrl + p->pos * GROUP_SIZE, ctrl_tag(hash));
+		}
+	} else if (is_linear(h)) {
+		if (!p->started) {
+			p->started = true;
+			p->pos = (size_t)hash & (linear_cap(h->end) - 1);
+		} else {
+			p->pos++;
+			p->step++;
+		}
+		for (; p->step < LINEAR_MAX; p->pos++, p->step++) {
+			unsigned c = h->ctrl[p->pos];
+			if (c < p->step + 1) {
+				break;
+			} else if (c == p->step + 1 && (!h->hashes || h->hashes[p->pos] == hash)) {
+				return p->pos;
+			}
+		}
+		return h->end;
+	}
+
+	size_t mask = h->end - 1;
+	if (!p->started) {
+		p->started = true;
+		p->pos = (size_t)hash & mask;
+	} else if (p->step == mask) {
+		return h->end;
+	} else {
+		p->pos = (p->pos + (++p->step)) & mask;
+	}
+	for (;;) {
+		size_t flags = get_flags(h->flags, p->pos);
+		if (!flags) {
+			return h->end;
+		} else if ((flags & USED) && (!h->hashes || h->hashes[p->pos] == hash)) {
+			return p->pos;
+		} else if (p->step == mask) {
+			return h->end;
+		}
+		p->pos = (p->pos + (++p->step)) & mask;
+	}
+}
+
+size_t find_hash(hash_t *h, size_t keysz, uint64_t key, const void *blob) {
+	if (!h->end) {
+		return 0;
+	}
+	if (h->migrating) {
+		step_migration(h);
+	}
+	uint64_t full = hash_key(h, key, blob);
+	size_t idx = lookup(h, keysz, full, key, blob);
+	if (idx == h->end && h->migrating) {
+		struct hash_migration *m = h->migrating;
+		size_t old = find_old(h, keysz, full, key, blob);
+		if (old < m->end) {
+			idx = place_entry(h, full);
+			move_entry(h, m, old, idx);
+		}
+	}
+	return idx;
+}
+
 static size_t roundup(size_t v) {
 	v--;
 	v |= v >> 1;
@@ -185,15 +854,24 @@ static size_t roundup(size_t v) {
 	return v;
 }
 
-static int rehash_table(hash_t *h, size_t keysz, size_t valsz, size_t newcap) {
+// allocates the new arrays and hands the old ones over to m
+static int start_resize(hash_t *h, struct hash_migration *m, size_t keysz, size_t valsz, size_t newcap) {
 	struct table *t = (struct table*)h;
+	bool grouped = is_grouped(h);
+	bool linear = is_linear(h);
 	newcap = roundup(newcap);
 	if (newcap < 16) {
 		newcap = 16;
 	}
+	if (linear) {
+		newcap = linear_end(newcap);
+	}
 	allocator_t *a = h->alloc;
 	uint8_t *new_vals = NULL;
-	uint32_t *new_flags = xcalloc(a, newcap >> 4, 4);
+	uint64_t *new_hashes = NULL;
+	uint32_t *new_flags = grouped ? xmalloc(a, newcap)
+		: linear ? xcalloc(a, newcap + GROUP_SIZE, 1)
+		: xcalloc(a, newcap >> 4, 4);
 	uint8_t *new_keys = xmalloc(a, keysz * newcap);
 	if (!new_flags || !new_keys) {
 		goto err;
@@ -204,76 +882,203 @@ static int rehash_table(hash_t *h, size_t keysz, size_t valsz, size_t newcap) {
 			goto err;
 		}
 	}
-
-	size_t mask = newcap - 1;
-	for (size_t i = 0; i < h->end; i++) {
-		size_t old_flag = get_flags(h->flags, i);
-		if (old_flag & USED) {
-			size_t hash = rehash_key(keysz, t->keys, i) & mask;
-			size_t first = hash;
-			size_t step = 0;
-			for (;;) {
-				size_t new_flag = get_flags(new_flags, hash);
-				if (!new_flag) {
-					memcpy(new_keys + (hash * keysz), t->keys + (i * keysz), keysz);
-					set_used(new_flags, hash);
-					if (valsz) {
-						memcpy(new_vals + (hash * valsz), t->values + (i * valsz), valsz);
-					}
-					break;
-				}
-				hash = (hash + (++step)) & mask;
-				if (hash == first) {
-					goto err;
-				}
-			}
+	if (h->mode & HASH_STORE_HASHES) {
+		new_hashes = xmalloc(a, sizeof(uint64_t) * newcap);
+		if (!new_hashes) {
+			goto err;
 		}
 	}
+	if (grouped) {
+		memset(new_flags, CTRL_EMPTY, newcap);
+	}
+
+	m->end = h->end;
+	m->next = 0;
+	m->keysz = keysz;
+	m->valsz = valsz;
+	m->flags = h->flags;
+	m->hashes = h->hashes;
+	m->keys = t->keys;
+	m->values = valsz ? t->values : NULL;
 
+	t->keys = new_keys;
 	if (valsz) {
-		xfree(a, t->values);
 		t->values = new_vals;
 	}
-	xfree(a, t->keys);
-	xfree(a, h->flags);
-	t->keys = new_keys;
 	h->flags = new_flags;
+	h->hashes = new_hashes;
 	h->end = newcap;
-	h->num_used = h->size;
+	h->num_used = 0;
+	h->keysz = (unsigned)keysz;
+	h->valsz = (unsigned)valsz;
 	return 0;
 
 err:
+	xfree(a, new_hashes);
 	xfree(a, new_flags);
 	xfree(a, new_keys);
-	xfree(a, new_keys);
+	xfree(a, new_vals);
 	return -1;
 }
 
+// drops the new arrays and goes back to the old ones
+static void undo_resize(hash_t *h, struct hash_migration *m, size_t num_used) {
+	struct table *t = (struct table*)h;
+	allocator_t *a = h->alloc;
+	xfree(a, h->flags);
+	xfree(a, h->hashes);
+	xfree(a, t->keys);
+	if (m->valsz) {
+		xfree(a, t->values);
+		t->values = m->values;
+	}
+	h->flags = m->flags;
+	h->hashes = m->hashes;
+	t->keys = m->keys;
+	h->end = m->end;
+	h->num_used = num_used;
+}
+
+static int rehash_table(hash_t *h, size_t keysz, size_t valsz, size_t newcap) {
+	finish_migration(h);
+	for (;;) {
+		struct hash_migration m;
+		size_t num_used = h->num_used;
+		if (start_resize(h, &m, keysz, valsz, newcap)) {
+			return -1;
+		}
+		if (!move_entries(h, &m, m.end)) {
+			free_old(h, &m);
+			return 0;
+		}
+		// a linear run is too long, try again with a bigger table
+		newcap = linear_cap(h->end) * 2;
+		undo_resize(h, &m, num_used);
+	}
+}
+
+static int grow_table(hash_t *h, size_t keysz, size_t valsz, size_t newcap) {
+	// Placing an entry in a linear table shifts the entries after it,
+	// so moving entries over during finds would invalidate indices
+	// returned by earlier finds. Linear tables always grow in one go.
+	if (!(h->mode & HASH_INCREMENTAL) || is_linear(h) || !h->size) {
+		return rehash_table(h, keysz, valsz, newcap);
+	}
+	finish_migration(h);
+	struct hash_migration *m = xmalloc(h->alloc, sizeof(struct hash_migration));
+	if (!m || start_resize(h, m, keysz, valsz, newcap)) {
+		xfree(h->alloc, m);
+		return -1;
+	}
+	h->migrating = m;
+	return 0;
+}
+
 int resize_hash(hash_t *h, size_t keysz, size_t valsz, size_t newsz) {
-	size_t slots = newsz * 2;
-	if (slots > h->end) {
+	size_t slots = (is_grouped(h) || is_linear(h)) ? (newsz + newsz / 7 + 1) : (newsz * 2);
+	size_t cap = is_linear(h) ? linear_cap(h->end) : h->end;
+	if (slots > cap) {
 		return rehash_table(h, keysz, valsz, slots);
 	} else {
 		return 0;
 	}
 }
 
-size_t insert_hash(hash_t *h, size_t keysz, size_t valsz, bool *padded, uint64_t key, const void *blob) {
+static size_t insert_grouped(hash_t *h, size_t keysz, size_t valsz, bool *padded, uint64_t hash, uint64_t key, const void *blob) {
+	struct table *t = (struct table*)h;
+	if (h->size >= h->end - h->end / 8) {
+		// grow the table
+		if (grow_table(h, keysz, valsz, h->end + 1)) {
+			return h->end;
+		}
+	} else if (h->num_used >= h->end - h->end / 16) {
+		// clear the removed entries
+		if (grow_table(h, keysz, valsz, h->end)) {
+			return h->end;
+		}
+	}
+
+	size_t idx = find_grouped(h, keysz, hash, key, blob);
+	if (idx < h->end) {
+		*padded = false;
+		return idx;
+	}
+
+	size_t old = h->migrating ? find_old(h, keysz, hash, key, blob) : 0;
+	size_t site = place_entry(h, hash);
+	if (site == h->end) {
+		return h->end;
+	}
+	if (h->migrating && old < h->migrating->end) {
+		move_entry(h, h->migrating, old, site);
+		*padded = false;
+		return site;
+	}
+	set_key(keysz, t->keys, site, key, blob);
+	h->size++;
+	*padded = true;
+	return site;
+}
+
+static size_t insert_linear(hash_t *h, size_t keysz, size_t valsz, bool *padded, uint64_t hash, uint64_t key, const void *blob) {
+	struct table *t = (struct table*)h;
+	size_t cap = linear_cap(h->end);
+	if (h->size >= cap - cap / 8) {
+		if (grow_table(h, keysz, valsz, cap * 2)) {
+			return h->end;
+		}
+	}
+
+	for (;;) {
+		size_t idx = find_linear(h, keysz, hash, key, blob);
+		if (idx < h->end) {
+			*padded = false;
+			return idx;
+		}
+
+		size_t site = place_linear(h, hash);
+		if (site < h->end) {
+			if (h->hashes) {
+				h->hashes[site] = hash;
+			}
+			set_key(keysz, t->keys, site, key, blob);
+			h->size++;
+			*padded = true;
+			return site;
+		}
+
+		// the run is too long, grow and try again
+		if (grow_table(h, keysz, valsz, linear_cap(h->end) * 2)) {
+			return h->end;
+		}
+	}
+}
+
+static size_t insert_full(hash_t *h, size_t keysz, size_t valsz, bool *padded, uint64_t full, uint64_t key, const void *blob) {
 	struct table *t = (struct table*)h;
+	if (h->migrating) {
+		step_migration(h);
+	}
+	if (is_grouped(h)) {
+		return insert_grouped(h, keysz, valsz, padded, full, key, blob);
+	} else if (is_linear(h)) {
+		return insert_linear(h, keysz, valsz, padded, full, key, blob);
+	}
+
 	if (h->size >= h->end * 3 / 4) {
 		// grow the table
-		if (rehash_table(h, keysz, valsz, h->end + 1)) {
+		if (grow_table(h, keysz, valsz, h->end + 1)) {
 			return h->end;
 		}
 	} else if (h->num_used >= h->end * 7 / 8) {
 		// clear the removed entries
-		if (rehash_table(h, keysz, valsz, h->end)) {
+		if (grow_table(h, keysz, valsz, h->end)) {
 			return h->end;
 		}
 	}
 
 	size_t mask = h->end - 1;
-	size_t hash = hash_key(key, blob) & mask;
+	size_t hash = (size_t)full & mask;
 	size_t first = hash;
 	size_t step = 0;
 	size_t site = h->end;
@@ -285,7 +1090,9 @@ size_t insert_hash(hash_t *h, size_t keysz, size_t valsz, bool *padded, uint64_t
 				site = hash;
 			}
 			goto add_entry;
-		} else if ((flags & USED) && key_equals(keysz, t->keys, hash, key, blob)) {
+		} else if ((flags & USED)
+			&& (!h->hashes || h->hashes[hash] == full)
+			&& key_equals(keysz, t->keys, hash, key, blob)) {
 			*padded = false;
 			return hash;
 		} else if (flags == REMOVED) {
@@ -298,17 +1105,208 @@ size_t insert_hash(hash_t *h, size_t keysz, size_t valsz, bool *padded, uint64_t
 		return h->end;
 	}
 add_entry:
-	set_key(keysz, t->keys, site, key, blob);
 	set_used(h->flags, site);
+	if (h->hashes) {
+		h->hashes[site] = full;
+	}
+	if (h->migrating) {
+		size_t old = find_old(h, keysz, full, key, blob);
+		if (old < h->migrating->end) {
+			move_entry(h, h->migrating, old, site);
+			*padded = false;
+			return site;
+		}
+	}
+	set_key(keysz, t->keys, site, key, blob);
 	h->size++;
 	*padded = true;
 	return site;
 }
 
+size_t insert_hash(hash_t *h, size_t keysz, size_t valsz, bool *padded, uint64_t key, const void *blob) {
+	return insert_full(h, keysz, valsz, padded, hash_key(h, key, blob), key, blob);
+}
+
+// Batches are processed in windows. All the hashes in a window are
+// computed and their control bytes prefetched, then the likely key
+// slots are prefetched and only then are the keys resolved. This lets
+// the cache misses for the whole window overlap instead of each lookup
+// waiting on the last.
+
+#define BATCH_SIZE 16
+
+static void prefetch(const void *p) {
+#if defined __GNUC__ || defined __clang__
+	__builtin_prefetch(p);
+#elif defined HASH_SSE2
+	_mm_prefetch((const char*)p, _MM_HINT_T0);
+#else
+	(void)p;
+#endif
+}
+
+static const void *batch_key(size_t keysz, const void *keys, size_t i, uint64_t *pkey) {
+	switch (keysz) {
+	case 4:
+		*pkey = ((uint32_t*)keys)[i];
+		return NULL;
+	case 8:
+		*pkey = ((uint64_t*)keys)[i];
+		return NULL;
+	default: {
+		blob_t b = ((blob_t*)keys)[i];
+		*pkey = b.size;
+		return b.data ? b.data : "";
+	}
+	}
+}
+
+static void prefetch_batch(const hash_t *h, size_t keysz, const uint64_t *full, size_t num) {
+	struct table *t = (struct table*)h;
+	if (is_grouped(h)) {
+		size_t gmask = (h->end / GROUP_SIZE) - 1;
+		for (size_t j = 0; j < num; j++) {
+			size_t group = (size_t)full[j] & gmask;
+			prefetch(h->ctrl + group * GROUP_SIZE);
+			if (h->hashes) {
+				prefetch(h->hashes + group * GROUP_SIZE);
+			}
+		}
+		for (size_t j = 0; j < num; j++) {
+			size_t group = (size_t)full[j] & gmask;
+			unsigned match = group_match(h->ctrl + group * GROUP_SIZE, ctrl_tag(full[j]));
+			if (match) {
+				prefetch(t->keys + (group * GROUP_SIZE + lowest_bit(match)) * keysz);
+			}
+		}
+	} else if (is_linear(h)) {
+		size_t mask = linear_cap(h->end) - 1;
+		for (size_t j = 0; j < num; j++) {
+			size_t idx = (size_t)full[j] & mask;
+			prefetch(h->ctrl + idx);
+			prefetch(t->keys + idx * keysz);
+			if (h->hashes) {
+				prefetch(h->hashes + idx);
+			}
+		}
+	} else {
+		size_t mask = h->end - 1;
+		for (size_t j = 0; j < num; j++) {
+			size_t idx = (size_t)full[j] & mask;
+			prefetch(h->flags + (idx >> 4));
+			prefetch(t->keys + idx * keysz);
+			if (h->hashes) {
+				prefetch(h->hashes + idx);
+			}
+		}
+	}
+}
+
+void find_hash_batch(hash_t *h, size_t keysz, const void *keys, size_t n, size_t *idx) {
+	finish_migration(h);
+	if (!h->end) {
+		memset(idx, 0, n * sizeof(size_t));
+		return;
+	}
+	uint64_t full[BATCH_SIZE];
+	for (size_t base = 0; base < n; base += BATCH_SIZE) {
+		size_t num = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+		for (size_t j = 0; j < num; j++) {
+			uint64_t key;
+			const void *blob = batch_key(keysz, keys, base + j, &key);
+			full[j] = hash_key(h, key, blob);
+		}
+		prefetch_batch(h, keysz, full, num);
+		for (size_t j = 0; j < num; j++) {
+			uint64_t key;
+			const void *blob = batch_key(keysz, keys, base + j, &key);
+			idx[base + j] = lookup(h, keysz, full[j], key, blob);
+		}
+	}
+}
+
+// grows the table so that n more inserts can't cause it to be rehashed
+static int reserve_hash(hash_t *h, size_t keysz, size_t valsz, size_t n) {
+	if (resize_hash(h, keysz, valsz, h->size + n)) {
+		return -1;
+	}
+	if (is_linear(h)) {
+		// no removed entries to clear out
+		return 0;
+	}
+	size_t max_used = is_grouped(h) ? (h->end - h->end / 16) : (h->end * 7 / 8);
+	if (h->num_used + n >= max_used) {
+		return rehash_table(h, keysz, valsz, h->end);
+	}
+	return 0;
+}
+
+int insert_hash_batch(hash_t *h, size_t keysz, size_t valsz, const void *keys, size_t n, size_t *idx, bool *padded) {
+	finish_migration(h);
+	if (reserve_hash(h, keysz, valsz, n)) {
+		return -1;
+	}
+	int ret = 0;
+	uint64_t full[BATCH_SIZE];
+	for (size_t base = 0; base < n; base += BATCH_SIZE) {
+		size_t num = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+		for (size_t j = 0; j < num; j++) {
+			uint64_t key;
+			const void *blob = batch_key(keysz, keys, base + j, &key);
+			full[j] = hash_key(h, key, blob);
+		}
+		prefetch_batch(h, keysz, full, num);
+		for (size_t j = 0; j < num; j++) {
+			uint64_t key;
+			const void *blob = batch_key(keysz, keys, base + j, &key);
+			bool added = false;
+			idx[base + j] = insert_full(h, keysz, valsz, &added, full[j], key, blob);
+			if (idx[base + j] == h->end) {
+				ret = -1;
+			}
+			if (padded) {
+				padded[base + j] = added;
+			}
+		}
+	}
+	if (is_linear(h)) {
+		// inserts shift the entries that follow, so look them all up
+		// again once everything is in
+		find_hash_batch(h, keysz, keys, n, idx);
+	}
+	return ret;
+}
+
+static void remove_grouped(hash_t *h, size_t idx) {
+	// If the group still has an empty slot then it has never been
+	// full. No probe sequence can have passed through it, so the
+	// slot can go straight back to empty rather than leaving a
+	// removed marker behind.
+	uint8_t *ctrl = h->ctrl + (idx & ~(size_t)(GROUP_SIZE - 1));
+	if (group_empty(ctrl)) {
+		h->ctrl[idx] = CTRL_EMPTY;
+		h->num_used--;
+	} else {
+		h->ctrl[idx] = CTRL_REMOVED;
+	}
+	h->size--;
+}
+
 void remove_hash(hash_t *h, size_t idx) {
-	if (idx < h->end) {
+	// slots that aren't live are left alone so that size stays correct
+	if (idx >= h->end) {
+		return;
+	} else if (is_grouped(h)) {
+		if (h->ctrl[idx] < CTRL_EMPTY) {
+			remove_grouped(h, idx);
+		}
+	} else if (is_linear(h)) {
+		if (h->ctrl[idx]) {
+			remove_linear(h, idx);
+		}
+	} else if (get_flags(h->flags, idx) & USED) {
 		set_removed(h->flags, idx);
+		h->size--;
 	}
 }
 
-
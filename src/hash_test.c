@@ -1,13 +1,19 @@
 #include "cutils/hash.h"
 #include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-int main(int argc, const char *argv[]) {
-	start_test(argc, argv);
+static int bench_bits = 16;
 
+static void test_set(unsigned mode) {
 	struct {
 		hash_t h;
 		uint32_t *keys;
 	} uu = { 0 };
+	uu.h.mode = mode;
 
 	bool added;
 	size_t ii = INSERT_SET(&uu, 3, &added);
@@ -29,5 +35,637 @@ int main(int argc, const char *argv[]) {
 	}
 
 	FREE_SET(&uu);
+}
+
+static void test_churn(unsigned mode) {
+	struct {
+		hash_t h;
+		uint64_t *keys;
+		int *values;
+	} ii = { 0 };
+	ii.h.mode = mode;
+
+	bool added;
+	for (uint64_t key = 0; key < 1000; key++) {
+		size_t idx = INSERT_HASH(&ii, key << 4, &added);
+		EXPECT_TRUE(added);
+		ii.values[idx] = (int)key;
+	}
+	EXPECT_EQ(1000, ii.h.size);
+
+	// remove every other key and then add them back
+	for (int pass = 0; pass < 4; pass++) {
+		for (uint64_t key = pass & 1; key < 1000; key += 2) {
+			size_t idx = FIND_HASH(&ii, key << 4);
+			EXPECT_GT(ii.h.end, idx);
+			REMOVE_HASH(&ii, idx);
+			EXPECT_EQ(ii.h.end, FIND_HASH(&ii, key << 4));
+		}
+		EXPECT_EQ(500, ii.h.size);
+		for (uint64_t key = pass & 1; key < 1000; key += 2) {
+			size_t idx = INSERT_HASH(&ii, key << 4, &added);
+			EXPECT_TRUE(added);
+			ii.values[idx] = (int)key;
+		}
+	}
+
+	int count = 0;
+	size_t idx = SIZE_MAX;
+	while (NEXT_HASH(&ii, &idx)) {
+		EXPECT_EQ(ii.keys[idx], (uint64_t)ii.values[idx] << 4);
+		count++;
+	}
+	EXPECT_EQ(1000, count);
+
+	FREE_HASH(&ii);
+}
+
+static void test_remove(unsigned mode) {
+	struct {
+		hash_t h;
+		uint32_t *keys;
+	} uu = { 0 };
+	uu.h.mode = mode;
+
+	// removing the same index twice only removes the entry once
+	bool added;
+	size_t first = INSERT_SET(&uu, 100, &added);
+	REMOVE_HASH(&uu, first);
+	size_t used = uu.h.num_used;
+	REMOVE_HASH(&uu, first);
+	EXPECT_EQ(0, uu.h.size);
+	EXPECT_EQ(used, uu.h.num_used);
+	EXPECT_EQ(uu.h.end, FIND_SET(&uu, 100));
+	INSERT_SET(&uu, 100, &added);
+	EXPECT_TRUE(added);
+	EXPECT_EQ(1, uu.h.size);
+	REMOVE_HASH(&uu, FIND_SET(&uu, 100));
+
+	// removing a key must leave its neighbours alone
+	for (uint32_t key = 0; key < 12; key++) {
+		INSERT_SET(&uu, key, &added);
+	}
+	for (uint32_t key = 0; key < 12; key++) {
+		REMOVE_HASH(&uu, FIND_SET(&uu, key));
+		EXPECT_EQ(11, uu.h.size);
+		EXPECT_EQ(uu.h.end, FIND_SET(&uu, key));
+		for (uint32_t other = 0; other < 12; other++) {
+			if (other != key) {
+				EXPECT_GT(uu.h.end, FIND_SET(&uu, other));
+			}
+		}
+		INSERT_SET(&uu, key, &added);
+		EXPECT_TRUE(added);
+	}
+
+	// remove the odd keys while iterating
+	for (uint32_t key = 12; key < 1000; key++) {
+		INSERT_SET(&uu, key, &added);
+	}
+	size_t idx = SIZE_MAX;
+	int visited = 0;
+	while (NEXT_HASH(&uu, &idx)) {
+		visited++;
+		if (uu.keys[idx] & 1) {
+			REMOVE_HASH(&uu, idx);
+			idx--;
+		}
+	}
+	EXPECT_EQ(1000, visited);
+	EXPECT_EQ(500, uu.h.size);
+	for (uint32_t key = 0; key < 1000; key++) {
+		EXPECT_EQ(key & 1, FIND_SET(&uu, key) == uu.h.end);
+	}
+
+	FREE_SET(&uu);
+}
+
+static void test_blob(unsigned mode) {
+	static const char *words[] = { "foo", "bar", "foobar", "", "a longer key that spans a few words" };
+	struct {
+		hash_t h;
+		blob_t *keys;
+		size_t *values;
+	} bb = { 0 };
+	bb.h.mode = mode;
+
+	bool added;
+	for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		size_t idx = INSERT_BLOB_HASH(&bb, words[i], strlen(words[i]), &added);
+		EXPECT_TRUE(added);
+		bb.values[idx] = i;
+	}
+	for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		size_t idx = FIND_BLOB_HASH(&bb, words[i], strlen(words[i]));
+		EXPECT_GT(bb.h.end, idx);
+		EXPECT_EQ(i, bb.values[idx]);
+	}
+	EXPECT_EQ(bb.h.end, FIND_BLOB_HASH(&bb, "fo", 2));
+
+	FREE_HASH(&bb);
+}
+
+static void test_stored_hashes(unsigned mode) {
+	struct {
+		hash_t h;
+		blob_t *keys;
+		int *values;
+	} bb = { 0 };
+	bb.h.mode = mode | HASH_STORE_HASHES;
+
+	char first[10][24], later[1000][24];
+	bool added;
+	for (int i = 0; i < 10; i++) {
+		snprintf(first[i], sizeof(first[i]), "first%d", i);
+		size_t idx = INSERT_BLOB_HASH(&bb, first[i], strlen(first[i]), &added);
+		bb.values[idx] = i;
+	}
+
+	// Scribble over the key data while the table grows. The entries
+	// will only still be found afterwards if the growth used the
+	// stored hashes rather than rehashing the key bytes.
+	char saved[sizeof(first)];
+	memcpy(saved, first, sizeof(first));
+	memset(first, 'x', sizeof(first));
+	size_t end = bb.h.end;
+	for (int i = 0; i < 1000; i++) {
+		snprintf(later[i], sizeof(later[i]), "later%d", i);
+		size_t idx = INSERT_BLOB_HASH(&bb, later[i], strlen(later[i]), &added);
+		bb.values[idx] = 100 + i;
+	}
+	EXPECT_GT(bb.h.end, end);
+	memcpy(first, saved, sizeof(first));
+
+	for (int i = 0; i < 10; i++) {
+		size_t idx = FIND_BLOB_HASH(&bb, first[i], strlen(first[i]));
+		EXPECT_GT(bb.h.end, idx);
+		EXPECT_EQ(i, bb.values[idx]);
+	}
+	for (int i = 0; i < 1000; i++) {
+		size_t idx = FIND_BLOB_HASH(&bb, later[i], strlen(later[i]));
+		EXPECT_GT(bb.h.end, idx);
+		EXPECT_EQ(100 + i, bb.values[idx]);
+	}
+	EXPECT_EQ(bb.h.end, FIND_BLOB_HASH(&bb, "first10", 7));
+
+	FREE_HASH(&bb);
+}
+
+static void test_incremental(unsigned mode) {
+	struct {
+		hash_t h;
+		uint32_t *keys;
+		uint32_t *values;
+	} ii = { 0 };
+	ii.h.mode = mode | HASH_INCREMENTAL;
+
+	// fill until a large enough resize is in progress
+	bool added;
+	uint32_t num = 0;
+	while (!ii.h.migrating || ii.h.end < 4096) {
+		size_t idx = INSERT_HASH(&ii, num, &added);
+		EXPECT_TRUE(added);
+		ii.values[idx] = num * 3;
+		num++;
+	}
+	size_t end = ii.h.end;
+	uint32_t grown = num;
+
+	// entries can be found and updated through both tables
+	for (uint32_t key = 0; key < grown; key += 97) {
+		size_t idx = FIND_HASH(&ii, key);
+		EXPECT_GT(ii.h.end, idx);
+		EXPECT_EQ(key * 3, ii.values[idx]);
+		idx = INSERT_HASH(&ii, key, &added);
+		EXPECT_TRUE(!added);
+		ii.values[idx] = key * 5;
+	}
+
+	// keep on inserting until the old table has been drained
+	EXPECT_TRUE(ii.h.migrating != NULL);
+	while (ii.h.migrating) {
+		size_t idx = INSERT_HASH(&ii, num, &added);
+		EXPECT_TRUE(added);
+		ii.values[idx] = num * 3;
+		num++;
+	}
+	EXPECT_EQ(end, ii.h.end);
+	EXPECT_EQ(num, ii.h.size);
+
+	for (uint32_t key = 0; key < num; key++) {
+		size_t idx = FIND_HASH(&ii, key);
+		EXPECT_GT(ii.h.end, idx);
+		EXPECT_EQ(key * ((key % 97 || key >= grown) ? 3 : 5), ii.values[idx]);
+	}
+
+	FREE_HASH(&ii);
+}
+
+static void test_stable_finds(unsigned mode) {
+	struct {
+		hash_t h;
+		uint32_t *keys;
+	} uu = { 0 };
+	uu.h.mode = mode | HASH_INCREMENTAL;
+
+	// fill until a resize has just started
+	bool added;
+	uint32_t num = 0;
+	size_t end = 0;
+	while (uu.h.end < 4096 || uu.h.end == end) {
+		end = uu.h.end;
+		INSERT_SET(&uu, num++, &added);
+	}
+	// linear tables always grow in one go
+	EXPECT_EQ(mode == HASH_LINEAR, uu.h.migrating == NULL);
+
+	// finds move entries over from the old table, but indices from
+	// earlier finds must still refer to the same keys
+	size_t *idx = malloc(num * sizeof(size_t));
+	for (uint32_t key = 0; key < num; key++) {
+		idx[key] = FIND_SET(&uu, key);
+		EXPECT_GT(uu.h.end, idx[key]);
+	}
+	for (uint32_t key = 0; key < num; key++) {
+		EXPECT_EQ(key, uu.keys[idx[key]]);
+	}
+	free(idx);
+	FREE_SET(&uu);
+}
+
+static void test_long_runs(void) {
+	struct {
+		hash_t h;
+		uint64_t *keys;
+	} uu = { 0 };
+	uu.h.mode = HASH_LINEAR;
+
+	// Two sets of keys that share a home slot each. In small tables they
+	// sit at either end, but with 8192 slots their homes are next to each
+	// other and the combined run is too long, so the resize has to go
+	// bigger again.
+	enum { NUM = 400 };
+	uint64_t keys[NUM];
+	int num = 0;
+	for (uint64_t k = 0; num < NUM; k++) {
+		uint64_t home = hash_u64(k, 0) & 8191;
+		if (home == (num < NUM / 2 ? 4095 : 4096)) {
+			keys[num++] = k;
+		}
+	}
+	bool added;
+	for (int i = 0; i < NUM; i++) {
+		EXPECT_GT(uu.h.end, INSERT_SET(&uu, keys[i], &added));
+		EXPECT_TRUE(added);
+	}
+	EXPECT_EQ(0, RESIZE_SET(&uu, 7000));
+	EXPECT_GT(uu.h.end, 16384);
+	EXPECT_EQ(NUM, uu.h.size);
+	for (int i = 0; i < NUM; i++) {
+		size_t idx = FIND_SET(&uu, keys[i]);
+		EXPECT_GT(uu.h.end, idx);
+		EXPECT_EQ(keys[i], uu.keys[idx]);
+	}
+	FREE_SET(&uu);
+}
+
+static void test_batch(unsigned mode) {
+	struct {
+		hash_t h;
+		uint64_t *keys;
+		uint64_t *values;
+	} ii = { 0 };
+	ii.h.mode = mode;
+
+	// start with some removed entries in the way
+	bool added;
+	for (uint64_t i = 0; i < 1000; i++) {
+		size_t site = INSERT_HASH(&ii, i, &added);
+		ii.values[site] = i;
+	}
+	for (uint64_t i = 0; i < 1000; i += 3) {
+		REMOVE_HASH(&ii, FIND_HASH(&ii, i));
+	}
+
+	enum { n = 5000 };
+	static uint64_t keys[n];
+	static size_t idx[n];
+	static bool padded[n];
+	for (size_t i = 0; i < n; i++) {
+		keys[i] = i % 4000;
+	}
+	EXPECT_EQ(0, INSERT_HASH_BATCH(&ii, keys, n, idx, padded));
+	EXPECT_EQ(4000, ii.h.size);
+	for (size_t i = 0; i < n; i++) {
+		// indices are valid for the whole batch
+		EXPECT_EQ(keys[i], ii.keys[idx[i]]);
+		EXPECT_EQ(i < 4000 && (i >= 1000 || i % 3 == 0), padded[i]);
+		ii.values[idx[i]] = keys[i] * 2;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		keys[i] = i;
+	}
+	FIND_HASH_BATCH(&ii, keys, n, idx);
+	for (size_t i = 0; i < n; i++) {
+		EXPECT_EQ(FIND_HASH(&ii, keys[i]), idx[i]);
+		if (i < 4000) {
+			EXPECT_EQ(i * 2, ii.values[idx[i]]);
+		} else {
+			EXPECT_EQ(ii.h.end, idx[i]);
+		}
+	}
+	FREE_HASH(&ii);
+
+	struct {
+		hash_t h;
+		blob_t *keys;
+	} bb = { 0 };
+	bb.h.mode = mode;
+	blob_t blobs[4] = {
+		{ "foo", 3 },
+		{ "bar", 3 },
+		{ "foo", 2 },
+		{ "foo", 3 },
+	};
+	size_t bidx[4];
+	EXPECT_EQ(0, INSERT_SET_BATCH(&bb, blobs, 4, bidx, NULL));
+	EXPECT_EQ(3, bb.h.size);
+	EXPECT_EQ(bidx[0], bidx[3]);
+	EXPECT_TRUE(bidx[0] != bidx[2]);
+	blobs[1].data = "baz";
+	FIND_SET_BATCH(&bb, blobs, 4, bidx);
+	EXPECT_EQ(FIND_BLOB_SET(&bb, "foo", 3), bidx[0]);
+	EXPECT_EQ(bb.h.end, bidx[1]);
+	EXPECT_EQ(FIND_BLOB_SET(&bb, "foo", 2), bidx[2]);
+	FREE_SET(&bb);
+}
+
+static void bench_batch(log_t *log, unsigned mode) {
+	struct {
+		hash_t h;
+		uint64_t *keys;
+		uint64_t *values;
+	} ii = { 0 };
+	ii.h.mode = mode;
+
+	size_t n = (size_t)1 << bench_bits;
+	uint64_t *keys = malloc(n * sizeof(uint64_t));
+	size_t *idx = malloc(n * sizeof(size_t));
+	for (size_t i = 0; i < n; i++) {
+		keys[i] = hash_u64(i, 1);
+	}
+	EXPECT_EQ(0, INSERT_HASH_BATCH(&ii, keys, n, idx, NULL));
+	for (size_t i = 0; i < n; i++) {
+		ii.values[idx[i]] = i;
+	}
+	// look them up in a different order to how they were added
+	for (size_t i = 0; i < n; i++) {
+		keys[i] = hash_u64((i * 7919) & (n - 1), 1);
+	}
+
+	struct timer t;
+	uint64_t sum = 0;
+	start_timer(&t);
+	for (size_t i = 0; i < n; i++) {
+		sum += ii.values[FIND_HASH(&ii, keys[i])];
+	}
+	double single = stop_timer(&t);
+
+	start_timer(&t);
+	for (size_t i = 0; i < n; i += 1024) {
+		size_t num = n - i < 1024 ? n - i : 1024;
+		FIND_HASH_BATCH(&ii, keys + i, num, idx + i);
+		for (size_t j = 0; j < num; j++) {
+			sum -= ii.values[idx[i + j]];
+		}
+	}
+	double batch = stop_timer(&t);
+	EXPECT_EQ(0, sum);
+
+	LOG(log, "batch find|mode:%d|keys:%d|single nsPerKey:%.2f|batch nsPerKey:%.2f",
+		(int)mode, (int)n, single * 1e9 / n, batch * 1e9 / n);
+
+	free(keys);
+	free(idx);
+	FREE_HASH(&ii);
+}
+
+// Steady state churn as seen in connection tables. Each step removes
+// the oldest key and adds a new one.
+static void bench_churn(log_t *log, unsigned mode) {
+	struct {
+		hash_t h;
+		uint64_t *keys;
+		uint64_t *values;
+	} ii = { 0 };
+	ii.h.mode = mode;
+
+	size_t n = (size_t)1 << bench_bits;
+	bool added;
+	for (uint64_t i = 0; i < n; i++) {
+		size_t idx = INSERT_HASH(&ii, hash_u64(i, 2), &added);
+		ii.values[idx] = i;
+	}
+	size_t end = ii.h.end;
+
+	struct timer t;
+	uint64_t worst = 0;
+	start_timer(&t);
+	for (uint64_t i = n; i < 4 * n; i++) {
+		REMOVE_HASH(&ii, FIND_HASH(&ii, hash_u64(i - n, 2)));
+		uint64_t start = monotonic_ns();
+		size_t idx = INSERT_HASH(&ii, hash_u64(i, 2), &added);
+		uint64_t ns = monotonic_ns() - start;
+		worst = ns > worst ? ns : worst;
+		ii.values[idx] = i;
+	}
+	double secs = stop_timer(&t);
+
+	size_t found = 0;
+	for (uint64_t i = 3 * n; i < 4 * n; i++) {
+		size_t idx = FIND_HASH(&ii, hash_u64(i, 2));
+		found += idx < ii.h.end && ii.values[idx] == i;
+	}
+	EXPECT_EQ(n, found);
+	EXPECT_EQ(n, ii.h.size);
+	// the table never needs to grow to make room
+	EXPECT_EQ(end, ii.h.end);
+
+	LOG(log, "churn|mode:%d|keys:%d|nsPerOp:%.2f|worst insert us:%.1f",
+		(int)mode, (int)n, secs * 1e9 / (3 * n), worst / 1e3);
+	FREE_HASH(&ii);
+}
+
+// The probe length benchmark fills a quadratic probed table to 3/4 load
+// and reports how far each key had to probe from its home slot. It is
+// run with the hashes used before seeded hashing was added (the key
+// itself and h*31 over the bytes) and with the current ones.
+
+static uint64_t old_hash_bytes(const void *data, size_t size) {
+	const uint8_t *p = data;
+	size_t h = 0;
+	for (size_t i = 0; i < size; i++) {
+		h = (h << 5) - h + p[i];
+	}
+	return h;
+}
+
+static double probe_lengths(log_t *log, const char *name, const uint64_t *hashes, size_t n, size_t slots) {
+	uint8_t *used = calloc(slots, 1);
+	size_t hist[6] = { 0 };
+	size_t total = 0, max = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t mask = slots - 1;
+		size_t idx = (size_t)hashes[i] & mask;
+		size_t step = 0;
+		while (used[idx]) {
+			idx = (idx + (++step)) & mask;
+		}
+		used[idx] = 1;
+		total += step;
+		max = (step > max) ? step : max;
+		hist[step == 0 ? 0 : step < 2 ? 1 : step < 4 ? 2 : step < 8 ? 3 : step < 16 ? 4 : 5]++;
+	}
+	free(used);
+	double mean = (double)total / (double)n;
+	LOG(log, "probe length|keys:%s|mean:%.2f|max:%d|0:%d|1:%d|2-3:%d|4-7:%d|8-15:%d|16+:%d",
+		name, mean, (int)max,
+		(int)hist[0], (int)hist[1], (int)hist[2], (int)hist[3], (int)hist[4], (int)hist[5]);
+	return mean;
+}
+
+static void bench_probe_lengths(log_t *log) {
+	size_t slots = (size_t)1 << bench_bits;
+	size_t n = slots * 3 / 4;
+	uint64_t *hashes = malloc(n * sizeof(uint64_t));
+	char *strings = malloc(n * 32);
+	struct timer t;
+
+	// aligned pointers as handed out by malloc
+	uintptr_t base = (uintptr_t)hashes;
+	for (size_t i = 0; i < n; i++) {
+		hashes[i] = base + i * 48;
+	}
+	probe_lengths(log, "pointer (before)", hashes, n, slots);
+	for (size_t i = 0; i < n; i++) {
+		hashes[i] = hash_u64(base + i * 48, 0);
+	}
+	EXPECT_GT(4, probe_lengths(log, "pointer (after)", hashes, n, slots));
+
+	for (size_t i = 0; i < n; i++) {
+		hashes[i] = i;
+	}
+	probe_lengths(log, "sequential (before)", hashes, n, slots);
+	for (size_t i = 0; i < n; i++) {
+		hashes[i] = hash_u64(i, 0);
+	}
+	EXPECT_GT(4, probe_lengths(log, "sequential (after)", hashes, n, slots));
+
+	// paths like those returned from scandir_utf8
+	for (size_t i = 0; i < n; i++) {
+		snprintf(strings + i * 32, 32, "src/dir%d/file%d.c", (int)(i / 64), (int)(i % 64));
+	}
+	start_timer(&t);
+	for (size_t i = 0; i < n; i++) {
+		hashes[i] = old_hash_bytes(strings + i * 32, strlen(strings + i * 32));
+	}
+	LOG(log, "hash strings (before)|nsPerKey:%.2f", stop_timer(&t) * 1e9 / n);
+	probe_lengths(log, "string (before)", hashes, n, slots);
+	start_timer(&t);
+	for (size_t i = 0; i < n; i++) {
+		hashes[i] = hash_bytes(strings + i * 32, strlen(strings + i * 32), 0);
+	}
+	LOG(log, "hash strings (after)|nsPerKey:%.2f", stop_timer(&t) * 1e9 / n);
+	EXPECT_GT(4, probe_lengths(log, "string (after)", hashes, n, slots));
+
+	free(strings);
+	free(hashes);
+}
+
+static void test_seed(void) {
+	EXPECT_TRUE(hash_u64(1, 0) != hash_u64(1, 1));
+	EXPECT_TRUE(hash_bytes("foo", 3, 0) != hash_bytes("foo", 3, 1));
+	EXPECT_TRUE(hash_bytes("foo", 3, 0) != hash_bytes("foo", 2, 0));
+
+	// every length path must depend on every byte
+	uint8_t buf[100] = { 0 };
+	for (size_t sz = 1; sz < sizeof(buf); sz++) {
+		uint64_t h = hash_bytes(buf, sz, 0);
+		for (size_t i = 0; i < sz; i++) {
+			buf[i] = 1;
+			EXPECT_TRUE(h != hash_bytes(buf, sz, 0));
+			buf[i] = 0;
+		}
+	}
+
+	struct {
+		hash_t h;
+		uint32_t *keys;
+	} uu = { 0 };
+	uu.h.seed = 12345;
+	bool added;
+	for (uint32_t key = 0; key < 100; key++) {
+		INSERT_SET(&uu, key, &added);
+	}
+	for (uint32_t key = 0; key < 100; key++) {
+		EXPECT_GT(uu.h.end, FIND_SET(&uu, key));
+	}
+	FREE_SET(&uu);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_bits, 0, "bench-bits", "N", "log2 of the benchmark table size");
+	log_t *log = start_test(argc, argv);
+
+	test_seed();
+	bench_probe_lengths(log);
+	bench_batch(log, HASH_QUADRATIC);
+	bench_batch(log, HASH_GROUPED);
+	bench_batch(log, HASH_LINEAR);
+	bench_churn(log, HASH_QUADRATIC);
+	bench_churn(log, HASH_GROUPED);
+	bench_churn(log, HASH_LINEAR);
+
+	test_set(HASH_QUADRATIC);
+	test_remove(HASH_QUADRATIC);
+	test_blob(HASH_QUADRATIC);
+	test_blob(HASH_QUADRATIC | HASH_STORE_HASHES);
+	test_stored_hashes(HASH_QUADRATIC);
+	test_churn(HASH_QUADRATIC);
+	test_churn(HASH_QUADRATIC | HASH_INCREMENTAL);
+	test_incremental(HASH_QUADRATIC);
+	test_stable_finds(HASH_QUADRATIC);
+	test_batch(HASH_QUADRATIC);
+	test_batch(HASH_QUADRATIC | HASH_INCREMENTAL);
+
+	test_set(HASH_GROUPED);
+	test_remove(HASH_GROUPED);
+	test_blob(HASH_GROUPED);
+	test_blob(HASH_GROUPED | HASH_STORE_HASHES);
+	test_stored_hashes(HASH_GROUPED);
+	test_churn(HASH_GROUPED);
+	test_churn(HASH_GROUPED | HASH_STORE_HASHES);
+	test_churn(HASH_GROUPED | HASH_INCREMENTAL);
+	test_incremental(HASH_GROUPED);
+	test_incremental(HASH_GROUPED | HASH_STORE_HASHES);
+	test_stable_finds(HASH_GROUPED);
+	test_batch(HASH_GROUPED);
+	test_batch(HASH_GROUPED | HASH_STORE_HASHES);
+	test_batch(HASH_GROUPED | HASH_INCREMENTAL);
+
+	test_set(HASH_LINEAR);
+	test_remove(HASH_LINEAR);
+	test_blob(HASH_LINEAR);
+	test_blob(HASH_LINEAR | HASH_STORE_HASHES);
+	test_stored_hashes(HASH_LINEAR);
+	test_churn(HASH_LINEAR);
+	test_churn(HASH_LINEAR | HASH_STORE_HASHES);
+	test_churn(HASH_LINEAR | HASH_INCREMENTAL);
+	test_stable_finds(HASH_LINEAR);
+	test_long_runs();
+	test_batch(HASH_LINEAR);
+	test_batch(HASH_LINEAR | HASH_INCREMENTAL);
+
 	return finish_test();
 }
@@ -1,12 +1,17 @@
 #include "cutils/heap.h"
 #include "cutils/test.h"
 #include "cutils/log.h"
+#include "cutils/pool.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdlib.h>
 
 struct int_node {
 	struct heap_node hn;
 	int value;
 };
 
+static int bench_nodes = 10000;
 static int total_comparisons;
 static int int_node_before(const struct heap_node *a, const struct heap_node *b) {
 	struct int_node *ia = container_of(a, struct int_node, hn);
@@ -50,13 +55,76 @@ static void update(log_t *log, struct heap *h, struct int_node *in) {
 	log_heap(log, h);
 }
 
-static void remove(log_t *log, struct heap *h, struct int_node *in) {
+static void remove_node(log_t *log, struct heap *h, struct int_node *in) {
 	LOG(log, "remove %d", in->value);
 	heap_remove(h, &in->hn);
 	log_heap(log, h);
 }
 
+static uint32_t bench_rand(uint32_t *seed) {
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+struct bench_node {
+	struct heap_node hn;
+	uint64_t value;
+};
+
+static int bench_node_before(const struct heap_node *a, const struct heap_node *b) {
+	struct bench_node *ba = container_of(a, struct bench_node, hn);
+	struct bench_node *bb = container_of(b, struct bench_node, hn);
+	return ba->value < bb->value;
+}
+
+// timer like churn, the earliest node is removed and a later one added
+static double bench_churn(pool_t *pool, uint64_t *psum) {
+	struct heap h = HEAP_INIT(&bench_node_before);
+	uint32_t seed = 1;
+	struct timer t;
+	start_timer(&t);
+	for (int i = 0; i < bench_nodes; i++) {
+		struct bench_node *in = pool ? POOL_NEW(pool, struct bench_node) : malloc(sizeof(*in));
+		in->value = bench_rand(&seed) % ((uint64_t)bench_nodes * 16);
+		heap_insert(&h, &in->hn);
+	}
+	uint64_t sum = 0;
+	for (int i = 0; i < bench_nodes * 4; i++) {
+		struct bench_node *in = container_of(h.head, struct bench_node, hn);
+		uint64_t value = in->value;
+		sum += value;
+		heap_remove(&h, &in->hn);
+		pool ? put_pool(pool, in) : free(in);
+		in = pool ? POOL_NEW(pool, struct bench_node) : malloc(sizeof(*in));
+		in->value = value + bench_rand(&seed) % ((uint64_t)bench_nodes * 16);
+		heap_insert(&h, &in->hn);
+	}
+	while (h.head) {
+		struct bench_node *in = container_of(h.head, struct bench_node, hn);
+		heap_remove(&h, &in->hn);
+		pool ? put_pool(pool, in) : free(in);
+	}
+	*psum = sum;
+	return stop_timer(&t);
+}
+
+static void bench_alloc(log_t *log) {
+	pool_t pool;
+	INIT_POOL(&pool, struct bench_node);
+	uint64_t sum1, sum2;
+	double libc = bench_churn(NULL, &sum1);
+	double pooled = bench_churn(&pool, &sum2);
+	EXPECT_EQ(sum1, sum2);
+	// an insert and remove for each node plus a remove and insert for
+	// each step of the churn
+	double ops = (double)bench_nodes * 10;
+	LOG(log, "heap churn|nodes:%d|mallocNsPerOp:%.1f|poolNsPerOp:%.1f",
+		bench_nodes, libc * 1e9 / ops, pooled * 1e9 / ops);
+	free_pool(&pool);
+}
+
 int main(int argc, const char *argv[]) {
+	flag_int(&bench_nodes, 0, "bench-nodes", "N", "number of nodes in the benchmark");
 	log_t *log = start_test(argc, argv);
 	struct heap h = HEAP_INIT(&int_node_before);
 	struct int_node n[30];
@@ -79,13 +147,13 @@ int main(int argc, const char *argv[]) {
 	struct int_node u;
 	u.value = 15;
 	insert(log, &h, &u);
-	remove(log, &h, container_of(h.head, struct int_node, hn));
+	remove_node(log, &h, container_of(h.head, struct int_node, hn));
 	u.value = 31;
 	update(log, &h, &u);
 
-	remove(log, &h, n+13);
+	remove_node(log, &h, n+13);
 	while (h.size > 10) {
-		remove(log, &h, container_of(h.head, struct int_node, hn));
+		remove_node(log, &h, container_of(h.head, struct int_node, hn));
 	}
 	insert(log, &h, n+27);
 	insert(log, &h, n+28);
@@ -98,8 +166,10 @@ int main(int argc, const char *argv[]) {
 	insert(log, &h, n+9);
 	insert(log, &h, n+10);
 	while (h.size) {
-		remove(log, &h, container_of(h.head, struct int_node, hn));
+		remove_node(log, &h, container_of(h.head, struct int_node, hn));
 	}
 	LOG(log, "total comparisons %d", total_comparisons);
+
+	bench_alloc(log);
 	return finish_test();
 }
@@ -0,0 +1,173 @@
+#include "cutils/intern.h"
+#include "cutils/vector.h"
+#include "cutils/endian.h"
+#include "cutils/thread.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_SIZE 0x10000 // 64 KB
+#define DEFAULT_SHARDS 16
+#define HDR 8
+
+void init_intern(intern_t *t, allocator_t *parent) {
+	memset(t, 0, sizeof(*t));
+	init_arena(&t->arena, parent, PAGE_SIZE + 64);
+	t->set.h.mode = HASH_GROUPED;
+}
+
+void free_intern(intern_t *t) {
+	free_arena(&t->arena);
+	FREE_SET(&t->set);
+	free(t->strings.v);
+	memset(t, 0, sizeof(*t));
+}
+
+size_t intern_memory(const intern_t *t) {
+	return arena_memory(&t->arena) + SET_MEMORY(&t->set) + t->strings.cap * sizeof(t->strings.v[0]);
+}
+
+// Strings are packed into pages with 4B alignment. Large strings get an
+// arena allocation of their own so that they don't waste the rest of the
+// current page.
+static char *alloc_string(intern_t *t, size_t size) {
+	size_t need = ALIGN_UP(HDR + size + 1, 4);
+	if (need > (size_t)(t->end - t->next)) {
+		if (need > PAGE_SIZE / 4) {
+			return arena_alloc(&t->arena, need);
+		}
+		char *p = arena_alloc(&t->arena, PAGE_SIZE);
+		if (!p) {
+			return NULL;
+		}
+		t->next = p;
+		t->end = p + PAGE_SIZE;
+	}
+	char *p = t->next;
+	t->next += need;
+	return p;
+}
+
+const char *find_intern(intern_t *t, const void *data, size_t size) {
+	size_t idx = FIND_BLOB_SET(&t->set, data, size);
+	return idx < t->set.h.end ? (const char*)t->set.keys[idx].data : NULL;
+}
+
+const char *intern(intern_t *t, const void *data, size_t size) {
+	if (size >= UINT32_MAX) {
+		return NULL;
+	}
+	bool added;
+	size_t idx = INSERT_BLOB_SET(&t->set, data, size, &added);
+	if (idx == t->set.h.end) {
+		return NULL;
+	} else if (!added) {
+		return (const char*)t->set.keys[idx].data;
+	}
+
+	// the key points at the caller's data until it's replaced by the copy
+	size_t id = t->strings.size;
+	char *p = alloc_string(t, size);
+	const char **pv = p && (id << t->id_shift) < UINT32_MAX ? APPEND(&t->strings) : NULL;
+	if (!pv) {
+		REMOVE_HASH(&t->set, idx);
+		return NULL;
+	}
+
+	uint32_t hdr[2] = {(uint32_t)(id << t->id_shift) | t->id_tag, (uint32_t)size};
+	memcpy(p, hdr, HDR);
+	p += HDR;
+	memcpy(p, data, size);
+	p[size] = 0;
+	t->set.keys[idx].data = p;
+	*pv = p;
+	return p;
+}
+
+struct cintern_shard {
+	mtx_t lock;
+	intern_t t;
+	// keep each shard's lock off the neighbour's cache line
+	char pad[64];
+};
+
+int init_cintern(cintern_t *c, size_t shards, uint64_t seed) {
+	size_t n = 1;
+	unsigned shift = 0;
+	while (n < (shards ? shards : DEFAULT_SHARDS)) {
+		n *= 2;
+		shift++;
+	}
+	c->shards = calloc(n, sizeof(struct cintern_shard));
+	if (!c->shards) {
+		return -1;
+	}
+	c->mask = n - 1;
+	c->seed = seed;
+	for (size_t i = 0; i < n; i++) {
+		struct cintern_shard *s = &c->shards[i];
+		if (mtx_init(&s->lock, mtx_plain) != thrd_success) {
+			while (i-- > 0) {
+				mtx_destroy(&c->shards[i].lock);
+			}
+			free(c->shards);
+			c->shards = NULL;
+			return -1;
+		}
+		init_intern(&s->t, NULL);
+		s->t.set.h.seed = seed;
+		s->t.id_shift = shift;
+		s->t.id_tag = (uint32_t)i;
+	}
+	return 0;
+}
+
+void free_cintern(cintern_t *c) {
+	for (size_t i = 0; c->shards && i <= c->mask; i++) {
+		free_intern(&c->shards[i].t);
+		mtx_destroy(&c->shards[i].lock);
+	}
+	free(c->shards);
+	c->shards = NULL;
+}
+
+size_t cintern_memory(cintern_t *c) {
+	size_t ret = (c->mask + 1) * sizeof(struct cintern_shard);
+	for (size_t i = 0; i <= c->mask; i++) {
+		struct cintern_shard *s = &c->shards[i];
+		mtx_lock(&s->lock);
+		ret += intern_memory(&s->t);
+		mtx_unlock(&s->lock);
+	}
+	return ret;
+}
+
+static struct cintern_shard *get_shard(cintern_t *c, const void *data, size_t size) {
+	// the shard tables use the low bits for the slot and the top bits
+	// for the control byte tag
+	uint64_t hash = hash_bytes(data, size, c->seed);
+	return &c->shards[(size_t)(hash >> 32) & c->mask];
+}
+
+const char *cintern(cintern_t *c, const void *data, size_t size) {
+	struct cintern_shard *s = get_shard(c, data, size);
+	mtx_lock(&s->lock);
+	const char *ret = intern(&s->t, data, size);
+	mtx_unlock(&s->lock);
+	return ret;
+}
+
+const char *find_cintern(cintern_t *c, const void *data, size_t size) {
+	struct cintern_shard *s = get_shard(c, data, size);
+	mtx_lock(&s->lock);
+	const char *ret = find_intern(&s->t, data, size);
+	mtx_unlock(&s->lock);
+	return ret;
+}
+
+const char *cintern_lookup(cintern_t *c, uint32_t id) {
+	struct cintern_shard *s = &c->shards[id & c->mask];
+	mtx_lock(&s->lock);
+	const char *ret = id >> s->t.id_shift < s->t.strings.size ? intern_lookup(&s->t, id) : NULL;
+	mtx_unlock(&s->lock);
+	return ret;
+}
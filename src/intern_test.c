@@ -0,0 +1,197 @@
+#include "cutils/intern.h"
+#include "cutils/thread.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include "cutils/str.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int bench_paths = 200000;
+
+// paths as found in an archive, many sharing the same directories
+static void make_path(char *buf, size_t bufsz, uint64_t v) {
+	static const char *dirs[] = {"src", "include", "docs", "test", "lib", "share/man", "bin"};
+	snprintf(buf, bufsz, "project/%s/module%d/file%d.c", dirs[v % 7], (int)(v / 7 % 50), (int)(v / 350 % 100));
+}
+
+static void test_basic(void) {
+	intern_t t;
+	init_intern(&t, NULL);
+
+	const char *foo = INTERN(&t, "foo");
+	const char *bar = INTERN(&t, "bar");
+	const char *empty = intern(&t, "", 0);
+	EXPECT_STREQ("foo", foo);
+	EXPECT_STREQ("bar", bar);
+	EXPECT_STREQ("", empty);
+	EXPECT_EQ(3, intern_len(foo));
+	EXPECT_EQ(0, intern_len(empty));
+	EXPECT_EQ(0, intern_id(foo));
+	EXPECT_EQ(1, intern_id(bar));
+	EXPECT_EQ(2, intern_id(empty));
+
+	// the same string gives the same pointer wherever it comes from
+	char buf[] = "foobar";
+	EXPECT_PTREQ(foo, intern(&t, buf, 3));
+	EXPECT_PTREQ(bar, intern(&t, buf + 3, 3));
+	EXPECT_PTREQ(foo, find_intern(&t, buf, 3));
+	EXPECT_PTREQ(NULL, find_intern(&t, buf, 6));
+	EXPECT_PTREQ(NULL, find_intern(&t, "fo", 2));
+	EXPECT_PTREQ(bar, intern_lookup(&t, 1));
+
+	// embedded nulls are part of the key
+	const char *nul = intern(&t, "a\0b", 3);
+	EXPECT_EQ(3, intern_len(nul));
+	EXPECT_PTREQ(nul, intern(&t, "a\0b", 3));
+	EXPECT_TRUE(nul != INTERN(&t, "a"));
+
+	// large strings are stored whole
+	str_t big = STR_INIT;
+	while (big.len < 100000) {
+		str_add(&big, "0123456789");
+	}
+	const char *pbig = intern(&t, big.c_str, big.len);
+	EXPECT_EQ(big.len, intern_len(pbig));
+	EXPECT_STREQ(big.c_str, pbig);
+	EXPECT_PTREQ(pbig, intern(&t, big.c_str, big.len));
+	str_destroy(&big);
+
+	free_intern(&t);
+}
+
+static void test_many(void) {
+	intern_t t;
+	init_intern(&t, NULL);
+
+	char buf[128];
+	const char **ptrs = calloc(35000, sizeof(char*));
+	for (uint64_t i = 0; i < 35000; i++) {
+		make_path(buf, sizeof(buf), i);
+		ptrs[i] = INTERN(&t, buf);
+		EXPECT_STREQ(buf, ptrs[i]);
+	}
+	EXPECT_EQ(35000, t.strings.size);
+
+	// earlier pointers stay valid as the table grows
+	for (uint64_t i = 0; i < 35000; i++) {
+		make_path(buf, sizeof(buf), i);
+		EXPECT_STREQ(buf, ptrs[i]);
+		EXPECT_PTREQ(ptrs[i], INTERN(&t, buf));
+		EXPECT_PTREQ(ptrs[i], intern_lookup(&t, intern_id(ptrs[i])));
+		EXPECT_EQ(i, intern_id(ptrs[i]));
+	}
+	EXPECT_EQ(35000, t.strings.size);
+
+	free(ptrs);
+	free_intern(&t);
+}
+
+struct racer {
+	cintern_t *c;
+	const char **ptrs;
+	int start, num;
+};
+
+static int race_interner(void *udata) {
+	struct racer *r = udata;
+	char buf[128];
+	for (int i = 0; i < r->num; i++) {
+		int k = (r->start + i) % r->num;
+		make_path(buf, sizeof(buf), k);
+		r->ptrs[k] = CINTERN(r->c, buf);
+	}
+	return 0;
+}
+
+static void test_concurrent(void) {
+	cintern_t c;
+	EXPECT_EQ(0, init_cintern(&c, 8, 1234));
+
+	// each thread interns the same strings in a different order
+	enum {THREADS = 4, NUM = 5000};
+	thrd_t thrd[THREADS];
+	struct racer r[THREADS];
+	for (int i = 0; i < THREADS; i++) {
+		r[i].c = &c;
+		r[i].ptrs = calloc(NUM, sizeof(char*));
+		r[i].start = i * NUM / THREADS;
+		r[i].num = NUM;
+		EXPECT_EQ(thrd_success, thrd_create(&thrd[i], &race_interner, &r[i]));
+	}
+	for (int i = 0; i < THREADS; i++) {
+		thrd_join(thrd[i], NULL);
+	}
+
+	char buf[128];
+	for (int k = 0; k < NUM; k++) {
+		make_path(buf, sizeof(buf), k);
+		const char *p = r[0].ptrs[k];
+		EXPECT_STREQ(buf, p);
+		for (int i = 1; i < THREADS; i++) {
+			EXPECT_PTREQ(p, r[i].ptrs[k]);
+		}
+		EXPECT_PTREQ(p, find_cintern(&c, buf, strlen(buf)));
+		EXPECT_PTREQ(p, cintern_lookup(&c, intern_id(p)));
+	}
+	EXPECT_PTREQ(NULL, find_cintern(&c, "missing", 7));
+	EXPECT_TRUE(cintern_memory(&c) > 0);
+
+	for (int i = 0; i < THREADS; i++) {
+		free(r[i].ptrs);
+	}
+	free_cintern(&c);
+}
+
+// interning paths that repeat against keeping a copy of each
+static void bench_intern(log_t *log) {
+	char buf[128];
+	uint64_t seed = 5;
+	struct timer t;
+
+	start_timer(&t);
+	intern_t in;
+	init_intern(&in, NULL);
+	for (int i = 0; i < bench_paths; i++) {
+		make_path(buf, sizeof(buf), test_rand(&seed));
+		INTERN(&in, buf);
+	}
+	double interns = stop_timer(&t);
+
+	seed = 5;
+	size_t copied = 0;
+	char **copies = malloc(bench_paths * sizeof(char*));
+	start_timer(&t);
+	for (int i = 0; i < bench_paths; i++) {
+		make_path(buf, sizeof(buf), test_rand(&seed));
+		size_t len = strlen(buf);
+		copies[i] = malloc(len + 1);
+		memcpy(copies[i], buf, len + 1);
+		// allocations are rounded up to 16B with an 8B header
+		copied += (len + 1 + 8 + 15) & ~(size_t)15;
+	}
+	double copys = stop_timer(&t);
+
+	LOG(log, "intern paths|paths:%d|distinct:%d|internNs:%.1f|copyNs:%.1f|internKB:%.0f|copyKB:%.0f",
+		bench_paths, (int)in.strings.size, interns * 1e9 / bench_paths, copys * 1e9 / bench_paths,
+		intern_memory(&in) / 1e3, (copied + bench_paths * sizeof(char*)) / 1e3);
+
+	for (int i = 0; i < bench_paths; i++) {
+		free(copies[i]);
+	}
+	free(copies);
+	free_intern(&in);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_paths, 0, "bench-paths", "N", "number of paths in the benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_basic();
+	test_many();
+	test_concurrent();
+	bench_intern(log);
+
+	return finish_test();
+}
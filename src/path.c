@@ -88,7 +88,7 @@ int clean_path(enum path_type type, char *s, size_t *len) {
 			}
 		} else {
 			// copy over the valid segment
-			memcpy(to, seg_start, seg_end - seg_start);
+			memmove(to, seg_start, seg_end - seg_start);
 			to += seg_end - seg_start;
 			if (has_trailing_slash) {
 				// 0. Replace windows style \\ with /
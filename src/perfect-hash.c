@@ -0,0 +1,326 @@
+#include "cutils/perfect-hash.h"
+#include "cutils/endian.h"
+#include "cutils/vector.h"
+#include <stdlib.h>
+#include <string.h>
+
+// File layout, all offsets from the start of the file
+//
+// 0   "CUPHASH1"
+// 8   u32 key size (4, 8 or 0 for blobs)
+// 12  u32 value size
+// 16  u64 number of entries
+// 24  u64 seed
+// 32  u64 number of buckets
+// 40  u64 offset of the keys
+// 48  u64 offset of the values
+// 56  u64 offset of the string pool
+// 64  u32 pilot per bucket
+//
+// Keys are stored as little endian integers or as a u32 offset into the
+// string pool followed by a u32 length. Keys and values are 8B aligned.
+
+#define HEADER_SIZE 64
+#define BUCKET_SIZE 4
+#define MAX_ATTEMPTS 16
+
+static const char magic[8] = {'C', 'U', 'P', 'H', 'A', 'S', 'H', '1'};
+
+// same layout as the table types in hash.h
+struct table {
+	hash_t h;
+	uint8_t *keys, *values;
+};
+
+struct entry {
+	uint64_t hash;
+	uint32_t bucket, bucketsz;
+	size_t idx;
+};
+
+static inline size_t hash_bucket(uint64_t hash, size_t nbuckets) {
+	return (size_t) (((hash & UINT32_MAX) * nbuckets) >> 32);
+}
+
+// The multiply is needed so that the slots of keys in the same bucket
+// don't differ by a fixed pattern for every pilot.
+static inline size_t hash_slot(uint64_t hash, uint64_t pilot, size_t num) {
+	uint64_t x = (hash ^ pilot) * UINT64_C(0x9E3779B97F4A7C15);
+	return (size_t) (((x >> 32) * num) >> 32);
+}
+
+static uint64_t table_key(const struct table *t, size_t keysz, size_t idx, blob_t *pblob) {
+	if (keysz == 4) {
+		uint32_t k;
+		memcpy(&k, t->keys + idx * 4, 4);
+		return k;
+	} else if (keysz == 8) {
+		uint64_t k;
+		memcpy(&k, t->keys + idx * 8, 8);
+		return k;
+	} else {
+		memcpy(pblob, t->keys + idx * keysz, sizeof(*pblob));
+		return pblob->size;
+	}
+}
+
+static int cmp_entry(const void *a, const void *b) {
+	const struct entry *ea = a, *eb = b;
+	if (ea->bucketsz != eb->bucketsz) {
+		return ea->bucketsz > eb->bucketsz ? -1 : 1;
+	}
+	return ea->bucket < eb->bucket ? -1 : (ea->bucket > eb->bucket);
+}
+
+// Places the buckets largest first, searching for a pilot that moves all
+// of the bucket's keys onto free slots. Later buckets are small, so they
+// usually find room even when the table is nearly full.
+static int place_buckets(struct entry *e, size_t num, uint64_t seed, uint32_t *pilots, uint32_t *slots, uint8_t *taken) {
+	uint64_t limit = (uint64_t) num * 8 + 1024;
+	if (limit > UINT32_MAX) {
+		limit = UINT32_MAX;
+	}
+	memset(taken, 0, num);
+
+	for (size_t i = 0; i < num;) {
+		size_t j = i + e[i].bucketsz;
+		uint32_t p;
+		for (p = 0;; p++) {
+			if (p == limit) {
+				return -1;
+			}
+			uint64_t ph = hash_u64(p, seed);
+			size_t k;
+			for (k = i; k < j; k++) {
+				size_t s = hash_slot(e[k].hash, ph, num);
+				if (taken[s]) {
+					break;
+				}
+				taken[s] = 1;
+				slots[k] = (uint32_t) s;
+			}
+			if (k == j) {
+				break;
+			}
+			while (k > i) {
+				taken[slots[--k]] = 0;
+			}
+		}
+		pilots[e[i].bucket] = p;
+		i = j;
+	}
+	return 0;
+}
+
+static int build(struct table *t, size_t keysz, size_t num, size_t nbuckets, uint64_t *pseed, struct entry *e, uint32_t *pilots, uint32_t *slots, uint32_t *counts) {
+	uint64_t seed = *pseed;
+	for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+		memset(counts, 0, nbuckets * sizeof(counts[0]));
+		memset(pilots, 0, nbuckets * sizeof(pilots[0]));
+
+		size_t idx = SIZE_MAX, n = 0;
+		while (next_hash(&t->h, &idx)) {
+			blob_t b;
+			uint64_t key = table_key(t, keysz, idx, &b);
+			e[n].hash = (keysz == 4 || keysz == 8) ? hash_u64(key, seed) : hash_bytes(b.data, b.size, seed);
+			e[n].bucket = (uint32_t) hash_bucket(e[n].hash, nbuckets);
+			e[n].idx = idx;
+			counts[e[n].bucket]++;
+			n++;
+		}
+		for (size_t i = 0; i < num; i++) {
+			e[i].bucketsz = counts[e[i].bucket];
+		}
+		qsort(e, num, sizeof(e[0]), &cmp_entry);
+
+		// reuse counts as the taken flags
+		if (!place_buckets(e, num, seed, pilots, slots, (uint8_t*) counts)) {
+			*pseed = seed;
+			return 0;
+		}
+
+		// most likely two keys with the same hash, try again with a new seed
+		seed = hash_u64(seed, attempt + 1);
+	}
+	return -1;
+}
+
+int write_perfect_hash(FILE *f, hash_t *h, size_t keysz, size_t valsz, uint64_t seed) {
+	struct table *t = (struct table*) h;
+	size_t num = h->size;
+	size_t nbuckets = num / BUCKET_SIZE + 1;
+	bool blob = keysz != 4 && keysz != 8;
+	if ((uint64_t) num > UINT32_MAX || valsz > UINT32_MAX) {
+		return -1;
+	}
+
+	size_t strsz = 0;
+	if (blob) {
+		size_t idx = SIZE_MAX;
+		while (next_hash(h, &idx)) {
+			blob_t b;
+			table_key(t, keysz, idx, &b);
+			strsz += b.size;
+		}
+		if ((uint64_t) strsz > UINT32_MAX) {
+			return -1;
+		}
+	}
+
+	size_t entsz = blob ? 8 : keysz;
+	size_t keysoff = ALIGN_UP(HEADER_SIZE + nbuckets * 4, 8);
+	size_t valoff = ALIGN_UP(keysoff + num * entsz, 8);
+	size_t stroff = ALIGN_UP(valoff + num * valsz, 8);
+	size_t filesz = stroff + strsz;
+
+	struct entry *e = malloc(num * sizeof(*e) + 1);
+	uint32_t *slots = malloc(num * sizeof(*slots) + 1);
+	// counts is also used for the taken flags, so needs num bytes
+	uint32_t *counts = malloc(nbuckets * sizeof(*counts) + num);
+	uint8_t *buf = calloc(1, filesz);
+	int ret = -1;
+	if (!e || !slots || !counts || !buf) {
+		goto end;
+	}
+
+	uint32_t *pilots = (uint32_t*) (buf + HEADER_SIZE);
+	if (build(t, keysz, num, nbuckets, &seed, e, pilots, slots, counts)) {
+		goto end;
+	}
+	for (size_t i = 0; i < nbuckets; i++) {
+		write_little_32(buf + HEADER_SIZE + i * 4, pilots[i]);
+	}
+
+	size_t stroff_next = 0;
+	for (size_t i = 0; i < num; i++) {
+		uint8_t *pk = buf + keysoff + (size_t) slots[i] * entsz;
+		blob_t b;
+		uint64_t key = table_key(t, keysz, e[i].idx, &b);
+		if (keysz == 4) {
+			write_little_32(pk, (uint32_t) key);
+		} else if (keysz == 8) {
+			write_little_64(pk, key);
+		} else {
+			write_little_32(pk, (uint32_t) stroff_next);
+			write_little_32(pk + 4, (uint32_t) b.size);
+			if (b.size) {
+				memcpy(buf + stroff + stroff_next, b.data, b.size);
+			}
+			stroff_next += b.size;
+		}
+		if (valsz) {
+			memcpy(buf + valoff + (size_t) slots[i] * valsz, t->values + e[i].idx * valsz, valsz);
+		}
+	}
+
+	memcpy(buf, magic, 8);
+	write_little_32(buf + 8, blob ? 0 : (uint32_t) keysz);
+	write_little_32(buf + 12, (uint32_t) valsz);
+	write_little_64(buf + 16, num);
+	write_little_64(buf + 24, seed);
+	write_little_64(buf + 32, nbuckets);
+	write_little_64(buf + 40, keysoff);
+	write_little_64(buf + 48, valoff);
+	write_little_64(buf + 56, stroff);
+
+	if (fwrite(buf, 1, filesz, f) == filesz) {
+		ret = 0;
+	}
+
+end:
+	free(e);
+	free(slots);
+	free(counts);
+	free(buf);
+	return ret;
+}
+
+int load_perfect_hash(perfect_hash_t *p, const void *data, size_t size) {
+	const uint8_t *d = data;
+	memset(p, 0, sizeof(*p));
+	if (size < HEADER_SIZE || memcmp(d, magic, 8)) {
+		return -1;
+	}
+	uint32_t keysz = little_32(d + 8);
+	uint32_t valsz = little_32(d + 12);
+	uint64_t num = little_64(d + 16);
+	uint64_t nbuckets = little_64(d + 32);
+	uint64_t keysoff = little_64(d + 40);
+	uint64_t valoff = little_64(d + 48);
+	uint64_t stroff = little_64(d + 56);
+	uint64_t entsz = keysz ? keysz : 8;
+
+	if ((keysz != 0 && keysz != 4 && keysz != 8)
+		|| num > UINT32_MAX
+		|| nbuckets == 0 || nbuckets > UINT32_MAX
+		|| (keysoff & 7) || (valoff & 7)
+		|| keysoff < HEADER_SIZE + nbuckets * 4
+		|| valoff < keysoff || valoff - keysoff < num * entsz
+		|| stroff < valoff || stroff - valoff < num * valsz
+		|| stroff > size) {
+		return -1;
+	}
+
+	p->pilots = d + HEADER_SIZE;
+	p->keys = d + keysoff;
+	p->values = d + valoff;
+	p->strings = d + stroff;
+	p->strings_size = size - (size_t) stroff;
+	p->num = (size_t) num;
+	p->nbuckets = (size_t) nbuckets;
+	p->seed = little_64(d + 24);
+	p->keysz = keysz;
+	p->valsz = valsz;
+	return 0;
+}
+
+int open_perfect_hash(perfect_hash_t *p, const char *fn) {
+	mapped_file mf;
+	if (map_file(&mf, fn)) {
+		return -1;
+	}
+	if (load_perfect_hash(p, mf.data, mf.size)) {
+		unmap_file(&mf);
+		return -1;
+	}
+	p->mf = mf;
+	return 0;
+}
+
+void close_perfect_hash(perfect_hash_t *p) {
+	unmap_file(&p->mf);
+}
+
+size_t find_perfect_hash(const perfect_hash_t *p, uint64_t key, const void *blob) {
+	if (!p->num) {
+		return 0;
+	}
+	uint64_t hash;
+	if (!p->keysz) {
+		hash = hash_bytes(blob, (size_t) key, p->seed);
+	} else {
+		if (p->keysz == 4) {
+			key = (uint32_t) key;
+		}
+		hash = hash_u64(key, p->seed);
+	}
+
+	uint32_t pilot = little_32(p->pilots + hash_bucket(hash, p->nbuckets) * 4);
+	size_t idx = hash_slot(hash, hash_u64(pilot, p->seed), p->num);
+
+	switch (p->keysz) {
+	case 4:
+		return little_32(p->keys + idx * 4) == key ? idx : p->num;
+	case 8:
+		return little_64(p->keys + idx * 8) == key ? idx : p->num;
+	default: {
+		const uint8_t *pk = p->keys + idx * 8;
+		size_t off = little_32(pk);
+		size_t len = little_32(pk + 4);
+		if (len != key || off > p->strings_size || len > p->strings_size - off) {
+			return p->num;
+		}
+		return (!len || !memcmp(p->strings + off, blob, len)) ? idx : p->num;
+	}
+	}
+}
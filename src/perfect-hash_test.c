@@ -0,0 +1,251 @@
+#include "cutils/perfect-hash.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int bench_bits = 16;
+static bool added;
+
+struct u64_map {
+	hash_t h;
+	uint64_t *keys;
+	uint32_t *values;
+};
+
+struct blob_map {
+	hash_t h;
+	blob_t *keys;
+	int *values;
+};
+
+struct u32_set {
+	hash_t h;
+	uint32_t *keys;
+};
+
+// writes the table out to a temp file and reads the bytes back
+static uint8_t *write_temp(hash_t *h, size_t keysz, size_t valsz, size_t *psize) {
+	FILE *f = tmpfile();
+	EXPECT_TRUE(f != NULL);
+	EXPECT_EQ(0, write_perfect_hash(f, h, keysz, valsz, 1234));
+	long sz = ftell(f);
+	EXPECT_GT(sz, 0);
+	uint8_t *buf = malloc(sz);
+	rewind(f);
+	EXPECT_EQ(sz, fread(buf, 1, sz, f));
+	fclose(f);
+	*psize = sz;
+	return buf;
+}
+
+static uint64_t test_key(uint64_t i) {
+	return i * 0x9E3779B97F4A7C15 + 17;
+}
+
+static void test_ints(void) {
+	struct u64_map m = {0};
+	m.h.mode = HASH_GROUPED;
+	for (uint32_t i = 0; i < 10000; i++) {
+		size_t idx = INSERT_HASH(&m, test_key(i), &added);
+		m.values[idx] = i;
+	}
+
+	size_t sz;
+	uint8_t *buf = write_temp(&m.h, sizeof(m.keys[0]), sizeof(m.values[0]), &sz);
+	perfect_hash_t p;
+	EXPECT_EQ(0, load_perfect_hash(&p, buf, sz));
+	EXPECT_EQ(10000, p.num);
+
+	// every slot is used exactly once
+	static uint8_t seen[10000];
+	for (uint32_t i = 0; i < 10000; i++) {
+		size_t idx = FIND_PERFECT_HASH(&p, test_key(i));
+		EXPECT_GT(p.num, idx);
+		EXPECT_EQ(0, seen[idx]++);
+		uint32_t v;
+		memcpy(&v, perfect_hash_value(&p, idx), sizeof(v));
+		EXPECT_EQ(i, v);
+	}
+	for (uint32_t i = 10000; i < 20000; i++) {
+		EXPECT_EQ(p.num, FIND_PERFECT_HASH(&p, test_key(i)));
+	}
+
+	close_perfect_hash(&p);
+	free(buf);
+	FREE_HASH(&m);
+}
+
+static void test_set(void) {
+	struct u32_set s = {0};
+	for (uint32_t i = 0; i < 1000; i++) {
+		INSERT_SET(&s, i * 3, &added);
+	}
+
+	size_t sz;
+	uint8_t *buf = write_temp(&s.h, sizeof(s.keys[0]), 0, &sz);
+	perfect_hash_t p;
+	EXPECT_EQ(0, load_perfect_hash(&p, buf, sz));
+	EXPECT_EQ(4, p.keysz);
+	EXPECT_EQ(0, p.valsz);
+	for (uint32_t i = 0; i < 3000; i++) {
+		EXPECT_EQ(i % 3 == 0, FIND_PERFECT_HASH(&p, i) < p.num);
+	}
+	// high bits are dropped for 4B keys as with hash_t
+	EXPECT_GT(p.num, FIND_PERFECT_HASH(&p, UINT64_C(0x100000000) + 3));
+
+	free(buf);
+	FREE_SET(&s);
+}
+
+static void test_blob(void) {
+	struct blob_map m = {0};
+	static char names[500][32];
+	for (int i = 0; i < 500; i++) {
+		int n = i ? sprintf(names[i], "dir/file-%d.txt", i) : 0;
+		size_t idx = INSERT_BLOB_HASH(&m, names[i], n, &added);
+		m.values[idx] = i;
+	}
+
+	size_t sz;
+	uint8_t *buf = write_temp(&m.h, sizeof(m.keys[0]), sizeof(m.values[0]), &sz);
+	FREE_HASH(&m);
+
+	// the file holds its own copy of the keys
+	char key[32];
+	memcpy(key, names[10], sizeof(key));
+	memset(names, 'x', sizeof(names));
+
+	perfect_hash_t p;
+	EXPECT_EQ(0, load_perfect_hash(&p, buf, sz));
+	EXPECT_EQ(0, p.keysz);
+	for (int i = 0; i < 500; i++) {
+		char name[32];
+		int n = i ? sprintf(name, "dir/file-%d.txt", i) : 0;
+		size_t idx = FIND_BLOB_PERFECT_HASH(&p, name, n);
+		EXPECT_GT(p.num, idx);
+		int v;
+		memcpy(&v, perfect_hash_value(&p, idx), sizeof(v));
+		EXPECT_EQ(i, v);
+	}
+	EXPECT_GT(p.num, FIND_BLOB_PERFECT_HASH(&p, key, strlen(key)));
+	EXPECT_EQ(p.num, FIND_BLOB_PERFECT_HASH(&p, "dir/file-500.txt", 16));
+	EXPECT_EQ(p.num, FIND_BLOB_PERFECT_HASH(&p, "dir/file-10.tx", 14));
+
+	free(buf);
+}
+
+static void test_invalid(void) {
+	struct u64_map m = {0};
+	perfect_hash_t p;
+
+	// empty tables are valid
+	size_t sz;
+	uint8_t *buf = write_temp(&m.h, sizeof(m.keys[0]), sizeof(m.values[0]), &sz);
+	EXPECT_EQ(0, load_perfect_hash(&p, buf, sz));
+	EXPECT_EQ(0, p.num);
+	EXPECT_EQ(0, FIND_PERFECT_HASH(&p, 3));
+	free(buf);
+
+	for (uint32_t i = 0; i < 100; i++) {
+		size_t idx = INSERT_HASH(&m, i, &added);
+		m.values[idx] = i;
+	}
+	buf = write_temp(&m.h, sizeof(m.keys[0]), sizeof(m.values[0]), &sz);
+	EXPECT_EQ(-1, load_perfect_hash(&p, buf, 63));
+	EXPECT_EQ(-1, load_perfect_hash(&p, buf, sz - 1));
+	buf[0] = 'X';
+	EXPECT_EQ(-1, load_perfect_hash(&p, buf, sz));
+	free(buf);
+	FREE_HASH(&m);
+
+	EXPECT_EQ(-1, open_perfect_hash(&p, "does-not-exist.phash"));
+}
+
+static void test_mapped(void) {
+	struct u64_map m = {0};
+	for (uint32_t i = 0; i < 1000; i++) {
+		size_t idx = INSERT_HASH(&m, test_key(i), &added);
+		m.values[idx] = i;
+	}
+
+	const char *fn = "test_perfect-hash.phash";
+	FILE *f = fopen(fn, "wb");
+	EXPECT_TRUE(f != NULL);
+	EXPECT_EQ(0, WRITE_PERFECT_HASH(f, &m, 99));
+	fclose(f);
+	FREE_HASH(&m);
+
+	perfect_hash_t p;
+	EXPECT_EQ(0, open_perfect_hash(&p, fn));
+	for (uint32_t i = 0; i < 1000; i++) {
+		size_t idx = FIND_PERFECT_HASH(&p, test_key(i));
+		EXPECT_GT(p.num, idx);
+		uint32_t v;
+		memcpy(&v, perfect_hash_value(&p, idx), sizeof(v));
+		EXPECT_EQ(i, v);
+	}
+	close_perfect_hash(&p);
+	remove(fn);
+}
+
+static void bench_lookup(log_t *log) {
+	struct u64_map m = {0};
+	m.h.mode = HASH_GROUPED;
+	size_t num = (size_t)1 << bench_bits;
+	for (size_t i = 0; i < num; i++) {
+		size_t idx = INSERT_HASH(&m, test_key(i), &added);
+		m.values[idx] = (uint32_t)i;
+	}
+
+	struct timer t;
+	start_timer(&t);
+	size_t sz;
+	uint8_t *buf = write_temp(&m.h, sizeof(m.keys[0]), sizeof(m.values[0]), &sz);
+	double build = stop_timer(&t);
+
+	perfect_hash_t p;
+	start_timer(&t);
+	EXPECT_EQ(0, load_perfect_hash(&p, buf, sz));
+	double load = stop_timer(&t);
+
+	uint64_t sum = 0;
+	start_timer(&t);
+	for (size_t i = 0; i < num; i++) {
+		sum += m.values[FIND_HASH(&m, test_key(i))];
+	}
+	double hash = stop_timer(&t);
+
+	start_timer(&t);
+	for (size_t i = 0; i < num; i++) {
+		uint32_t v;
+		memcpy(&v, perfect_hash_value(&p, FIND_PERFECT_HASH(&p, test_key(i))), sizeof(v));
+		sum -= v;
+	}
+	double perfect = stop_timer(&t);
+	EXPECT_EQ(0, sum);
+
+	LOG(log, "perfect hash|size:%u|buildMs:%.1f|loadUs:%.1f|fileBytes:%u|hashBytes:%u",
+		(unsigned)num, build * 1e3, load * 1e6, (unsigned)sz, (unsigned)HASH_MEMORY(&m));
+	LOG(log, "perfect hash lookup|size:%u|hashNsPerOp:%.1f|perfectNsPerOp:%.1f",
+		(unsigned)num, hash * 1e9 / num, perfect * 1e9 / num);
+
+	free(buf);
+	FREE_HASH(&m);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_bits, 0, "bench-bits", "N", "log2 of the benchmark table size");
+	log_t *log = start_test(argc, argv);
+
+	test_ints();
+	test_set();
+	test_blob();
+	test_invalid();
+	test_mapped();
+	bench_lookup(log);
+
+	return finish_test();
+}
@@ -0,0 +1,148 @@
+#include "cutils/pool.h"
+#include "cutils/endian.h"
+
+#define DEFAULT_SLAB 0x10000 // 64 KB
+#define MIN_PER_SLAB 16
+#define ALIGN 16
+
+struct pool_slab {
+	struct pool_slab *next;
+};
+
+static uint8_t *slab_begin(struct pool_slab *s) {
+	return (uint8_t*) ALIGN_UP((uintptr_t) (s + 1), ALIGN);
+}
+
+void *grow_pool(pool_t *p) {
+	if (p->next == p->end) {
+		// reuse slabs left over from clear_pool before allocating new ones
+		struct pool_slab *s = p->cur ? p->cur->next : p->slabs;
+		if (!s) {
+			s = xmalloc(p->parent, ALIGN + p->slabsz);
+			if (!s) {
+				return NULL;
+			}
+			s->next = NULL;
+			if (p->cur) {
+				p->cur->next = s;
+			} else {
+				p->slabs = s;
+			}
+		}
+		p->cur = s;
+		p->next = slab_begin(s);
+		p->end = p->next + p->slabsz;
+	}
+	void *ret = p->next;
+	p->next += p->objsz;
+	return ret;
+}
+
+static void *pool_realloc(allocator_t *a, void *ptr, size_t size) {
+	pool_t *p = (pool_t*) a;
+	if (size > p->objsz) {
+		return NULL;
+	}
+	return ptr ? ptr : get_pool(p);
+}
+
+static void *pool_calloc(allocator_t *a, size_t num, size_t size) {
+	pool_t *p = (pool_t*) a;
+	if (size && num > p->objsz / size) {
+		return NULL;
+	}
+	void *ret = get_pool(p);
+	if (ret) {
+		memset(ret, 0, p->objsz);
+	}
+	return ret;
+}
+
+static void pool_free(allocator_t *a, void *ptr) {
+	if (ptr) {
+		put_pool((pool_t*) a, ptr);
+	}
+}
+
+void init_pool(pool_t *p, allocator_t *parent, size_t objsz, size_t per_slab) {
+	memset(p, 0, sizeof(*p));
+	p->alloc.calloc = &pool_calloc;
+	p->alloc.realloc = &pool_realloc;
+	p->alloc.free = &pool_free;
+	p->parent = parent;
+	if (objsz < sizeof(struct pool_free)) {
+		objsz = sizeof(struct pool_free);
+	}
+	p->objsz = ALIGN_UP(objsz, sizeof(void*));
+	if (!per_slab) {
+		per_slab = DEFAULT_SLAB / p->objsz;
+		if (per_slab < MIN_PER_SLAB) {
+			per_slab = MIN_PER_SLAB;
+		}
+	}
+	p->slabsz = p->objsz * per_slab;
+	mtx_init(&p->lock, mtx_plain);
+}
+
+void free_pool(pool_t *p) {
+	struct pool_slab *s = p->slabs;
+	while (s) {
+		struct pool_slab *next = s->next;
+		xfree(p->parent, s);
+		s = next;
+	}
+	p->slabs = p->cur = NULL;
+	p->free = NULL;
+	p->next = p->end = NULL;
+	mtx_destroy(&p->lock);
+}
+
+void clear_pool(pool_t *p) {
+	p->free = NULL;
+	p->cur = NULL;
+	p->next = p->end = NULL;
+}
+
+size_t pool_memory(const pool_t *p) {
+	size_t ret = 0;
+	for (struct pool_slab *s = p->slabs; s != NULL; s = s->next) {
+		ret += ALIGN + p->slabsz;
+	}
+	return ret;
+}
+
+void *refill_pool_cache(struct pool_cache *c) {
+	pool_t *p = c->pool;
+	mtx_lock(&p->lock);
+	void *ret = get_pool(p);
+	for (int i = 1; ret && i < POOL_CACHE_BATCH; i++) {
+		struct pool_free *f = get_pool(p);
+		if (!f) {
+			break;
+		}
+		f->next = c->free;
+		c->free = f;
+		c->num++;
+	}
+	mtx_unlock(&p->lock);
+	return ret;
+}
+
+void drain_pool_cache(struct pool_cache *c, size_t keep) {
+	if (c->num <= keep) {
+		return;
+	}
+	// unlink the objects to return before taking the lock
+	struct pool_free *first = c->free, *last = first;
+	for (size_t i = 1; i < c->num - keep; i++) {
+		last = last->next;
+	}
+	c->free = last->next;
+	c->num = keep;
+
+	pool_t *p = c->pool;
+	mtx_lock(&p->lock);
+	last->next = p->free;
+	p->free = first;
+	mtx_unlock(&p->lock);
+}
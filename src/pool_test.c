@@ -0,0 +1,118 @@
+#include "cutils/pool.h"
+#include "cutils/test.h"
+#include <stdint.h>
+
+struct obj {
+	struct obj *self;
+	int value;
+};
+
+static void test_basic(void) {
+	pool_t p;
+	init_pool(&p, NULL, 12, 4);
+	EXPECT_EQ(16, p.objsz);
+
+	struct obj *o[10];
+	for (int i = 0; i < 10; i++) {
+		o[i] = POOL_NEW(&p, struct obj);
+		o[i]->self = o[i];
+		o[i]->value = i;
+	}
+	// 3 slabs of 4 objects
+	EXPECT_EQ(3 * (16 + 4 * 16), pool_memory(&p));
+	for (int i = 0; i < 10; i++) {
+		EXPECT_PTREQ(o[i], o[i]->self);
+		EXPECT_EQ(i, o[i]->value);
+	}
+
+	// freed objects are handed out again, most recent first
+	put_pool(&p, o[3]);
+	put_pool(&p, o[7]);
+	EXPECT_PTREQ(o[7], get_pool(&p));
+	EXPECT_PTREQ(o[3], get_pool(&p));
+
+	// clearing keeps the slabs
+	clear_pool(&p);
+	EXPECT_PTREQ(o[0], get_pool(&p));
+	for (int i = 1; i < 12; i++) {
+		get_pool(&p);
+	}
+	EXPECT_EQ(3 * (16 + 4 * 16), pool_memory(&p));
+
+	free_pool(&p);
+	EXPECT_EQ(0, pool_memory(&p));
+}
+
+static void test_allocator(void) {
+	pool_t p;
+	INIT_POOL(&p, struct obj);
+	allocator_t *a = &p.alloc;
+
+	struct obj *o = xcalloc(a, 1, sizeof(struct obj));
+	EXPECT_TRUE(o != NULL);
+	EXPECT_TRUE(o->self == NULL && o->value == 0);
+	EXPECT_PTREQ(o, xrealloc(a, o, sizeof(struct obj)));
+	EXPECT_PTREQ(NULL, xrealloc(a, o, 1000));
+	EXPECT_PTREQ(NULL, xmalloc(a, 1000));
+	xfree(a, o);
+	EXPECT_PTREQ(o, xmalloc(a, 1));
+
+	free_pool(&p);
+}
+
+#define CACHE_THREADS 4
+#define CACHE_OBJECTS 1000
+
+static int cache_thread(void *udata) {
+	pool_t *p = udata;
+	struct pool_cache c;
+	init_pool_cache(&c, p);
+	struct obj *o[CACHE_OBJECTS];
+	int errors = 0;
+	for (int round = 0; round < 10; round++) {
+		for (int i = 0; i < CACHE_OBJECTS; i++) {
+			o[i] = POOL_CACHE_NEW(&c, struct obj);
+			o[i]->self = o[i];
+			o[i]->value = i;
+		}
+		for (int i = 0; i < CACHE_OBJECTS; i++) {
+			errors += o[i]->self != o[i] || o[i]->value != i;
+			put_pool_cache(&c, o[i]);
+		}
+	}
+	flush_pool_cache(&c);
+	return errors;
+}
+
+static void test_cache(void) {
+	pool_t p;
+	INIT_POOL(&p, struct obj);
+	thrd_t thrd[CACHE_THREADS];
+	for (int i = 0; i < CACHE_THREADS; i++) {
+		EXPECT_EQ(thrd_success, thrd_create(&thrd[i], &cache_thread, &p));
+	}
+	for (int i = 0; i < CACHE_THREADS; i++) {
+		int res = -1;
+		thrd_join(thrd[i], &res);
+		EXPECT_EQ(0, res);
+	}
+
+	// every object should be back in the pool
+	size_t num = 0;
+	for (struct pool_free *f = p.free; f != NULL; f = f->next) {
+		num++;
+	}
+	EXPECT_EQ(pool_memory(&p) / (16 + p.slabsz) * (p.slabsz / p.objsz), num + (p.end - p.next) / p.objsz);
+
+	free_pool(&p);
+}
+
+int main(int argc, const char *argv[]) {
+	start_test(argc, argv);
+
+	test_basic();
+	test_allocator();
+	test_cache();
+
+	return finish_test();
+}
@@ -311,3 +311,48 @@ rbnode *rb_next(const rbnode *n, rbdirection dir) {
 	}
 }
 
+
+struct build_source {
+	rbnode *const *nodes;
+	char *base;
+	size_t stride;
+};
+
+static rbnode *build_node(const struct build_source *s, size_t i) {
+	return s->nodes ? s->nodes[i] : (rbnode*) (s->base + i * s->stride);
+}
+
+// Splitting at the middle every time fills each level before starting the
+// next. Nodes on the last level are red if it isn't full, which leaves
+// every path with the same number of black nodes.
+static rbnode *build(const struct build_source *s, size_t begin, size_t n, rbnode *parent, unsigned depth, unsigned red_depth) {
+	if (!n) {
+		return NULL;
+	}
+	size_t mid = (n - 1) / 2;
+	rbnode *node = build_node(s, begin + mid);
+	setparent(node, parent, depth == red_depth);
+	node->child[0] = build(s, begin, mid, node, depth + 1, red_depth);
+	node->child[1] = build(s, begin + mid + 1, n - mid - 1, node, depth + 1, red_depth);
+	return node;
+}
+
+static void build_tree(rbtree *tree, const struct build_source *s, size_t n) {
+	// number of full levels
+	unsigned full = 0;
+	while (full < sizeof(size_t) * 8 - 1 && ((size_t) 2 << full) - 1 <= n) {
+		full++;
+	}
+	tree->root = build(s, 0, n, NULL, 0, full);
+	tree->size = n;
+}
+
+void rb_build(rbtree *tree, rbnode *const *nodes, size_t n) {
+	struct build_source s = {nodes, NULL, 0};
+	build_tree(tree, &s, n);
+}
+
+void rb_build_array(rbtree *tree, void *v, size_t n, size_t objsz, size_t offset) {
+	struct build_source s = {NULL, (char*) v + offset, objsz};
+	build_tree(tree, &s, n);
+}
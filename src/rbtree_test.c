@@ -1,12 +1,23 @@
 #include "cutils/rbtree.h"
+#include "cutils/btree.h"
 #include "cutils/test.h"
 #include "cutils/log.h"
+#include "cutils/pool.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdlib.h>
 
 struct int_node {
 	struct rbnode rb;
 	int value;
 };
 
+#define INT_LESS(a, b) ((a)->value < (b)->value)
+
+DECLARE_RBTREE(int_tree, struct int_node, rb, INT_LESS)
+
+static int bench_nodes = 10000;
+
 static const char spaces[] = "                        ";
 
 static int node_id(const rbnode *n) {
@@ -125,7 +136,352 @@ static void remove_node(log_t *log, rbtree *tree, struct int_node *in) {
 	check_tree(tree);
 }
 
+static uint32_t bench_rand(uint32_t *seed) {
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+struct bench_node {
+	rbnode rb;
+	uint64_t value;
+};
+
+static void bench_insert(rbtree *tree, struct bench_node *in) {
+	rbnode *p = tree->root;
+	rbdirection dir = RB_LEFT;
+	while (p) {
+		struct bench_node *ip = container_of(p, struct bench_node, rb);
+		dir = (in->value < ip->value) ? RB_LEFT : RB_RIGHT;
+		if (!rb_child(p, dir)) {
+			break;
+		}
+		p = rb_child(p, dir);
+	}
+	rb_insert(tree, p, &in->rb, dir);
+}
+
+// timer like churn, the earliest node is removed and a later one added
+static double bench_churn(pool_t *pool, uint64_t *psum) {
+	struct rbtree tree = RB_INIT;
+	uint32_t seed = 1;
+	struct timer t;
+	start_timer(&t);
+	for (int i = 0; i < bench_nodes; i++) {
+		struct bench_node *in = pool ? POOL_NEW(pool, struct bench_node) : malloc(sizeof(*in));
+		in->value = bench_rand(&seed) % ((uint64_t)bench_nodes * 16);
+		bench_insert(&tree, in);
+	}
+	uint64_t sum = 0;
+	for (int i = 0; i < bench_nodes * 4; i++) {
+		struct bench_node *in = container_of(rb_begin(&tree, RB_LEFT), struct bench_node, rb);
+		uint64_t value = in->value;
+		sum += value;
+		rb_remove(&tree, &in->rb);
+		pool ? put_pool(pool, in) : free(in);
+		in = pool ? POOL_NEW(pool, struct bench_node) : malloc(sizeof(*in));
+		in->value = value + bench_rand(&seed) % ((uint64_t)bench_nodes * 16);
+		bench_insert(&tree, in);
+	}
+	while (tree.root) {
+		struct bench_node *in = container_of(tree.root, struct bench_node, rb);
+		rb_remove(&tree, &in->rb);
+		pool ? put_pool(pool, in) : free(in);
+	}
+	*psum = sum;
+	return stop_timer(&t);
+}
+
+static void bench_alloc(log_t *log) {
+	pool_t pool;
+	INIT_POOL(&pool, struct bench_node);
+	uint64_t sum1, sum2;
+	double libc = bench_churn(NULL, &sum1);
+	double pooled = bench_churn(&pool, &sum2);
+	EXPECT_EQ(sum1, sum2);
+	// an insert and remove for each node plus a remove and insert for
+	// each step of the churn
+	double ops = (double)bench_nodes * 10;
+	LOG(log, "rbtree churn|nodes:%d|mallocNsPerOp:%.1f|poolNsPerOp:%.1f",
+		bench_nodes, libc * 1e9 / ops, pooled * 1e9 / ops);
+	free_pool(&pool);
+}
+
+static void check_btree(btree *t, void **ref, int num) {
+	btree_iter it = bt_begin(t, RB_LEFT);
+	size_t count = 0;
+	for (int k = 0; k < num; k++) {
+		if (ref[k]) {
+			EXPECT_TRUE(it.leaf != NULL);
+			if (!it.leaf) {
+				break;
+			}
+			EXPECT_EQ(k, (int) bt_key(it));
+			EXPECT_PTREQ(ref[k], bt_value(it));
+			it = bt_next(it, RB_RIGHT);
+			count++;
+		}
+	}
+	EXPECT_PTREQ(NULL, it.leaf);
+	EXPECT_EQ(count, t->size);
+
+	it = bt_begin(t, RB_RIGHT);
+	for (int k = num - 1; k >= 0 && it.leaf; k--) {
+		if (ref[k]) {
+			EXPECT_EQ(k, (int) bt_key(it));
+			it = bt_next(it, RB_LEFT);
+		}
+	}
+	EXPECT_PTREQ(NULL, it.leaf);
+
+	// leaves are never left empty
+	for (btree_leaf *l = t->first; l != NULL; l = l->next) {
+		EXPECT_GT(l->count, 0);
+	}
+}
+
+static void test_btree(void) {
+	enum {NUM = 4096};
+	static void *ref[NUM];
+	static int values[NUM];
+	btree t = BT_INIT;
+	uint32_t seed = 1;
+
+	// sorted inserts go down the append path
+	for (int k = 0; k < NUM; k += 2) {
+		EXPECT_EQ(1, bt_insert(&t, k, &values[k]));
+		ref[k] = &values[k];
+	}
+	check_btree(&t, ref, NUM);
+
+	for (int i = 0; i < 20000; i++) {
+		int k = bench_rand(&seed) % NUM;
+		switch (bench_rand(&seed) % 3) {
+		case 0:
+		case 1:
+			EXPECT_EQ(ref[k] ? 0 : 1, bt_insert(&t, k, &values[k]));
+			ref[k] = &values[k];
+			break;
+		default:
+			EXPECT_PTREQ(ref[k], bt_remove(&t, k));
+			ref[k] = NULL;
+			break;
+		}
+		k = bench_rand(&seed) % NUM;
+		EXPECT_PTREQ(ref[k], bt_find(&t, k));
+		btree_iter it = bt_lower_bound(&t, k);
+		while (k < NUM && !ref[k]) {
+			k++;
+		}
+		if (k == NUM) {
+			EXPECT_PTREQ(NULL, it.leaf);
+		} else {
+			EXPECT_TRUE(it.leaf && bt_key(it) == (uint64_t) k);
+		}
+		if (i % 1000 == 0) {
+			check_btree(&t, ref, NUM);
+		}
+	}
+	check_btree(&t, ref, NUM);
+
+	// remove everything in a random order
+	for (int i = 0; i < NUM * 4; i++) {
+		int k = bench_rand(&seed) % NUM;
+		EXPECT_PTREQ(ref[k], bt_remove(&t, k));
+		ref[k] = NULL;
+	}
+	for (int k = 0; k < NUM; k++) {
+		EXPECT_PTREQ(ref[k], bt_remove(&t, k));
+		ref[k] = NULL;
+	}
+	check_btree(&t, ref, NUM);
+	EXPECT_PTREQ(NULL, t.root);
+	free_btree(&t);
+}
+
+static int64_t find_rb(const rbtree *tree, uint64_t value) {
+	rbnode *p = tree->root;
+	while (p) {
+		struct bench_node *ip = container_of(p, struct bench_node, rb);
+		if (value == ip->value) {
+			return (int64_t) ip->value;
+		}
+		p = rb_child(p, value < ip->value ? RB_LEFT : RB_RIGHT);
+	}
+	return -1;
+}
+
+// insert, lookup and in order scan against a B+tree of the same keys
+static void bench_btree(log_t *log) {
+	pool_t pool;
+	INIT_POOL(&pool, struct bench_node);
+	pool_t btpool;
+	init_pool(&btpool, NULL, BT_NODE_SIZE, 0);
+	int *keys = malloc(bench_nodes * sizeof(int));
+	for (int i = 0; i < bench_nodes; i++) {
+		// a permutation of 0 to 2^31-1
+		keys[i] = (int) (((uint32_t) i * 2654435761U) & 0x7FFFFFFF);
+	}
+
+	struct rbtree rb = RB_INIT;
+	struct timer t;
+	start_timer(&t);
+	for (int i = 0; i < bench_nodes; i++) {
+		struct bench_node *in = POOL_NEW(&pool, struct bench_node);
+		in->value = (uint64_t) keys[i];
+		bench_insert(&rb, in);
+	}
+	double rbinsert = stop_timer(&t);
+
+	btree bt = BT_INIT;
+	bt.alloc = &btpool.alloc;
+	start_timer(&t);
+	for (int i = 0; i < bench_nodes; i++) {
+		bt_insert(&bt, (uint64_t) keys[i], &keys[i]);
+	}
+	double btinsert = stop_timer(&t);
+	EXPECT_EQ(bench_nodes, (int) bt.size);
+
+	uint32_t seed = 1;
+	int64_t rbsum = 0, btsum = 0;
+	start_timer(&t);
+	for (int i = 0; i < bench_nodes; i++) {
+		rbsum += find_rb(&rb, (uint64_t) keys[bench_rand(&seed) % bench_nodes]);
+	}
+	double rbfind = stop_timer(&t);
+
+	seed = 1;
+	start_timer(&t);
+	for (int i = 0; i < bench_nodes; i++) {
+		btsum += *(int*) bt_find(&bt, (uint64_t) keys[bench_rand(&seed) % bench_nodes]);
+	}
+	double btfind = stop_timer(&t);
+	EXPECT_EQ(rbsum, btsum);
+
+	rbsum = btsum = 0;
+	start_timer(&t);
+	for (rbnode *n = rb_begin(&rb, RB_LEFT); n != NULL; n = rb_next(n, RB_RIGHT)) {
+		rbsum += container_of(n, struct bench_node, rb)->value;
+	}
+	double rbscan = stop_timer(&t);
+
+	start_timer(&t);
+	for (btree_iter it = bt_begin(&bt, RB_LEFT); it.leaf != NULL; it = bt_next(it, RB_RIGHT)) {
+		btsum += (int64_t) bt_key(it);
+	}
+	double btscan = stop_timer(&t);
+	EXPECT_EQ(rbsum, btsum);
+
+	LOG(log, "rbtree vs btree|nodes:%d|rbInsertNs:%.1f|btInsertNs:%.1f|rbFindNs:%.1f|btFindNs:%.1f|rbScanNs:%.2f|btScanNs:%.2f",
+		bench_nodes,
+		rbinsert * 1e9 / bench_nodes, btinsert * 1e9 / bench_nodes,
+		rbfind * 1e9 / bench_nodes, btfind * 1e9 / bench_nodes,
+		rbscan * 1e9 / bench_nodes, btscan * 1e9 / bench_nodes);
+
+	free(keys);
+	free_pool(&pool);
+	free_pool(&btpool);
+}
+
+static void test_typed(void) {
+	struct int_node n[70], key;
+	for (int i = 0; i < 70; i++) {
+		n[i].value = 2 * (i + 1);
+	}
+	for (int num = 0; num <= 70; num++) {
+		rbtree tree = RB_INIT;
+		int_tree_build(&tree, n, num);
+		check_tree(&tree);
+	}
+
+	// n now holds 2, 4 ... 140
+	rbtree tree = RB_INIT;
+	int_tree_build(&tree, n, 70);
+	key.value = 10;
+	EXPECT_PTREQ(&n[4], int_tree_find(&tree, &key));
+	EXPECT_PTREQ(&n[4], int_tree_lower_bound(&tree, &key));
+	EXPECT_PTREQ(&n[5], int_tree_upper_bound(&tree, &key));
+	key.value = 11;
+	EXPECT_PTREQ(NULL, int_tree_find(&tree, &key));
+	EXPECT_PTREQ(&n[5], int_tree_lower_bound(&tree, &key));
+	EXPECT_PTREQ(&n[5], int_tree_upper_bound(&tree, &key));
+	key.value = 140;
+	EXPECT_PTREQ(NULL, int_tree_upper_bound(&tree, &key));
+	key.value = 1;
+	EXPECT_PTREQ(&n[0], int_tree_lower_bound(&tree, &key));
+
+	struct int_node lo = {.value = 7}, hi = {.value = 20};
+	int sum = 0, count = 0;
+	struct rbrange r = int_tree_range(&tree, &lo, &hi);
+	RB_FOR_RANGE(p, r) {
+		sum += int_tree_entry(p)->value;
+		count++;
+	}
+	EXPECT_EQ(8 + 10 + 12 + 14 + 16 + 18, sum);
+	EXPECT_EQ(6, count);
+
+	// empty and reversed ranges
+	r = int_tree_range(&tree, &hi, &lo);
+	EXPECT_PTREQ(r.begin, r.end);
+	lo.value = 141;
+	hi.value = 200;
+	r = int_tree_range(&tree, &lo, &hi);
+	EXPECT_PTREQ(NULL, r.begin);
+	EXPECT_PTREQ(NULL, r.end);
+
+	// inserts into a built tree keep it balanced
+	struct int_node odd[70], dup = {.value = 10};
+	EXPECT_PTREQ(&n[4], int_tree_insert_unique(&tree, &dup));
+	for (int i = 0; i < 70; i++) {
+		odd[i].value = 2 * i + 1;
+		EXPECT_PTREQ(NULL, int_tree_insert_unique(&tree, &odd[i]));
+	}
+	check_tree(&tree);
+	EXPECT_EQ(140, tree.size);
+
+	// NAME_insert allows duplicates and adds after equal elements
+	int_tree_insert(&tree, &dup);
+	EXPECT_PTREQ(&dup, int_tree_entry(rb_next(&n[4].rb, RB_RIGHT)));
+	EXPECT_EQ(141, tree.size);
+}
+
+// loading sorted nodes by inserting each one, by appending each one
+// after the last and by building the tree in one go
+static void bench_build(log_t *log) {
+	struct int_node *nodes = malloc(bench_nodes * sizeof(struct int_node));
+	for (int i = 0; i < bench_nodes; i++) {
+		nodes[i].value = i + 1;
+	}
+
+	struct timer t;
+	rbtree tree = RB_INIT;
+	start_timer(&t);
+	for (int i = 0; i < bench_nodes; i++) {
+		int_tree_insert(&tree, &nodes[i]);
+	}
+	double insert = stop_timer(&t);
+
+	tree.root = NULL;
+	tree.size = 0;
+	start_timer(&t);
+	rbnode *last = NULL;
+	for (int i = 0; i < bench_nodes; i++) {
+		rb_insert(&tree, last, &nodes[i].rb, RB_RIGHT);
+		last = &nodes[i].rb;
+	}
+	double append = stop_timer(&t);
+
+	start_timer(&t);
+	int_tree_build(&tree, nodes, bench_nodes);
+	double build = stop_timer(&t);
+	EXPECT_EQ(bench_nodes, (int) tree.size);
+
+	LOG(log, "rbtree sorted load|nodes:%d|insertNsPerNode:%.2f|appendNsPerNode:%.2f|buildNsPerNode:%.2f",
+		bench_nodes, insert * 1e9 / bench_nodes, append * 1e9 / bench_nodes, build * 1e9 / bench_nodes);
+	free(nodes);
+}
+
 int main(int argc, const char *argv[]) {
+	flag_int(&bench_nodes, 0, "bench-nodes", "N", "number of nodes in the benchmark");
 	log_t *log = start_test(argc, argv);
 	struct int_node n[30];
 	for (int i = 0; i < sizeof(n)/sizeof(n[0]); i++) {
@@ -180,5 +536,10 @@ int main(int argc, const char *argv[]) {
 	remove_node(log, &tree, n+13);
 	remove_node(log, &tree, n+14);
 
+	test_typed();
+	test_btree();
+	bench_alloc(log);
+	bench_btree(log);
+	bench_build(log);
 	return finish_test();
 }
@@ -0,0 +1,921 @@
+#include "cutils/roaring.h"
+#include "cutils/endian.h"
+#include <stdlib.h>
+#include <string.h>
+
+// File layout, all offsets from the start of the file
+//
+// 0   "CUROAR01"
+// 8   u32 number of containers
+// 12  u32 reserved (0)
+// 16  16B descriptor per container in key order
+//     0   u16 key
+//     2   u8 type
+//     3   u8 reserved (0)
+//     4   u32 num
+//     8   u32 cardinality
+//     12  u32 offset of the data
+//
+// The data of each container is 8B aligned. Arrays are u16 values, bitmaps
+// are 1024 u64 words and runs are u16 start and length-1 pairs.
+
+#define HEADER_SIZE 16
+#define DESC_SIZE 16
+#define ARRAY_MAX 4096
+#define BITMAP_WORDS 1024
+#define BITMAP_BYTES (BITMAP_WORDS * 8)
+#define CHUNK_BITS 65536
+
+static const char magic[8] = {'C', 'U', 'R', 'O', 'A', 'R', '0', '1'};
+
+static inline uint64_t *bitmap_words(const struct roaring_container *c) {
+	return (uint64_t*) c->data;
+}
+
+static size_t data_bytes(const struct roaring_container *c) {
+	switch (c->type) {
+	case ROARING_BITMAP:
+		return BITMAP_BYTES;
+	case ROARING_RUN:
+		return (size_t) c->num * 4;
+	default:
+		return (size_t) c->num * 2;
+	}
+}
+
+// index of the first value not less than key
+static uint32_t lower_u16(const uint16_t *v, uint32_t n, uint32_t key) {
+	if (!n) {
+		return 0;
+	}
+	const uint16_t *base = v;
+	while (n > 1) {
+		uint32_t half = n / 2;
+		base = base[half] < key ? base + half : base;
+		n -= half;
+	}
+	return (uint32_t) (base - v) + (*base < key);
+}
+
+// index of the first run that ends at or after low
+static uint32_t find_run(const struct roaring_container *c, uint32_t low) {
+	uint32_t lo = 0, hi = c->num;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if ((uint32_t) c->data[2 * mid] + c->data[2 * mid + 1] < low) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// index of the first container with a key not less than key
+static size_t find_container(const roaring_t *r, uint32_t key) {
+	size_t lo = 0, hi = r->size;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (r->v[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static uint32_t next_bit(const uint64_t *w, uint32_t i) {
+	while (i < CHUNK_BITS) {
+		uint64_t x = w[i >> 6] & (UINT64_MAX << (i & 63));
+		if (x) {
+			return (i & ~63U) + ctzl(x);
+		}
+		i = (i | 63) + 1;
+	}
+	return CHUNK_BITS;
+}
+
+static uint32_t next_clear_bit(const uint64_t *w, uint32_t i) {
+	while (i < CHUNK_BITS) {
+		uint64_t x = ~w[i >> 6] & (UINT64_MAX << (i & 63));
+		if (x) {
+			return (i & ~63U) + ctzl(x);
+		}
+		i = (i | 63) + 1;
+	}
+	return CHUNK_BITS;
+}
+
+static void set_bit_range(uint64_t *w, uint32_t begin, uint32_t end) {
+	while (begin < end) {
+		uint32_t stop = (begin | 63) + 1;
+		if (stop > end) {
+			stop = end;
+		}
+		uint64_t mask = UINT64_MAX << (begin & 63);
+		if (stop & 63) {
+			mask &= UINT64_MAX >> (64 - (stop & 63));
+		}
+		w[begin >> 6] |= mask;
+		begin = stop;
+	}
+}
+
+static bool contains_container(const struct roaring_container *c, uint32_t low) {
+	switch (c->type) {
+	case ROARING_BITMAP:
+		return (bitmap_words(c)[low >> 6] >> (low & 63)) & 1;
+	case ROARING_RUN: {
+		uint32_t i = find_run(c, low);
+		return i < c->num && c->data[2 * i] <= low;
+	}
+	default: {
+		uint32_t i = lower_u16(c->data, c->num, low);
+		return i < c->num && c->data[i] == low;
+	}
+	}
+}
+
+// always fills words
+static void copy_words(const struct roaring_container *c, uint64_t *words) {
+	if (c->type == ROARING_BITMAP) {
+		memcpy(words, c->data, BITMAP_BYTES);
+		return;
+	}
+	memset(words, 0, BITMAP_BYTES);
+	if (c->type == ROARING_RUN) {
+		for (uint32_t i = 0; i < c->num; i++) {
+			uint32_t start = c->data[2 * i];
+			set_bit_range(words, start, start + c->data[2 * i + 1] + 1);
+		}
+	} else {
+		for (uint32_t i = 0; i < c->num; i++) {
+			words[c->data[i] >> 6] |= (uint64_t) 1 << (c->data[i] & 63);
+		}
+	}
+}
+
+// only fills tmp if the container isn't already a bitmap
+static const uint64_t *container_words(const struct roaring_container *c, uint64_t *tmp) {
+	if (c->type == ROARING_BITMAP) {
+		return bitmap_words(c);
+	}
+	copy_words(c, tmp);
+	return tmp;
+}
+
+static void free_container(struct roaring_container *c) {
+	if (c->cap) {
+		free(c->data);
+	}
+	c->data = NULL;
+	c->cap = 0;
+}
+
+// replaces the contents of c with the card bits set in words, which may be
+// c's own data
+static int set_container_words(struct roaring_container *c, const uint64_t *words, uint32_t card) {
+	uint16_t *data;
+	if (card <= ARRAY_MAX) {
+		uint32_t cap = card < 4 ? 4 : card;
+		data = malloc(cap * sizeof(uint16_t));
+		if (!data) {
+			return -1;
+		}
+		uint32_t n = 0;
+		for (uint32_t w = 0; w < BITMAP_WORDS; w++) {
+			for (uint64_t x = words[w]; x; x &= x - 1) {
+				data[n++] = (uint16_t) (w * 64 + ctzl(x));
+			}
+		}
+		free_container(c);
+		c->type = ROARING_ARRAY;
+		c->num = card;
+		c->cap = cap;
+	} else {
+		data = malloc(BITMAP_BYTES);
+		if (!data) {
+			return -1;
+		}
+		memcpy(data, words, BITMAP_BYTES);
+		free_container(c);
+		c->type = ROARING_BITMAP;
+		c->num = BITMAP_WORDS;
+		c->cap = BITMAP_BYTES / 2;
+	}
+	c->card = card;
+	c->data = data;
+	return 0;
+}
+
+static int copy_container(struct roaring_container *dst, const struct roaring_container *src) {
+	size_t bytes = data_bytes(src);
+	uint16_t *data = malloc(bytes ? bytes : 2);
+	if (!data) {
+		return -1;
+	}
+	memcpy(data, src->data, bytes);
+	*dst = *src;
+	dst->data = data;
+	dst->cap = (uint32_t) (bytes ? bytes / 2 : 1);
+	return 0;
+}
+
+static struct roaring_container *insert_container(roaring_t *r, size_t i, uint16_t key) {
+	if (!GROW_VECTOR(r, 1)) {
+		return NULL;
+	}
+	memmove(&r->v[i + 1], &r->v[i], (r->size - i) * sizeof(r->v[0]));
+	r->size++;
+	struct roaring_container *c = &r->v[i];
+	memset(c, 0, sizeof(*c));
+	c->key = key;
+	c->type = ROARING_ARRAY;
+	return c;
+}
+
+static void remove_container(roaring_t *r, size_t i) {
+	free_container(&r->v[i]);
+	memmove(&r->v[i], &r->v[i + 1], (r->size - i - 1) * sizeof(r->v[0]));
+	r->size--;
+}
+
+void clear_roaring(roaring_t *r) {
+	if (r->readonly) {
+		free_roaring(r);
+		return;
+	}
+	for (size_t i = 0; i < r->size; i++) {
+		free_container(&r->v[i]);
+	}
+	r->size = 0;
+}
+
+void free_roaring(roaring_t *r) {
+	if (!r->readonly) {
+		for (size_t i = 0; i < r->size; i++) {
+			free_container(&r->v[i]);
+		}
+	}
+	free(r->v);
+	unmap_file(&r->mf);
+	init_roaring(r);
+}
+
+static int add_container(struct roaring_container *c, uint32_t low) {
+	uint64_t tmp[BITMAP_WORDS];
+	switch (c->type) {
+	case ROARING_BITMAP: {
+		uint64_t *w = &bitmap_words(c)[low >> 6];
+		uint64_t bit = (uint64_t) 1 << (low & 63);
+		c->card += (*w & bit) == 0;
+		*w |= bit;
+		return 0;
+	}
+	case ROARING_RUN:
+		if (contains_container(c, low)) {
+			return 0;
+		}
+		copy_words(c, tmp);
+		tmp[low >> 6] |= (uint64_t) 1 << (low & 63);
+		return set_container_words(c, tmp, c->card + 1);
+	default: {
+		uint32_t i = lower_u16(c->data, c->num, low);
+		if (i < c->num && c->data[i] == low) {
+			return 0;
+		}
+		if (c->num == ARRAY_MAX) {
+			copy_words(c, tmp);
+			tmp[low >> 6] |= (uint64_t) 1 << (low & 63);
+			return set_container_words(c, tmp, c->card + 1);
+		}
+		if (c->num == c->cap) {
+			uint32_t cap = c->cap < 4 ? 4 : c->cap * 2;
+			if (cap > ARRAY_MAX) {
+				cap = ARRAY_MAX;
+			}
+			uint16_t *data = realloc(c->data, cap * sizeof(uint16_t));
+			if (!data) {
+				return -1;
+			}
+			c->data = data;
+			c->cap = cap;
+		}
+		memmove(&c->data[i + 1], &c->data[i], (c->num - i) * sizeof(uint16_t));
+		c->data[i] = (uint16_t) low;
+		c->num++;
+		c->card++;
+		return 0;
+	}
+	}
+}
+
+int add_roaring(roaring_t *r, uint32_t val) {
+	if (r->readonly) {
+		return -1;
+	}
+	uint16_t key = (uint16_t) (val >> 16);
+	size_t i = find_container(r, key);
+	bool inserted = i == r->size || r->v[i].key != key;
+	if (inserted && !insert_container(r, i, key)) {
+		return -1;
+	}
+	if (add_container(&r->v[i], val & 0xFFFF)) {
+		// don't leave an empty container behind
+		if (inserted) {
+			remove_container(r, i);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+int remove_roaring(roaring_t *r, uint32_t val) {
+	if (r->readonly) {
+		return -1;
+	}
+	uint16_t key = (uint16_t) (val >> 16);
+	uint32_t low = val & 0xFFFF;
+	size_t i = find_container(r, key);
+	if (i == r->size || r->v[i].key != key || !contains_container(&r->v[i], low)) {
+		return 0;
+	}
+	struct roaring_container *c = &r->v[i];
+	if (c->card == 1) {
+		remove_container(r, i);
+		return 0;
+	}
+	uint64_t tmp[BITMAP_WORDS];
+	switch (c->type) {
+	case ROARING_BITMAP:
+		bitmap_words(c)[low >> 6] &= ~((uint64_t) 1 << (low & 63));
+		c->card--;
+		return c->card <= ARRAY_MAX ? set_container_words(c, bitmap_words(c), c->card) : 0;
+	case ROARING_RUN:
+		copy_words(c, tmp);
+		tmp[low >> 6] &= ~((uint64_t) 1 << (low & 63));
+		return set_container_words(c, tmp, c->card - 1);
+	default: {
+		uint32_t j = lower_u16(c->data, c->num, low);
+		memmove(&c->data[j], &c->data[j + 1], (c->num - j - 1) * sizeof(uint16_t));
+		c->num--;
+		c->card--;
+		return 0;
+	}
+	}
+}
+
+bool test_roaring(const roaring_t *r, uint32_t val) {
+	uint16_t key = (uint16_t) (val >> 16);
+	size_t i = find_container(r, key);
+	return i < r->size && r->v[i].key == key && contains_container(&r->v[i], val & 0xFFFF);
+}
+
+uint64_t count_roaring(const roaring_t *r) {
+	uint64_t ret = 0;
+	for (size_t i = 0; i < r->size; i++) {
+		ret += r->v[i].card;
+	}
+	return ret;
+}
+
+size_t roaring_memory(const roaring_t *r) {
+	size_t ret = r->cap * sizeof(r->v[0]);
+	for (size_t i = 0; i < r->size; i++) {
+		ret += (size_t) r->v[i].cap * 2;
+	}
+	return ret;
+}
+
+static int or_container(struct roaring_container *out, const struct roaring_container *a, const struct roaring_container *b) {
+	memset(out, 0, sizeof(*out));
+	out->key = a->key;
+	if (a->type == ROARING_ARRAY && b->type == ROARING_ARRAY && a->card + b->card <= ARRAY_MAX) {
+		uint32_t cap = a->num + b->num;
+		uint16_t *data = malloc(cap * sizeof(uint16_t));
+		if (!data) {
+			return -1;
+		}
+		uint32_t i = 0, j = 0, n = 0;
+		while (i < a->num && j < b->num) {
+			uint16_t va = a->data[i], vb = b->data[j];
+			data[n++] = va < vb ? va : vb;
+			i += va <= vb;
+			j += vb <= va;
+		}
+		memcpy(data + n, a->data + i, (a->num - i) * sizeof(uint16_t));
+		n += a->num - i;
+		memcpy(data + n, b->data + j, (b->num - j) * sizeof(uint16_t));
+		n += b->num - j;
+		out->type = ROARING_ARRAY;
+		out->num = out->card = n;
+		out->cap = cap;
+		out->data = data;
+		return 0;
+	}
+	uint64_t wa[BITMAP_WORDS], tmp[BITMAP_WORDS];
+	copy_words(a, wa);
+	struct bitset sa = {(unsigned char*) wa, BITMAP_BYTES, BITMAP_BYTES};
+	struct bitset sb = {(unsigned char*) container_words(b, tmp), BITMAP_BYTES, BITMAP_BYTES};
+	or_bitset(&sa, &sb, 0, CHUNK_BITS);
+	return set_container_words(out, wa, (uint32_t) count_bitset(&sa, 0, CHUNK_BITS));
+}
+
+// returns -1 on error, 0 if the intersection is empty and 1 otherwise
+static int and_container(struct roaring_container *out, const struct roaring_container *a, const struct roaring_container *b) {
+	memset(out, 0, sizeof(*out));
+	out->key = a->key;
+	if (b->type == ROARING_ARRAY) {
+		const struct roaring_container *t = a;
+		a = b;
+		b = t;
+	}
+	if (a->type == ROARING_ARRAY) {
+		uint16_t *data = malloc(a->num * sizeof(uint16_t));
+		if (!data) {
+			return -1;
+		}
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < a->num; i++) {
+			data[n] = a->data[i];
+			n += contains_container(b, a->data[i]);
+		}
+		if (!n) {
+			free(data);
+			return 0;
+		}
+		out->type = ROARING_ARRAY;
+		out->num = out->card = n;
+		out->cap = a->num;
+		out->data = data;
+		return 1;
+	}
+	uint64_t wa[BITMAP_WORDS], tmp[BITMAP_WORDS];
+	copy_words(a, wa);
+	struct bitset sa = {(unsigned char*) wa, BITMAP_BYTES, BITMAP_BYTES};
+	struct bitset sb = {(unsigned char*) container_words(b, tmp), BITMAP_BYTES, BITMAP_BYTES};
+	and_bitset(&sa, &sb, 0, CHUNK_BITS);
+	uint32_t card = (uint32_t) count_bitset(&sa, 0, CHUNK_BITS);
+	if (!card) {
+		return 0;
+	}
+	return set_container_words(out, wa, card) ? -1 : 1;
+}
+
+int or_roaring(roaring_t *dst, const roaring_t *a, const roaring_t *b) {
+	clear_roaring(dst);
+	size_t i = 0, j = 0;
+	while (i < a->size || j < b->size) {
+		const struct roaring_container *ca = i < a->size ? &a->v[i] : NULL;
+		const struct roaring_container *cb = j < b->size ? &b->v[j] : NULL;
+		struct roaring_container *out = GROW_VECTOR(dst, 1);
+		int err;
+		if (!out) {
+			goto fail;
+		} else if (!cb || (ca && ca->key < cb->key)) {
+			err = copy_container(out, ca);
+			i++;
+		} else if (!ca || cb->key < ca->key) {
+			err = copy_container(out, cb);
+			j++;
+		} else {
+			err = or_container(out, ca, cb);
+			i++;
+			j++;
+		}
+		if (err) {
+			goto fail;
+		}
+		dst->size++;
+	}
+	return 0;
+fail:
+	clear_roaring(dst);
+	return -1;
+}
+
+int and_roaring(roaring_t *dst, const roaring_t *a, const roaring_t *b) {
+	clear_roaring(dst);
+	size_t i = 0, j = 0;
+	while (i < a->size && j < b->size) {
+		const struct roaring_container *ca = &a->v[i];
+		const struct roaring_container *cb = &b->v[j];
+		if (ca->key < cb->key) {
+			i++;
+		} else if (cb->key < ca->key) {
+			j++;
+		} else {
+			struct roaring_container *out = GROW_VECTOR(dst, 1);
+			int res = out ? and_container(out, ca, cb) : -1;
+			if (res < 0) {
+				clear_roaring(dst);
+				return -1;
+			}
+			dst->size += res;
+			i++;
+			j++;
+		}
+	}
+	return 0;
+}
+
+int optimize_roaring(roaring_t *r) {
+	if (r->readonly) {
+		return -1;
+	}
+	for (size_t i = 0; i < r->size; i++) {
+		struct roaring_container *c = &r->v[i];
+		if (c->type == ROARING_RUN) {
+			continue;
+		}
+		uint64_t tmp[BITMAP_WORDS];
+		const uint64_t *w = container_words(c, tmp);
+		// count the bits that start a run
+		uint32_t runs = 0;
+		uint64_t prev = 0;
+		for (uint32_t k = 0; k < BITMAP_WORDS; k++) {
+			runs += popcountl(w[k] & ~((w[k] << 1) | (prev >> 63)));
+			prev = w[k];
+		}
+		if ((size_t) runs * 4 >= data_bytes(c)) {
+			continue;
+		}
+		uint16_t *data = malloc(runs * 4);
+		if (!data) {
+			return -1;
+		}
+		uint32_t n = 0;
+		for (uint32_t b = next_bit(w, 0); b < CHUNK_BITS; b = next_bit(w, b)) {
+			uint32_t e = next_clear_bit(w, b);
+			data[2 * n] = (uint16_t) b;
+			data[2 * n + 1] = (uint16_t) (e - b - 1);
+			n++;
+			b = e;
+		}
+		free_container(c);
+		c->type = ROARING_RUN;
+		c->num = runs;
+		c->cap = runs * 2;
+		c->data = data;
+	}
+	return 0;
+}
+
+// returns the first value at or after low or CHUNK_BITS
+static uint32_t next_container(const struct roaring_container *c, uint32_t low) {
+	switch (c->type) {
+	case ROARING_BITMAP:
+		return next_bit(bitmap_words(c), low);
+	case ROARING_RUN: {
+		uint32_t i = find_run(c, low);
+		if (i == c->num) {
+			return CHUNK_BITS;
+		}
+		return low > c->data[2 * i] ? low : c->data[2 * i];
+	}
+	default: {
+		uint32_t i = lower_u16(c->data, c->num, low);
+		return i < c->num ? c->data[i] : CHUNK_BITS;
+	}
+	}
+}
+
+uint64_t next_roaring(const roaring_t *r, uint64_t idx) {
+	if (idx >= ROARING_END) {
+		return ROARING_END;
+	}
+	uint32_t key = (uint32_t) (idx >> 16);
+	for (size_t i = find_container(r, key); i < r->size; i++) {
+		const struct roaring_container *c = &r->v[i];
+		uint32_t low = c->key == key ? (uint32_t) (idx & 0xFFFF) : 0;
+		uint32_t n = next_container(c, low);
+		if (n < CHUNK_BITS) {
+			return ((uint64_t) c->key << 16) | n;
+		}
+	}
+	return ROARING_END;
+}
+
+// lists up to max values at or after low, sets *next to the first value
+// not listed or CHUNK_BITS
+static size_t list_container(const struct roaring_container *c, uint32_t low, uint32_t *out, size_t max, uint32_t *next) {
+	uint32_t hi = (uint32_t) c->key << 16;
+	size_t n = 0;
+	switch (c->type) {
+	case ROARING_BITMAP: {
+		const uint64_t *words = bitmap_words(c);
+		uint32_t w = low >> 6;
+		uint64_t x = words[w] & (UINT64_MAX << (low & 63));
+		for (;;) {
+			while (!x) {
+				if (++w == BITMAP_WORDS) {
+					*next = CHUNK_BITS;
+					return n;
+				}
+				x = words[w];
+			}
+			if (n == max) {
+				*next = w * 64 + ctzl(x);
+				return n;
+			}
+			out[n++] = hi | (w * 64 + ctzl(x));
+			x &= x - 1;
+		}
+	}
+	case ROARING_RUN: {
+		uint32_t v = low;
+		for (uint32_t i = find_run(c, low); i < c->num; i++) {
+			uint32_t start = c->data[2 * i];
+			uint32_t end = start + c->data[2 * i + 1];
+			if (v < start) {
+				v = start;
+			}
+			for (; v <= end; v++) {
+				if (n == max) {
+					*next = v;
+					return n;
+				}
+				out[n++] = hi | v;
+			}
+		}
+		*next = CHUNK_BITS;
+		return n;
+	}
+	default: {
+		uint32_t i = lower_u16(c->data, c->num, low);
+		for (; i < c->num && n < max; i++) {
+			out[n++] = hi | c->data[i];
+		}
+		*next = i < c->num ? c->data[i] : CHUNK_BITS;
+		return n;
+	}
+	}
+}
+
+size_t list_roaring(const roaring_t *r, uint64_t *pidx, uint32_t *out, size_t max) {
+	uint64_t idx = *pidx;
+	if (idx >= ROARING_END) {
+		return 0;
+	}
+	uint32_t key = (uint32_t) (idx >> 16);
+	size_t n = 0;
+	size_t i = find_container(r, key);
+	for (; i < r->size && n < max; i++) {
+		const struct roaring_container *c = &r->v[i];
+		uint32_t low = c->key == key ? (uint32_t) (idx & 0xFFFF) : 0;
+		uint32_t next;
+		n += list_container(c, low, out + n, max - n, &next);
+		if (next < CHUNK_BITS) {
+			*pidx = ((uint64_t) c->key << 16) | next;
+			return n;
+		}
+	}
+	*pidx = i < r->size ? (uint64_t) r->v[i].key << 16 : ROARING_END;
+	return n;
+}
+
+int roaring_to_bitset(struct bitset *b, const roaring_t *r, uint64_t begin, uint64_t end) {
+	if (end < begin) {
+		end = begin;
+	}
+	b->bytes = 0;
+	if (set_bitset_size(NULL, b, (size_t) (end - begin))) {
+		return -1;
+	}
+	uint32_t out[256];
+	for (size_t i = find_container(r, (uint32_t) (begin >> 16)); i < r->size; i++) {
+		const struct roaring_container *c = &r->v[i];
+		uint64_t chunk = (uint64_t) c->key << 16;
+		if (chunk >= end) {
+			break;
+		}
+		if (c->type == ROARING_BITMAP && chunk >= begin && chunk + CHUNK_BITS <= end && !((chunk - begin) & 7)) {
+			// whole bitmap lines up with the bytes of the bitset
+			uint8_t *p = b->v + (chunk - begin) / 8;
+			for (uint32_t w = 0; w < BITMAP_WORDS; w++) {
+				write_little_64(p + w * 8, bitmap_words(c)[w]);
+			}
+			continue;
+		}
+		uint32_t low = chunk < begin ? (uint32_t) (begin - chunk) : 0;
+		for (;;) {
+			uint32_t next;
+			size_t n = list_container(c, low, out, 256, &next);
+			for (size_t j = 0; j < n && out[j] < end; j++) {
+				set_bitset(b, out[j] - (size_t) begin);
+			}
+			if (next == CHUNK_BITS || chunk + next >= end) {
+				break;
+			}
+			low = next;
+		}
+	}
+	return 0;
+}
+
+int bitset_to_roaring(roaring_t *r, const struct bitset *b, uint32_t offset) {
+	size_t bits = bitset_bits(b);
+	if (r->readonly || (uint64_t) offset + bits > ROARING_END) {
+		return -1;
+	}
+	if (offset & 0xFFFF) {
+		// chunks don't line up, so add the bits one at a time
+		FOR_BITSET(i, b) {
+			if (add_roaring(r, offset + (uint32_t) i)) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+	for (size_t begin = 0; begin < bits; begin += CHUNK_BITS) {
+		size_t end = begin + CHUNK_BITS < bits ? begin + CHUNK_BITS : bits;
+		uint32_t card = (uint32_t) count_bitset(b, begin, end);
+		if (!card) {
+			continue;
+		}
+		uint64_t words[BITMAP_WORDS];
+		memset(words, 0, sizeof(words));
+		memcpy(words, b->v + begin / 8, (end - begin) / 8);
+#ifndef NATIVE_LITTLE_ENDIAN
+		for (uint32_t w = 0; w < BITMAP_WORDS; w++) {
+			words[w] = little_64(&words[w]);
+		}
+#endif
+		uint16_t key = (uint16_t) ((offset >> 16) + begin / CHUNK_BITS);
+		size_t i = find_container(r, key);
+		if (i < r->size && r->v[i].key == key) {
+			struct roaring_container add = {key, ROARING_BITMAP, BITMAP_WORDS, card, 0, (uint16_t*) words};
+			struct roaring_container merged;
+			if (or_container(&merged, &r->v[i], &add)) {
+				return -1;
+			}
+			free_container(&r->v[i]);
+			r->v[i] = merged;
+		} else {
+			struct roaring_container *c = insert_container(r, i, key);
+			if (!c || set_container_words(c, words, card)) {
+				if (c) {
+					remove_container(r, i);
+				}
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+int write_roaring(FILE *f, const roaring_t *r) {
+	size_t hdrsz = HEADER_SIZE + r->size * DESC_SIZE;
+	uint8_t *hdr = calloc(1, hdrsz);
+	uint8_t *buf = malloc(BITMAP_BYTES);
+	int ret = -1;
+	if (!hdr || !buf) {
+		goto end;
+	}
+	memcpy(hdr, magic, 8);
+	write_little_32(hdr + 8, (uint32_t) r->size);
+	size_t off = hdrsz;
+	for (size_t i = 0; i < r->size; i++) {
+		const struct roaring_container *c = &r->v[i];
+		uint8_t *d = hdr + HEADER_SIZE + i * DESC_SIZE;
+		write_little_16(d, c->key);
+		d[2] = c->type;
+		write_little_32(d + 4, c->num);
+		write_little_32(d + 8, c->card);
+		write_little_32(d + 12, (uint32_t) off);
+		off = ALIGN_UP(off + data_bytes(c), 8);
+	}
+	if (off > UINT32_MAX || fwrite(hdr, 1, hdrsz, f) != hdrsz) {
+		goto end;
+	}
+
+	off = hdrsz;
+	for (size_t i = 0; i < r->size; i++) {
+		const struct roaring_container *c = &r->v[i];
+		size_t bytes = data_bytes(c);
+		if (c->type == ROARING_BITMAP) {
+			for (uint32_t w = 0; w < BITMAP_WORDS; w++) {
+				write_little_64(buf + w * 8, bitmap_words(c)[w]);
+			}
+		} else {
+			for (size_t j = 0; j < bytes / 2; j++) {
+				write_little_16(buf + j * 2, c->data[j]);
+			}
+		}
+		size_t pad = ALIGN_UP(off + bytes, 8) - (off + bytes);
+		memset(buf + bytes, 0, pad);
+		if (fwrite(buf, 1, bytes + pad, f) != bytes + pad) {
+			goto end;
+		}
+		off += bytes + pad;
+	}
+	ret = 0;
+
+end:
+	free(hdr);
+	free(buf);
+	return ret;
+}
+
+// The data of a loaded container is checked so that a bad file can't make
+// the set operations write outside their bitmaps.
+static bool valid_data(const struct roaring_container *c) {
+	uint32_t card = 0;
+	switch (c->type) {
+	case ROARING_ARRAY:
+		for (uint32_t i = 1; i < c->num; i++) {
+			if (c->data[i] <= c->data[i - 1]) {
+				return false;
+			}
+		}
+		return true;
+	case ROARING_BITMAP:
+		for (uint32_t i = 0; i < BITMAP_WORDS; i++) {
+			card += popcountl(bitmap_words(c)[i]);
+		}
+		return card == c->card;
+	default:
+		for (uint32_t i = 0; i < c->num; i++) {
+			uint32_t start = c->data[2 * i];
+			uint32_t len = c->data[2 * i + 1];
+			// runs must be sorted, not overlap and end within the chunk
+			if (start + len > 0xFFFF || (i && start <= (uint32_t) c->data[2 * i - 2] + c->data[2 * i - 1])) {
+				return false;
+			}
+			card += len + 1;
+		}
+		return card == c->card;
+	}
+}
+
+int load_roaring(roaring_t *r, const void *data, size_t size) {
+	const uint8_t *d = data;
+	init_roaring(r);
+#ifndef NATIVE_LITTLE_ENDIAN
+	return -1;
+#endif
+	if (size < HEADER_SIZE || memcmp(d, magic, 8) || ((uintptr_t) d & 7)) {
+		return -1;
+	}
+	uint32_t num = little_32(d + 8);
+	if (num > CHUNK_BITS || (size - HEADER_SIZE) / DESC_SIZE < num) {
+		return -1;
+	}
+	struct roaring_container *v = malloc(num * sizeof(*v) + 1);
+	if (!v) {
+		return -1;
+	}
+	for (uint32_t i = 0; i < num; i++) {
+		const uint8_t *p = d + HEADER_SIZE + i * DESC_SIZE;
+		struct roaring_container *c = &v[i];
+		c->key = little_16(p);
+		c->type = p[2];
+		c->num = little_32(p + 4);
+		c->card = little_32(p + 8);
+		c->cap = 0;
+		uint32_t off = little_32(p + 12);
+		bool ok = (i == 0 || c->key > v[i - 1].key) && c->card > 0 && c->card <= CHUNK_BITS;
+		switch (c->type) {
+		case ROARING_ARRAY:
+			ok = ok && c->num == c->card && c->num <= ARRAY_MAX;
+			break;
+		case ROARING_BITMAP:
+			ok = ok && c->num == BITMAP_WORDS;
+			break;
+		case ROARING_RUN:
+			ok = ok && c->num > 0 && c->num <= CHUNK_BITS / 2;
+			break;
+		default:
+			ok = false;
+		}
+		if (!ok || (off & 7) || off < HEADER_SIZE + (size_t) num * DESC_SIZE
+			|| off > size || size - off < data_bytes(c)) {
+			free(v);
+			return -1;
+		}
+		c->data = (uint16_t*) (d + off);
+		if (!valid_data(c)) {
+			free(v);
+			return -1;
+		}
+	}
+	r->v = v;
+	r->size = r->cap = num;
+	r->readonly = true;
+	return 0;
+}
+
+int open_roaring(roaring_t *r, const char *fn) {
+	mapped_file mf;
+	if (map_file(&mf, fn)) {
+		init_roaring(r);
+		return -1;
+	}
+	if (load_roaring(r, mf.data, mf.size)) {
+		unmap_file(&mf);
+		return -1;
+	}
+	r->mf = mf;
+	return 0;
+}
@@ -0,0 +1,316 @@
+#include "cutils/roaring.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include "cutils/endian.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// values in the tests are below RANGE so that a flat bitset can be used to
+// check them
+#define RANGE (1 << 20)
+
+static int bench_ids = 200000;
+
+// chunks alternate between sparse (arrays), dense (bitmaps) and ranges
+static void fill(roaring_t *r, struct bitset *b, uint64_t *seed) {
+	b->bytes = 0;
+	EXPECT_EQ(0, set_bitset_size(NULL, b, RANGE));
+	for (uint32_t chunk = 0; chunk < RANGE >> 16; chunk++) {
+		uint32_t base = chunk << 16;
+		switch (test_rand(seed) % 4) {
+		case 0:
+			for (int i = 0; i < 100; i++) {
+				uint32_t v = base + (uint32_t) (test_rand(seed) & 0xFFFF);
+				EXPECT_EQ(0, add_roaring(r, v));
+				set_bitset(b, v);
+			}
+			break;
+		case 1:
+			for (int i = 0; i < 10000; i++) {
+				uint32_t v = base + (uint32_t) (test_rand(seed) & 0xFFFF);
+				EXPECT_EQ(0, add_roaring(r, v));
+				set_bitset(b, v);
+			}
+			break;
+		case 2: {
+			uint32_t start = base + (uint32_t) (test_rand(seed) & 0x7FFF);
+			for (uint32_t v = start; v < start + 20000; v++) {
+				EXPECT_EQ(0, add_roaring(r, v));
+				set_bitset(b, v);
+			}
+			break;
+		}
+		}
+	}
+}
+
+static void check(const roaring_t *r, const struct bitset *b) {
+	EXPECT_EQ(count_bitset(b, 0, RANGE), count_roaring(r));
+	uint32_t out[1000];
+	uint64_t idx = 0;
+	size_t want = next_bitset(b, 0), n;
+	while ((n = list_roaring(r, &idx, out, 1000)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			EXPECT_EQ(want, out[i]);
+			want = next_bitset(b, want + 1);
+		}
+	}
+	EXPECT_EQ(RANGE, want);
+	EXPECT_EQ(ROARING_END, idx);
+	for (uint32_t v = 0; v < RANGE; v += 61) {
+		EXPECT_EQ(test_bitset((struct bitset*) b, v), test_roaring(r, v));
+		size_t next = next_bitset(b, v);
+		EXPECT_EQ(next == RANGE ? ROARING_END : next, next_roaring(r, v));
+	}
+}
+
+static void test_basic(void) {
+	roaring_t r;
+	init_roaring(&r);
+	EXPECT_EQ(ROARING_END, next_roaring(&r, 0));
+	EXPECT_EQ(0, add_roaring(&r, 5));
+	EXPECT_EQ(0, add_roaring(&r, UINT32_MAX));
+	EXPECT_EQ(0, add_roaring(&r, 5));
+	EXPECT_EQ(2, count_roaring(&r));
+	EXPECT_TRUE(test_roaring(&r, UINT32_MAX));
+	EXPECT_TRUE(!test_roaring(&r, 6));
+	EXPECT_EQ(UINT32_MAX, next_roaring(&r, 6));
+	EXPECT_EQ(0, remove_roaring(&r, 5));
+	EXPECT_EQ(1, r.size);
+	free_roaring(&r);
+
+	// containers switch type as they fill up and empty out
+	struct bitset b = {0};
+	uint64_t seed = 1;
+	fill(&r, &b, &seed);
+	check(&r, &b);
+	for (uint32_t v = 0; v < RANGE; v += 3) {
+		EXPECT_EQ(0, remove_roaring(&r, v));
+		clear_bitset(&b, v);
+	}
+	check(&r, &b);
+
+	// runs are only used where they are smaller and still allow changes
+	size_t before = roaring_memory(&r);
+	EXPECT_EQ(0, optimize_roaring(&r));
+	EXPECT_TRUE(roaring_memory(&r) <= before);
+	check(&r, &b);
+	for (int i = 0; i < 1000; i++) {
+		uint32_t v = (uint32_t) (test_rand(&seed) % RANGE);
+		if (i & 1) {
+			EXPECT_EQ(0, add_roaring(&r, v));
+			set_bitset(&b, v);
+		} else {
+			EXPECT_EQ(0, remove_roaring(&r, v));
+			clear_bitset(&b, v);
+		}
+	}
+	check(&r, &b);
+
+	free_roaring(&r);
+	free(b.v);
+}
+
+static void test_ops(void) {
+	roaring_t a, b, dst;
+	init_roaring(&a);
+	init_roaring(&b);
+	init_roaring(&dst);
+	struct bitset fa = {0}, fb = {0};
+	uint64_t seed = 2;
+	fill(&a, &fa, &seed);
+	fill(&b, &fb, &seed);
+	EXPECT_EQ(0, optimize_roaring(&b));
+
+	EXPECT_EQ(0, or_roaring(&dst, &a, &b));
+	struct bitset want = {0};
+	EXPECT_EQ(0, set_bitset_size(NULL, &want, RANGE));
+	memcpy(want.v, fa.v, fa.bytes);
+	or_bitset(&want, &fb, 0, RANGE);
+	check(&dst, &want);
+
+	EXPECT_EQ(0, and_roaring(&dst, &a, &b));
+	memcpy(want.v, fa.v, fa.bytes);
+	and_bitset(&want, &fb, 0, RANGE);
+	check(&dst, &want);
+
+	// conversion to and from flat bitsets
+	struct bitset flat = {0};
+	EXPECT_EQ(0, roaring_to_bitset(&flat, &a, 0, RANGE));
+	EXPECT_BYTES_EQ(fa.v, fa.bytes, flat.v, flat.bytes);
+	EXPECT_EQ(0, roaring_to_bitset(&flat, &a, 12345, 12345 + 200000));
+	for (uint32_t i = 0; i < 200000; i++) {
+		EXPECT_EQ(test_bitset(&fa, 12345 + i), test_bitset(&flat, i));
+	}
+
+	roaring_t c;
+	init_roaring(&c);
+	EXPECT_EQ(0, bitset_to_roaring(&c, &fb, 0));
+	check(&c, &fb);
+	EXPECT_EQ(0, bitset_to_roaring(&c, &fa, 0));
+	memcpy(want.v, fa.v, fa.bytes);
+	or_bitset(&want, &fb, 0, RANGE);
+	check(&c, &want);
+	free_roaring(&c);
+
+	init_roaring(&c);
+	EXPECT_EQ(0, bitset_to_roaring(&c, &flat, 12345));
+	EXPECT_EQ(count_bitset(&flat, 0, 200000), count_roaring(&c));
+	EXPECT_EQ(next_bitset(&fa, 12345), next_roaring(&c, 0));
+	free_roaring(&c);
+
+	free_roaring(&a);
+	free_roaring(&b);
+	free_roaring(&dst);
+	free(fa.v);
+	free(fb.v);
+	free(want.v);
+	free(flat.v);
+}
+
+static void test_file(void) {
+	roaring_t r;
+	init_roaring(&r);
+	struct bitset b = {0};
+	uint64_t seed = 3;
+	fill(&r, &b, &seed);
+	EXPECT_EQ(0, optimize_roaring(&r));
+
+	const char *fn = "test_roaring.bin";
+	FILE *f = fopen(fn, "wb");
+	EXPECT_TRUE(f != NULL);
+	EXPECT_EQ(0, write_roaring(f, &r));
+	fclose(f);
+
+	roaring_t m;
+	EXPECT_EQ(0, open_roaring(&m, fn));
+	EXPECT_EQ(r.size, m.size);
+	check(&m, &b);
+	EXPECT_EQ(-1, add_roaring(&m, 1));
+
+	// read only bitmaps can still be combined
+	roaring_t dst;
+	init_roaring(&dst);
+	EXPECT_EQ(0, or_roaring(&dst, &m, &r));
+	check(&dst, &b);
+	free_roaring(&dst);
+
+	// bad files are rejected
+	uint64_t *buf = malloc(m.mf.size + 8);
+	memcpy(buf, m.mf.data, m.mf.size);
+	roaring_t bad;
+	EXPECT_EQ(-1, load_roaring(&bad, buf, 15));
+	EXPECT_EQ(-1, load_roaring(&bad, buf, m.mf.size - 8));
+	EXPECT_EQ(-1, load_roaring(&bad, (uint8_t*) buf + 1, m.mf.size));
+	EXPECT_EQ(0, load_roaring(&bad, buf, m.mf.size));
+	free_roaring(&bad);
+	free(buf);
+
+	free_roaring(&m);
+	free_roaring(&r);
+	free(b.v);
+	remove(fn);
+	EXPECT_EQ(-1, open_roaring(&m, "does-not-exist.bin"));
+}
+
+// a file with a single container of the given type and data
+static int load_single(roaring_t *r, uint64_t *buf, uint8_t type, uint32_t num, uint32_t card, const uint16_t *data, size_t n) {
+	uint8_t *p = (uint8_t*) buf;
+	memset(p, 0, 32 + 8192);
+	memcpy(p, "CUROAR01", 8);
+	write_little_32(p + 8, 1);
+	p[16 + 2] = type;
+	write_little_32(p + 16 + 4, num);
+	write_little_32(p + 16 + 8, card);
+	write_little_32(p + 16 + 12, 32);
+	for (size_t i = 0; i < n; i++) {
+		write_little_16(p + 32 + 2 * i, data[i]);
+	}
+	return load_roaring(r, buf, 32 + 8192);
+}
+
+static void test_bad_data(void) {
+	uint64_t *buf = malloc(32 + 8192);
+	roaring_t r;
+	static const uint16_t array[] = {1, 5, 9};
+	static const uint16_t unsorted[] = {1, 9, 5};
+	static const uint16_t repeated[] = {1, 5, 5};
+	static const uint16_t runs[] = {10, 4, 20, 0};
+	static const uint16_t past_end[] = {0xFFFF, 0xFFFF};
+	static const uint16_t wraps[] = {0xFFF0, 0x10};
+	static const uint16_t overlap[] = {10, 4, 14, 0};
+	static const uint16_t backwards[] = {20, 0, 10, 4};
+	uint16_t bitmap[4] = {0xFF, 0, 0, 0x8000};
+
+	EXPECT_EQ(0, load_single(&r, buf, ROARING_ARRAY, 3, 3, array, 3));
+	EXPECT_TRUE(test_roaring(&r, 5));
+	free_roaring(&r);
+	EXPECT_EQ(-1, load_single(&r, buf, ROARING_ARRAY, 3, 3, unsorted, 3));
+	EXPECT_EQ(-1, load_single(&r, buf, ROARING_ARRAY, 3, 3, repeated, 3));
+
+	EXPECT_EQ(0, load_single(&r, buf, ROARING_RUN, 2, 6, runs, 4));
+	EXPECT_EQ(6, count_roaring(&r));
+	free_roaring(&r);
+	EXPECT_EQ(-1, load_single(&r, buf, ROARING_RUN, 2, 7, runs, 4));
+	EXPECT_EQ(-1, load_single(&r, buf, ROARING_RUN, 1, 0x10000, past_end, 2));
+	EXPECT_EQ(-1, load_single(&r, buf, ROARING_RUN, 1, 0x11, wraps, 2));
+	EXPECT_EQ(-1, load_single(&r, buf, ROARING_RUN, 2, 6, overlap, 4));
+	EXPECT_EQ(-1, load_single(&r, buf, ROARING_RUN, 2, 6, backwards, 4));
+
+	EXPECT_EQ(0, load_single(&r, buf, ROARING_BITMAP, 1024, 9, bitmap, 4));
+	EXPECT_EQ(9, count_roaring(&r));
+	free_roaring(&r);
+	EXPECT_EQ(-1, load_single(&r, buf, ROARING_BITMAP, 1024, 10, bitmap, 4));
+	free(buf);
+}
+
+// ids spread over the whole 32 bit space, where a flat bitset would need
+// 512MB, added in order as they would be when scanning a table
+static void bench_sparse(log_t *log) {
+	roaring_t a, b, dst;
+	init_roaring(&a);
+	init_roaring(&b);
+	init_roaring(&dst);
+	uint64_t seed = 4;
+	uint64_t gap = 2 * (ROARING_END / bench_ids);
+	uint64_t ida = 0, idb = 0;
+	struct timer t;
+	start_timer(&t);
+	for (int i = 0; i < bench_ids; i++) {
+		ida += 1 + test_rand(&seed) % gap;
+		idb += 1 + test_rand(&seed) % gap;
+		add_roaring(&a, (uint32_t) ida);
+		add_roaring(&b, (uint32_t) idb);
+	}
+	double build = stop_timer(&t);
+
+	start_timer(&t);
+	or_roaring(&dst, &a, &b);
+	double or = stop_timer(&t);
+	uint64_t count = count_roaring(&dst);
+
+	start_timer(&t);
+	and_roaring(&dst, &a, &b);
+	double and = stop_timer(&t);
+
+	LOG(log, "roaring sparse|ids:%d|bytesPerId:%.2f|addNs:%.1f|orMs:%.2f|andMs:%.2f|union:%.0f",
+		bench_ids, (double) roaring_memory(&a) / bench_ids, build * 1e9 / (2.0 * bench_ids),
+		or * 1e3, and * 1e3, (double) count);
+	free_roaring(&a);
+	free_roaring(&b);
+	free_roaring(&dst);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_ids, 0, "bench-ids", "N", "number of ids in the benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_basic();
+	test_ops();
+	test_file();
+	test_bad_data();
+	bench_sparse(log);
+
+	return finish_test();
+}
@@ -0,0 +1,205 @@
+#include "cutils/rope.h"
+#include "cutils/format.h"
+#include <stdlib.h>
+#include <limits.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+void free_rope(rope_t *r) {
+	struct rope_block *b = r->first;
+	while (b) {
+		struct rope_block *next = b->next;
+		free(b);
+		b = next;
+	}
+	init_rope(r);
+}
+
+void clear_rope(rope_t *r) {
+	// keep the first block around for reuse
+	struct rope_block *b = r->first;
+	if (b) {
+		r->first = b->next;
+		free_rope(r);
+		b->next = NULL;
+		b->len = 0;
+		r->first = r->last = b;
+	}
+}
+
+// Adds a new tail block with room for at least len bytes. Appends larger
+// than the block size get a block to themselves.
+static struct rope_block *add_block(rope_t *r, size_t len) {
+	size_t cap = len > ROPE_BLOCK_SIZE ? len : ROPE_BLOCK_SIZE;
+	struct rope_block *b = (struct rope_block*) malloc(sizeof(struct rope_block) + cap);
+	if (!b) {
+		return NULL;
+	}
+	b->next = NULL;
+	b->len = 0;
+	b->cap = cap;
+	if (r->last) {
+		r->last->next = b;
+	} else {
+		r->first = b;
+	}
+	r->last = b;
+	return b;
+}
+
+char *rope_reserve(rope_t *r, size_t len) {
+	struct rope_block *b = r->last;
+	if (!b || b->cap - b->len < len) {
+		b = add_block(r, len);
+		if (!b) {
+			return NULL;
+		}
+	}
+	return b->data + b->len;
+}
+
+int rope_add2(rope_t *r, const char *a, size_t len) {
+	struct rope_block *b = r->last;
+	if (b) {
+		// fill up the tail before starting a new block
+		size_t n = b->cap - b->len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(b->data + b->len, a, n);
+		b->len += n;
+		r->len += n;
+		a += n;
+		len -= n;
+	}
+	if (len) {
+		b = add_block(r, len);
+		if (!b) {
+			return -1;
+		}
+		memcpy(b->data, a, len);
+		b->len = len;
+		r->len += len;
+	}
+	return 0;
+}
+
+int rope_addch(rope_t *r, char ch) {
+	char *p = rope_reserve(r, 1);
+	if (!p) {
+		return -1;
+	}
+	*p = ch;
+	rope_commit(r, 1);
+	return 0;
+}
+
+int rope_addf(rope_t *r, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	int ret = rope_vaddf(r, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+int rope_vaddf(rope_t *r, const char *fmt, va_list ap) {
+	// try formatting into the tail first and only if that doesn't fit
+	// start a new block large enough for the whole output
+	struct rope_block *b = r->last;
+	size_t avail = b ? b->cap - b->len : 0;
+	va_list aq;
+	va_copy(aq, ap);
+	int ret = fmt_vsnprintf(b ? b->data + b->len : NULL, avail, fmt, aq);
+	va_end(aq);
+	if (ret < 0) {
+		return -1;
+	} else if ((size_t) ret >= avail) {
+		// fmt_vsnprintf needs space for the terminating null
+		b = add_block(r, (size_t) ret + 1);
+		if (!b) {
+			return -1;
+		}
+		fmt_vsnprintf(b->data, b->cap, fmt, ap);
+	}
+	b->len += ret;
+	r->len += ret;
+	return ret;
+}
+
+void str_add_rope(str_t *s, const rope_t *r) {
+	str_grow(s, s->len + r->len);
+	FOR_ROPE(b, r) {
+		str_add2(s, b->data, b->len);
+	}
+}
+
+int write_rope(FILE *f, const rope_t *r) {
+	FOR_ROPE(b, r) {
+		if (fwrite(b->data, 1, b->len, f) != b->len) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+#ifdef WIN32
+int writev_rope(int fd, const rope_t *r) {
+	FOR_ROPE(b, r) {
+		const char *p = b->data;
+		size_t len = b->len;
+		while (len) {
+			int w = _write(fd, p, len > INT_MAX ? INT_MAX : (unsigned) len);
+			if (w <= 0) {
+				return -1;
+			}
+			p += w;
+			len -= w;
+		}
+	}
+	return 0;
+}
+#else
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+int writev_rope(int fd, const rope_t *r) {
+	const struct rope_block *b = r->first;
+	size_t off = 0;
+	while (b) {
+		// gather as many blocks as one call can take
+		struct iovec iov[IOV_MAX < 64 ? IOV_MAX : 64];
+		size_t total = 0;
+		int n = 0;
+		for (const struct rope_block *c = b; c && n < (int) (sizeof(iov) / sizeof(iov[0])); c = c->next) {
+			size_t coff = c == b ? off : 0;
+			iov[n].iov_base = (char*) c->data + coff;
+			iov[n].iov_len = c->len - coff;
+			total += iov[n].iov_len;
+			n++;
+		}
+		ssize_t w = writev(fd, iov, n);
+		if (w < 0 && errno == EINTR) {
+			continue;
+		} else if (w < 0 || (w == 0 && total)) {
+			return -1;
+		}
+
+		// skip over what was written, this may stop part way into a block
+		size_t left = (size_t) w;
+		while (b && left >= b->len - off) {
+			left -= b->len - off;
+			b = b->next;
+			off = 0;
+		}
+		off += left;
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,234 @@
+#include "cutils/rope.h"
+#include "cutils/stream.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include "cutils/format.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static int bench_bytes = 4 << 20;
+
+static size_t count_blocks(const rope_t *r) {
+	size_t n = 0, len = 0;
+	FOR_ROPE(b, r) {
+		EXPECT_TRUE(b->len <= b->cap);
+		len += b->len;
+		n++;
+	}
+	EXPECT_EQ(r->len, len);
+	return n;
+}
+
+static void check_rope(const rope_t *r, const str_t *want) {
+	str_t s = STR_INIT;
+	str_add_rope(&s, r);
+	EXPECT_EQ(want->len, s.len);
+	EXPECT_BYTES_EQ(want->c_str, want->len, s.c_str, s.len);
+	str_destroy(&s);
+}
+
+// random appends checked against the same appends to a str_t
+static void test_add(void) {
+	rope_t r;
+	init_rope(&r);
+	str_t want = STR_INIT;
+	char buf[1000];
+	uint64_t seed = 1;
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = 'a' + (i % 26);
+	}
+	while (want.len < 3 * ROPE_BLOCK_SIZE) {
+		size_t n = test_rand(&seed) % sizeof(buf);
+		EXPECT_EQ(0, rope_add2(&r, buf, n));
+		str_add2(&want, buf, n);
+		EXPECT_EQ(0, rope_addch(&r, '\n'));
+		str_addch(&want, '\n');
+	}
+	// plain appends fill each block before starting the next
+	EXPECT_EQ((want.len + ROPE_BLOCK_SIZE - 1) / ROPE_BLOCK_SIZE, count_blocks(&r));
+	check_rope(&r, &want);
+
+	// large appends go into a block of their own
+	str_t big = STR_INIT;
+	while (big.len < 3 * ROPE_BLOCK_SIZE) {
+		str_add2(&big, buf, sizeof(buf));
+	}
+	size_t blocks = count_blocks(&r);
+	rope_addstr(&r, big);
+	str_addstr(&want, big);
+	EXPECT_EQ(blocks + 1, count_blocks(&r));
+	check_rope(&r, &want);
+
+	clear_rope(&r);
+	EXPECT_EQ(0, r.len);
+	EXPECT_EQ(1, count_blocks(&r));
+	rope_add(&r, "abc");
+	str_set(&want, "abc");
+	check_rope(&r, &want);
+
+	free_rope(&r);
+	EXPECT_PTREQ(NULL, r.first);
+	str_destroy(&big);
+	str_destroy(&want);
+}
+
+static void test_format(void) {
+	rope_t r;
+	init_rope(&r);
+	str_t want = STR_INIT;
+
+	// formatted output is kept whole even where it runs over a block edge
+	for (int i = 0; r.len < 2 * ROPE_BLOCK_SIZE; i++) {
+		EXPECT_EQ(20, rope_addf(&r, "%-8d|%10.3f\n", i, i / 7.0));
+		str_addf(&want, "%-8d|%10.3f\n", i, i / 7.0);
+		char *p = rope_reserve(&r, FMT_BUFSZ);
+		EXPECT_TRUE(p != NULL);
+		rope_commit(&r, fmt_u64(p, (uint64_t) i * 1000003));
+		str_add_u64(&want, (uint64_t) i * 1000003);
+	}
+	check_rope(&r, &want);
+	EXPECT_EQ(3, count_blocks(&r));
+	FOR_ROPE(b, &r) {
+		if (b->next) {
+			EXPECT_TRUE(b->data[b->len - 1] == '\n' || (b->data[b->len - 1] >= '0' && b->data[b->len - 1] <= '9'));
+			EXPECT_TRUE(b->len + FMT_BUFSZ > b->cap);
+		}
+	}
+
+	// oversized output gets an exact block
+	str_t big = STR_INIT;
+	while (big.len < ROPE_BLOCK_SIZE + 100) {
+		str_add(&big, "0123456789");
+	}
+	EXPECT_EQ((int) big.len + 2, rope_addf(&r, "<%s>", big.c_str));
+	str_addf(&want, "<%s>", big.c_str);
+	EXPECT_EQ(big.len + 2, r.last->len);
+	check_rope(&r, &want);
+
+	free_rope(&r);
+	str_destroy(&big);
+	str_destroy(&want);
+}
+
+static void build_rope(rope_t *r, str_t *want, size_t size) {
+	uint64_t seed = 3;
+	while (r->len < size) {
+		uint64_t v = test_rand(&seed);
+		rope_addf(r, "%016" PRIx64 " line %d\n", v, (int) (v % 1000));
+		str_addf(want, "%016" PRIx64 " line %d\n", v, (int) (v % 1000));
+	}
+}
+
+static void test_write(void) {
+	rope_t r;
+	init_rope(&r);
+	str_t want = STR_INIT, got = STR_INIT;
+	build_rope(&r, &want, 5 * ROPE_BLOCK_SIZE + 17);
+
+	FILE *f = tmpfile();
+	EXPECT_TRUE(f != NULL);
+	EXPECT_EQ(0, write_rope(f, &r));
+	EXPECT_EQ(0, fflush(f));
+	EXPECT_EQ(0, writev_rope(fileno(f), &r));
+	EXPECT_EQ(0, fseek(f, 0, SEEK_SET));
+	str_grow(&got, 2 * want.len);
+	got.len = fread(got.c_str, 1, 2 * want.len + 1, f);
+	EXPECT_EQ(2 * want.len, got.len);
+	EXPECT_BYTES_EQ(want.c_str, want.len, got.c_str, want.len);
+	EXPECT_BYTES_EQ(want.c_str, want.len, got.c_str + want.len, got.len - want.len);
+	fclose(f);
+
+	free_rope(&r);
+	str_destroy(&want);
+	str_destroy(&got);
+}
+
+static void test_stream(void) {
+	rope_t r;
+	init_rope(&r);
+	str_t want = STR_INIT;
+	build_rope(&r, &want, 3 * ROPE_BLOCK_SIZE);
+
+	// mix small reads, reads that span block edges and reads of the rest
+	stream *s = open_rope_stream(&r);
+	uint64_t seed = 4;
+	size_t off = 0, consume = 0, len;
+	for (;;) {
+		size_t need = test_rand(&seed) % 3 ? (size_t) (test_rand(&seed) % 64) : (size_t) (test_rand(&seed) % (2 * ROPE_BLOCK_SIZE));
+		const uint8_t *p = s->read(s, consume, need, &len);
+		off += consume;
+		EXPECT_TRUE(p != NULL);
+		if (!len) {
+			break;
+		}
+		EXPECT_TRUE(len >= need || off + len == want.len);
+		EXPECT_TRUE(off + len <= want.len);
+		EXPECT_BYTES_EQ(want.c_str + off, len, p, len);
+		consume = 1 + test_rand(&seed) % len;
+	}
+	EXPECT_EQ(want.len, off);
+	s->close(s);
+
+	free_rope(&r);
+	str_destroy(&want);
+}
+
+// building a large report in pieces and writing it out
+static void bench_output(log_t *log) {
+	struct timer t;
+	int fd = -1;
+#ifndef WIN32
+	fd = open("/dev/null", O_WRONLY);
+#endif
+
+	start_timer(&t);
+	str_t s = STR_INIT;
+	for (int i = 0; s.len < (size_t) bench_bytes; i++) {
+		str_addf(&s, "%d,%s,%.2f\n", i, "some field text", i * 0.25);
+	}
+	size_t strpeak = s.cap;
+	if (fd >= 0) {
+		EXPECT_EQ((ssize_t) s.len, write(fd, s.c_str, s.len));
+	}
+	double strt = stop_timer(&t);
+
+	start_timer(&t);
+	rope_t r;
+	init_rope(&r);
+	for (int i = 0; r.len < (size_t) bench_bytes; i++) {
+		rope_addf(&r, "%d,%s,%.2f\n", i, "some field text", i * 0.25);
+	}
+	size_t ropepeak = count_blocks(&r) * ROPE_BLOCK_SIZE;
+	if (fd >= 0) {
+		EXPECT_EQ(0, writev_rope(fd, &r));
+	}
+	double ropet = stop_timer(&t);
+	EXPECT_EQ(s.len, r.len);
+
+	LOG(log, "rope output|bytes:%d|strMs:%.2f|ropeMs:%.2f|strPeakMB:%.2f|ropePeakMB:%.2f",
+		bench_bytes, strt * 1e3, ropet * 1e3, strpeak / 1e6, ropepeak / 1e6);
+#ifndef WIN32
+	if (fd >= 0) {
+		close(fd);
+	}
+#endif
+	str_destroy(&s);
+	free_rope(&r);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_bytes, 0, "bench-bytes", "BYTES", "size of the output in the benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_add();
+	test_format();
+	test_write();
+	test_stream();
+	bench_output(log);
+
+	return finish_test();
+}
@@ -0,0 +1,207 @@
+#include "cutils/char-array.h"
+#include "cutils/endian.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined __AVX2__
+#include <immintrin.h>
+#define SEARCH_AVX2
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SEARCH_SSE2
+#elif defined __ARM_NEON && defined __aarch64__
+#include <arm_neon.h>
+#define SEARCH_NEON
+#endif
+
+// vec_match returns a mask with a bit set every MASK_BITS bits for each
+// byte of a that equals first and where the same byte of b equals last
+#if defined SEARCH_AVX2
+#define VEC_SIZE 32
+#define MASK_BITS 1
+typedef __m256i vec_t;
+static inline vec_t vec_splat(uint8_t c) {return _mm256_set1_epi8((char) c);}
+static inline uint64_t vec_match(const uint8_t *a, const uint8_t *b, vec_t first, vec_t last) {
+	__m256i x = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) a), first);
+	__m256i y = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) b), last);
+	return (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(x, y));
+}
+#elif defined SEARCH_SSE2
+#define VEC_SIZE 16
+#define MASK_BITS 1
+typedef __m128i vec_t;
+static inline vec_t vec_splat(uint8_t c) {return _mm_set1_epi8((char) c);}
+static inline uint64_t vec_match(const uint8_t *a, const uint8_t *b, vec_t first, vec_t last) {
+	__m128i x = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) a), first);
+	__m128i y = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) b), last);
+	return (uint32_t) _mm_movemask_epi8(_mm_and_si128(x, y));
+}
+#elif defined SEARCH_NEON
+#define VEC_SIZE 16
+#define MASK_BITS 4
+typedef uint8x16_t vec_t;
+static inline vec_t vec_splat(uint8_t c) {return vdupq_n_u8(c);}
+static inline uint64_t vec_match(const uint8_t *a, const uint8_t *b, vec_t first, vec_t last) {
+	uint8x16_t m = vandq_u8(vceqq_u8(vld1q_u8(a), first), vceqq_u8(vld1q_u8(b), last));
+	uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+	return nibbles & UINT64_C(0x8888888888888888);
+}
+#endif
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define BYTESET_TEST(set, c) ((set)[(c) >> 6] & ((uint64_t) 1 << ((c) & 63)))
+#define BYTESET_ADD(set, c) ((set)[(c) >> 6] |= ((uint64_t) 1 << ((c) & 63)))
+
+// Two-Way string matching (Crochemore & Perrin 1991) as used by musl's
+// memmem. It's linear in the size of the haystack whatever the input, but
+// slower than the anchored search below on typical text.
+static const char *twoway_search(const uint8_t *h, const uint8_t *z, const uint8_t *n, size_t l) {
+	uint64_t byteset[4] = {0};
+	size_t shift[256];
+	for (size_t i = 0; i < l; i++) {
+		BYTESET_ADD(byteset, n[i]);
+		shift[n[i]] = i + 1;
+	}
+
+	// compute the maximal suffix for both orderings to find the critical
+	// factorization of the needle
+	size_t ip = (size_t) -1, jp = 0, k = 1, p = 1;
+	while (jp + k < l) {
+		if (n[ip + k] == n[jp + k]) {
+			if (k == p) {
+				jp += p;
+				k = 1;
+			} else {
+				k++;
+			}
+		} else if (n[ip + k] > n[jp + k]) {
+			jp += k;
+			k = 1;
+			p = jp - ip;
+		} else {
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	size_t ms = ip, p0 = p;
+
+	ip = (size_t) -1, jp = 0, k = p = 1;
+	while (jp + k < l) {
+		if (n[ip + k] == n[jp + k]) {
+			if (k == p) {
+				jp += p;
+				k = 1;
+			} else {
+				k++;
+			}
+		} else if (n[ip + k] < n[jp + k]) {
+			jp += k;
+			k = 1;
+			p = jp - ip;
+		} else {
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	if (ip + 1 > ms + 1) {
+		ms = ip;
+	} else {
+		p = p0;
+	}
+
+	// periodic needles remember how much of the needle is already known
+	// to match after a shift by the period
+	size_t mem0, mem = 0;
+	if (memcmp(n, n + p, ms + 1)) {
+		mem0 = 0;
+		p = MAX(ms, l - ms - 1) + 1;
+	} else {
+		mem0 = l - p;
+	}
+
+	for (;;) {
+		if ((size_t) (z - h) < l) {
+			return NULL;
+		}
+
+		// check the last byte first to skip ahead on a mismatch
+		if (BYTESET_TEST(byteset, h[l - 1])) {
+			k = l - shift[h[l - 1]];
+			if (k) {
+				h += MAX(k, mem);
+				mem = 0;
+				continue;
+			}
+		} else {
+			h += l;
+			mem = 0;
+			continue;
+		}
+
+		// right half and then left half
+		for (k = MAX(ms + 1, mem); k < l && n[k] == h[k]; k++) {
+		}
+		if (k < l) {
+			h += k - ms;
+			mem = 0;
+			continue;
+		}
+		for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--) {
+		}
+		if (k <= mem) {
+			return (const char*) h;
+		}
+		h += p;
+		mem = mem0;
+	}
+}
+
+const char *str_search(const char *hay, size_t haysz, const char *needle, size_t needlesz) {
+	if (!needlesz) {
+		return hay;
+	} else if (needlesz > haysz) {
+		return NULL;
+	} else if (needlesz == 1) {
+		return (const char*) memchr(hay, needle[0], haysz);
+	}
+
+	const uint8_t *h = (const uint8_t*) hay;
+	const uint8_t *n = (const uint8_t*) needle;
+	size_t last = needlesz - 1;
+	size_t end = haysz - last;
+	size_t i = 0;
+
+	// Candidates have to match the first and last bytes of the needle. The
+	// bytes in between are only compared for those. Inputs with many false
+	// candidates switch over to Two-Way so that the worst case stays linear.
+	size_t checked = 0;
+#ifdef VEC_SIZE
+	vec_t first = vec_splat(n[0]), lastv = vec_splat(n[last]);
+	for (; i + VEC_SIZE <= end; i += VEC_SIZE) {
+		uint64_t mask = vec_match(h + i, h + i + last, first, lastv);
+		while (mask) {
+			size_t j = i + ctzl(mask) / MASK_BITS;
+			if (!memcmp(h + j + 1, n + 1, last - 1)) {
+				return hay + j;
+			}
+			checked += needlesz;
+			mask &= mask - 1;
+		}
+		if (checked > 4 * i + 4096) {
+			return twoway_search(h + i, h + haysz, n, needlesz);
+		}
+	}
+#endif
+	for (; i < end; i++) {
+		if (h[i] == n[0] && h[i + last] == n[last]) {
+			if (!memcmp(h + i + 1, n + 1, last - 1)) {
+				return hay + i;
+			}
+			checked += needlesz;
+			if (checked > 4 * i + 4096) {
+				return twoway_search(h + i, h + haysz, n, needlesz);
+			}
+		}
+	}
+	return NULL;
+}
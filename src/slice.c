@@ -0,0 +1,404 @@
+#include "cutils/slice.h"
+#include "cutils/endian.h"
+#include <stdlib.h>
+
+#if defined __AVX2__
+#include <immintrin.h>
+#define SLICE_AVX2
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SLICE_SSE2
+#elif defined __ARM_NEON && defined __aarch64__
+#include <arm_neon.h>
+#define SLICE_NEON
+#endif
+
+// vec_mask returns a mask with a bit set every MASK_BITS bits for each
+// byte that is set in the result of vec_eq
+#if defined SLICE_AVX2
+#define VEC_SIZE 32
+#define MASK_BITS 1
+typedef __m256i vec_t;
+static inline vec_t vec_splat(char c) {return _mm256_set1_epi8(c);}
+static inline vec_t vec_load(const char *p) {return _mm256_loadu_si256((const __m256i*) p);}
+static inline vec_t vec_eq(vec_t a, vec_t b) {return _mm256_cmpeq_epi8(a, b);}
+static inline vec_t vec_or(vec_t a, vec_t b) {return _mm256_or_si256(a, b);}
+static inline uint64_t vec_mask(vec_t a) {return (uint32_t) _mm256_movemask_epi8(a);}
+#elif defined SLICE_SSE2
+#define VEC_SIZE 16
+#define MASK_BITS 1
+typedef __m128i vec_t;
+static inline vec_t vec_splat(char c) {return _mm_set1_epi8(c);}
+static inline vec_t vec_load(const char *p) {return _mm_loadu_si128((const __m128i*) p);}
+static inline vec_t vec_eq(vec_t a, vec_t b) {return _mm_cmpeq_epi8(a, b);}
+static inline vec_t vec_or(vec_t a, vec_t b) {return _mm_or_si128(a, b);}
+static inline uint64_t vec_mask(vec_t a) {return (uint32_t) _mm_movemask_epi8(a);}
+#elif defined SLICE_NEON
+#define VEC_SIZE 16
+#define MASK_BITS 4
+typedef uint8x16_t vec_t;
+static inline vec_t vec_splat(char c) {return vdupq_n_u8((uint8_t) c);}
+static inline vec_t vec_load(const char *p) {return vld1q_u8((const uint8_t*) p);}
+static inline vec_t vec_eq(vec_t a, vec_t b) {return vceqq_u8(a, b);}
+static inline vec_t vec_or(vec_t a, vec_t b) {return vorrq_u8(a, b);}
+static inline uint64_t vec_mask(vec_t a) {
+	uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(a), 4)), 0);
+	return nibbles & UINT64_C(0x8888888888888888);
+}
+#endif
+
+#define BYTESET_TEST(set, c) ((set)[(c) >> 6] & ((uint64_t) 1 << ((c) & 63)))
+#define BYTESET_ADD(set, c) ((set)[(c) >> 6] |= ((uint64_t) 1 << ((c) & 63)))
+
+static inline bool is_space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int to_lower(char c) {
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : (uint8_t) c;
+}
+
+slice_t slice_ltrim(slice_t s) {
+	while (s.len && is_space(s.c_str[0])) {
+		s.c_str++;
+		s.len--;
+	}
+	return s;
+}
+
+slice_t slice_rtrim(slice_t s) {
+	while (s.len && is_space(s.c_str[s.len - 1])) {
+		s.len--;
+	}
+	return s;
+}
+
+slice_t slice_trim(slice_t s) {
+	return slice_rtrim(slice_ltrim(s));
+}
+
+int slice_cmp(slice_t a, slice_t b) {
+	int ret = memcmp(a.c_str, b.c_str, a.len < b.len ? a.len : b.len);
+	if (ret) {
+		return ret;
+	}
+	return a.len < b.len ? -1 : a.len > b.len;
+}
+
+// Lower cases the ASCII letters in 8 bytes at once. The top bit of each
+// byte is set in ge_a for bytes >= 'A' and in gt_z for bytes > 'Z'.
+static inline uint64_t fold_ascii(uint64_t x) {
+	uint64_t low = x & UINT64_C(0x7F7F7F7F7F7F7F7F);
+	uint64_t ge_a = low + UINT64_C(0x3F3F3F3F3F3F3F3F);
+	uint64_t gt_z = low + UINT64_C(0x2525252525252525);
+	uint64_t upper = (ge_a ^ gt_z) & ~x & UINT64_C(0x8080808080808080);
+	return x | (upper >> 2);
+}
+
+// returns the length of the common prefix ignoring case, up to len
+static size_t iprefix(const char *a, const char *b, size_t len) {
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		if (fold_ascii(little_64(a + i)) != fold_ascii(little_64(b + i))) {
+			break;
+		}
+	}
+	while (i < len && to_lower(a[i]) == to_lower(b[i])) {
+		i++;
+	}
+	return i;
+}
+
+int slice_icmp(slice_t a, slice_t b) {
+	size_t n = a.len < b.len ? a.len : b.len;
+	size_t i = iprefix(a.c_str, b.c_str, n);
+	if (i < n) {
+		return to_lower(a.c_str[i]) - to_lower(b.c_str[i]);
+	}
+	return a.len < b.len ? -1 : a.len > b.len;
+}
+
+bool slice_iequals(slice_t a, slice_t b) {
+	return a.len == b.len && iprefix(a.c_str, b.c_str, a.len) == a.len;
+}
+
+bool slice_cut(slice_t s, char ch, slice_t *pbefore, slice_t *pafter) {
+	const char *p = (const char*) memchr(s.c_str, ch, s.len);
+	if (!p) {
+		return false;
+	}
+	if (pbefore) {
+		*pbefore = make_slice(s.c_str, p - s.c_str);
+	}
+	if (pafter) {
+		*pafter = make_slice(p + 1, s.c_str + s.len - p - 1);
+	}
+	return true;
+}
+
+void init_slice_set(struct slice_set *set, const char *chars) {
+	memset(set, 0, sizeof(*set));
+	for (const uint8_t *p = (const uint8_t*) chars; *p; p++) {
+		if (!BYTESET_TEST(set->bits, *p)) {
+			BYTESET_ADD(set->bits, *p);
+			if (set->num < sizeof(set->chars)) {
+				set->chars[set->num] = (char) *p;
+			}
+			set->num++;
+		}
+	}
+}
+
+size_t slice_find_any(slice_t s, const struct slice_set *set) {
+	const char *p = s.c_str;
+	size_t i = 0;
+	if (set->num == 1) {
+		const char *q = (const char*) memchr(p, set->chars[0], s.len);
+		return q ? (size_t) (q - p) : s.len;
+	}
+#ifdef VEC_SIZE
+	unsigned n = set->num;
+	if (n && n <= sizeof(set->chars)) {
+		vec_t c[sizeof(set->chars)];
+		for (unsigned j = 0; j < n; j++) {
+			c[j] = vec_splat(set->chars[j]);
+		}
+		for (; i + VEC_SIZE <= s.len; i += VEC_SIZE) {
+			vec_t x = vec_load(p + i);
+			vec_t m = vec_eq(x, c[0]);
+			for (unsigned j = 1; j < n; j++) {
+				m = vec_or(m, vec_eq(x, c[j]));
+			}
+			uint64_t mask = vec_mask(m);
+			if (mask) {
+				return i + ctzl(mask) / MASK_BITS;
+			}
+		}
+	}
+#endif
+	for (; i < s.len; i++) {
+		if (BYTESET_TEST(set->bits, (uint8_t) p[i])) {
+			return i;
+		}
+	}
+	return s.len;
+}
+
+size_t slice_span(slice_t s, const struct slice_set *set) {
+	size_t i = 0;
+	while (i < s.len && BYTESET_TEST(set->bits, (uint8_t) s.c_str[i])) {
+		i++;
+	}
+	return i;
+}
+
+void init_slice_iter(struct slice_iter *it, slice_t s, const char *delims) {
+	it->rest = s;
+	init_slice_set(&it->set, delims);
+	it->done = false;
+}
+
+bool next_field(struct slice_iter *it, slice_t *pfield) {
+	if (it->done) {
+		return false;
+	}
+	size_t i = slice_find_any(it->rest, &it->set);
+	*pfield = make_slice(it->rest.c_str, i);
+	if (i == it->rest.len) {
+		it->done = true;
+		it->rest.c_str += i;
+		it->rest.len = 0;
+	} else {
+		it->rest.c_str += i + 1;
+		it->rest.len -= i + 1;
+	}
+	return true;
+}
+
+bool next_token(struct slice_iter *it, slice_t *ptoken) {
+	size_t skip = slice_span(it->rest, &it->set);
+	it->rest.c_str += skip;
+	it->rest.len -= skip;
+	if (!it->rest.len) {
+		it->done = true;
+		return false;
+	}
+	return next_field(it, ptoken);
+}
+
+// Checks and converts 8 decimal digits at once (little endian). The
+// digits are combined in pairs, then fours, then the two halves.
+static inline bool is_8_digits(uint64_t x) {
+	return !(((x + UINT64_C(0x4646464646464646)) | (x - UINT64_C(0x3030303030303030))) & UINT64_C(0x8080808080808080));
+}
+
+static inline uint32_t parse_8_digits(uint64_t x) {
+	x -= UINT64_C(0x3030303030303030);
+	x = (x * 10) + (x >> 8);
+	x = (((x & UINT64_C(0x000000FF000000FF)) * (100 + (UINT64_C(1000000) << 32)))
+		+ (((x >> 16) & UINT64_C(0x000000FF000000FF)) * (1 + (UINT64_C(10000) << 32)))) >> 32;
+	return (uint32_t) x;
+}
+
+static inline unsigned digit_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'z') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'Z') {
+		return c - 'A' + 10;
+	} else {
+		return 36;
+	}
+}
+
+int slice_to_u64(slice_t s, int base, uint64_t *pv) {
+	const char *p = s.c_str, *e = p + s.len;
+	if ((base == 0 || base == 16) && e - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x') {
+		p += 2;
+		base = 16;
+	} else if (base == 0) {
+		base = (e - p > 1 && p[0] == '0') ? 8 : 10;
+	}
+	if (p == e || base < 2 || base > 36) {
+		return -1;
+	}
+
+	uint64_t v = 0;
+	if (base == 10) {
+		// 8 digits at a time while that can't overflow
+		while (e - p >= 8 && v < UINT64_C(100000000000) && is_8_digits(little_64(p))) {
+			v = v * 100000000 + parse_8_digits(little_64(p));
+			p += 8;
+		}
+	}
+	for (; p < e; p++) {
+		unsigned d = digit_value(*p);
+		if (d >= (unsigned) base || v > (UINT64_MAX - d) / base) {
+			return -1;
+		}
+		v = v * base + d;
+	}
+	*pv = v;
+	return 0;
+}
+
+int slice_to_i64(slice_t s, int base, int64_t *pv) {
+	bool neg = false;
+	if (s.len && (s.c_str[0] == '-' || s.c_str[0] == '+')) {
+		neg = s.c_str[0] == '-';
+		s.c_str++;
+		s.len--;
+	}
+	uint64_t u;
+	if (slice_to_u64(s, base, &u)) {
+		return -1;
+	} else if (neg ? u > (uint64_t) INT64_MAX + 1 : u > INT64_MAX) {
+		return -1;
+	}
+	*pv = neg ? (int64_t) (0 - u) : (int64_t) u;
+	return 0;
+}
+
+static const double exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// For more complicated inputs, strtod needs a null terminated copy.
+static int parse_double_slow(slice_t s, double *pv) {
+	char buf[128];
+	if (!s.len || s.len >= sizeof(buf) || is_space(s.c_str[0])) {
+		return -1;
+	}
+	memcpy(buf, s.c_str, s.len);
+	buf[s.len] = 0;
+	char *end;
+	double v = strtod(buf, &end);
+	if (end != buf + s.len) {
+		return -1;
+	}
+	*pv = v;
+	return 0;
+}
+
+int slice_to_double(slice_t s, double *pv) {
+	const char *p = s.c_str, *e = p + s.len;
+	bool neg = false;
+	if (p < e && (*p == '-' || *p == '+')) {
+		neg = *p++ == '-';
+	}
+
+	// mantissa as an integer of up to 19 digits and a power of 10
+	uint64_t m = 0;
+	int digits = 0, exp = 0;
+	const char *start = p;
+	while (e - p >= 8 && is_8_digits(little_64(p)) && digits <= 11) {
+		m = m * 100000000 + parse_8_digits(little_64(p));
+		digits += m ? 8 : 0;
+		p += 8;
+	}
+	for (; p < e && *p >= '0' && *p <= '9'; p++) {
+		m = m * 10 + (*p - '0');
+		digits += m != 0;
+		if (digits > 19) {
+			return parse_double_slow(s, pv);
+		}
+	}
+	if (p < e && *p == '.') {
+		const char *frac = ++p;
+		for (; p < e && *p >= '0' && *p <= '9'; p++) {
+			m = m * 10 + (*p - '0');
+			digits += m != 0;
+			if (digits > 19) {
+				return parse_double_slow(s, pv);
+			}
+		}
+		exp = -(int) (p - frac);
+		if (p == start + 1) {
+			// just a decimal point
+			return -1;
+		}
+	}
+	if (p == start) {
+		// inf, nan and so on
+		return parse_double_slow(s, pv);
+	}
+	if (p < e && (*p | 0x20) == 'e') {
+		p++;
+		bool eneg = false;
+		if (p < e && (*p == '-' || *p == '+')) {
+			eneg = *p++ == '-';
+		}
+		if (p == e) {
+			return -1;
+		}
+		int x = 0;
+		for (; p < e && *p >= '0' && *p <= '9'; p++) {
+			if (x < 100000) {
+				x = x * 10 + (*p - '0');
+			}
+		}
+		exp += eneg ? -x : x;
+	}
+	if (p != e) {
+		return parse_double_slow(s, pv);
+	}
+
+	// Both m and 10^|exp| are exact doubles so a single multiply or
+	// divide rounds correctly.
+	double v;
+	if (m > ((uint64_t) 1 << 53) || exp < -22 || exp > 22) {
+		if (m == 0) {
+			v = 0;
+		} else {
+			return parse_double_slow(s, pv);
+		}
+	} else if (exp < 0) {
+		v = (double) m / exact_pow10[-exp];
+	} else {
+		v = (double) m * exact_pow10[exp];
+	}
+	*pv = neg ? -v : v;
+	return 0;
+}
@@ -0,0 +1,271 @@
+#include "cutils/slice.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include "cutils/str.h"
+#include "cutils/format.h"
+#include <stdlib.h>
+#include <inttypes.h>
+
+static int bench_numbers = 200000;
+
+#define S(STR) make_slice((STR), sizeof(STR) - 1)
+
+static void test_basic(void) {
+	slice_t s = slice_trim(S(" \t foo bar\r\n"));
+	EXPECT_EQ(7, s.len);
+	EXPECT_BYTES_EQ("foo bar", 7, s.c_str, s.len);
+	EXPECT_EQ(0, slice_trim(S(" \n ")).len);
+	EXPECT_EQ(5, slice_ltrim(S("  foo  ")).len);
+	EXPECT_EQ(5, slice_rtrim(S("  foo  ")).len);
+
+	slice_t sub = slice_sub(s, 4, 100);
+	EXPECT_TRUE(str_test(sub, "bar"));
+	EXPECT_EQ(0, slice_sub(s, 100, 1).len);
+
+	slice_t key, value;
+	EXPECT_TRUE(slice_cut(S("Content-Length: 42"), ':', &key, &value));
+	EXPECT_TRUE(str_test(key, "Content-Length"));
+	EXPECT_TRUE(str_test(slice_trim(value), "42"));
+	EXPECT_TRUE(!slice_cut(S("no colon"), ':', &key, NULL));
+	EXPECT_TRUE(str_test(key, "Content-Length"));
+
+	EXPECT_EQ(0, slice_cmp(S("abc"), S("abc")));
+	EXPECT_GT(0, slice_cmp(S("ab"), S("abc")));
+	EXPECT_GT(slice_cmp(S("abd"), S("abc")), 0);
+	EXPECT_EQ(0, slice_icmp(S("Content-Length"), S("content-LENGTH")));
+	EXPECT_GT(0, slice_icmp(S("ABC"), S("abd")));
+	EXPECT_GT(slice_icmp(S("abcdefghijklmnopQ"), S("ABCDEFGHIJKLMNOP")), 0);
+	EXPECT_TRUE(slice_iequals(S("Transfer-Encoding: Chunked"), S("transfer-encoding: chunked")));
+	EXPECT_TRUE(!slice_iequals(S("transfer-encoding"), S("transfer-encodinG ")));
+
+	// only ASCII letters fold, not the bytes either side or non-ASCII
+	EXPECT_TRUE(!slice_iequals(S("@@@@@@@@"), S("````````")));
+	EXPECT_TRUE(!slice_iequals(S("[[[[[[[["), S("{{{{{{{{")));
+	EXPECT_TRUE(!slice_iequals(S("\xC0\xC0\xC0\xC0\xC0\xC0\xC0\xC0"), S("\xE0\xE0\xE0\xE0\xE0\xE0\xE0\xE0")));
+	char upper[256], lower[256];
+	for (int i = 0; i < 256; i++) {
+		upper[i] = (char) i;
+		lower[i] = (char) ((i >= 'A' && i <= 'Z') ? i + 32 : i);
+	}
+	EXPECT_TRUE(slice_iequals(make_slice(upper, 256), make_slice(lower, 256)));
+	for (int i = 0; i < 256; i++) {
+		char c = upper[i];
+		upper[i] = (char) (c ^ 0x20);
+		bool letter = (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+		EXPECT_EQ(letter, slice_iequals(make_slice(upper, 256), make_slice(lower, 256)));
+		upper[i] = c;
+	}
+}
+
+static size_t naive_find_any(slice_t s, const char *set) {
+	for (size_t i = 0; i < s.len; i++) {
+		if (s.c_str[i] && strchr(set, s.c_str[i])) {
+			return i;
+		}
+	}
+	return s.len;
+}
+
+static void test_find(void) {
+	static const char *sets[] = {",", " \t", ",;:", "\r\n\t =;,&", " \t\r\n=;,&?", "\xFF"};
+	char buf[300];
+	uint64_t seed = 1;
+	for (int n = 0; n < 2000; n++) {
+		// mostly letters with the odd delimiter candidate
+		size_t len = test_rand(&seed) % sizeof(buf);
+		for (size_t i = 0; i < len; i++) {
+			uint64_t r = test_rand(&seed);
+			buf[i] = r % 40 ? 'a' + (char) (r % 26) : " ,;:\t\r\n=&?\xFF"[r / 40 % 11];
+		}
+		slice_t s = make_slice(buf, len);
+		for (size_t j = 0; j < ARRAYSZ(sets); j++) {
+			struct slice_set set;
+			init_slice_set(&set, sets[j]);
+			EXPECT_EQ(naive_find_any(s, sets[j]), slice_find_any(s, &set));
+		}
+	}
+
+	struct slice_set set;
+	init_slice_set(&set, " \t");
+	EXPECT_EQ(3, slice_span(S(" \t foo"), &set));
+	EXPECT_EQ(0, slice_span(S("foo "), &set));
+	init_slice_set(&set, "");
+	EXPECT_EQ(3, slice_find_any(S("foo"), &set));
+}
+
+static void test_iter(void) {
+	static const char *fields[] = {"a", "", "b", ""};
+	struct slice_iter it;
+	slice_t tok;
+	init_slice_iter(&it, S("a,,b,"), ",");
+	for (size_t i = 0; i < ARRAYSZ(fields); i++) {
+		EXPECT_TRUE(next_field(&it, &tok));
+		EXPECT_TRUE(str_test(tok, fields[i]));
+	}
+	EXPECT_TRUE(!next_field(&it, &tok));
+
+	static const char *tokens[] = {"GET", "/index.html", "HTTP/1.1"};
+	init_slice_iter(&it, S("  GET \t/index.html  HTTP/1.1\r\n"), " \t\r\n");
+	for (size_t i = 0; i < ARRAYSZ(tokens); i++) {
+		EXPECT_TRUE(next_token(&it, &tok));
+		EXPECT_TRUE(str_test(tok, tokens[i]));
+	}
+	EXPECT_TRUE(!next_token(&it, &tok));
+
+	init_slice_iter(&it, S(""), ",");
+	EXPECT_TRUE(next_field(&it, &tok));
+	EXPECT_EQ(0, tok.len);
+	EXPECT_TRUE(!next_field(&it, &tok));
+	init_slice_iter(&it, S(",,"), ",");
+	EXPECT_TRUE(!next_token(&it, &tok));
+}
+
+static void test_int(void) {
+	uint64_t u = 7;
+	int64_t i = 7;
+	EXPECT_EQ(0, slice_to_u64(S("0"), 10, &u));
+	EXPECT_EQ(0, u);
+	EXPECT_EQ(0, slice_to_u64(S("18446744073709551615"), 10, &u));
+	EXPECT_EQ(UINT64_MAX, u);
+	EXPECT_EQ(-1, slice_to_u64(S("18446744073709551616"), 10, &u));
+	EXPECT_EQ(-1, slice_to_u64(S("99999999999999999999"), 10, &u));
+	EXPECT_EQ(UINT64_MAX, u);
+	EXPECT_EQ(0, slice_to_u64(S("0000000000000000000000123"), 10, &u));
+	EXPECT_EQ(123, u);
+	EXPECT_EQ(0, slice_to_u64(S("1234567890123456789"), 10, &u));
+	EXPECT_EQ(UINT64_C(1234567890123456789), u);
+	EXPECT_EQ(0, slice_to_u64(S("0x1F"), 0, &u));
+	EXPECT_EQ(31, u);
+	EXPECT_EQ(0, slice_to_u64(S("ff"), 16, &u));
+	EXPECT_EQ(255, u);
+	EXPECT_EQ(0, slice_to_u64(S("0755"), 0, &u));
+	EXPECT_EQ(0755, u);
+	EXPECT_EQ(0, slice_to_u64(S("00000644"), 8, &u));
+	EXPECT_EQ(0644, u);
+	EXPECT_EQ(-1, slice_to_u64(S("8"), 8, &u));
+	EXPECT_EQ(-1, slice_to_u64(S(""), 10, &u));
+	EXPECT_EQ(-1, slice_to_u64(S("0x"), 0, &u));
+	EXPECT_EQ(-1, slice_to_u64(S(" 1"), 10, &u));
+	EXPECT_EQ(-1, slice_to_u64(S("12345678a"), 10, &u));
+	EXPECT_EQ(-1, slice_to_u64(S("-1"), 10, &u));
+
+	EXPECT_EQ(0, slice_to_i64(S("-9223372036854775808"), 10, &i));
+	EXPECT_EQ(INT64_MIN, i);
+	EXPECT_EQ(0, slice_to_i64(S("+9223372036854775807"), 10, &i));
+	EXPECT_EQ(INT64_MAX, i);
+	EXPECT_EQ(-1, slice_to_i64(S("9223372036854775808"), 10, &i));
+	EXPECT_EQ(0, slice_to_i64(S("-0x10"), 0, &i));
+	EXPECT_EQ(-16, i);
+	EXPECT_EQ(-1, slice_to_i64(S("-"), 10, &i));
+
+	// against strtoull
+	uint64_t seed = 2;
+	char buf[32];
+	for (int n = 0; n < 10000; n++) {
+		uint64_t v = test_rand(&seed) << (test_rand(&seed) % 48);
+		int len = snprintf(buf, sizeof(buf), "%" PRIu64, v);
+		EXPECT_EQ(0, slice_to_u64(make_slice(buf, len), 10, &u));
+		EXPECT_EQ(v, u);
+	}
+}
+
+static void check_double(const char *str) {
+	double got = 0;
+	EXPECT_EQ(0, slice_to_double(cstr_slice(str), &got));
+	// compare in hex so that all bits and the sign of zero are checked
+	char want[64], have[64];
+	snprintf(want, sizeof(want), "%a", strtod(str, NULL));
+	snprintf(have, sizeof(have), "%a", got);
+	EXPECT_STREQ(want, have);
+}
+
+static void test_double(void) {
+	static const char *good[] = {
+		"0", "-0", "1", "+1.5", "0.1", ".5", "5.", "3.14159", "1e10", "1E-10",
+		"123456789012345678", "9007199254740993", "1e23", "2.2250738585072014e-308",
+		"4.9e-324", "1.7976931348623157e308", "1e400", "0e999", "0.000000000000000000000000001",
+		"12345678.87654321", "inf", "-nan", "0x1p3",
+	};
+	for (size_t i = 0; i < ARRAYSZ(good); i++) {
+		check_double(good[i]);
+	}
+
+	static const char *bad[] = {"", ".", "-", "e5", "1e", "1e+", " 1", "1 ", "1.2.3", "--1", "0x"};
+	for (size_t i = 0; i < ARRAYSZ(bad); i++) {
+		double v = 7;
+		EXPECT_EQ(-1, slice_to_double(cstr_slice(bad[i]), &v));
+		EXPECT_EQ(7, v);
+	}
+
+	// random decimals across the fast and slow paths
+	uint64_t seed = 3;
+	char buf[64];
+	for (int n = 0; n < 10000; n++) {
+		uint64_t m = test_rand(&seed) >> (test_rand(&seed) % 48);
+		int frac = (int) (test_rand(&seed) % 12);
+		int exp = (int) (test_rand(&seed) % 60) - 30;
+		snprintf(buf, sizeof(buf), "%" PRIu64 ".%0*de%d", m, frac, (int) (test_rand(&seed) % 1000), exp);
+		check_double(buf);
+	}
+}
+
+// parsing a CSV of numbers
+static void bench_parse(log_t *log) {
+	str_t csv = STR_INIT;
+	uint64_t seed = 4;
+	for (int i = 0; i < bench_numbers; i++) {
+		str_add_u64(&csv, test_rand(&seed) % 1000000000);
+		str_addch(&csv, ',');
+		str_add_fixed(&csv, (test_rand(&seed) % 1000000) / 100.0, 2);
+		str_addch(&csv, '\n');
+	}
+
+	struct timer t;
+	start_timer(&t);
+	struct slice_iter it;
+	slice_t tok;
+	uint64_t isum = 0;
+	double dsum = 0;
+	init_slice_iter(&it, slice_trim(make_slice(csv.c_str, csv.len)), ",\n");
+	while (next_field(&it, &tok)) {
+		uint64_t u;
+		double d;
+		slice_to_u64(tok, 10, &u);
+		isum += u;
+		next_field(&it, &tok);
+		slice_to_double(tok, &d);
+		dsum += d;
+	}
+	double slicet = stop_timer(&t);
+
+	start_timer(&t);
+	uint64_t lisum = 0;
+	double ldsum = 0;
+	for (char *p = csv.c_str; *p;) {
+		lisum += strtoull(p, &p, 10);
+		ldsum += strtod(p + 1, &p);
+		p++;
+	}
+	double libct = stop_timer(&t);
+	EXPECT_EQ(lisum, isum);
+	EXPECT_EQ(ldsum, dsum);
+
+	LOG(log, "slice parse|numbers:%d|sliceNs:%.1f|strtoNs:%.1f",
+		2 * bench_numbers, slicet * 1e9 / (2 * bench_numbers), libct * 1e9 / (2 * bench_numbers));
+	str_destroy(&csv);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_numbers, 0, "bench-numbers", "N", "number of lines in the parse benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_basic();
+	test_find();
+	test_iter();
+	test_int();
+	test_double();
+	bench_parse(log);
+
+	return finish_test();
+}
@@ -0,0 +1,135 @@
+#include "cutils/sort.h"
+#include "cutils/thread.h"
+
+#define MAX_THREADS 64
+#define MIN_PER_THREAD 0x10000
+
+struct sort_task {
+	const struct sort_ops *ops;
+	// sort the chunk at v
+	char *v;
+	size_t n;
+	// merge output positions [begin,end) of a and b into out
+	const char *a, *b;
+	size_t na, nb;
+	char *out;
+	size_t begin, end;
+};
+
+static int sort_chunk(void *udata) {
+	struct sort_task *t = udata;
+	t->ops->sort(t->v, t->n);
+	return 0;
+}
+
+static int merge_chunk(void *udata) {
+	struct sort_task *t = udata;
+	size_t sz = t->ops->objsz;
+	size_t abegin = t->ops->split(t->a, t->na, t->b, t->nb, t->begin);
+	size_t aend = t->ops->split(t->a, t->na, t->b, t->nb, t->end);
+	size_t bbegin = t->begin - abegin;
+	size_t bend = t->end - aend;
+	t->ops->merge(t->out + t->begin * sz,
+		t->a + abegin * sz, aend - abegin,
+		t->b + bbegin * sz, bend - bbegin);
+	return 0;
+}
+
+static void run_tasks(struct sort_task *t, int num, thrd_start_t fn) {
+	thrd_t thrd[MAX_THREADS];
+	bool started[MAX_THREADS];
+	for (int i = 1; i < num; i++) {
+		started[i] = thrd_create(&thrd[i], fn, &t[i]) == thrd_success;
+	}
+	fn(&t[0]);
+	for (int i = 1; i < num; i++) {
+		if (started[i]) {
+			thrd_join(thrd[i], NULL);
+		} else {
+			// couldn't start the thread, so do it ourselves
+			fn(&t[i]);
+		}
+	}
+}
+
+void parallel_sort(const struct sort_ops *ops, void *data, size_t n, int threads) {
+	if (threads < 1) {
+		threads = 1;
+	}
+	if ((size_t) threads > n / MIN_PER_THREAD) {
+		threads = (int) (n / MIN_PER_THREAD);
+	}
+	if (threads > MAX_THREADS) {
+		threads = MAX_THREADS;
+	}
+	size_t sz = ops->objsz;
+	char *tmp = threads > 1 ? malloc(n * sz) : NULL;
+	if (!tmp) {
+		ops->sort(data, n);
+		return;
+	}
+
+	struct sort_task t[MAX_THREADS];
+	size_t bounds[MAX_THREADS + 1];
+	int chunks = threads;
+	for (int i = 0; i < chunks; i++) {
+		bounds[i] = (size_t) ((uint64_t) n * i / chunks);
+	}
+	bounds[chunks] = n;
+
+	for (int i = 0; i < chunks; i++) {
+		t[i].ops = ops;
+		t[i].v = (char*) data + bounds[i] * sz;
+		t[i].n = bounds[i + 1] - bounds[i];
+	}
+	run_tasks(t, chunks, &sort_chunk);
+
+	// merge pairs of chunks, splitting each merge so that every level
+	// uses all the threads
+	char *src = data, *dst = tmp;
+	while (chunks > 1) {
+		int pairs = chunks / 2;
+		int per_pair = threads / pairs;
+		if (per_pair < 1) {
+			per_pair = 1;
+		}
+		int num = 0;
+		for (int p = 0; p < pairs; p++) {
+			size_t lo = bounds[2 * p], mid = bounds[2 * p + 1], hi = bounds[2 * p + 2];
+			for (int i = 0; i < per_pair; i++) {
+				struct sort_task *m = &t[num++];
+				m->ops = ops;
+				m->a = src + lo * sz;
+				m->na = mid - lo;
+				m->b = src + mid * sz;
+				m->nb = hi - mid;
+				m->out = dst + lo * sz;
+				m->begin = (hi - lo) * i / per_pair;
+				m->end = (hi - lo) * (i + 1) / per_pair;
+			}
+		}
+		if (chunks & 1) {
+			size_t last = bounds[chunks - 1];
+			memcpy(dst + last * sz, src + last * sz, (n - last) * sz);
+		}
+		run_tasks(t, num, &merge_chunk);
+
+		for (int p = 0; p < pairs; p++) {
+			bounds[p] = bounds[2 * p];
+		}
+		if (chunks & 1) {
+			bounds[pairs] = bounds[chunks - 1];
+		}
+		chunks = (chunks + 1) / 2;
+		bounds[chunks] = n;
+
+		char *swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if (src != data) {
+		memcpy(data, src, n * sz);
+	}
+	free(tmp);
+}
@@ -0,0 +1,243 @@
+#include "cutils/sort.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include "cutils/thread.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+struct entry {
+	uint64_t key;
+	uint32_t index;
+};
+
+#define U32_LESS(a, b) (*(a) < *(b))
+#define ENTRY_LESS(a, b) ((a)->key < (b)->key)
+#define U32_KEY(p) (*(p))
+#define ENTRY_KEY(p) ((p)->key)
+
+DECLARE_SORT(sort_u32, uint32_t, U32_LESS)
+DECLARE_SORT(sort_entry, struct entry, ENTRY_LESS)
+DECLARE_RADIX_SORT(radix_u32, uint32_t, U32_KEY)
+DECLARE_RADIX_SORT(radix_entry, struct entry, ENTRY_KEY)
+
+static int bench_sort = 250000;
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t va = *(const uint32_t*)a;
+	uint32_t vb = *(const uint32_t*)b;
+	return va < vb ? -1 : va > vb;
+}
+
+enum pattern {
+	RANDOM,
+	SORTED,
+	REVERSED,
+	FEW_VALUES,
+	ORGAN_PIPE,
+	SAWTOOTH,
+	NUM_PATTERNS,
+};
+
+static void fill(uint32_t *v, size_t n, enum pattern p, uint64_t *seed) {
+	for (size_t i = 0; i < n; i++) {
+		switch (p) {
+		case RANDOM:
+			v[i] = (uint32_t) test_rand(seed);
+			break;
+		case SORTED:
+			v[i] = (uint32_t) i;
+			break;
+		case REVERSED:
+			v[i] = (uint32_t) (n - i);
+			break;
+		case FEW_VALUES:
+			v[i] = (uint32_t) (test_rand(seed) % 4);
+			break;
+		case ORGAN_PIPE:
+			v[i] = (uint32_t) (i < n / 2 ? i : n - i);
+			break;
+		default:
+			v[i] = (uint32_t) (i % 100);
+			break;
+		}
+	}
+}
+
+static void test_patterns(void) {
+	static const size_t sizes[] = {0, 1, 2, 5, 23, 24, 25, 100, 129, 1000, 10000};
+	uint32_t *v = malloc(10000 * sizeof(uint32_t));
+	uint32_t *r = malloc(10000 * sizeof(uint32_t));
+	uint32_t *q = malloc(10000 * sizeof(uint32_t));
+	uint64_t seed = 1;
+	for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		size_t n = sizes[s];
+		for (int p = 0; p < NUM_PATTERNS; p++) {
+			fill(v, n, (enum pattern) p, &seed);
+			memcpy(r, v, n * sizeof(uint32_t));
+			memcpy(q, v, n * sizeof(uint32_t));
+			qsort(q, n, sizeof(uint32_t), &compare_u32);
+			sort_u32(v, n);
+			EXPECT_EQ(0, radix_u32(r, n));
+			EXPECT_BYTES_EQ(q, n * sizeof(uint32_t), v, n * sizeof(uint32_t));
+			EXPECT_BYTES_EQ(q, n * sizeof(uint32_t), r, n * sizeof(uint32_t));
+		}
+	}
+	free(v);
+	free(r);
+	free(q);
+}
+
+static void test_search(void) {
+	uint32_t v[100];
+	for (int i = 0; i < 100; i++) {
+		v[i] = (i / 2) * 2;
+	}
+	for (uint32_t key = 0; key < 101; key++) {
+		size_t want = 0;
+		while (want < 100 && v[want] < key) {
+			want++;
+		}
+		EXPECT_EQ(want, sort_u32_lower_bound(v, 100, &key));
+		uint32_t *found = sort_u32_search(v, 100, &key);
+		EXPECT_PTREQ((key & 1) || key >= 100 ? NULL : &v[key], found);
+	}
+	uint32_t key = 5;
+	EXPECT_EQ(0, sort_u32_lower_bound(v, 0, &key));
+	EXPECT_PTREQ(NULL, sort_u32_search(v, 0, &key));
+}
+
+static void test_entries(void) {
+	// radix sort is stable, so the indices of equal keys stay in order
+	enum { N = 5000 };
+	struct entry *e = malloc(N * sizeof(struct entry));
+	struct entry *f = malloc(N * sizeof(struct entry));
+	uint64_t seed = 2;
+	for (int i = 0; i < N; i++) {
+		e[i].key = test_rand(&seed) % 1000 + ((uint64_t) 1 << 40);
+		e[i].index = i;
+	}
+	memcpy(f, e, N * sizeof(struct entry));
+	EXPECT_EQ(0, radix_entry(e, N));
+	sort_entry(f, N);
+	for (int i = 1; i < N; i++) {
+		EXPECT_TRUE(e[i - 1].key < e[i].key || (e[i - 1].key == e[i].key && e[i - 1].index < e[i].index));
+		EXPECT_EQ(e[i].key, f[i].key);
+	}
+	free(e);
+	free(f);
+}
+
+static void test_parallel(void) {
+	enum { N = 200000 };
+	uint32_t *v = malloc(N * sizeof(uint32_t));
+	uint32_t *r = malloc(N * sizeof(uint32_t));
+	uint64_t seed = 3;
+	static const int threads[] = {1, 2, 3, 4};
+	for (int t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		fill(v, N, RANDOM, &seed);
+		memcpy(r, v, N * sizeof(uint32_t));
+		sort_u32_parallel(v, N, threads[t]);
+		EXPECT_EQ(0, radix_u32(r, N));
+		EXPECT_BYTES_EQ(r, N * sizeof(uint32_t), v, N * sizeof(uint32_t));
+	}
+	free(v);
+	free(r);
+}
+
+static mtx_t count_lock;
+static int sort_calls;
+
+static void count_sort(void *v, size_t n) {
+	mtx_lock(&count_lock);
+	sort_calls++;
+	mtx_unlock(&count_lock);
+}
+static size_t count_split(const void *a, size_t na, const void *b, size_t nb, size_t k) {
+	return k < na ? k : na;
+}
+static void count_merge(void *out, const void *a, size_t na, const void *b, size_t nb) {
+}
+
+static void test_thread_count(void) {
+	// one chunk is sorted per thread, so count the chunks
+	static const struct sort_ops ops = {1, &count_sort, &count_split, &count_merge};
+	static const struct {
+		int threads, chunks;
+	} tests[] = {{-1, 1}, {0, 1}, {2, 2}, {100, 64}};
+	size_t n = 5 << 20;
+	char *v = calloc(n, 1);
+	mtx_init(&count_lock, mtx_plain);
+	for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		sort_calls = 0;
+		parallel_sort(&ops, v, n, tests[i].threads);
+		EXPECT_EQ(tests[i].chunks, sort_calls);
+	}
+	mtx_destroy(&count_lock);
+	free(v);
+}
+
+static void bench(log_t *log) {
+	size_t n = (size_t) bench_sort;
+	uint32_t *src = malloc(n * sizeof(uint32_t));
+	uint32_t *v = malloc(n * sizeof(uint32_t));
+	uint64_t seed = 4;
+	fill(src, n, RANDOM, &seed);
+	struct timer t;
+
+	memcpy(v, src, n * sizeof(uint32_t));
+	start_timer(&t);
+	qsort(v, n, sizeof(uint32_t), &compare_u32);
+	double libc = stop_timer(&t);
+
+	memcpy(v, src, n * sizeof(uint32_t));
+	start_timer(&t);
+	sort_u32(v, n);
+	double pdq = stop_timer(&t);
+
+	memcpy(v, src, n * sizeof(uint32_t));
+	start_timer(&t);
+	radix_u32(v, n);
+	double radix = stop_timer(&t);
+
+	memcpy(v, src, n * sizeof(uint32_t));
+	start_timer(&t);
+	sort_u32_parallel(v, n, 4);
+	double parallel = stop_timer(&t);
+
+	start_timer(&t);
+	size_t sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		uint32_t key = src[i];
+		sum += sort_u32_lower_bound(v, n, &key);
+	}
+	double search = stop_timer(&t);
+
+	start_timer(&t);
+	for (size_t i = 0; i < n; i++) {
+		sum += (uint32_t*) bsearch(&src[i], v, n, sizeof(uint32_t), &compare_u32) - v;
+	}
+	double libc_search = stop_timer(&t);
+	EXPECT_GT(sum, 0);
+
+	LOG(log, "sort u32|elements:%.0f|qsortNs:%.1f|pdqNs:%.1f|radixNs:%.1f|parallel4Ns:%.1f|bsearchNs:%.1f|lowerBoundNs:%.1f",
+		(double) n, libc * 1e9 / n, pdq * 1e9 / n, radix * 1e9 / n, parallel * 1e9 / n,
+		libc_search * 1e9 / n, search * 1e9 / n);
+
+	free(src);
+	free(v);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_sort, 0, "bench-sort", "N", "number of elements to sort in the benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_patterns();
+	test_search();
+	test_entries();
+	test_parallel();
+	test_thread_count();
+	bench(log);
+
+	return finish_test();
+}
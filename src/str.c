@@ -1,4 +1,5 @@
 #include "cutils/str.h"
+#include "cutils/vector.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -13,27 +14,43 @@
 char str_initbuf[] = {0};
 
 void str_destroy(str_t *s) {
-    if (s->cap) {
+    if (s->cap && s->cap != STR_INLINE) {
         free(s->c_str);
     }
 }
 
 void str_grow(str_t *s, size_t cap) {
-    if (cap < s->cap) {
+    STR_CHECK(s);
+    if (cap <= s->cap) {
+        return;
+    }
+
+    // the first allocation uses the inline buffer if it's big enough
+    if (!s->cap && cap <= STR_INLINE) {
+        s->c_str = s->buf;
+        s->c_str[0] = 0;
+        s->cap = STR_INLINE;
         return;
     }
 
-    char *buf = s->cap ? s->c_str : NULL;
     size_t newcap = (s->cap + 16) * 3 / 2;
     if (newcap < cap) {
         newcap = cap;
     }
 
-    s->c_str = (char*) realloc(buf, newcap+1);
+    if (!s->cap || s->cap == STR_INLINE) {
+        // initbuf and the inline buffer can't be realloced
+        char *p = (char*) malloc(newcap+1);
+        memcpy(p, s->c_str, s->len+1);
+        s->c_str = p;
+    } else {
+        s->c_str = (char*) realloc(s->c_str, newcap+1);
+    }
     s->cap = newcap;
 }
 
 void str_add2(str_t *s, const char *a, size_t len) {
+    STR_CHECK(s);
     str_grow(s, s->len + len);
     memcpy(s->c_str + s->len, a, len);
     s->len += len;
@@ -46,48 +63,6 @@ int str_addf(str_t *s, const char *fmt, ...) {
     return str_vaddf(s, fmt, ap);
 }
 
-int str_vaddf(str_t *s, const char *fmt, va_list ap) {
-    str_grow(s, s->len + 1);
-    for (;;) {
-        va_list aq;
-        va_copy(aq, ap);
-
-        // detect when snprintf runs out of buffer by seeing whether
-        // it overwrites the null terminator at the end of the buffer
-        char* buf = s->c_str + s->len;
-        size_t bufsz = s->cap - s->len;
-        buf[bufsz] = '\0';
-        int ret = vsnprintf(buf, bufsz + 1, fmt, aq);
-
-        if (ret > (int)bufsz) {
-            // snprintf has told us the size of buffer required (ISO C99
-            // behavior)
-            str_grow(s, s->len + ret);
-            // loop around to try again
-
-        } else if (ret >= 0) {
-            /* success */
-            s->len += ret;
-            return ret;
-
-        } else if (buf[bufsz] != '\0') {
-            /* snprintf has returned an error but has written to the end of the
-             * buffer (MSVC behavior). The buffer is not large enough so grow
-             * and retry. This can also occur with a format error if it occurs
-             * right on the boundary, but then we grow the buffer and can
-             * figure out its an error next time around.
-             */
-            str_grow(s, s->cap + 1);
-
-        } else {
-            /* snprintf has returned an error but has not written to the last
-             * character in the buffer. We have a format error.
-             */
-            return -1;
-        }
-    }
-}
-
 void str_fread_all(str_t *s, FILE *f) {
 #ifdef WIN32
 	_setmode(_fileno(f), _O_BINARY);
@@ -117,30 +92,151 @@ int str_read_file(str_t *s, const char *fn) {
 	}
 }
 
-void str_replace_all(str_t *s, const char *find, const char *replacement) {
-    size_t flen = strlen(find);
-    size_t rlen = strlen(replacement);
-    size_t off = 0;
-    for (;;) {
-        char *f = (char*) memmem(s->c_str + off, s->len - off, find, flen);
-        if (!f) {
-            break;
-        }
-        off = (int) (f - s->c_str);
-		if (flen == rlen) {
-            memcpy(f, replacement, rlen);
-        } else {
-            if (rlen > flen) {
-                str_grow(s, s->len + rlen - flen);
-                f = s->c_str + off;
-            }
-            memmove(f + rlen, f + flen, s->len - (off + flen));
-            memcpy(f, replacement, rlen);
-            str_setlen(s, s->len + rlen - flen);
-        }
-        off += rlen;
-    }
+struct match {
+	size_t off;
+	size_t idx;
+};
+
+struct pattern {
+	const char *find, *replace;
+	size_t flen, rlen;
+};
+
+typedef SMALL_VECTOR(struct match, 32) match_vector;
+
+static int find_matches(const str_t *s, const struct pattern *p, size_t num, match_vector *m) {
+	// a match for any pattern has to start with one of these bytes
+	uint8_t first[256] = {0};
+	size_t distinct = 0;
+	for (size_t i = 0; i < num; i++) {
+		distinct += !first[(uint8_t) p[i].find[0]];
+		first[(uint8_t) p[i].find[0]] = 1;
+	}
+
+	const char *c = s->c_str;
+	const char *end = c + s->len;
+	const char *next = c;
+	while (next < end) {
+		size_t idx = 0;
+		if (num == 1) {
+			next = str_search(next, end - next, p[0].find, p[0].flen);
+			if (!next) {
+				break;
+			}
+		} else {
+			if (distinct == 1) {
+				// usually templates where every pattern starts the same way
+				next = (const char*) memchr(next, p[0].find[0], end - next);
+				if (!next) {
+					break;
+				}
+			}
+			while (next < end && !first[(uint8_t) *next]) {
+				next++;
+			}
+			while (idx < num && ((size_t) (end - next) < p[idx].flen || memcmp(next, p[idx].find, p[idx].flen))) {
+				idx++;
+			}
+			if (idx == num) {
+				next++;
+				continue;
+			}
+		}
+		struct match *pm = (struct match*) APPEND(m);
+		if (!pm) {
+			return -1;
+		}
+		pm->off = next - c;
+		pm->idx = idx;
+		next += p[idx].flen;
+	}
+	return 0;
 }
 
+static void replace_matches(str_t *s, const struct pattern *p, const struct match *m, size_t num) {
+	size_t newlen = s->len;
+	bool grows = false, shrinks = false;
+	for (size_t i = 0; i < num; i++) {
+		const struct pattern *pp = &p[m[i].idx];
+		newlen += pp->rlen - pp->flen;
+		grows |= pp->rlen > pp->flen;
+		shrinks |= pp->rlen < pp->flen;
+	}
 
+	if (!grows) {
+		// copy forwards in place, the output never passes the input
+		char *c = s->c_str;
+		char *w = c + m[0].off;
+		for (size_t i = 0; i < num; i++) {
+			const struct pattern *pp = &p[m[i].idx];
+			size_t from = m[i].off + pp->flen;
+			size_t to = i + 1 < num ? m[i + 1].off : s->len;
+			memcpy(w, pp->replace, pp->rlen);
+			w += pp->rlen;
+			memmove(w, c + from, to - from);
+			w += to - from;
+		}
+		str_setlen(s, newlen);
+	} else if (!shrinks) {
+		// grow once and copy backwards in place
+		str_grow(s, newlen);
+		char *c = s->c_str;
+		size_t r = s->len, w = newlen;
+		for (size_t i = num; i > 0; i--) {
+			const struct pattern *pp = &p[m[i - 1].idx];
+			size_t from = m[i - 1].off + pp->flen;
+			w -= r - from;
+			memmove(c + w, c + from, r - from);
+			w -= pp->rlen;
+			memcpy(c + w, pp->replace, pp->rlen);
+			r = m[i - 1].off;
+		}
+		str_setlen(s, newlen);
+	} else {
+		// mixed replacements are built in a new buffer
+		str_t out = STR_INIT;
+		str_grow(&out, newlen);
+		size_t r = 0;
+		for (size_t i = 0; i < num; i++) {
+			const struct pattern *pp = &p[m[i].idx];
+			str_add2(&out, s->c_str + r, m[i].off - r);
+			str_add2(&out, pp->replace, pp->rlen);
+			r = m[i].off + pp->flen;
+		}
+		str_add2(&out, s->c_str + r, s->len - r);
+		str_swap(s, &out);
+		str_destroy(&out);
+	}
+}
+
+void str_replace_many(str_t *s, const struct str_replacement *r, size_t num) {
+	SMALL_VECTOR(struct pattern, 8) p;
+	INIT_SMALL_VECTOR(&p);
+	for (size_t i = 0; i < num; i++) {
+		// empty find strings never match
+		if (*r[i].find) {
+			struct pattern *pp = (struct pattern*) APPEND(&p);
+			if (!pp) {
+				FREE_SMALL_VECTOR(&p);
+				return;
+			}
+			pp->find = r[i].find;
+			pp->replace = r[i].replace;
+			pp->flen = strlen(r[i].find);
+			pp->rlen = strlen(r[i].replace);
+		}
+	}
 
+	match_vector m;
+	INIT_SMALL_VECTOR(&m);
+	if (p.size && !find_matches(s, p.v, p.size, &m) && m.size) {
+		replace_matches(s, p.v, m.v, m.size);
+	}
+	FREE_SMALL_VECTOR(&m);
+	FREE_SMALL_VECTOR(&p);
+}
+
+void str_replace_all(str_t *s, const char *find, const char *replacement) {
+	struct str_replacement r = {find, replacement};
+	str_replace_many(s, &r, 1);
+}
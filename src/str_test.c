@@ -1,6 +1,21 @@
 #include "cutils/str.h"
 #include "cutils/test.h"
 #include "cutils/path.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include "cutils/format.h"
+
+static int bench_strings = 200000;
+static int bench_doc = 1 << 20;
+
+static const char *naive_search(const char *hay, size_t haysz, const char *needle, size_t needlesz) {
+	for (size_t i = 0; i + needlesz <= haysz; i++) {
+		if (!memcmp(hay + i, needle, needlesz)) {
+			return hay + i;
+		}
+	}
+	return NULL;
+}
 
 static void test_path(enum path_type type, const char *in, const char *out) {
 	bool same = !strcmp(in, out);
@@ -12,8 +27,256 @@ static void test_path(enum path_type type, const char *in, const char *out) {
 	str_destroy(&s);
 }
 
+static void test_inline(void) {
+	str_t s = STR_INIT;
+	str_add(&s, "short");
+	EXPECT_PTREQ(s.buf, s.c_str);
+	EXPECT_EQ(STR_INLINE, s.cap);
+
+	// moves to the heap once it no longer fits
+	str_add(&s, " string that is now too long");
+	EXPECT_TRUE(s.c_str != s.buf);
+	EXPECT_STREQ("short string that is now too long", s.c_str);
+
+	// growth is geometric rather than by the amount added
+	size_t grows = 0, cap = s.cap;
+	for (int i = 0; i < 10000; i++) {
+		str_addch(&s, 'a' + (i % 26));
+		if (s.cap != cap) {
+			EXPECT_GT(s.cap, cap + cap / 2);
+			cap = s.cap;
+			grows++;
+		}
+	}
+	EXPECT_GT(25, grows);
+
+	// swapping inline and heap strings fixes up c_str
+	str_t t = STR_INIT;
+	str_set(&t, "inline");
+	str_swap(&s, &t);
+	EXPECT_PTREQ(s.buf, s.c_str);
+	EXPECT_STREQ("inline", s.c_str);
+	EXPECT_EQ(10033, t.len);
+	str_swap(&s, &t);
+	EXPECT_PTREQ(t.buf, t.c_str);
+	EXPECT_STREQ("inline", t.c_str);
+
+	char *p = str_release(&t);
+	EXPECT_STREQ("inline", p);
+	EXPECT_STREQ("", t.c_str);
+	free(p);
+
+	str_t u = str_init("returned by value");
+	EXPECT_TRUE(u.c_str != u.buf);
+	EXPECT_STREQ("returned by value", u.c_str);
+	str_swap(&s, &u);
+	str_destroy(&u);
+
+	str_destroy(&s);
+	str_destroy(&t);
+}
+
+static void test_search(void) {
+	// small alphabets give lots of partial matches
+	uint64_t seed = 1;
+	char hay[300], needle[20];
+	for (int i = 0; i < 20000; i++) {
+		size_t haysz = test_rand(&seed) % sizeof(hay);
+		size_t needlesz = test_rand(&seed) % sizeof(needle);
+		int alphabet = 1 + (int) (test_rand(&seed) % 4);
+		for (size_t j = 0; j < haysz; j++) {
+			hay[j] = (char) ('a' + test_rand(&seed) % alphabet);
+		}
+		for (size_t j = 0; j < needlesz; j++) {
+			needle[j] = (char) ('a' + test_rand(&seed) % alphabet);
+		}
+		EXPECT_PTREQ(naive_search(hay, haysz, needle, needlesz), str_search(hay, haysz, needle, needlesz));
+	}
+
+	// inputs where every position is a candidate use Two-Way
+	size_t n = 100000;
+	char *big = (char*) malloc(n);
+	memset(big, 'a', n);
+	char pattern[64];
+	memset(pattern, 'a', sizeof(pattern));
+	pattern[30] = 'b';
+	EXPECT_PTREQ(NULL, str_search(big, n, pattern, sizeof(pattern)));
+	big[n - 34] = 'b';
+	EXPECT_PTREQ(big + n - 64, str_search(big, n, pattern, sizeof(pattern)));
+	for (int i = 0; i < 200; i++) {
+		size_t needlesz = 2 + test_rand(&seed) % 40;
+		for (size_t j = 0; j < n; j++) {
+			big[j] = (char) ('a' + (test_rand(&seed) % 16 == 0));
+		}
+		memcpy(pattern, big + test_rand(&seed) % (n - needlesz), needlesz);
+		EXPECT_PTREQ(naive_search(big, n, pattern, needlesz), str_search(big, n, pattern, needlesz));
+	}
+	free(big);
+
+	str_t s = STR_INIT;
+	str_set(&s, "hello world");
+	EXPECT_PTREQ(s.c_str + 6, str_find(s, "world"));
+	EXPECT_PTREQ(NULL, str_find(s, "word"));
+	str_destroy(&s);
+}
+
+static void test_replace(void) {
+	str_t s = STR_INIT;
+	str_set(&s, "aaa");
+	str_replace_all(&s, "a", "bb");
+	EXPECT_STREQ("bbbbbb", s.c_str);
+	str_replace_all(&s, "bbb", "c");
+	EXPECT_STREQ("cc", s.c_str);
+	str_replace_all(&s, "", "x");
+	EXPECT_STREQ("cc", s.c_str);
+	str_replace_all(&s, "c", "");
+	EXPECT_STREQ("", s.c_str);
+
+	// growing and shrinking patterns together
+	static const struct str_replacement r[] = {
+		{"{{name}}", "world"},
+		{"{{n}}", "a much longer value"},
+		{"{{", "<"},
+		{"x", "xx"},
+	};
+	str_set(&s, "hello {{name}} {{n}}{{name}}x {{ {{nam");
+	str_replace_many(&s, r, 4);
+	EXPECT_STREQ("hello world a much longer valueworldxx < <nam", s.c_str);
+	str_set(&s, "{{n}}x{{n}}");
+	str_replace_many(&s, r + 1, 1);
+	EXPECT_STREQ("a much longer valuexa much longer value", s.c_str);
+	str_set(&s, "x{{name}}{{name}}x");
+	str_replace_many(&s, r, 1);
+	EXPECT_STREQ("xworldworldx", s.c_str);
+	str_destroy(&s);
+}
+
+// replacing placeholders in a large template
+static void bench_replace(log_t *log) {
+	static const struct str_replacement r[] = {
+		{"{{host}}", "db.example.com"},
+		{"{{port}}", "5432"},
+		{"{{user}}", "service"},
+	};
+	str_t doc = STR_INIT, s = STR_INIT;
+	uint64_t seed = 2;
+	while (doc.len < (size_t) bench_doc) {
+		str_add(&doc, "option_");
+		str_add_u64(&doc, test_rand(&seed) % 1000);
+		str_add(&doc, " = ");
+		str_add(&doc, r[test_rand(&seed) % 3].find);
+		str_add(&doc, " # some explanatory comment text that is not replaced\n");
+	}
+
+	struct timer t;
+	start_timer(&t);
+	size_t found = 0;
+	for (const char *p = doc.c_str; (p = str_search(p, doc.c_str + doc.len - p, "comment", 7)) != NULL; p++) {
+		found++;
+	}
+	double search = stop_timer(&t);
+
+	start_timer(&t);
+	size_t libc = 0;
+	for (const char *p = doc.c_str; (p = (const char*) memmem(p, doc.c_str + doc.len - p, "comment", 7)) != NULL; p++) {
+		libc++;
+	}
+	double memmemt = stop_timer(&t);
+	EXPECT_EQ(libc, found);
+
+	str_setstr(&s, doc);
+	start_timer(&t);
+	str_replace_many(&s, r, 3);
+	double many = stop_timer(&t);
+
+	str_setstr(&s, doc);
+	start_timer(&t);
+	for (int i = 0; i < 3; i++) {
+		str_replace_all(&s, r[i].find, r[i].replace);
+	}
+	double all = stop_timer(&t);
+	EXPECT_PTREQ(NULL, str_find(s, "{{"));
+
+	LOG(log, "str replace|bytes:%d|searchGBs:%.2f|memmemGBs:%.2f|replaceManyMs:%.2f|replaceAllMs:%.2f",
+		bench_doc, doc.len / search / 1e9, doc.len / memmemt / 1e9, many * 1e3, all * 1e3);
+	str_destroy(&doc);
+	str_destroy(&s);
+}
+
+static str_t make_inline(const char *a) {
+	str_t s = STR_INIT;
+	str_set(&s, a);
+	return s;
+}
+
+static void test_move(void) {
+	// returned by value, c_str still points into the callee's copy
+	str_t s = make_inline("moved");
+	str_fixup(&s);
+	EXPECT_PTREQ(s.buf, s.c_str);
+	EXPECT_STREQ("moved", s.c_str);
+
+	// copied by value, the copy takes over and the original is dropped
+	str_t c = s;
+	str_fixup(&c);
+	EXPECT_PTREQ(c.buf, c.c_str);
+	str_addch(&c, '!');
+	EXPECT_STREQ("moved!", c.c_str);
+	str_destroy(&c);
+
+	// arrays of strings moved by realloc
+	str_t *v = malloc(2 * sizeof(str_t));
+	v[0] = make_inline("first");
+	v[1] = make_inline("a second string that lives on the heap");
+	for (int i = 0; i < 4; i++) {
+		v = realloc(v, (i + 3) * sizeof(str_t));
+		str_fixup(&v[0]);
+		str_fixup(&v[1]);
+		EXPECT_STREQ("first", v[0].c_str);
+		EXPECT_STREQ("a second string that lives on the heap", v[1].c_str);
+	}
+	str_add(&v[0], " now long enough for the heap");
+	EXPECT_STREQ("first now long enough for the heap", v[0].c_str);
+	str_destroy(&v[0]);
+	str_destroy(&v[1]);
+	free(v);
+
+	// empty strings are copied out too so the result can always be freed
+	str_t e = str_init0();
+	char *p = str_release(&e);
+	EXPECT_STREQ("", p);
+	free(p);
+}
+
+// short lived strings as used for log lines and paths
+static void bench_short(log_t *log) {
+	struct timer t;
+	start_timer(&t);
+	size_t total = 0;
+	for (int i = 0; i < bench_strings; i++) {
+		str_t s = STR_INIT;
+		str_add(&s, "dir/");
+		str_addch(&s, 'a' + (i % 26));
+		str_add(&s, ".txt");
+		total += s.len;
+		str_destroy(&s);
+	}
+	double ns = stop_timer(&t) * 1e9 / bench_strings;
+	EXPECT_EQ(9 * (size_t) bench_strings, total);
+	LOG(log, "str short|strings:%d|nsPerString:%.1f", bench_strings, ns);
+}
+
 int main(int argc, const char *argv[]) {
-	start_test(argc, argv);
+	flag_int(&bench_strings, 0, "bench-strings", "N", "number of strings in the benchmark");
+	flag_int(&bench_doc, 0, "bench-doc", "BYTES", "size of the document in the replace benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_inline();
+	test_move();
+	test_search();
+	test_replace();
+	bench_short(log);
+	bench_replace(log);
 
 	str_t s = STR_INIT;
 	str_set(&s, "foo bar foo bar");
@@ -1,4 +1,5 @@
 #include "cutils/stream.h"
+#include "cutils/slice.h"
 #include "tar.h"
 
 #ifndef WIN32
@@ -36,6 +37,15 @@ static char *clean_tar_linkname(const tar_posix_header *t) {
 	return lnk;
 }
 
+// numeric fields are octal padded with spaces or nulls
+static slice_t tar_field(const char *p, size_t sz) {
+	size_t len = 0;
+	while (len < sz && p[len]) {
+		len++;
+	}
+	return slice_trim(make_slice(p, len));
+}
+
 #define TAR_BLOCK_SIZE UINT64_C(512)
 
 struct tar_container {
@@ -56,10 +66,13 @@ static void close_tar(container *iface) {
 }
 
 static int read_tar_file_header(struct tar_container *c, const tar_posix_header *t) {
-	char mode[sizeof(t->mode) + 1];
-	strncpy(mode, t->mode, sizeof(t->mode));
-	mode[sizeof(t->mode)] = 0;
-	int imode = strtol(mode, NULL, 8);
+	// a size we can't parse would lose our place in the stream
+	uint64_t imode, sz;
+	if (slice_to_u64(tar_field(t->mode, sizeof(t->mode)), 8, &imode)
+		|| slice_to_u64(tar_field(t->size, sizeof(t->size)), 8, &sz)) {
+		fprintf(stderr, "invalid tar header for %.*s\n", (int) sizeof(t->name), t->name);
+		return -1;
+	}
 
 	char *path = clean_tar_name(t);
 	if (!path) {
@@ -67,12 +80,6 @@ static int read_tar_file_header(struct tar_container *c, const tar_posix_header
 		return -1;
 	}
 
-	char size[sizeof(t->size) + 1];
-	strncpy(size, t->size, sizeof(t->size));
-	size[sizeof(t->size)] = 0;
-
-	uint64_t sz = strtoull(size, NULL, 8);
-
 	c->file_opened = 0;
 	c->path = path;
 	c->lnk = NULL;
@@ -81,7 +88,7 @@ static int read_tar_file_header(struct tar_container *c, const tar_posix_header
 	c->h.file_path = path;
 	c->h.link_target = NULL;
 	c->h.file_size = sz;
-	c->h.file_mode = imode;
+	c->h.file_mode = (int) imode;
 	return 0;
 }
 
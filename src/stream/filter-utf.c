@@ -0,0 +1,169 @@
+#include "cutils/stream.h"
+#include "cutils/utf.h"
+#include <string.h>
+#include <stdbool.h>
+
+// Upstream data is converted at most this many bytes at a time so that
+// the output buffer stays small when the source returns large blocks.
+#define UTF_CHUNK (16 * 1024)
+
+typedef struct utf_stream utf_stream;
+
+struct utf_stream {
+	stream iface;
+	stream *source;
+	const uint8_t *in;
+	size_t inlen, inused;
+	uint8_t *buf;
+	size_t avail, bufsz, consumed;
+	int flags;
+	bool to_utf8;
+	bool started;
+	bool eof;
+	bool finished;
+};
+
+// Number of bytes at the end of p that may be the start of a sequence
+// continued in the next read. These are held back until the rest arrives.
+static size_t UTF8_tail(const uint8_t *p, size_t n) {
+	for (size_t i = 1; i <= 3 && i <= n; i++) {
+		uint8_t c = p[n - i];
+		if ((c & 0xC0) != 0x80) {
+			size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+			return len > i ? i : 0;
+		}
+	}
+	return 0;
+}
+
+static size_t UTF16LE_tail(const uint8_t *p, size_t n) {
+	size_t odd = n & 1;
+	if (n - odd >= 2 && (p[n - odd - 1] & 0xFC) == 0xD8) {
+		// high surrogate
+		return odd + 2;
+	}
+	return odd;
+}
+
+static void close_utf(stream *s) {
+	utf_stream *us = (utf_stream*)s;
+	us->source->close(us->source);
+	free(us->buf);
+	free(us);
+}
+
+static void skip_bom(utf_stream *us) {
+	const uint8_t *p = us->in + us->inused;
+	size_t left = us->inlen - us->inused;
+	if (us->to_utf8 && left >= 2 && p[0] == 0xFF && p[1] == 0xFE) {
+		us->inused += 2;
+	} else if (!us->to_utf8 && left >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) {
+		us->inused += 3;
+	}
+}
+
+static const uint8_t *read_utf(stream *s, size_t consume, size_t need, size_t *plen) {
+	utf_stream *us = (utf_stream*) s;
+
+	// see if we can service from the existing buffer
+	us->consumed += consume;
+	if (!need) {
+		need = 1;
+	}
+	if (us->finished || us->consumed + need <= us->avail) {
+		*plen = us->avail - us->consumed;
+		return us->buf ? us->buf + us->consumed : (const uint8_t*) "";
+	}
+
+	// compress the buffer
+	if (us->consumed && us->consumed < us->avail) {
+		memmove(us->buf, us->buf + us->consumed, us->avail - us->consumed);
+	}
+	us->avail -= us->consumed;
+	us->consumed = 0;
+
+	while (need > us->avail) {
+		size_t left = us->inlen - us->inused;
+		size_t n = left < UTF_CHUNK ? left : UTF_CHUNK;
+		if (n && (!us->eof || n < left)) {
+			n -= us->to_utf8 ? UTF16LE_tail(us->in + us->inused, n) : UTF8_tail(us->in + us->inused, n);
+		}
+
+		// read more from upstream, keeping any partial sequence
+		if (!us->eof && (!n || (!us->started && left < 3))) {
+			us->in = us->source->read(us->source, us->inused, left + 1, &us->inlen);
+			if (!us->in) {
+				goto err;
+			}
+			us->inused = 0;
+			us->eof = us->inlen <= left;
+			continue;
+		}
+
+		if (!us->started) {
+			if (us->flags & UTF_STRIP_BOM) {
+				skip_bom(us);
+			}
+			us->started = true;
+			continue;
+		}
+
+		if (!n) {
+			us->finished = true;
+			break;
+		}
+
+		const uint8_t *p = us->in + us->inused;
+		if ((us->flags & UTF_STRICT) && !(us->to_utf8 ? is_valid_UTF16LE(p, n) : is_valid_UTF8(p, n))) {
+			goto err;
+		}
+
+		size_t max = us->to_utf8 ? UTF16LE_to_UTF8_size(n) : UTF8_to_UTF16LE_size(n);
+		if (us->avail + max > us->bufsz) {
+			size_t bufsz = us->avail + max;
+			uint8_t *buf = realloc(us->buf, bufsz);
+			if (!buf) {
+				goto err;
+			}
+			us->bufsz = bufsz;
+			us->buf = buf;
+		}
+
+		uint8_t *dest = us->buf + us->avail;
+		us->avail += us->to_utf8 ? UTF16LE_to_UTF8(dest, p, n) : UTF8_to_UTF16LE(dest, p, n);
+		us->inused += n;
+	}
+
+	*plen = us->avail;
+	return us->buf ? us->buf : (const uint8_t*) "";
+err:
+	us->finished = true;
+	*plen = 0;
+	return NULL;
+}
+
+static stream *open_utf(stream *source, int flags, bool to_utf8) {
+	if (!source) {
+		return NULL;
+	}
+	utf_stream *us = calloc(1, sizeof(struct utf_stream));
+	if (!us) {
+		source->close(source);
+		return NULL;
+	}
+	us->source = source;
+	us->flags = flags;
+	us->to_utf8 = to_utf8;
+	us->started = !(flags & UTF_STRIP_BOM);
+	us->iface.close = &close_utf;
+	us->iface.read = &read_utf;
+	return &us->iface;
+}
+
+stream *open_utf16le_to_utf8(stream *source, int flags) {
+	return open_utf(source, flags, true);
+}
+
+stream *open_utf8_to_utf16le(stream *source, int flags) {
+	return open_utf(source, flags, false);
+}
@@ -0,0 +1,79 @@
+#include "cutils/stream.h"
+#include "cutils/rope.h"
+
+typedef struct rope_stream rope_stream;
+
+struct rope_stream {
+	stream iface;
+	const struct rope_block *block;
+	size_t off;
+	uint8_t *tmp;
+	size_t tmpcap;
+};
+
+static void close_rope(stream *s) {
+	rope_stream *rs = (rope_stream*)s;
+	free(rs->tmp);
+	free(rs);
+}
+
+static const uint8_t *read_rope(stream *s, size_t consume, size_t need, size_t *plen) {
+	rope_stream *rs = (rope_stream*)s;
+	const struct rope_block *b = rs->block;
+	size_t off = rs->off + consume;
+	while (b && off >= b->len) {
+		off -= b->len;
+		b = b->next;
+	}
+	rs->block = b;
+	rs->off = off;
+
+	if (!b) {
+		*plen = 0;
+		return (const uint8_t*) "";
+	}
+
+	// Data is returned directly out of the block where possible. Only
+	// reads that need more than the rest of the block are copied.
+	size_t avail = b->len - off;
+	if (avail >= need || !b->next) {
+		*plen = avail;
+		return (const uint8_t*) b->data + off;
+	}
+
+	if (need > rs->tmpcap) {
+		uint8_t *p = (uint8_t*)realloc(rs->tmp, need);
+		if (!p) {
+			*plen = 0;
+			return NULL;
+		}
+		rs->tmp = p;
+		rs->tmpcap = need;
+	}
+
+	size_t n = 0;
+	for (; b && n < need; b = b->next, off = 0) {
+		size_t sz = b->len - off;
+		if (sz > need - n) {
+			sz = need - n;
+		}
+		memcpy(rs->tmp + n, b->data + off, sz);
+		n += sz;
+	}
+	*plen = n;
+	return rs->tmp;
+}
+
+stream *open_rope_stream(const struct rope *r) {
+	rope_stream *rs = (rope_stream*)malloc(sizeof(rope_stream));
+	if (!rs) {
+		return NULL;
+	}
+	rs->iface.close = &close_rope;
+	rs->iface.read = &read_rope;
+	rs->block = r->first;
+	rs->off = 0;
+	rs->tmp = NULL;
+	rs->tmpcap = 0;
+	return &rs->iface;
+}
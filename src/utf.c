@@ -1,6 +1,290 @@
 #include "cutils/utf.h"
+#include "cutils/endian.h"
+#include <string.h>
 
+#if defined __AVX2__
+#include <immintrin.h>
+#define UTF_AVX2
+#elif defined __SSSE3__
+#include <tmmintrin.h>
+#define UTF_SSSE3
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTF_SSE2
+#elif defined __ARM_NEON && defined __aarch64__
+#include <arm_neon.h>
+#define UTF_NEON
+#endif
 
+// vec_widen stores VEC_SIZE bytes as 16 bit units. vec_narrow stores two
+// vectors of 16 bit units as bytes. Both are only used on ASCII. The
+// validator also needs vec_lookup (a byte shuffle) and VEC_PREV, which
+// returns the vector shifted back N bytes into the previous vector.
+#if defined UTF_AVX2
+#define VEC_SIZE 32
+#define VEC_LOOKUP
+typedef __m256i vec_t;
+static inline vec_t vec_load(const uint8_t *p) {return _mm256_loadu_si256((const __m256i*) p);}
+static inline vec_t vec_splat(uint8_t c) {return _mm256_set1_epi8((char) c);}
+static inline vec_t vec_and(vec_t a, vec_t b) {return _mm256_and_si256(a, b);}
+static inline vec_t vec_or(vec_t a, vec_t b) {return _mm256_or_si256(a, b);}
+static inline vec_t vec_xor(vec_t a, vec_t b) {return _mm256_xor_si256(a, b);}
+static inline vec_t vec_subs(vec_t a, vec_t b) {return _mm256_subs_epu8(a, b);}
+static inline vec_t vec_shr4(vec_t a) {return _mm256_and_si256(_mm256_srli_epi16(a, 4), _mm256_set1_epi8(0x0F));}
+static inline vec_t vec_table(const uint8_t *t) {return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) t));}
+static inline vec_t vec_lookup(vec_t table, vec_t idx) {return _mm256_shuffle_epi8(table, idx);}
+static inline bool vec_any(vec_t a) {return !_mm256_testz_si256(a, a);}
+static inline bool vec_is_ascii(vec_t a) {return !_mm256_movemask_epi8(a);}
+static inline bool vec_is_ascii16(vec_t a, vec_t b) {
+	vec_t t = _mm256_and_si256(_mm256_or_si256(a, b), _mm256_set1_epi16((short) 0xFF80));
+	return _mm256_testz_si256(t, t);
+}
+static inline void vec_widen(uint8_t *d, vec_t a) {
+	_mm256_storeu_si256((__m256i*) d, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a)));
+	_mm256_storeu_si256((__m256i*) (d + 32), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1)));
+}
+static inline void vec_narrow(uint8_t *d, vec_t a, vec_t b) {
+	_mm256_storeu_si256((__m256i*) d, _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+}
+#define VEC_PREV(IN, PREV, N) _mm256_alignr_epi8((IN), _mm256_permute2x128_si256((PREV), (IN), 0x21), 16 - (N))
+
+#elif defined UTF_SSSE3 || defined UTF_SSE2
+#define VEC_SIZE 16
+typedef __m128i vec_t;
+static inline vec_t vec_load(const uint8_t *p) {return _mm_loadu_si128((const __m128i*) p);}
+static inline bool vec_is_ascii(vec_t a) {return !_mm_movemask_epi8(a);}
+static inline bool vec_is_ascii16(vec_t a, vec_t b) {
+	vec_t t = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16((short) 0xFF80));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(t, _mm_setzero_si128())) == 0xFFFF;
+}
+static inline void vec_widen(uint8_t *d, vec_t a) {
+	_mm_storeu_si128((__m128i*) d, _mm_unpacklo_epi8(a, _mm_setzero_si128()));
+	_mm_storeu_si128((__m128i*) (d + 16), _mm_unpackhi_epi8(a, _mm_setzero_si128()));
+}
+static inline void vec_narrow(uint8_t *d, vec_t a, vec_t b) {
+	_mm_storeu_si128((__m128i*) d, _mm_packus_epi16(a, b));
+}
+#ifdef UTF_SSSE3
+#define VEC_LOOKUP
+static inline vec_t vec_splat(uint8_t c) {return _mm_set1_epi8((char) c);}
+static inline vec_t vec_and(vec_t a, vec_t b) {return _mm_and_si128(a, b);}
+static inline vec_t vec_or(vec_t a, vec_t b) {return _mm_or_si128(a, b);}
+static inline vec_t vec_xor(vec_t a, vec_t b) {return _mm_xor_si128(a, b);}
+static inline vec_t vec_subs(vec_t a, vec_t b) {return _mm_subs_epu8(a, b);}
+static inline vec_t vec_shr4(vec_t a) {return _mm_and_si128(_mm_srli_epi16(a, 4), _mm_set1_epi8(0x0F));}
+static inline vec_t vec_table(const uint8_t *t) {return _mm_loadu_si128((const __m128i*) t);}
+static inline vec_t vec_lookup(vec_t table, vec_t idx) {return _mm_shuffle_epi8(table, idx);}
+static inline bool vec_any(vec_t a) {return _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128())) != 0xFFFF;}
+#define VEC_PREV(IN, PREV, N) _mm_alignr_epi8((IN), (PREV), 16 - (N))
+#endif
+
+#elif defined UTF_NEON
+#define VEC_SIZE 16
+#define VEC_LOOKUP
+typedef uint8x16_t vec_t;
+static inline vec_t vec_load(const uint8_t *p) {return vld1q_u8(p);}
+static inline vec_t vec_splat(uint8_t c) {return vdupq_n_u8(c);}
+static inline vec_t vec_and(vec_t a, vec_t b) {return vandq_u8(a, b);}
+static inline vec_t vec_or(vec_t a, vec_t b) {return vorrq_u8(a, b);}
+static inline vec_t vec_xor(vec_t a, vec_t b) {return veorq_u8(a, b);}
+static inline vec_t vec_subs(vec_t a, vec_t b) {return vqsubq_u8(a, b);}
+static inline vec_t vec_shr4(vec_t a) {return vshrq_n_u8(a, 4);}
+static inline vec_t vec_table(const uint8_t *t) {return vld1q_u8(t);}
+static inline vec_t vec_lookup(vec_t table, vec_t idx) {return vqtbl1q_u8(table, idx);}
+static inline bool vec_any(vec_t a) {return vmaxvq_u8(a) != 0;}
+static inline bool vec_is_ascii(vec_t a) {return vmaxvq_u8(a) < 0x80;}
+static inline bool vec_is_ascii16(vec_t a, vec_t b) {
+	return vmaxvq_u16(vorrq_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b))) < 0x80;
+}
+static inline void vec_widen(uint8_t *d, vec_t a) {
+	vst1q_u8(d, vreinterpretq_u8_u16(vmovl_u8(vget_low_u8(a))));
+	vst1q_u8(d + 16, vreinterpretq_u8_u16(vmovl_high_u8(a)));
+}
+static inline void vec_narrow(uint8_t *d, vec_t a, vec_t b) {
+	vst1q_u8(d, vuzp1q_u8(a, b));
+}
+#define VEC_PREV(IN, PREV, N) vextq_u8((PREV), (IN), 16 - (N))
+#endif
+
+// returned by the decode functions for invalid input
+#define BAD_CHAR 0x110000
+#define REPLACEMENT_CHAR 0xFFFD
+
+// Decodes the code point at sp, returning the number of bytes used. An
+// invalid sequence gives BAD_CHAR and uses the bytes up to the first one
+// that makes it invalid, or the first byte if that's the problem.
+static inline size_t decode_UTF8(const uint8_t *sp, const uint8_t *end, uint32_t *pc) {
+	uint8_t c = sp[0];
+	uint8_t lo = 0x80, hi = 0xBF;
+	size_t need;
+	uint32_t u;
+	if (c < 0x80) {
+		*pc = c;
+		return 1;
+	} else if (c < 0xC2) {
+		// continuation without a start or an overlong 2 byte encoding
+		*pc = BAD_CHAR;
+		return 1;
+	} else if (c < 0xE0) {
+		/* Source: 110yyyxx 10xxxxxx */
+		need = 1;
+		u = c & 0x1F;
+	} else if (c < 0xF0) {
+		/* Source: 1110yyyy 10yyyyxx 10xxxxxx
+		 * E0 must be followed by A0+ to not be overlong
+		 * ED must be followed by 9F- to not be a surrogate */
+		need = 2;
+		u = c & 0x0F;
+		lo = c == 0xE0 ? 0xA0 : 0x80;
+		hi = c == 0xED ? 0x9F : 0xBF;
+	} else if (c < 0xF5) {
+		/* Source: 11110zzz 10zzyyyy 10yyyyxx 10xxxxxx
+		 * F0 must be followed by 90+ to not be overlong
+		 * F4 must be followed by 8F- to not be above U+10FFFF */
+		need = 3;
+		u = c & 0x07;
+		lo = c == 0xF0 ? 0x90 : 0x80;
+		hi = c == 0xF4 ? 0x8F : 0xBF;
+	} else {
+		*pc = BAD_CHAR;
+		return 1;
+	}
+
+	size_t i = 1;
+	for (; i <= need; i++) {
+		if (sp + i >= end || sp[i] < lo || sp[i] > hi) {
+			*pc = BAD_CHAR;
+			return i;
+		}
+		u = (u << 6) | (sp[i] & 0x3F);
+		lo = 0x80;
+		hi = 0xBF;
+	}
+	*pc = u;
+	return i;
+}
+
+// As decode_UTF8 for UTF-16LE. end must be at an even offset from sp.
+static inline size_t decode_UTF16LE(const uint8_t *sp, const uint8_t *end, uint32_t *pc) {
+	uint32_t w = little_16(sp);
+	if (w < 0xD800 || w >= 0xE000) {
+		*pc = w;
+		return 2;
+	}
+	if (w < 0xDC00 && end - sp >= 4) {
+		/* Source: zzyyyyyy 110110zz xxxxxxxx 110111yy
+		 * UTF16 data is shifted by 0x10000 */
+		uint32_t w2 = little_16(sp + 2);
+		if (w2 >= 0xDC00 && w2 < 0xE000) {
+			*pc = 0x10000 + ((w - 0xD800) << 10) + (w2 - 0xDC00);
+			return 4;
+		}
+	}
+	*pc = BAD_CHAR;
+	return 2;
+}
+
+static inline uint8_t *encode_UTF8(uint8_t *dp, uint32_t c) {
+	if (c < 0x80) {
+		dp[0] = (uint8_t) c;
+		return dp + 1;
+	} else if (c < 0x800) {
+		/* Dest: 110yyyxx 10xxxxxx */
+		dp[0] = (uint8_t) (0xC0 | (c >> 6));
+		dp[1] = (uint8_t) (0x80 | (c & 0x3F));
+		return dp + 2;
+	} else if (c < 0x10000) {
+		/* Dest: 1110yyyy 10yyyyxx 10xxxxxx */
+		dp[0] = (uint8_t) (0xE0 | (c >> 12));
+		dp[1] = (uint8_t) (0x80 | ((c >> 6) & 0x3F));
+		dp[2] = (uint8_t) (0x80 | (c & 0x3F));
+		return dp + 3;
+	} else {
+		/* Dest: 11110zzz 10zzyyyy 10yyyyxx 10xxxxxx */
+		dp[0] = (uint8_t) (0xF0 | (c >> 18));
+		dp[1] = (uint8_t) (0x80 | ((c >> 12) & 0x3F));
+		dp[2] = (uint8_t) (0x80 | ((c >> 6) & 0x3F));
+		dp[3] = (uint8_t) (0x80 | (c & 0x3F));
+		return dp + 4;
+	}
+}
+
+static inline uint8_t *encode_UTF16LE(uint8_t *dp, uint32_t c) {
+	if (c < 0x10000) {
+		return write_little_16(dp, (uint16_t) c);
+	}
+	/* Dest: zzyyyyyy 110110zz xxxxxxxx 110111yy */
+	c -= 0x10000;
+	dp = write_little_16(dp, (uint16_t) (0xD800 | (c >> 10)));
+	return write_little_16(dp, (uint16_t) (0xDC00 | (c & 0x3FF)));
+}
+
+static inline size_t UTF8_length(uint32_t c) {
+	return c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+}
+
+// The ASCII functions handle the run of ASCII at the start of the source
+// and return the number of bytes of source used.
+
+static size_t widen_ascii(uint8_t *dp, const uint8_t *sp, size_t size) {
+	size_t i = 0;
+#ifdef VEC_SIZE
+	for (; i + VEC_SIZE <= size; i += VEC_SIZE) {
+		vec_t v = vec_load(sp + i);
+		if (!vec_is_ascii(v)) {
+			break;
+		}
+		vec_widen(dp + 2 * i, v);
+	}
+#endif
+	for (; i < size && sp[i] < 0x80; i++) {
+		dp[2 * i] = sp[i];
+		dp[2 * i + 1] = 0;
+	}
+	return i;
+}
+
+static size_t narrow_ascii(uint8_t *dp, const uint8_t *sp, size_t size) {
+	size_t i = 0;
+#ifdef VEC_SIZE
+	for (; i + 2 * VEC_SIZE <= size; i += 2 * VEC_SIZE) {
+		vec_t a = vec_load(sp + i);
+		vec_t b = vec_load(sp + i + VEC_SIZE);
+		if (!vec_is_ascii16(a, b)) {
+			break;
+		}
+		vec_narrow(dp + i / 2, a, b);
+	}
+#endif
+	for (; i + 2 <= size && sp[i] < 0x80 && !sp[i + 1]; i += 2) {
+		dp[i / 2] = sp[i];
+	}
+	return i;
+}
+
+static size_t count_ascii(const uint8_t *sp, size_t size) {
+	size_t i = 0;
+#ifdef VEC_SIZE
+	for (; i + VEC_SIZE <= size && vec_is_ascii(vec_load(sp + i)); i += VEC_SIZE) {
+	}
+#endif
+	while (i < size && sp[i] < 0x80) {
+		i++;
+	}
+	return i;
+}
+
+static size_t count_ascii16(const uint8_t *sp, size_t size) {
+	size_t i = 0;
+#ifdef VEC_SIZE
+	for (; i + 2 * VEC_SIZE <= size && vec_is_ascii16(vec_load(sp + i), vec_load(sp + i + VEC_SIZE)); i += 2 * VEC_SIZE) {
+	}
+#endif
+	while (i + 2 <= size && sp[i] < 0x80 && !sp[i + 1]) {
+		i += 2;
+	}
+	return i;
+}
 
 size_t UTF16LE_to_UTF8(void *dest, const void* src, size_t size) {
 	uint8_t *dp = dest;
@@ -9,202 +293,228 @@ size_t UTF16LE_to_UTF8(void *dest, const void* src, size_t size) {
 
 	while (sp < end) {
 		if (sp[0] < 0x80 && !sp[1]) {
-			/* 1 chars utf8, 1 wchar utf16 (US-ASCII)
-			* UTF32:  00000000 00000000 00000000 0xxxxxxx
-			* Source: 0xxxxxxx 00000000
-			* Dest:   0xxxxxxx
-			*/
-			dp[0] = sp[0];
-			dp += 1;
-			sp += 2;
-		} else if (sp[1] < 0x8) {
-			/* 2 chars utf8, 1 wchar utf16
-			* UTF32:  00000000 00000000 00000yyy xxxxxxxx
-			* Source: xxxxxxxx 00000yyy
-			* Dest:   110yyyxx 10xxxxxx
-			*/
-			dp[0] = 0xC0 | (sp[0] >> 6) | (sp[1] << 2);
-			dp[1] = 0x80 | (sp[0] & 0x3F);
-			dp += 2;
-			sp += 2;
-		} else if (sp[1] < 0xD8) {
-			/* 3 chars utf8, 1 wchar utf16
-			* UTF32:  00000000 00000000 yyyyyyyy xxxxxxxx
-			* Source: xxxxxxxx yyyyyyyy
-			* Dest:   1110yyyy 10yyyyxx 10xxxxxx
-			*/
-			dp[0] = 0xE0 | (sp[1] >> 4);
-			dp[1] = 0x80 | ((sp[1] << 2) & 0x3C) | (sp[0] >> 6);
-			dp[2] = 0x80 | (sp[0] & 0x3F);
-			dp += 3;
-			sp += 2;
-		} else if (sp[1] < 0xDC) {
-			/* 4 chars utf8, 2 wchars utf16
-			* 0xD8 1101 1000
-			* 0xDB 1101 1011
-			* 0xDC 1101 1100
-			* 0xDF 1101 1111
-			* Source: zzyyyyyy 110110zz xxxxxxxx 110111yy
-			* Shifted:00000000 0000zzzz yyyyyyyy xxxxxxxx
-			* UTF32:  00000000 000zzzzz yyyyyyyy xxxxxxxx
-			* Dest:   11110zzz 10zzyyyy 10yyyyxx 10xxxxxx
-			* UTF16 data is shifted by 0x10000
-			*/
-			if (sp + 2 < end || (sp[3] & 0xFC) != 0xDC) {
-				// Check that we can have enough bytes and a valid surrogate
-				// if not insert the replacement character
-				dp[0] = 0xEF;
-				dp[1] = 0xBF;
-				dp[2] = 0xBD;
-				dp += 3;
-				sp += 2;
-			} else {
-				uint32_t u32 = (((uint32_t)sp[1] & 3) << 18)
-					| (((uint32_t)sp[0]) << 16)
-					| (((uint32_t)sp[3] & 3) << 8)
-					| ((uint32_t)sp[2]);
-				u32 += 0x10000;
-				dp[0] = (uint8_t)(0xF0 | ((u32 >> 18) & 0x07));
-				dp[1] = (uint8_t)(0x80 | ((u32 >> 12) & 0x3F));
-				dp[2] = (uint8_t)(0x80 | ((u32 >> 6) & 0x3F));
-				dp[3] = (uint8_t)(0x80 | (u32 & 0x3F));
-				dp += 4;
-				sp += 4;
-			}
+			size_t n = narrow_ascii(dp, sp, end - sp);
+			dp += n / 2;
+			sp += n;
 		} else {
-			/* 3 chars utf8, 1 wchar utf16
-			* UTF32:  00000000 00000000 yyyyyyyy xxxxxxxx
-			* Source: xxxxxxxx yyyyyyyy
-			* Dest:   1110yyyy 10yyyyxx 10xxxxxx
-			*/
-			dp[0] = 0xE0 | (sp[1] >> 4);
-			dp[1] = 0x80 | ((sp[1] & 0xF) << 2) | (sp[0] >> 6);
-			dp[2] = 0x80 | (sp[0] & 0x3F);
-			dp += 3;
-			sp += 2;
+			uint32_t c;
+			sp += decode_UTF16LE(sp, end, &c);
+			dp = encode_UTF8(dp, c == BAD_CHAR ? REPLACEMENT_CHAR : c);
 		}
 	}
 	return (size_t)(dp - (uint8_t*) dest);
 }
 
-static uint8_t *utf16_replacement(uint8_t* dp) {
-	// insert the UTF16 replacement character 0xFFFD
-	dp[0] = 0xFD;
-	dp[1] = 0xFF;
-	return dp + 2;
+size_t UTF8_to_UTF16LE(void* dest, const void* src, size_t size) {
+	uint8_t *dp = dest;
+	const uint8_t *sp = src;
+	const uint8_t *end = sp + size;
+
+	while (sp < end) {
+		if (sp[0] < 0x80) {
+			size_t n = widen_ascii(dp, sp, end - sp);
+			dp += 2 * n;
+			sp += n;
+		} else {
+			uint32_t c;
+			sp += decode_UTF8(sp, end, &c);
+			dp = encode_UTF16LE(dp, c == BAD_CHAR ? REPLACEMENT_CHAR : c);
+		}
+	}
+	return (size_t) (dp - (uint8_t*) dest);
 }
 
-size_t UTF8_to_UTF16LE(void* dest, const void* src, size_t size) {
-    uint8_t* dp = dest;
-    const uint8_t* sp = src;
-    const uint8_t* end = sp + size;
-
-    while (sp < end) {
-        if (sp[0] < 0x80) {
-            /* 1 char utf8, 1 wchar utf16 (US-ASCII)
-             * UTF32:  00000000 00000000 00000000 0xxxxxxx
-             * Source: 0xxxxxxx
-             * Dest:   0xxxxxxx 00000000
-             */
-            dp[0] = sp[0];
-			dp[1] = 0;
-            dp += 2;
-            sp += 1;
-        } else if (sp[0] < 0xC0) {
-            /* Multi-byte data without start */
-			sp++;
-        } else if (sp[0] < 0xE0) {
-            /* 2 chars utf8, 1 wchar utf16
-             * UTF32:  00000000 00000000 00000yyy xxxxxxxx
-             * Source: 110yyyxx 10xxxxxx
-             * Dest:   xxxxxxxx 00000yyy
-             * Overlong: Require 1 in some y or top bit of x
-             */
-            if (sp + 2 > end) {                   /* Check that we have enough bytes */
-                dp = utf16_replacement(dp);
-				sp++;
-            } else if ((sp[1] & 0xC0) != 0x80) {  /* Check continuation byte */
-                dp = utf16_replacement(dp);
-				sp++;
-            } else if ((sp[1] & 0x1E) == 0) {     /* Check for overlong encoding */
-                dp = utf16_replacement(dp);
-				sp += 2;
-            } else {
-				dp[0] = (sp[0] << 6) | (sp[1] & 0x3F);
-				dp[1] = (sp[1] >> 2) & 7;
-                dp += 2;
-                sp += 2;
-            }
-        } else if (sp[0] < 0xF0) {
-            /* 3 chars utf8, 1 wchar utf16
-             * UTF32:  00000000 00000000 yyyyyyyy xxxxxxxx
-             * Source: 1110yyyy 10yyyyxx 10xxxxxx
-             * Dest:   xxxxxxxx yyyyyyyy
-             * Overlong: Require 1 in one of the top 5 bits of y
-             */
-            if (sp + 3 > end) {
-				/* Check that we have enough bytes */
-                dp = utf16_replacement(dp);
-				sp++;
-            } else if ((sp[1] & 0xC0) != 0x80 || (sp[2] & 0xC0) != 0x80) {
-				/* Check continuation byte */
-                dp = utf16_replacement(dp);
-				sp++;
-            } else if ((sp[0] & 0x0F) == 0 && (sp[1] & 0x20) == 0) {
-				/* Check for overlong encoding */
-                dp = utf16_replacement(dp);
-				sp += 3;
-            } else {
-				dp[0] = (sp[1] << 6) | (sp[0] & 0x3F);
-				dp[1] = (sp[0] << 4) | ((sp[1] >> 2) & 0xF);
-                dp += 2;
-                sp += 3;
-            }
-        } else if (sp[0] < 0xF8) {
-            /* 4 chars utf8, 2 wchars utf16
-			 * 0xD8 1101 1000
-			 * 0xDB 1101 1011
-			 * 0xDC 1101 1100
-			 * 0xDF 1101 1111
-             * Source: 11110zzz 10zzyyyy 10yyyyxx 10xxxxxx
-             * UTF32:  00000000 000zzzzz yyyyyyyy xxxxxxxx
-			 * Shifted:00000000 0000zzzz yyyyyyyy xxxxxxxx
-             * Dest:   zzyyyyyy 110110zz xxxxxxxx 110111yy
-             * Overlong: Check UTF32 value
-             * UTF16 data is shifted by 0x10000
-             */
-            if (sp + 4 > end) {
-				/* Check that we have enough bytes */
-                dp = utf16_replacement(dp);
-				sp++;
-            } else if ((sp[1] & 0xC0) != 0x80 || (sp[2] & 0xC0) != 0x80 || (sp[3] & 0xC0) != 0x80) {
-				/* Check continuation bytes */
-                dp = utf16_replacement(dp);
-				sp++;
-            } else {
-                uint32_t u32  = ((((uint32_t) sp[0]) & 0x07) << 18)
-                              | ((((uint32_t) sp[1]) & 0x3F) << 12)
-                              | ((((uint32_t) sp[2]) & 0x3F) << 6)
-                              | (((uint32_t) sp[3]) & 0x3F);
-
-                /* Check for overlong or too long encoding */
-                if (u32 < 0x10000 || u32 > 0x10FFFF) {
-                    dp = utf16_replacement(dp);
-					sp += 4;
-                } else {
-                    u32 -= 0x10000;
-					dp[0] = (uint8_t)(u32 >> 10);
-					dp[1] = 0xD8 | (uint8_t)(u32 >> 18);
-					dp[2] = (uint8_t)(u32);
-					dp[3] = 0xDC | (uint8_t)((u32 >> 8) & 3);
-                    dp += 4;
-                    sp += 4;
-                }
-            }
-        } else {
-            dp = utf16_replacement(dp);
-			sp++;
-        }
-    }
-    return (size_t) (dp - (uint8_t*) dest);
+size_t UTF16LE_to_UTF8_length(const void *src, size_t size) {
+	const uint8_t *sp = src;
+	const uint8_t *end = sp + (size & ~1);
+	size_t len = 0;
+
+	while (sp < end) {
+		size_t n = count_ascii16(sp, end - sp);
+		len += n / 2;
+		sp += n;
+		if (sp < end) {
+			uint32_t c;
+			sp += decode_UTF16LE(sp, end, &c);
+			len += c == BAD_CHAR ? 3 : UTF8_length(c);
+		}
+	}
+	return len;
+}
+
+size_t UTF8_to_UTF16LE_length(const void *src, size_t size) {
+	const uint8_t *sp = src;
+	const uint8_t *end = sp + size;
+	size_t len = 0;
+
+	while (sp < end) {
+		size_t n = count_ascii(sp, end - sp);
+		len += 2 * n;
+		sp += n;
+		if (sp < end) {
+			uint32_t c;
+			sp += decode_UTF8(sp, end, &c);
+			len += (c != BAD_CHAR && c >= 0x10000) ? 4 : 2;
+		}
+	}
+	return len;
+}
+
+bool is_valid_UTF16LE(const void *src, size_t size) {
+	const uint8_t *sp = src;
+	const uint8_t *end = sp + size;
+	if (size & 1) {
+		return false;
+	}
+	while (sp < end) {
+		sp += count_ascii16(sp, end - sp);
+		if (sp < end) {
+			uint32_t c;
+			sp += decode_UTF16LE(sp, end, &c);
+			if (c == BAD_CHAR) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+#ifdef VEC_LOOKUP
+// Each byte is checked against the byte before it with three table
+// lookups on the high nibble of the previous byte, the low nibble of the
+// previous byte and the high nibble of this byte. Each bit in the tables
+// is one class of error and a byte is in error if all three lookups have
+// that bit set. Lead bytes of 3 and 4 byte sequences are then checked for
+// the right number of continuation bytes using the bytes 2 and 3 back.
+#define TOO_SHORT (1 << 0)  // lead byte or ASCII followed by a continuation
+#define TOO_LONG (1 << 1)   // ASCII followed by a continuation
+#define OVERLONG_3 (1 << 2) // E0 followed by 80-9F
+#define TOO_LARGE (1 << 3)  // F4 followed by 90+ or F5+
+#define SURROGATE (1 << 4)  // ED followed by A0+
+#define OVERLONG_2 (1 << 5) // C0 or C1
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6) // F0 followed by 80-8F
+#define TWO_CONTS (1 << 7)  // two continuations, checked by the length test
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static const uint8_t byte_1_high[16] = {
+	// 0_______ ASCII
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	// 10______ continuation
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+	// 1100____ 2 byte lead
+	TOO_SHORT | OVERLONG_2,
+	// 1101____ 2 byte lead
+	TOO_SHORT,
+	// 1110____ 3 byte lead
+	TOO_SHORT | OVERLONG_3 | SURROGATE,
+	// 1111____ 4 byte lead
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+static const uint8_t byte_1_low[16] = {
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+	CARRY | OVERLONG_2,
+	CARRY,
+	CARRY,
+	CARRY | TOO_LARGE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+static const uint8_t byte_2_high[16] = {
+	// ________ 0_______ ASCII
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	// ________ 1000____
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+	// ________ 1001____
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+	// ________ 101_____
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	// ________ 11______ lead byte
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+
+// a block ending with the start of a sequence that needs more bytes than
+// are left has a non zero byte after subtracting this
+static const uint8_t incomplete_max[32] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+};
+
+struct validator {
+	vec_t t1, t2, t3, max, prev, err, incomplete;
+};
+
+static inline void check_block(struct validator *v, vec_t in) {
+	if (vec_is_ascii(in)) {
+		v->err = vec_or(v->err, v->incomplete);
+	} else {
+		vec_t prev1 = VEC_PREV(in, v->prev, 1);
+		vec_t sc = vec_and(vec_and(
+			vec_lookup(v->t1, vec_shr4(prev1)),
+			vec_lookup(v->t2, vec_and(prev1, vec_splat(0x0F)))),
+			vec_lookup(v->t3, vec_shr4(in)));
+		vec_t prev2 = VEC_PREV(in, v->prev, 2);
+		vec_t prev3 = VEC_PREV(in, v->prev, 3);
+		vec_t third = vec_subs(prev2, vec_splat(0xE0 - 0x80));
+		vec_t fourth = vec_subs(prev3, vec_splat(0xF0 - 0x80));
+		vec_t must23 = vec_and(vec_or(third, fourth), vec_splat(0x80));
+		v->err = vec_or(v->err, vec_xor(must23, sc));
+		v->incomplete = vec_subs(in, v->max);
+	}
+	v->prev = in;
+}
+
+bool is_valid_UTF8(const void *src, size_t size) {
+	const uint8_t *sp = src;
+	struct validator v;
+	v.t1 = vec_table(byte_1_high);
+	v.t2 = vec_table(byte_1_low);
+	v.t3 = vec_table(byte_2_high);
+	v.max = vec_load(incomplete_max + sizeof(incomplete_max) - VEC_SIZE);
+	v.prev = v.err = v.incomplete = vec_splat(0);
+
+	size_t i = 0;
+	for (; i + VEC_SIZE <= size; i += VEC_SIZE) {
+		check_block(&v, vec_load(sp + i));
+	}
+	if (i < size) {
+		// padding the end with zeros catches an incomplete last sequence
+		uint8_t buf[VEC_SIZE] = {0};
+		memcpy(buf, sp + i, size - i);
+		check_block(&v, vec_load(buf));
+	}
+	return !vec_any(vec_or(v.err, v.incomplete));
+}
+#else
+bool is_valid_UTF8(const void *src, size_t size) {
+	const uint8_t *sp = src;
+	const uint8_t *end = sp + size;
+	while (sp < end) {
+		sp += count_ascii(sp, end - sp);
+		if (sp < end) {
+			uint32_t c;
+			sp += decode_UTF8(sp, end, &c);
+			if (c == BAD_CHAR) {
+				return false;
+			}
+		}
+	}
+	return true;
 }
+#endif
@@ -0,0 +1,367 @@
+#include "cutils/utf.h"
+#include "cutils/stream.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int bench_bytes = 1 << 20;
+
+// straight from table 3-7 of the Unicode standard
+static bool reference_valid(const uint8_t *p, size_t n) {
+	size_t i = 0;
+	while (i < n) {
+		uint8_t c = p[i];
+		size_t need;
+		uint8_t lo = 0x80, hi = 0xBF;
+		if (c <= 0x7F) {
+			i++;
+			continue;
+		} else if (c >= 0xC2 && c <= 0xDF) {
+			need = 1;
+		} else if (c == 0xE0) {
+			need = 2;
+			lo = 0xA0;
+		} else if (c == 0xED) {
+			need = 2;
+			hi = 0x9F;
+		} else if (c >= 0xE1 && c <= 0xEF) {
+			need = 2;
+		} else if (c == 0xF0) {
+			need = 3;
+			lo = 0x90;
+		} else if (c >= 0xF1 && c <= 0xF3) {
+			need = 3;
+		} else if (c == 0xF4) {
+			need = 3;
+			hi = 0x8F;
+		} else {
+			return false;
+		}
+		if (i + need >= n) {
+			return false;
+		}
+		for (size_t j = 1; j <= need; j++) {
+			if (p[i + j] < lo || p[i + j] > hi) {
+				return false;
+			}
+			lo = 0x80;
+			hi = 0xBF;
+		}
+		i += need + 1;
+	}
+	return true;
+}
+
+static size_t add_char(uint8_t *p, uint32_t c) {
+	if (c < 0x80) {
+		p[0] = (uint8_t) c;
+		return 1;
+	} else if (c < 0x800) {
+		p[0] = (uint8_t) (0xC0 | (c >> 6));
+		p[1] = (uint8_t) (0x80 | (c & 0x3F));
+		return 2;
+	} else if (c < 0x10000) {
+		p[0] = (uint8_t) (0xE0 | (c >> 12));
+		p[1] = (uint8_t) (0x80 | ((c >> 6) & 0x3F));
+		p[2] = (uint8_t) (0x80 | (c & 0x3F));
+		return 3;
+	} else {
+		p[0] = (uint8_t) (0xF0 | (c >> 18));
+		p[1] = (uint8_t) (0x80 | ((c >> 12) & 0x3F));
+		p[2] = (uint8_t) (0x80 | ((c >> 6) & 0x3F));
+		p[3] = (uint8_t) (0x80 | (c & 0x3F));
+		return 4;
+	}
+}
+
+// random text with runs of ASCII between other characters
+static size_t random_text(uint8_t *p, size_t size, uint64_t *seed, int ascii_percent) {
+	size_t n = 0;
+	while (n + 4 <= size) {
+		uint64_t r = test_rand(seed);
+		uint32_t c;
+		if ((int) (r % 100) < ascii_percent) {
+			c = 0x20 + (uint32_t) (r / 100 % 0x5F);
+		} else {
+			switch (r / 100 % 3) {
+			case 0:
+				c = 0x80 + (uint32_t) (r / 300 % 0x780);
+				break;
+			case 1:
+				c = 0x800 + (uint32_t) (r / 300 % 0xF800);
+				if (c >= 0xD800 && c < 0xE000) {
+					c -= 0x800;
+				}
+				break;
+			default:
+				c = 0x10000 + (uint32_t) (r / 300 % 0x100000);
+				break;
+			}
+		}
+		n += add_char(p + n, c);
+	}
+	return n;
+}
+
+static void check_16to8(const char *in, size_t insz, const char *out, size_t outsz) {
+	uint8_t buf[64];
+	size_t n = UTF16LE_to_UTF8(buf, in, insz);
+	EXPECT_BYTES_EQ(out, outsz, buf, n);
+	EXPECT_EQ(outsz, UTF16LE_to_UTF8_length(in, insz));
+}
+
+static void check_8to16(const char *in, size_t insz, const char *out, size_t outsz) {
+	uint8_t buf[64];
+	size_t n = UTF8_to_UTF16LE(buf, in, insz);
+	EXPECT_BYTES_EQ(out, outsz, buf, n);
+	EXPECT_EQ(outsz, UTF8_to_UTF16LE_length(in, insz));
+	EXPECT_EQ(reference_valid((const uint8_t*) in, insz), is_valid_UTF8(in, insz));
+}
+
+#define CHECK_16TO8(IN, OUT) check_16to8(IN, sizeof(IN) - 1, OUT, sizeof(OUT) - 1)
+#define CHECK_8TO16(IN, OUT) check_8to16(IN, sizeof(IN) - 1, OUT, sizeof(OUT) - 1)
+#define FFFD "\xFD\xFF"
+
+static void test_convert(void) {
+	CHECK_16TO8("a\0b\0", "ab");
+	CHECK_16TO8("\xE9\0", "\xC3\xA9");
+	CHECK_16TO8("\xAC\x20", "\xE2\x82\xAC");
+	CHECK_16TO8("\xFF\xFF", "\xEF\xBF\xBF");
+	CHECK_16TO8("\x3D\xD8\x00\xDE", "\xF0\x9F\x98\x80");
+	CHECK_16TO8("\x3D\xD8\x00\xDEx\0", "\xF0\x9F\x98\x80x");
+	CHECK_16TO8("\x3D\xD8", "\xEF\xBF\xBD");
+	CHECK_16TO8("\x3D\xD8x\0", "\xEF\xBF\xBDx");
+	CHECK_16TO8("\x00\xDEx\0", "\xEF\xBF\xBDx");
+	CHECK_16TO8("\x3D\xD8\x3D\xD8\x00\xDE", "\xEF\xBF\xBD\xF0\x9F\x98\x80");
+	CHECK_16TO8("a\0b", "a");
+
+	CHECK_8TO16("ab", "a\0b\0");
+	CHECK_8TO16("\xC3\xA9", "\xE9\0");
+	CHECK_8TO16("\xE2\x82\xAC", "\xAC\x20");
+	CHECK_8TO16("\xEF\xBF\xBF", "\xFF\xFF");
+	CHECK_8TO16("\xF0\x9F\x98\x80", "\x3D\xD8\x00\xDE");
+	CHECK_8TO16("\xF4\x8F\xBF\xBF", "\xFF\xDB\xFF\xDF");
+
+	// invalid sequences are replaced a maximal part at a time
+	CHECK_8TO16("\x80", FFFD);
+	CHECK_8TO16("\x80\x80x", FFFD FFFD "x\0");
+	CHECK_8TO16("\xC0\xAF", FFFD FFFD);
+	CHECK_8TO16("\xC2", FFFD);
+	CHECK_8TO16("\xC2x", FFFD "x\0");
+	CHECK_8TO16("\xE0\x80\xAF", FFFD FFFD FFFD);
+	CHECK_8TO16("\xE0\xA0", FFFD);
+	CHECK_8TO16("\xE2\x82x", FFFD "x\0");
+	CHECK_8TO16("\xED\xA0\x80", FFFD FFFD FFFD);
+	CHECK_8TO16("\xED\x9F\xBF", "\xFF\xD7");
+	CHECK_8TO16("\xF0\x8F\xBF\xBF", FFFD FFFD FFFD FFFD);
+	CHECK_8TO16("\xF0\x9F\x98", FFFD);
+	CHECK_8TO16("\xF4\x90\x80\x80", FFFD FFFD FFFD FFFD);
+	CHECK_8TO16("\xF5\x80", FFFD FFFD);
+	CHECK_8TO16("\xFF", FFFD);
+}
+
+// Random text through both conversions, with the lengths and validity
+// checked after corrupting some of it.
+static void test_random(void) {
+	uint8_t *text = malloc(4096);
+	uint8_t *u16 = malloc(2 * 4096);
+	uint8_t *back = malloc(3 * 4096);
+	uint64_t seed = 1;
+	for (int n = 0; n < 400; n++) {
+		size_t len = random_text(text, test_rand(&seed) % 4096, &seed, n % 4 ? 90 : 10);
+		EXPECT_TRUE(is_valid_UTF8(text, len));
+
+		size_t n16 = UTF8_to_UTF16LE(u16, text, len);
+		EXPECT_EQ(n16, UTF8_to_UTF16LE_length(text, len));
+		size_t n8 = UTF16LE_to_UTF8(back, u16, n16);
+		EXPECT_EQ(n8, UTF16LE_to_UTF8_length(u16, n16));
+		EXPECT_BYTES_EQ(text, len, back, n8);
+
+		// corrupt a few bytes or cut off the end
+		size_t flips = test_rand(&seed) % 3;
+		for (size_t i = 0; i < flips && len; i++) {
+			text[test_rand(&seed) % len] = (uint8_t) test_rand(&seed);
+		}
+		if (len && test_rand(&seed) % 4 == 0) {
+			len -= test_rand(&seed) % (len < 4 ? len : 4);
+		}
+		EXPECT_EQ(reference_valid(text, len), is_valid_UTF8(text, len));
+		n16 = UTF8_to_UTF16LE(u16, text, len);
+		EXPECT_EQ(n16, UTF8_to_UTF16LE_length(text, len));
+		EXPECT_TRUE(n16 <= UTF8_to_UTF16LE_size(len));
+
+		for (size_t i = 0; i < flips && n16; i++) {
+			u16[test_rand(&seed) % n16] = (uint8_t) test_rand(&seed);
+		}
+		n8 = UTF16LE_to_UTF8(back, u16, n16);
+		EXPECT_EQ(n8, UTF16LE_to_UTF8_length(u16, n16));
+		EXPECT_TRUE(n8 <= UTF16LE_to_UTF8_size(n16));
+		EXPECT_TRUE(is_valid_UTF8(back, n8));
+	}
+	free(text);
+	free(u16);
+	free(back);
+}
+
+// source that returns the data a few bytes at a time so that code units
+// are split across reads
+struct drip_stream {
+	stream iface;
+	const uint8_t *data;
+	size_t left;
+	uint64_t seed;
+};
+
+static void close_drip(stream *s) {
+	free(s);
+}
+
+static const uint8_t *read_drip(stream *s, size_t consume, size_t need, size_t *plen) {
+	struct drip_stream *ds = (struct drip_stream*) s;
+	ds->data += consume;
+	ds->left -= consume;
+	size_t n = need + test_rand(&ds->seed) % 8;
+	*plen = n < ds->left ? n : ds->left;
+	return ds->data;
+}
+
+static stream *open_drip(const void *data, size_t size, uint64_t seed) {
+	struct drip_stream *ds = malloc(sizeof(struct drip_stream));
+	ds->iface.close = &close_drip;
+	ds->iface.read = &read_drip;
+	ds->data = data;
+	ds->left = size;
+	ds->seed = seed;
+	return &ds->iface;
+}
+
+// read the whole stream out, returning -1 on error
+static int read_all(stream *s, uint8_t *out, size_t *pn, uint64_t *seed) {
+	size_t n = 0, len = 0;
+	for (;;) {
+		size_t need = (size_t) (test_rand(seed) % 5);
+		const uint8_t *p = s->read(s, len, need, &len);
+		if (!p) {
+			return -1;
+		} else if (!len) {
+			break;
+		}
+		// consume a random amount of what we've been given
+		len = 1 + (size_t) (test_rand(seed) % len);
+		memcpy(out + n, p, len);
+		n += len;
+	}
+	*pn = n;
+	return 0;
+}
+
+static void test_stream(void) {
+	uint8_t *text = malloc(4096);
+	uint8_t *u16 = malloc(2 * 4096);
+	uint8_t *expect = malloc(3 * 4096);
+	uint8_t *got = malloc(3 * 4096);
+	uint64_t seed = 3;
+	for (int i = 0; i < 200; i++) {
+		size_t len = random_text(text, test_rand(&seed) % 4096, &seed, i % 4 ? 90 : 10);
+		size_t n16 = UTF8_to_UTF16LE(u16, text, len);
+		bool corrupt = i & 1;
+		if (corrupt && len) {
+			text[test_rand(&seed) % len] = (uint8_t) test_rand(&seed);
+			u16[test_rand(&seed) % n16] = (uint8_t) test_rand(&seed);
+			len -= test_rand(&seed) % (len < 3 ? len : 3);
+			n16 -= test_rand(&seed) % 3;
+		}
+
+		size_t n, expn = UTF8_to_UTF16LE(expect, text, len);
+		stream *s = open_utf8_to_utf16le(open_drip(text, len, seed), 0);
+		EXPECT_EQ(0, read_all(s, got, &n, &seed));
+		EXPECT_BYTES_EQ(expect, expn, got, n);
+		s->close(s);
+
+		s = open_utf8_to_utf16le(open_drip(text, len, seed), UTF_STRICT);
+		EXPECT_EQ(is_valid_UTF8(text, len) ? 0 : -1, read_all(s, got, &n, &seed));
+		s->close(s);
+
+		expn = UTF16LE_to_UTF8(expect, u16, n16);
+		s = open_utf16le_to_utf8(open_drip(u16, n16, seed), 0);
+		EXPECT_EQ(0, read_all(s, got, &n, &seed));
+		EXPECT_BYTES_EQ(expect, expn, got, n);
+		s->close(s);
+
+		s = open_utf16le_to_utf8(open_drip(u16, n16, seed), UTF_STRICT);
+		EXPECT_EQ(is_valid_UTF16LE(u16, n16) ? 0 : -1, read_all(s, got, &n, &seed));
+		s->close(s);
+	}
+
+	// byte order marks are only dropped at the start when asked for
+	size_t n;
+	stream *s = open_utf8_to_utf16le(open_buffer_stream("\xEF\xBB\xBF" "a\xEF\xBB\xBF", 7), UTF_STRIP_BOM);
+	EXPECT_EQ(0, read_all(s, got, &n, &seed));
+	EXPECT_BYTES_EQ("a\0\xFF\xFE", 4, got, n);
+	s->close(s);
+
+	s = open_utf16le_to_utf8(open_buffer_stream("\xFF\xFE" "a\0", 4), UTF_STRIP_BOM);
+	EXPECT_EQ(0, read_all(s, got, &n, &seed));
+	EXPECT_BYTES_EQ("a", 1, got, n);
+	s->close(s);
+
+	s = open_utf16le_to_utf8(open_buffer_stream("\xFF\xFE", 2), 0);
+	EXPECT_EQ(0, read_all(s, got, &n, &seed));
+	EXPECT_BYTES_EQ("\xEF\xBB\xBF", 3, got, n);
+	s->close(s);
+
+	s = open_utf8_to_utf16le(open_buffer_stream("", 0), UTF_STRIP_BOM);
+	EXPECT_EQ(0, read_all(s, got, &n, &seed));
+	EXPECT_EQ(0, n);
+	s->close(s);
+
+	free(text);
+	free(u16);
+	free(expect);
+	free(got);
+}
+
+static void bench_text(log_t *log, const char *name, int ascii_percent) {
+	uint8_t *text = malloc(bench_bytes);
+	uint8_t *u16 = malloc(2 * (size_t) bench_bytes);
+	uint8_t *back = malloc(3 * (size_t) bench_bytes);
+	uint64_t seed = 2;
+	size_t len = random_text(text, bench_bytes, &seed, ascii_percent);
+
+	struct timer t;
+	start_timer(&t);
+	bool valid = is_valid_UTF8(text, len);
+	double validt = stop_timer(&t);
+	EXPECT_TRUE(valid);
+
+	start_timer(&t);
+	size_t n16 = UTF8_to_UTF16LE(u16, text, len);
+	double to16 = stop_timer(&t);
+
+	start_timer(&t);
+	size_t n8 = UTF16LE_to_UTF8(back, u16, n16);
+	double to8 = stop_timer(&t);
+	EXPECT_BYTES_EQ(text, len, back, n8);
+
+	LOG(log, "utf %s|bytes:%d|validateGBs:%.2f|toUTF16GBs:%.2f|toUTF8GBs:%.2f",
+		name, (int) len, len / validt / 1e9, len / to16 / 1e9, len / to8 / 1e9);
+	free(text);
+	free(u16);
+	free(back);
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_bytes, 0, "bench-bytes", "BYTES", "size of the text in the benchmarks");
+	log_t *log = start_test(argc, argv);
+
+	test_convert();
+	test_random();
+	test_stream();
+	bench_text(log, "ascii", 100);
+	bench_text(log, "latin", 95);
+	bench_text(log, "mixed", 10);
+
+	return finish_test();
+}
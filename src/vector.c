@@ -1,6 +1,8 @@
 #include "cutils/vector.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #define TIER0 0x100 // 256B
 #define TIER1 0x1000 // 4 KB
@@ -8,11 +10,14 @@
 #define TIER3 0x100000 // 1 MB
 #define TIER4 0x1000000 // 16 MB
 
-void *grow_vector(allocator_t *a, struct vector *v, size_t objsz, size_t num) {
+void *grow_small_vector(allocator_t *a, struct vector *v, size_t vecsz, size_t objsz, size_t num) {
 	size_t newcap = v->size + num;
 	if (newcap > v->cap) {
+		if (newcap < num || newcap > SIZE_MAX / objsz) {
+			return NULL;
+		}
 		size_t want = newcap * objsz;
-		unsigned mem;
+		size_t mem;
 		if (want < TIER1) {
 			mem = (want + TIER0 - 1) &~(TIER0 - 1);
 		} else if (want < TIER2) {
@@ -22,12 +27,31 @@ void *grow_vector(allocator_t *a, struct vector *v, size_t objsz, size_t num) {
 		} else if (want < TIER4) {
 			mem = (want + TIER3 - 1) &~(TIER3 - 1);
 		} else {
-			mem = (want + TIER4 - 1) &~(TIER4 - 1);
+			// grow by half again so that appending to large vectors
+			// doesn't copy the data on every step
+			size_t grow = want + want / 2;
+			mem = grow < want ? want : grow;
+			mem = mem > SIZE_MAX - TIER4 ? want : (mem + TIER4 - 1) &~(TIER4 - 1);
+		}
+		// The data is in the inline buffer of a small vector if it points
+		// inside the struct. Heap memory can never be there.
+		uintptr_t data = (uintptr_t) v->data;
+		bool inline_buf = data >= (uintptr_t) (v + 1) && data < (uintptr_t) v + vecsz;
+		void *old = inline_buf ? NULL : v->data;
+
+		char *newdata = xrealloc(a, old, mem);
+		// the allocator may have a hard limit (e.g. vmem), so back off
+		// towards the size needed
+		while (!newdata && mem > want) {
+			mem = want + (mem - want) / 2;
+			newdata = xrealloc(a, old, mem);
 		}
-		char *newdata = xrealloc(a, v->data, mem);
 		if (!newdata) {
 			return NULL;
 		}
+		if (inline_buf) {
+			memcpy(newdata, v->data, v->size * objsz);
+		}
 		v->cap = mem / objsz;
 		v->data = newdata;
 	}
@@ -35,6 +59,10 @@ void *grow_vector(allocator_t *a, struct vector *v, size_t objsz, size_t num) {
 	return (char*)v->data + (objsz * v->size);
 }
 
+void *grow_vector(allocator_t *a, struct vector *v, size_t objsz, size_t num) {
+	return grow_small_vector(a, v, sizeof(struct vector), objsz, num);
+}
+
 void *grow_append_vector(allocator_t *a, struct vector *v, size_t objsz, size_t num) {
 	void *ret = grow_vector(a, v, objsz, num);
 	if (ret) {
@@ -0,0 +1,230 @@
+#include "cutils/vector.h"
+#include "cutils/vmem.h"
+#include "cutils/test.h"
+#include "cutils/flag.h"
+#include "cutils/timer.h"
+#include <stdint.h>
+
+static int bench_max = 1000000;
+
+struct u32_vector {
+	uint32_t *v;
+	size_t size, cap;
+};
+
+struct big {
+	char data[1024];
+};
+
+struct big_vector {
+	struct big *v;
+	size_t size, cap;
+};
+
+static void test_growth(void) {
+	struct u32_vector v = {0};
+	for (uint32_t i = 0; i < 100000; i++) {
+		*(uint32_t*)APPEND(&v) = i;
+	}
+	EXPECT_EQ(100000, v.size);
+	EXPECT_GT(v.cap + 1, v.size);
+	for (uint32_t i = 0; i < 100000; i++) {
+		EXPECT_EQ(i, v.v[i]);
+	}
+	free(v.v);
+
+	// sizes that overflow are rejected instead of wrapping
+	struct big_vector b = {0};
+	EXPECT_PTREQ(NULL, GROW_VECTOR(&b, SIZE_MAX / 512));
+	EXPECT_PTREQ(NULL, grow_vector(NULL, (struct vector*)&b, sizeof(b.v[0]), SIZE_MAX));
+	EXPECT_EQ(0, b.cap);
+}
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t va = *(const uint32_t*)a;
+	uint32_t vb = *(const uint32_t*)b;
+	return va < vb ? -1 : va > vb;
+}
+
+struct counting {
+	allocator_t alloc;
+	int allocs, frees;
+};
+
+static void *counting_calloc(allocator_t *a, size_t num, size_t size) {
+	((struct counting*)a)->allocs++;
+	return calloc(num, size);
+}
+
+static void *counting_realloc(allocator_t *a, void *p, size_t size) {
+	((struct counting*)a)->allocs += !p;
+	return realloc(p, size);
+}
+
+static void counting_free(allocator_t *a, void *p) {
+	((struct counting*)a)->frees += p != NULL;
+	free(p);
+}
+
+static void test_small(void) {
+	SMALL_VECTOR(uint32_t, 4) v;
+	INIT_SMALL_VECTOR(&v);
+	EXPECT_EQ(4, v.cap);
+
+	// the first few elements don't allocate
+	for (uint32_t i = 0; i < 4; i++) {
+		*(uint32_t*)APPEND(&v) = 10 - i;
+	}
+	EXPECT_PTREQ(v.buf, v.v);
+	EXPECT_EQ(7, LAST(&v));
+	SORT_VECTOR(&v, &compare_u32);
+	uint32_t key = 9;
+	EXPECT_PTREQ(&v.buf[2], BSEARCH_VECTOR(&v, key, &compare_u32));
+
+	// and then spill to the heap keeping the contents
+	*(uint32_t*)APPEND(&v) = 3;
+	EXPECT_TRUE(v.v != v.buf);
+	EXPECT_EQ(5, v.size);
+	EXPECT_EQ(7, v.v[0]);
+	EXPECT_EQ(10, v.v[3]);
+	EXPECT_EQ(3, LAST(&v));
+	uint32_t *p = APPEND2_ZERO(&v, 100);
+	EXPECT_EQ(0, p[99]);
+	EXPECT_EQ(105, v.size);
+
+	// freeing goes back to the inline buffer
+	FREE_SMALL_VECTOR(&v);
+	EXPECT_PTREQ(v.buf, v.v);
+	EXPECT_EQ(0, v.size);
+	EXPECT_PTREQ(&v.buf[0], GROW_VECTOR(&v, 4));
+	EXPECT_PTREQ(v.buf, v.v);
+
+	// a zeroed small vector still works, just without the inline buffer
+	SMALL_VECTOR(uint32_t, 4) z = {0};
+	*(uint32_t*)APPEND(&z) = 1;
+	EXPECT_TRUE(z.v != NULL && z.v != z.buf);
+	EXPECT_EQ(1, z.v[0]);
+	FREE_SMALL_VECTOR(&z);
+	EXPECT_PTREQ(z.buf, z.v);
+
+	// vectors grown with an allocator are freed back to it
+	struct counting c = {{&counting_calloc, &counting_realloc, &counting_free}, 0, 0};
+	for (uint32_t i = 0; i < 10; i++) {
+		*(uint32_t*)APPEND_ALLOC(&v, &c.alloc) = i;
+	}
+	EXPECT_TRUE(v.v != v.buf);
+	EXPECT_EQ(9, LAST(&v));
+	EXPECT_EQ(1, c.allocs);
+	FREE_SMALL_VECTOR_ALLOC(&v, &c.alloc);
+	EXPECT_EQ(1, c.frees);
+	EXPECT_PTREQ(v.buf, v.v);
+	FREE_SMALL_VECTOR_ALLOC(&v, &c.alloc);
+	EXPECT_EQ(1, c.frees);
+}
+
+static void test_vmem(void) {
+	vmem_t vm;
+	EXPECT_EQ(0, init_vmem(&vm, 64 << 20, VMEM_HUGE_PAGES));
+	EXPECT_EQ(64 << 20, vm.reserved);
+
+	// the data never moves
+	struct u32_vector v = {0};
+	*(uint32_t*)APPEND_ALLOC(&v, &vm.alloc) = 0;
+	uint32_t *first = v.v;
+	for (uint32_t i = 1; i < (16 << 20); i++) {
+		*(uint32_t*)APPEND_ALLOC(&v, &vm.alloc) = i;
+	}
+	EXPECT_PTREQ(first, v.v);
+	EXPECT_EQ(64 << 20, vm.committed);
+	EXPECT_EQ(12345, v.v[12345]);
+
+	// the reservation is full
+	EXPECT_PTREQ(NULL, APPEND_ALLOC(&v, &vm.alloc));
+	EXPECT_EQ(16 << 20, v.size);
+
+	// only one buffer at a time
+	EXPECT_PTREQ(NULL, xmalloc(&vm.alloc, 16));
+
+	// freeing gives the memory back and the next buffer starts zeroed
+	xfree(&vm.alloc, v.v);
+	EXPECT_EQ(0, vm.committed);
+	uint32_t *z = xcalloc(&vm.alloc, 1000, sizeof(uint32_t));
+	EXPECT_PTREQ(first, z);
+	EXPECT_EQ(0, z[12]);
+	xfree(&vm.alloc, z);
+
+	free_vmem(&vm);
+}
+
+static double bench_append(allocator_t *a, size_t n) {
+	struct u32_vector v = {0};
+	struct timer t;
+	start_timer(&t);
+	for (size_t i = 0; i < n; i++) {
+		*(uint32_t*)APPEND_ALLOC(&v, a) = (uint32_t)i;
+	}
+	double secs = stop_timer(&t);
+	EXPECT_EQ(n, v.size);
+	EXPECT_EQ(n - 1, v.v[n - 1]);
+	xfree(a, v.v);
+	return secs;
+}
+
+// lots of short lists such as the arguments of each call in a parser
+static void bench_small(log_t *log) {
+	enum { LISTS = 100000 };
+	struct timer t;
+	start_timer(&t);
+	for (int i = 0; i < LISTS; i++) {
+		struct u32_vector v = {0};
+		for (int j = 0; j <= (i & 7); j++) {
+			*(uint32_t*)APPEND(&v) = j;
+		}
+		EXPECT_EQ(i & 7, LAST(&v));
+		free(v.v);
+	}
+	double heap = stop_timer(&t);
+
+	start_timer(&t);
+	for (int i = 0; i < LISTS; i++) {
+		SMALL_VECTOR(uint32_t, 8) v;
+		INIT_SMALL_VECTOR(&v);
+		for (int j = 0; j <= (i & 7); j++) {
+			*(uint32_t*)APPEND(&v) = j;
+		}
+		EXPECT_EQ(i & 7, LAST(&v));
+		FREE_SMALL_VECTOR(&v);
+	}
+	double small = stop_timer(&t);
+
+	LOG(log, "short lists|lists:%d|heapNsPerList:%.1f|smallNsPerList:%.1f",
+		LISTS, heap * 1e9 / LISTS, small * 1e9 / LISTS);
+}
+
+// run with --bench-max=1000000000 to include 100M and 1B elements
+static void bench_vector(log_t *log) {
+	static const size_t sizes[] = {1000000, 100000000, 1000000000};
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && sizes[i] <= (size_t)bench_max; i++) {
+		size_t n = sizes[i];
+		double libc = bench_append(NULL, n);
+		vmem_t vm;
+		EXPECT_EQ(0, init_vmem(&vm, n * sizeof(uint32_t), VMEM_HUGE_PAGES));
+		double vmem = bench_append(&vm.alloc, n);
+		free_vmem(&vm);
+		LOG(log, "vector append|elements:%.0f|reallocNsPerAppend:%.2f|vmemNsPerAppend:%.2f",
+			(double)n, libc * 1e9 / n, vmem * 1e9 / n);
+	}
+}
+
+int main(int argc, const char *argv[]) {
+	flag_int(&bench_max, 0, "bench-max", "N", "largest vector in the benchmark");
+	log_t *log = start_test(argc, argv);
+
+	test_growth();
+	test_small();
+	test_vmem();
+	bench_small(log);
+	bench_vector(log);
+
+	return finish_test();
+}
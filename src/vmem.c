@@ -0,0 +1,142 @@
+#include "cutils/vmem.h"
+#include "cutils/endian.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Memory is committed in steps of the usual huge page size. The
+// reservation is aligned to it as well so that the OS can use huge pages
+// for all of it.
+#define COMMIT_SIZE 0x200000 // 2 MB
+
+#ifdef WIN32
+// Windows only supports large pages for memory committed up front by
+// processes with SeLockMemoryPrivilege, so VMEM_HUGE_PAGES is ignored.
+static uint8_t *reserve_pages(size_t size, unsigned flags) {
+	(void) flags;
+	return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+static int commit_pages(uint8_t *p, size_t size) {
+	return VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE) ? 0 : -1;
+}
+
+static void decommit_pages(uint8_t *p, size_t size) {
+	VirtualFree(p, size, MEM_DECOMMIT);
+}
+
+static void release_pages(uint8_t *p, size_t size) {
+	(void) size;
+	VirtualFree(p, 0, MEM_RELEASE);
+}
+#else
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static uint8_t *reserve_pages(size_t size, unsigned flags) {
+	// over reserve so that the start can be aligned
+	size_t over = size + COMMIT_SIZE;
+	if (over < size) {
+		return NULL;
+	}
+	uint8_t *p = mmap(NULL, over, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+	uint8_t *base = (uint8_t*) ALIGN_UP((uintptr_t) p, COMMIT_SIZE);
+	if (base > p) {
+		munmap(p, base - p);
+	}
+	if (p + over > base + size) {
+		munmap(base + size, (p + over) - (base + size));
+	}
+#ifdef MADV_HUGEPAGE
+	if (flags & VMEM_HUGE_PAGES) {
+		madvise(base, size, MADV_HUGEPAGE);
+	}
+#else
+	(void) flags;
+#endif
+	return base;
+}
+
+static int commit_pages(uint8_t *p, size_t size) {
+	return mprotect(p, size, PROT_READ | PROT_WRITE) ? -1 : 0;
+}
+
+static void decommit_pages(uint8_t *p, size_t size) {
+	madvise(p, size, MADV_DONTNEED);
+	mprotect(p, size, PROT_NONE);
+}
+
+static void release_pages(uint8_t *p, size_t size) {
+	munmap(p, size);
+}
+#endif
+
+static void *vmem_realloc(allocator_t *a, void *p, size_t size) {
+	vmem_t *v = (vmem_t*) a;
+	if (p ? p != v->base : v->used) {
+		return NULL;
+	}
+	if (size > v->reserved) {
+		return NULL;
+	}
+	if (size > v->committed) {
+		size_t to = ALIGN_UP(size, COMMIT_SIZE);
+		if (commit_pages(v->base + v->committed, to - v->committed)) {
+			return NULL;
+		}
+		v->committed = to;
+	}
+	v->used = true;
+	return v->base;
+}
+
+static void *vmem_calloc(allocator_t *a, size_t num, size_t size) {
+	if (size && num > SIZE_MAX / size) {
+		return NULL;
+	}
+	// newly committed pages are always zero
+	return vmem_realloc(a, NULL, num * size);
+}
+
+static void vmem_free(allocator_t *a, void *p) {
+	vmem_t *v = (vmem_t*) a;
+	if (p && p == v->base && v->used) {
+		decommit_pages(v->base, v->committed);
+		v->committed = 0;
+		v->used = false;
+	}
+}
+
+int init_vmem(vmem_t *v, size_t reserve, unsigned flags) {
+	memset(v, 0, sizeof(*v));
+	v->alloc.calloc = &vmem_calloc;
+	v->alloc.realloc = &vmem_realloc;
+	v->alloc.free = &vmem_free;
+	v->flags = flags;
+	size_t size = ALIGN_UP(reserve, COMMIT_SIZE);
+	if (!reserve || size < reserve) {
+		return -1;
+	}
+	v->base = reserve_pages(size, flags);
+	if (!v->base) {
+		return -1;
+	}
+	v->reserved = size;
+	return 0;
+}
+
+void free_vmem(vmem_t *v) {
+	if (v->base) {
+		release_pages(v->base, v->reserved);
+		v->base = NULL;
+		v->reserved = v->committed = 0;
+		v->used = false;
+	}
+}